@@ -8,9 +8,11 @@
 #define FIRMWARE_VERSION "9.0.0.0"
 
 void ota_task(void *pvParameters);
+void ota_trigger_check();
 const char *get_firmware_version();
 unsigned int get_current_update_offset();
 unsigned char get_update_progress();
 void switch_to_previous_partition();
+bool ota_has_pending_update();
 void blink_led_fast(uint32_t gpio);
 extern EventGroupHandle_t wifi_event_group;
@@ -1,23 +1,59 @@
 #include <string.h>
+#include <strings.h>
+#include <stdio.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "esp_event_loop.h"
 #include "mbedtls/md5.h"
+#include "mbedtls/sha256.h"
 #include "esp_log.h"
 #include "esp_ota_ops.h"
 #include "esp_partition.h"
-#include "azure_c_shared_utility\base64.h"
+#include "esp_spi_flash.h"
 #include "nvs.h"
 #include "nvs_flash.h"
 #include <esp_http_client.h>
 //#include "esp_request.h"
 #include "Common.h"
 #include "cJSON.h"
-
-#define MAX_HTTP_RECV_BUFFER 16384
+#include "base64_stream.h"
+#include "ota_writer.h"
+#include "ota_state.h"
+#include "ota_patch.h"
+#include "ota_inflate.h"
+#include "ota_pipeline.h"
+#include "ota_chunk_control.h"
+#include "ota_scheduler.h"
+#include "ota_probation.h"
+
+//a decoded chunk must fit one flash sector
+#define OTA_CHUNK_BUFFER_SIZE SPI_FLASH_SEC_SIZE
+#define OTA_TEXT_BUFFER_SIZE 512
+#define MAX_URL_LENGTH 512
+#define MAX_BLOB_NAME_LENGTH 128
+#define MAX_VERSION_LENGTH 32
+#define MAX_ENCODING_LENGTH 16
+#define MAX_VALIDATOR_LENGTH 64
+
+//the Azure Functions of "Azure Functions for OTA.txt", a build can point it to tools/ota_server, like http://192.168.1.10:8080/api
+#ifndef OTA_FUNCTIONS_URL
+#define OTA_FUNCTIONS_URL "https://watertank.azurewebsites.net/api"
+#endif
+
+//firmware check schedule, the jitter and the random first check spread the requests of a fleet
+#define OTA_CHECK_PERIOD_S (6 * 3600)
+#define OTA_CHECK_JITTER_PERCENT 25
+#define OTA_FIRST_CHECK_MIN_S 60
+#define OTA_FIRST_CHECK_MAX_S 900
+#define OTA_PROBATION_POLL_S 10
+
+//how the downloaded blob encodes the image, the flags combine
+#define OTA_FORMAT_PATCH 1
+#define OTA_FORMAT_ZLIB 2
 
 extern int CONNECTED_BIT;
 const int nMaxDownloadPacketRetries = 20;
@@ -25,10 +61,49 @@ int g_firmwareOffset = 0;
 int g_downloadPacketRetries = 0;
 const char *g_currentFirmwareVersion = FIRMWARE_VERSION; 
 size_t g_newFirmwareSize = 0;
-STRING_HANDLE g_blobName;
-esp_ota_handle_t g_update_handle = 0;
+char g_blobName[MAX_BLOB_NAME_LENGTH];
 bool g_fatalError = false;
-STRING_HANDLE g_md5base64;
+
+//Content-MD5 of the current chunk, decoded from the response header
+static unsigned char g_expectedMd5[16];
+static bool g_hasExpectedMd5 = false;
+//SHA-256 of the whole image, from the firmware manifest
+static unsigned char g_expectedSha256[32];
+static bool g_hasExpectedSha256 = false;
+static mbedtls_sha256_context g_imageSha256;
+//the download that is persisted in NVS and the image offset last checkpointed there
+static OTA_STATE g_otaState;
+static size_t g_committedOffset = 0;
+//delta update, offered by the manifest when it has a patch from the running version
+static char g_patchBlobName[MAX_BLOB_NAME_LENGTH];
+static char g_patchBlobUrl[MAX_URL_LENGTH];
+static size_t g_patchSize = 0;
+static int g_patchFormat = 0;
+static OTA_PATCH g_patch;
+//compressed image, blobSize is the size of the image and g_compressedSize the size of the blob
+static int g_imageFormat = 0;
+static size_t g_compressedSize = 0;
+//the format of the running download
+static int g_format = 0;
+//the number of bytes to download, the patch size for a delta update
+static size_t g_downloadSize = 0;
+
+//all OTA buffers are static, so an update does not fragment the heap that the telemetry loop lives on
+static char g_textBuffer[OTA_TEXT_BUFFER_SIZE];
+static char g_latestVersion[MAX_VERSION_LENGTH];
+static char g_url[MAX_URL_LENGTH];
+static char g_blobUrl[MAX_URL_LENGTH];
+static char g_rangeHeader[32];
+//validators of the manifest response, the cached ones are sent back so an unchanged manifest is a 304
+static char g_etag[MAX_VALIDATOR_LENGTH];
+static char g_lastModified[MAX_VALIDATOR_LENGTH];
+static char g_cachedEtag[MAX_VALIDATOR_LENGTH];
+static char g_cachedLastModified[MAX_VALIDATOR_LENGTH];
+static TaskHandle_t g_otaTask = NULL;
+
+//download statistics, a connection is a TCP + TLS handshake
+static int g_otaConnections = 0;
+static int g_otaRequests = 0;
 
 #define TAG "ota"
 
@@ -44,7 +119,7 @@ unsigned int get_current_update_offset()
 
 unsigned char get_update_progress()
 {
-	return g_newFirmwareSize == 0 ? 0 : (unsigned char)(g_firmwareOffset * 100 / g_newFirmwareSize);
+	return g_downloadSize == 0 ? 0 : (unsigned char)(g_firmwareOffset * 100 / g_downloadSize);
 }
 
 
@@ -57,21 +132,25 @@ esp_err_t _http_event_handler(esp_http_client_event_t *evt)
         break;
     case HTTP_EVENT_ON_CONNECTED:
         ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
+        ++g_otaConnections;
         break;
     case HTTP_EVENT_HEADER_SENT:
         ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
         break;
     case HTTP_EVENT_ON_HEADER:
         ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
-        STRING_HANDLE header, md5;
-        header = STRING_construct(evt->header_key);
-        md5 = STRING_construct("Content-MD5");
-        if (STRING_compare(header, md5) == 0)
+        if (strcasecmp(evt->header_key, "Content-MD5") == 0)
         {
-            g_md5base64 = STRING_construct(evt->header_value);
+            //24 base64 characters, decoded to the raw 16 bytes digest
+            unsigned char digest[BASE64_STREAM_DECODED_SIZE(24)];
+            BASE64_STREAM decoder;
+            base64_stream_init(&decoder);
+            size_t length = strlen(evt->header_value);
+            int decodedLength = length <= 24 ? base64_stream_decode(&decoder, evt->header_value, length, digest) : -1;
+            g_hasExpectedMd5 = decodedLength == sizeof(g_expectedMd5);
+            if (g_hasExpectedMd5)
+                memcpy(g_expectedMd5, digest, sizeof(g_expectedMd5));
         }
-        STRING_delete(header);
-        STRING_delete(md5);
         break;
 
     case HTTP_EVENT_ON_DATA:
@@ -95,194 +174,471 @@ esp_err_t _http_event_handler(esp_http_client_event_t *evt)
 
 
 
-bool download_and_update_firmware(const char *blobName, size_t blobSize)
+//every byte of the image goes through here, so the whole image hash covers exactly what is flashed
+static esp_err_t ota_write_image(const void *data, size_t length)
 {
-	const char *urlTemplate = "https://watertank.azurewebsites.net/api/DownloadFirmware?code=Ql9c0REMbeoxTpBXgav65AjRntUlT2kYnjUYOB674anaLFScUbXyWA==&firmwareBlobName=%s&offset=%d&chunkSize=%d";
-	size_t chunkSize = 512;
-	size_t maxChunkSize = 8192;
-	const size_t minChunkSize = 128;
+	mbedtls_sha256_update(&g_imageSha256, (const unsigned char *)data, length);
+	esp_err_t err = ota_writer_write(data, length);
+	if (err != ESP_OK || g_format != 0) //the decoder state is not persisted, only a plain image download resumes
+		return err;
+
+	//checkpoint once per completed sector, NVS wear stays at a few hundred writes per image
+	size_t committedOffset = ota_writer_committed_offset();
+	if (committedOffset != g_committedOffset && ota_state_commit_offset(committedOffset) == ESP_OK)
+		g_committedOffset = committedOffset;
+	return ESP_OK;
+}
 
-	g_firmwareOffset = 0;
-	g_downloadPacketRetries = 0;
-	int noErrorCounter = 0;
-	int status = ESP_OK;
+static int patch_read_source(void *context, size_t offset, void *buffer, size_t length)
+{
+	return esp_partition_read((const esp_partition_t *)context, offset, buffer, length) == ESP_OK ? 0 : -1;
+}
 
-	const esp_partition_t *configured = esp_ota_get_boot_partition();
-	const esp_partition_t *running = esp_ota_get_running_partition();
+static int patch_write_image(void *context, const void *data, size_t length)
+{
+	return ota_write_image(data, length) == ESP_OK ? 0 : -1;
+}
 
-	if (configured != running) 
+static esp_err_t ota_write_decompressed(const void *data, size_t length)
+{
+	if ((g_format & OTA_FORMAT_PATCH) == 0)
+		return ota_write_image(data, length);
+	return ota_patch_feed(&g_patch, data, length) == 0 ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+//every downloaded byte goes through here
+static esp_err_t ota_write(const void *data, size_t length)
+{
+	if ((g_format & OTA_FORMAT_ZLIB) == 0)
+		return ota_write_decompressed(data, length);
+	return ota_inflate_write(data, length);
+}
+
+//continue the hash of the image over the part that a previous download already wrote
+static bool rehash_written_image(const esp_partition_t *partition, size_t length)
+{
+	for (size_t offset = 0; offset < length; offset += sizeof(g_textBuffer))
 	{
-		ESP_LOGW(TAG, "Configured OTA boot partition at offset 0x%08x, but running from offset 0x%08x", configured->address, running->address);
-		ESP_LOGW(TAG, "(This can happen if either the OTA boot data or preferred boot image become corrupted somehow.)");
+		size_t readLen = length - offset < sizeof(g_textBuffer) ? length - offset : sizeof(g_textBuffer);
+		if (esp_partition_read(partition, offset, g_textBuffer, readLen) != ESP_OK)
+			return false;
+		mbedtls_sha256_update(&g_imageSha256, (const unsigned char *)g_textBuffer, readLen);
 	}
+	return true;
+}
 
-	ESP_LOGI(TAG, "Running partition type %d subtype %d (offset 0x%08x)", running->type, running->subtype, running->address);
-	const esp_partition_t *update_partition = esp_ota_get_next_update_partition(NULL);
+//a persisted download can continue only if it is the same image into the same partition
+static size_t get_resume_offset(const char *blobName, size_t blobSize, const esp_partition_t *partition)
+{
+	OTA_STATE state;
+	uint32_t committedOffset;
+	if (!ota_state_load(&state, &committedOffset))
+		return 0;
 
-	ESP_LOGI(TAG, "Writing to partition subtype %d at offset 0x%x", update_partition->subtype, update_partition->address);
-	assert(update_partition != NULL);
-	
-	
-	esp_err_t err = esp_ota_begin(update_partition, blobSize, &g_update_handle);
-	if (err != ESP_OK) 
+	if (strcmp(state.blobName, blobName) != 0 || state.blobSize != blobSize || state.partitionAddress != partition->address
+		|| state.hasSha256 != g_hasExpectedSha256 || (g_hasExpectedSha256 && memcmp(state.sha256, g_expectedSha256, sizeof(state.sha256)) != 0))
 	{
-		ESP_LOGE(TAG, "esp_ota_begin failed, error=%d", err);
-		g_fatalError = true;
+		ESP_LOGI(TAG, "Discarding the interrupted download of %s, the manifest has changed", state.blobName);
+		return 0;
+	}
+	return committedOffset;
+}
+
+bool ota_has_pending_update()
+{
+	OTA_STATE state;
+	uint32_t committedOffset;
+	return ota_state_load(&state, &committedOffset);
+}
+
+static bool parse_hex(const char *text, unsigned char *output, size_t length)
+{
+	if (text == NULL || strlen(text) != length * 2)
 		return false;
+
+	for (size_t i = 0; i < length * 2; ++i)
+	{
+		char c = text[i];
+		int value = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+		if (value < 0)
+			return false;
+		output[i / 2] = (i % 2 == 0) ? value << 4 : output[i / 2] | value;
 	}
-	ESP_LOGI(TAG, "esp_ota_begin succeeded");
+	return true;
+}
 
-  	while (g_firmwareOffset < blobSize && g_downloadPacketRetries < nMaxDownloadPacketRetries)
+//stream the raw image with HTTP Range requests, a dropped connection resumes from the current offset
+static bool download_raw(const char *blobUrl, size_t blobSize)
+{
+	esp_http_client_config_t config =
 	{
-		ESP_LOGI(TAG, "Continue download %s from offset:%u  chunk size:%u  out of total: %u", blobName,  g_firmwareOffset, chunkSize, blobSize);
-		STRING_HANDLE url = STRING_construct_sprintf(urlTemplate, blobName, g_firmwareOffset, chunkSize);
+		.url = blobUrl,
+		.event_handler = _http_event_handler,
+	};
 
-        esp_http_client_config_t config =
-        {
-            .url = STRING_c_str(url),
-            .event_handler = _http_event_handler,
-        };
+	esp_http_client_handle_t client = esp_http_client_init(&config);
+	if (client == NULL)
+	{
+		ESP_LOGE(TAG, "esp_http_client_init failed");
+		return false;
+	}
+
+	while (g_firmwareOffset < blobSize && g_downloadPacketRetries < nMaxDownloadPacketRetries)
+	{
+		snprintf(g_rangeHeader, sizeof(g_rangeHeader), "bytes=%d-", g_firmwareOffset);
+		esp_http_client_set_header(client, "Range", g_rangeHeader);
+
+		++g_otaRequests;
+		esp_err_t err = esp_http_client_open(client, 0);
+		if (err != ESP_OK)
+		{
+			++g_downloadPacketRetries;
+			ESP_LOGE(TAG, "Raw download open failed, err=%d, Retries: %d", err, g_downloadPacketRetries);
+			esp_http_client_close(client);
+			continue;
+		}
+
+		esp_http_client_fetch_headers(client);
+		int statusCode = esp_http_client_get_status_code(client);
+		size_t skip = 0;
+		if (statusCode == 200) //the server ignored the Range header and sends the whole image
+		{
+			skip = g_firmwareOffset;
+		}
+		else if (statusCode != 206)
+		{
+			ESP_LOGE(TAG, "Raw download of %s failed, status=%d", blobUrl, statusCode);
+			break;
+		}
+		ESP_LOGI(TAG, "Raw download from offset:%u status=%d, freemem=%d", g_firmwareOffset, statusCode, esp_get_free_heap_size());
+
+		while (g_firmwareOffset < blobSize)
+		{
+			//the buffer of a failed read is reused by the next one
+			unsigned char *buffer = ota_pipeline_get_buffer();
+			int readLen = esp_http_client_read(client, (char *)buffer, OTA_CHUNK_BUFFER_SIZE);
+			if (readLen <= 0)
+			{
+				++g_downloadPacketRetries;
+				ESP_LOGE(TAG, "Raw download stopped at offset:%u, Retries: %d", g_firmwareOffset, g_downloadPacketRetries);
+				break;
+			}
+
+			if (skip > 0)
+			{
+				size_t skipped = skip < (size_t)readLen ? skip : (size_t)readLen;
+				skip -= skipped;
+				readLen -= skipped;
+				memmove(buffer, buffer + skipped, readLen);
+			}
+			if (readLen > blobSize - g_firmwareOffset)
+				readLen = blobSize - g_firmwareOffset;
+			if (readLen == 0)
+				continue;
+
+			//the writer task flashes the buffer while the next one is received
+			err = ota_pipeline_submit(readLen);
+			if (err != ESP_OK)
+			{
+				ESP_LOGE(TAG, "Error: ota_write failed! err=0x%x", err);
+				g_fatalError = true;
+				break;
+			}
+			g_firmwareOffset += readLen;
+			g_downloadPacketRetries = 0;
+			ota_scheduler_throttle(readLen);
+		}
 
-        esp_http_client_handle_t client = esp_http_client_init(&config);
+		esp_http_client_close(client);
+		if (g_fatalError)
+			break;
+	}
+
+	esp_http_client_cleanup(client);
+	return g_firmwareOffset >= blobSize;
+}
 
-        //esp_http_client_set_method(client, HTTP_METHOD_GET);
+//download the base64 chunks of the DownloadFirmware function, starting at the current offset
+static bool download_chunked(const char *blobName, size_t blobSize)
+{
+	const char *urlTemplate = OTA_FUNCTIONS_URL "/DownloadFirmware?code=Ql9c0REMbeoxTpBXgav65AjRntUlT2kYnjUYOB674anaLFScUbXyWA==&firmwareBlobName=%s&offset=%d&chunkSize=%d";
+	int status = ESP_OK;
+	esp_err_t err;
+	//a decoded chunk must fit one pipeline buffer
+	OTA_CHUNK_CONTROL chunkControl;
+	ota_chunk_control_init(&chunkControl, 128, OTA_CHUNK_BUFFER_SIZE, 512);
+	size_t chunkSize = chunkControl.chunkSize;
+
+	//one client for the whole download, HTTP/1.1 keeps the TLS connection alive between the chunk requests
+	snprintf(g_url, sizeof(g_url), urlTemplate, blobName, g_firmwareOffset, chunkSize);
+	esp_http_client_config_t config =
+	{
+		.url = g_url,
+		.event_handler = _http_event_handler,
+	};
 
-        err = esp_http_client_open(client, 0);
+	esp_http_client_handle_t client = esp_http_client_init(&config);
+	if (client == NULL)
+	{
+		ESP_LOGE(TAG, "esp_http_client_init failed");
+		return false;
+	}
+
+  	while (g_firmwareOffset < blobSize && g_downloadPacketRetries < nMaxDownloadPacketRetries)
+	{
+		chunkSize = chunkControl.chunkSize;
+		int64_t chunkBegin = esp_timer_get_time();
+		ESP_LOGI(TAG, "Continue download %s from offset:%u  chunk size:%u  out of total: %u", blobName,  g_firmwareOffset, chunkSize, blobSize);
+		snprintf(g_url, sizeof(g_url), urlTemplate, blobName, g_firmwareOffset, chunkSize);
+		esp_http_client_set_url(client, g_url);
+
+        ++g_otaRequests;
+        g_hasExpectedMd5 = false;
+        err = esp_http_client_open(client, 0); //reconnects only if the previous request closed the connection
         if (err != ESP_OK)
         {
-            ESP_LOGE(TAG, "Err=%d Status = %d", err, esp_http_client_get_status_code(client));
-            return false;
+            ++g_downloadPacketRetries;
+            ESP_LOGE(TAG, "Err=%d Status = %d, Retries: %d", err, esp_http_client_get_status_code(client), g_downloadPacketRetries);
+            ota_chunk_control_failure(&chunkControl, chunkSize);
+            esp_http_client_close(client);
+            continue;
         }
 
-        STRING_delete(url);
-
         ESP_LOGI(TAG, "Finish request firmware download, status=%d, freemem=%d",
              esp_http_client_get_status_code(client), esp_get_free_heap_size());
 
-        char *buffer = malloc(MAX_HTTP_RECV_BUFFER + 1);
-        if (buffer == NULL) 
+        int contentLength = esp_http_client_fetch_headers(client);
+        int totalReadLen = 0;
+        size_t bufferlength = 0;
+        unsigned char *updateChunk = ota_pipeline_get_buffer(); //a dropped chunk leaves the buffer for the next one
+        bool isDecoded = true;
+        BASE64_STREAM decoder;
+        mbedtls_md5_context md5;
+
+        base64_stream_init(&decoder); //the quotes around the base64 text are skipped by the decoder
+        mbedtls_md5_init(&md5);
+        mbedtls_md5_starts(&md5);
+
+        //decode and hash while reading, the text never exists as a whole
+        while (totalReadLen < contentLength)
         {
-            ESP_LOGE(TAG, "Cannot malloc http receive buffer");
-            return false;
-        }
+            int readLen = contentLength - totalReadLen;
+            if (readLen > (int)sizeof(g_textBuffer))
+                readLen = sizeof(g_textBuffer);
 
-        size_t contentLength = esp_http_client_fetch_headers(client);
-        int totalReadLen = 0, readLen = 0;
-        if (totalReadLen < contentLength && contentLength <= MAX_HTTP_RECV_BUFFER) {
-            readLen = esp_http_client_read(client, buffer, contentLength);
-            if (readLen <= 0) 
+            readLen = esp_http_client_read(client, g_textBuffer, readLen);
+            if (readLen <= 0)
             {
                 ESP_LOGE(TAG, "Error read data");
+                isDecoded = false;
+                break;
             }
-            buffer[readLen] = 0;
-            ESP_LOGD(TAG, "read_len = %d", readLen);
-        }
+            totalReadLen += readLen;
 
-        ESP_LOGD(TAG, "HTTP Stream reader Status = %d, content_length = %d, Buffer=%.*s",
-                esp_http_client_get_status_code(client),
-                readLen,
-                readLen,
-                buffer);
+            if (bufferlength + BASE64_STREAM_DECODED_SIZE(readLen) > OTA_PIPELINE_BUFFER_SIZE)
+            {
+                ESP_LOGE(TAG, "Chunk is larger than the chunk buffer");
+                isDecoded = false;
+                break;
+            }
 
-        char *text = buffer;
-        ESP_LOGV(TAG, "original content: %s", text);
-        text[strlen(text) - 1] = '\0'; //remove last "
-        text++; //skip first "
+            int decodedLength = base64_stream_decode(&decoder, g_textBuffer, readLen, updateChunk + bufferlength);
+            if (decodedLength < 0)
+            {
+                ESP_LOGE(TAG, "Invalid base64 content");
+                isDecoded = false;
+                break;
+            }
+            mbedtls_md5_update(&md5, updateChunk + bufferlength, decodedLength);
+            bufferlength += decodedLength;
+        }
 
-        ESP_LOGV(TAG, "after triming content: %s", text);
+        if (totalReadLen != contentLength) //unread data is left on the connection, it can not be reused for the next request
+        {
+            esp_http_client_close(client);
+        }
 
-        BUFFER_HANDLE hBuffer = Base64_Decoder(text);
-        size_t bufferlength = BUFFER_length(hBuffer);
         ESP_LOGI(TAG, "decode size: %u, ", bufferlength);
-        const unsigned char *updateChunk;
-        BUFFER_content(hBuffer, &updateChunk);
 
-        /*for (int i = 0; i < bufferlength; ++i)
-        {
-        ESP_LOGV(TAG, "%d) %x", i, updateChunk[i]);
-        }*/
         unsigned char md5result[16];
-        mbedtls_md5(updateChunk, bufferlength, md5result);
-
-        STRING_HANDLE encodedMD5 = Base64_Encode_Bytes(md5result, 16);
-        ESP_LOGD(TAG, "MD5 after hash: %s, md5 in the header: %s", STRING_c_str(encodedMD5), STRING_c_str(g_md5base64));
+        mbedtls_md5_finish(&md5, md5result);
+        mbedtls_md5_free(&md5);
 
-        if (STRING_compare(encodedMD5, g_md5base64) != 0)
+        if (!isDecoded || !g_hasExpectedMd5 || memcmp(md5result, g_expectedMd5, sizeof(md5result)) != 0)
         {
             ++g_downloadPacketRetries;
             ESP_LOGE(TAG, "MD5 differ, droping last packet. Retries: %d", g_downloadPacketRetries);
+            ota_chunk_control_failure(&chunkControl, chunkSize);
             blink_led_fast(ERROR_STATUS_LED);
         }
         else //md5 ok
         {
-            esp_err_t err = esp_ota_write(g_update_handle, (const void *)updateChunk, bufferlength);
+            //the request time only, the flash write runs in the pipeline
+            ota_chunk_control_success(&chunkControl, bufferlength, (uint32_t)(esp_timer_get_time() - chunkBegin));
+            esp_err_t err = ota_pipeline_submit(bufferlength);
             if (err != ESP_OK)
             {
-                ESP_LOGE(TAG, "Error: esp_ota_write failed! err=0x%x", err);
+                ESP_LOGE(TAG, "Error: ota_write failed! err=0x%x", err);
                 g_fatalError = true;
-                return 1;
+                esp_http_client_cleanup(client);
+                return false;
             }
             //else
-            ESP_LOGI(TAG, "Success writing %d to OTA partition", bufferlength);
+            ESP_LOGI(TAG, "Queued %d bytes for the OTA partition", bufferlength);
             blink_led_fast(OK_STATUS_LED);
             g_downloadPacketRetries = 0;
             g_firmwareOffset += bufferlength;
+            ota_scheduler_throttle(bufferlength);
         }
 
-        ESP_LOGV(TAG, "before deleteing hBuffer, freemem=%d", esp_get_free_heap_size());
-        BUFFER_delete(hBuffer);
+		ESP_LOGI(TAG, "Finish request, status=%d, freemem=%d", status, esp_get_free_heap_size());
+	}
 
-        ESP_LOGV(TAG, "before deleteing encodedMD5 & md5base64 strings, freemem=%d", esp_get_free_heap_size());
-        STRING_delete(encodedMD5);
-        STRING_delete(g_md5base64);
+	esp_http_client_close(client);
+	esp_http_client_cleanup(client);
+	return g_firmwareOffset >= blobSize;
+}
 
-        ESP_LOGV(TAG, "after freeing all, freemem=%d", esp_get_free_heap_size());
+//download blobName and flash it, the OTA_FORMAT flags tell how the blob of blobSize bytes produces the image of imageSize bytes
+bool download_and_update_firmware(const char *blobName, const char *blobUrl, size_t blobSize, size_t imageSize, int format)
+{
+	g_firmwareOffset = 0;
+	g_downloadSize = blobSize;
+	g_format = format;
+	g_downloadPacketRetries = 0;
+	g_otaConnections = 0;
+	g_otaRequests = 0;
+	int64_t downloadBegin = esp_timer_get_time();
 
-        free(buffer);
-       
-		//optimize chunk size
-		if (g_downloadPacketRetries == 0)
-		{
-			if (++noErrorCounter > 10) //10 packets with no errors, increase packet size
-			{
-				maxChunkSize = maxChunkSize * 1.5;
-				noErrorCounter = 0;
-			}
+	const esp_partition_t *configured = esp_ota_get_boot_partition();
+	const esp_partition_t *running = esp_ota_get_running_partition();
 
-			if (chunkSize < maxChunkSize)
-				chunkSize *= 1.5;
-		}
-		
-		if (g_downloadPacketRetries > 0)
-		{
-			noErrorCounter = 0;
-		}
-		
-		if (g_downloadPacketRetries > 10) //10 packets with errors, decrease packet size
+	if (configured != running) 
+	{
+		ESP_LOGW(TAG, "Configured OTA boot partition at offset 0x%08x, but running from offset 0x%08x", configured->address, running->address);
+		ESP_LOGW(TAG, "(This can happen if either the OTA boot data or preferred boot image become corrupted somehow.)");
+	}
+
+	ESP_LOGI(TAG, "Running partition type %d subtype %d (offset 0x%08x)", running->type, running->subtype, running->address);
+	const esp_partition_t *update_partition = esp_ota_get_next_update_partition(NULL);
+
+	ESP_LOGI(TAG, "Writing to partition subtype %d at offset 0x%x", update_partition->subtype, update_partition->address);
+	assert(update_partition != NULL);
+
+	mbedtls_sha256_init(&g_imageSha256);
+	mbedtls_sha256_starts(&g_imageSha256, 0);
+
+	size_t resumeOffset = 0;
+	if (format != 0)
+	{
+		ota_state_clear(); //the partition is overwritten, a saved full image download is lost
+		ota_patch_init(&g_patch, patch_read_source, patch_write_image, (void *)running);
+		ota_inflate_begin(ota_write_decompressed);
+	}
+	else
+	{
+		resumeOffset = get_resume_offset(blobName, blobSize, update_partition);
+	}
+	if (resumeOffset > 0 && !rehash_written_image(update_partition, resumeOffset))
+	{
+		ESP_LOGW(TAG, "Reading the interrupted download failed, starting over");
+		mbedtls_sha256_starts(&g_imageSha256, 0);
+		resumeOffset = 0;
+	}
+
+	esp_err_t err = ota_writer_begin(update_partition, imageSize, resumeOffset);
+	if (err != ESP_OK) 
+	{
+		ESP_LOGE(TAG, "ota_writer_begin failed, error=%d", err);
+		mbedtls_sha256_free(&g_imageSha256);
+		g_fatalError = true;
+		return false;
+	}
+
+	if (resumeOffset == 0 && format == 0)
+	{
+		memset(&g_otaState, 0, sizeof(g_otaState));
+		snprintf(g_otaState.blobName, sizeof(g_otaState.blobName), "%s", blobName);
+		g_otaState.blobSize = blobSize;
+		g_otaState.hasSha256 = g_hasExpectedSha256;
+		memcpy(g_otaState.sha256, g_expectedSha256, sizeof(g_otaState.sha256));
+		g_otaState.partitionAddress = update_partition->address;
+		ota_state_save(&g_otaState); //without a saved state the download still works, it just can not resume
+	}
+	else
+	{
+		ESP_LOGI(TAG, "Resuming the download of %s at offset:%u", blobName, resumeOffset);
+	}
+	g_firmwareOffset = resumeOffset;
+	g_committedOffset = resumeOffset;
+
+	ota_scheduler_begin();
+	err = ota_pipeline_begin(ota_write);
+	if (err != ESP_OK)
+	{
+		ota_writer_end();
+		mbedtls_sha256_free(&g_imageSha256);
+		g_fatalError = true;
+		return false;
+	}
+
+	//prefer the raw image stream, the chunked base64 function continues from wherever the raw download stopped
+	bool isDownloaded = false;
+	if (blobUrl != NULL && blobUrl[0] != '\0')
+	{
+		isDownloaded = download_raw(blobUrl, blobSize);
+		if (!isDownloaded && !g_fatalError)
 		{
-			chunkSize /= 2;
-			if (chunkSize < minChunkSize)
-				chunkSize = minChunkSize;
-			maxChunkSize = chunkSize;
+			ESP_LOGW(TAG, "Raw download failed at offset:%u, falling back to chunked download", g_firmwareOffset);
+			g_downloadPacketRetries = 0;
 		}
-        esp_http_client_close(client);
-        esp_http_client_cleanup(client);
+	}
+	if (!isDownloaded && !g_fatalError)
+	{
+		isDownloaded = download_chunked(blobName, blobSize);
+	}
 
-		ESP_LOGI(TAG, "Finish request, status=%d, freemem=%d", status, esp_get_free_heap_size());
+	//the queued buffers are written before the image is checked
+	err = ota_pipeline_end();
+	if (err != ESP_OK)
+	{
+		ESP_LOGE(TAG, "Error: ota_write failed! err=0x%x", err);
+		g_fatalError = true;
+	}
+
+	//with the pipeline the total time approaches the larger of the network and the flash time instead of their sum
+	ESP_LOGI(TAG, "Download of %d bytes took %d ms, %d ms of it writing, %d requests over %d connections, %u bytes/s",
+		g_firmwareOffset, (int)((esp_timer_get_time() - downloadBegin) / 1000), (int)(ota_pipeline_write_time() / 1000), g_otaRequests, g_otaConnections, ota_scheduler_throughput());
+
+	unsigned char imageSha256[32];
+	mbedtls_sha256_finish(&g_imageSha256, imageSha256);
+	mbedtls_sha256_free(&g_imageSha256);
+
+	bool isSuccess = g_firmwareOffset >= blobSize && err == ESP_OK
+		&& ((format & OTA_FORMAT_PATCH) == 0 || ota_patch_is_complete(&g_patch))
+		&& ((format & OTA_FORMAT_ZLIB) == 0 || ota_inflate_is_complete());
+	if (isSuccess && g_hasExpectedSha256 && memcmp(imageSha256, g_expectedSha256, sizeof(imageSha256)) != 0)
+	{
+		ESP_LOGE(TAG, "Firmware image SHA-256 differs from the manifest, the image is discarded");
+		ota_writer_end();
+		ota_state_clear();
+		g_fatalError = true;
+		g_firmwareOffset = 0;
+		return false;
 	}
-   
 
-	bool isSuccess = g_firmwareOffset >= blobSize;
 	if (isSuccess)
 	{
-		ESP_LOGI(TAG, "Finish download firmware, size:%d", g_firmwareOffset);
-		if (esp_ota_end(g_update_handle) != ESP_OK) 
+		ESP_LOGI(TAG, "Finish download firmware, size:%d%s", g_firmwareOffset, g_hasExpectedSha256 ? ", SHA-256 verified" : "");
+		ota_state_clear();
+		if (ota_writer_end() != ESP_OK) 
 		{
-			ESP_LOGE(TAG, "esp_ota_end failed!");
+			ESP_LOGE(TAG, "ota_writer_end failed!");
 			g_fatalError = true;
 			return false;
 		}
 
+		//verifies the image before it is made bootable
 		err = esp_ota_set_boot_partition(update_partition);
 		if (err != ESP_OK) 
 		{
@@ -291,12 +647,16 @@ bool download_and_update_firmware(const char *blobName, size_t blobSize)
 			return false;
 		}
 
+		//the new firmware is compared with this one and boots this partition again if it regresses
+		ota_probation_arm(esp_ota_get_running_partition(), g_latestVersion);
+
 		ESP_LOGI(TAG, "Finish updating firmware, Prepare to restart system!");
 		esp_restart();
 		return isSuccess; 
 	}
 	//else
 	ESP_LOGI(TAG, "Error downloading firmware, stop at: %d", g_firmwareOffset);
+	ota_writer_end(); //the state stays in NVS, the next attempt continues from the last checkpoint
 	g_firmwareOffset = 0;
 	return isSuccess;
 }
@@ -304,43 +664,126 @@ bool download_and_update_firmware(const char *blobName, size_t blobSize)
 
 
 
-void do_check_firmware(esp_http_client_handle_t client, char *data, int len)
+//the manifest members OTA uses, the strings are unescaped straight into their buffers while the response is read
+enum
+{
+	MANIFEST_LATEST_VERSION,
+	MANIFEST_BLOB_NAME,
+	MANIFEST_BLOB_SIZE,
+	MANIFEST_BLOB_URL,
+	MANIFEST_SHA256,
+	MANIFEST_ENCODING,
+	MANIFEST_COMPRESSED_SIZE,
+	MANIFEST_PATCH_BASE_VERSION,
+	MANIFEST_PATCH_BLOB_NAME,
+	MANIFEST_PATCH_SIZE,
+	MANIFEST_PATCH_BLOB_URL,
+	MANIFEST_PATCH_ENCODING,
+	MANIFEST_FIELD_COUNT
+};
+
+static char g_sha256Text[65];
+static char g_encoding[MAX_ENCODING_LENGTH];
+static char g_patchBaseVersion[MAX_VERSION_LENGTH];
+static char g_patchEncoding[MAX_ENCODING_LENGTH];
+
+static cJSON_Selector g_manifest[MANIFEST_FIELD_COUNT] =
+{
+	[MANIFEST_LATEST_VERSION] = { "latestVersion", cJSON_String, g_latestVersion, sizeof(g_latestVersion) },
+	[MANIFEST_BLOB_NAME] = { "blobName", cJSON_String, g_blobName, sizeof(g_blobName) },
+	[MANIFEST_BLOB_SIZE] = { "blobSize", cJSON_Number },
+	[MANIFEST_BLOB_URL] = { "blobUrl", cJSON_String, g_blobUrl, sizeof(g_blobUrl) },
+	[MANIFEST_SHA256] = { "sha256", cJSON_String, g_sha256Text, sizeof(g_sha256Text) },
+	[MANIFEST_ENCODING] = { "encoding", cJSON_String, g_encoding, sizeof(g_encoding) },
+	[MANIFEST_COMPRESSED_SIZE] = { "compressedSize", cJSON_Number },
+	[MANIFEST_PATCH_BASE_VERSION] = { "patchBaseVersion", cJSON_String, g_patchBaseVersion, sizeof(g_patchBaseVersion) },
+	[MANIFEST_PATCH_BLOB_NAME] = { "patchBlobName", cJSON_String, g_patchBlobName, sizeof(g_patchBlobName) },
+	[MANIFEST_PATCH_SIZE] = { "patchSize", cJSON_Number },
+	[MANIFEST_PATCH_BLOB_URL] = { "patchBlobUrl", cJSON_String, g_patchBlobUrl, sizeof(g_patchBlobUrl) },
+	[MANIFEST_PATCH_ENCODING] = { "patchEncoding", cJSON_String, g_patchEncoding, sizeof(g_patchEncoding) },
+};
+static cJSON_Extractor g_manifestExtractor;
+
+//a string member that was found whole
+static bool has_manifest_string(int field)
+{
+	return g_manifest[field].found && !g_manifest[field].truncated;
+}
+
+static bool is_zlib_encoding(int field)
 {
-	//payload is like this: "{'lastVersion':'1.0.0.0','blobName':'esp32.bin','blobSize':'732800'}"
+	return has_manifest_string(field) && strcmp(g_manifest[field].valuestring, "zlib") == 0;
+}
+
+//returns false when the manifest is invalid, g_newFirmwareSize is 0 when there is nothing to update
+static bool do_check_firmware()
+{
+	g_newFirmwareSize = 0;
+
+	//payload is like this: "{'lastVersion':'1.0.0.0','blobName':'esp32.bin','blobSize':'732800','blobUrl':'https://...'}", blobUrl is optional
+	//a compressed image adds 'encoding':'zlib','compressedSize':'402311', a compressed patch 'patchEncoding':'zlib'
+	//a delta update adds 'patchBaseVersion':'0.9.0.0','patchBlobName':'esp32_0.9.0.0_1.0.0.0.patch','patchSize':'2300','patchBlobUrl':'https://...'
 
-	//currentFirmwareVersion
-	ESP_LOGI(TAG, "Check firmware input data: %s", data);
-	if (data == NULL)
+	if (!cJSON_ExtractorIsComplete(&g_manifestExtractor))
 	{
-		ESP_LOGE(TAG, "Error, data is NULL");
-		return;
+		ESP_LOGE(TAG, "Error parsing JSON");
+		return false;
 	}
-	
-	cJSON * root = cJSON_Parse(data); 
 
-	if (root == NULL)
+	if (!has_manifest_string(MANIFEST_LATEST_VERSION) || !has_manifest_string(MANIFEST_BLOB_NAME) || !g_manifest[MANIFEST_BLOB_SIZE].found)
 	{
-		ESP_LOGE(TAG, "Error parsing JSON");
-		return;
+		ESP_LOGE(TAG, "Firmware manifest is missing latestVersion, blobName or blobSize");
+		return false;
 	}
 
-	cJSON *jLatestVersion = cJSON_GetObjectItemCaseSensitive(root, "latestVersion");
-	ESP_LOGI(TAG, "Available firmware version: %s", jLatestVersion->valuestring);
+	ESP_LOGI(TAG, "Available firmware version: %s", g_latestVersion);
 
-	if (strcmp(jLatestVersion->valuestring, get_firmware_version()) == 0)// same fimware do nothing
+	if (strcmp(g_latestVersion, get_firmware_version()) == 0)// same fimware do nothing
 	{
 		ESP_LOGI(TAG, "Available firmware has the same version, hence, no need to update!");
 		g_newFirmwareSize = 0;
+		ota_state_clear(); //a download of an image that is no longer the latest can not be continued
+	}
+	else if (ota_probation_is_rejected(g_latestVersion))
+	{
+		ESP_LOGW(TAG, "Firmware %s was rolled back on this device, waiting for a newer version", g_latestVersion);
+		g_newFirmwareSize = 0;
+		ota_state_clear();
 	}
 	else
 	{
-		g_blobName = STRING_construct(cJSON_GetObjectItemCaseSensitive(root, "blobName")->valuestring);
-		g_newFirmwareSize = cJSON_GetObjectItemCaseSensitive(root, "blobSize")->valueint;
+		g_patchSize = 0;
+		g_patchFormat = OTA_FORMAT_PATCH;
+		g_newFirmwareSize = g_manifest[MANIFEST_BLOB_SIZE].valueint;
+
+		//a cut off SAS url can not be used, the blob is then read by chunks
+		if (!has_manifest_string(MANIFEST_BLOB_URL))
+			g_blobUrl[0] = '\0';
+
+		//a compressed blob has the size of the compressed data in compressedSize, blobSize stays the image size
+		g_imageFormat = is_zlib_encoding(MANIFEST_ENCODING) ? OTA_FORMAT_ZLIB : 0;
+		g_compressedSize = g_imageFormat != 0 && g_manifest[MANIFEST_COMPRESSED_SIZE].found ? g_manifest[MANIFEST_COMPRESSED_SIZE].valueint : g_newFirmwareSize;
+
+		g_hasExpectedSha256 = has_manifest_string(MANIFEST_SHA256) && parse_hex(g_sha256Text, g_expectedSha256, sizeof(g_expectedSha256));
+		if (!g_hasExpectedSha256)
+			ESP_LOGW(TAG, "The firmware manifest has no valid sha256, the image is verified by the bootloader checksum only");
+
+		//the patch fields are optional, the patch is usable only if it was made against the running version
+		if (has_manifest_string(MANIFEST_PATCH_BASE_VERSION) && strcmp(g_patchBaseVersion, get_firmware_version()) == 0
+			&& has_manifest_string(MANIFEST_PATCH_BLOB_NAME) && g_manifest[MANIFEST_PATCH_SIZE].found && g_manifest[MANIFEST_PATCH_SIZE].valueint > 0)
+		{
+			if (!has_manifest_string(MANIFEST_PATCH_BLOB_URL))
+				g_patchBlobUrl[0] = '\0';
+			g_patchSize = g_manifest[MANIFEST_PATCH_SIZE].valueint;
+			if (is_zlib_encoding(MANIFEST_PATCH_ENCODING))
+				g_patchFormat |= OTA_FORMAT_ZLIB;
+			ESP_LOGI(TAG, "Delta update available, patch: %s  Size:%d", g_patchBlobName, g_patchSize);
+		}
 
-		ESP_LOGI(TAG, "Available firmware version: %s blobName: %s  Size:%d", jLatestVersion->valuestring, STRING_c_str(g_blobName), g_newFirmwareSize);
+		ESP_LOGI(TAG, "Available firmware version: %s blobName: %s  Size:%d  Download size:%d", g_latestVersion, g_blobName, g_newFirmwareSize, g_compressedSize);
 	}
 
-	cJSON_Delete(root);
+	return true;
 }
 
 
@@ -361,8 +804,11 @@ esp_err_t  check_firmware_callback(esp_http_client_event_t *evt)
         break;
 
     case HTTP_EVENT_ON_HEADER:
-        ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER");
-        printf("%.*s", evt->data_len, (char*)evt->data);
+        ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
+        if (strcasecmp(evt->header_key, "ETag") == 0)
+            snprintf(g_etag, sizeof(g_etag), "%s", evt->header_value);
+        else if (strcasecmp(evt->header_key, "Last-Modified") == 0)
+            snprintf(g_lastModified, sizeof(g_lastModified), "%s", evt->header_value);
         break;
 
     case HTTP_EVENT_ON_FINISH:
@@ -406,62 +852,136 @@ void switch_to_previous_partition()
 }
 
 
-void ota_task(void *pvParameters)
+//a conditional GET of the firmware manifest, returns true when a manifest was read into g_manifest
+static bool fetch_firmware_manifest()
 {
-	xEventGroupWaitBits(wifi_event_group, CONNECTED_BIT, false, true, portMAX_DELAY);
-	ESP_LOGI(TAG, "Connected to AP, freemem=%d", esp_get_free_heap_size());
-	// vTaskDelay(1000/portTICK_RATE_MS);
-	
-	const char *checkFirmwareUrl = "https://watertank.azurewebsites.net/api/CheckForNewFirmware?code=ndfjZi2tudJeZ9SCFwHWTfOynsWQQLPZlPgiooCnTakQiDopm/7Raw==";
-	
-    esp_http_client_config_t config = 
-    {
-        .url = checkFirmwareUrl,
-        .method = HTTP_METHOD_GET,
-        .event_handler = &check_firmware_callback,
-    };
+	//the running version lets the function offer a patch from it
+	snprintf(g_url, sizeof(g_url), OTA_FUNCTIONS_URL "/CheckForNewFirmware?code=ndfjZi2tudJeZ9SCFwHWTfOynsWQQLPZlPgiooCnTakQiDopm/7Raw==&version=%s", get_firmware_version());
 
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    esp_err_t err = esp_http_client_perform(client);
+	esp_http_client_config_t config =
+	{
+		.url = g_url,
+		.method = HTTP_METHOD_GET,
+		.event_handler = &check_firmware_callback,
+	};
 
-    if (err == ESP_OK) 
-    {
-        ESP_LOGI(TAG, "Finish request firmware information, status=%d, freemem=%d", 
-            esp_http_client_get_status_code(client), esp_get_free_heap_size());
-        size_t bufferLength = esp_http_client_get_content_length(client);
-
-        char *buffer = malloc(bufferLength+1);
-
-        int read_len = esp_http_client_read(client, buffer, bufferLength);
-        buffer[read_len] = 0;
-        ESP_LOGI(TAG, "HTTP Stream reader Status = %d, content_length = %d, Buffer=%.*s",
-            esp_http_client_get_status_code(client),
-            read_len,
-            read_len,
-            buffer);
-
-        do_check_firmware(client, buffer, read_len);
-        free(buffer);
-    }
-    else
-    {
-        ESP_LOGE(TAG, "Error http request to get firmware information");
-        return;
-    }
+	esp_http_client_handle_t client = esp_http_client_init(&config);
+	if (client == NULL)
+	{
+		ESP_LOGE(TAG, "esp_http_client_init failed");
+		return false;
+	}
+
+	ota_state_load_validators(g_cachedEtag, sizeof(g_cachedEtag), g_cachedLastModified, sizeof(g_cachedLastModified));
+	if (g_cachedEtag[0] != '\0')
+		esp_http_client_set_header(client, "If-None-Match", g_cachedEtag);
+	if (g_cachedLastModified[0] != '\0')
+		esp_http_client_set_header(client, "If-Modified-Since", g_cachedLastModified);
+	g_etag[0] = '\0';
+	g_lastModified[0] = '\0';
+
+	bool isRead = false;
+	esp_err_t err = esp_http_client_open(client, 0);
+	if (err != ESP_OK)
+	{
+		ESP_LOGE(TAG, "Error http request to get firmware information, err=%d", err);
+	}
+	else
+	{
+		esp_http_client_fetch_headers(client);
+		int statusCode = esp_http_client_get_status_code(client);
+		if (statusCode == 304)
+		{
+			ESP_LOGI(TAG, "Firmware manifest not modified");
+		}
+		else if (statusCode != 200)
+		{
+			ESP_LOGE(TAG, "Firmware manifest request failed, status=%d", statusCode);
+		}
+		else
+		{
+			//the response is parsed as it is read, no buffer has to hold the whole manifest
+			cJSON_ExtractorInit(&g_manifestExtractor, g_manifest, MANIFEST_FIELD_COUNT);
+			int readLen = 0;
+			bool isValid = true;
+			while (isValid)
+			{
+				int length = esp_http_client_read(client, g_textBuffer, sizeof(g_textBuffer));
+				if (length <= 0)
+					break;
+				isValid = cJSON_ExtractorFeed(&g_manifestExtractor, g_textBuffer, length);
+				readLen += length;
+			}
+			ESP_LOGI(TAG, "Firmware manifest, length=%d, freemem=%d", readLen, esp_get_free_heap_size());
+			isRead = readLen > 0;
+		}
+	}
 
-    esp_http_client_cleanup(client);
+	esp_http_client_cleanup(client);
+	return isRead;
+}
 
-	if (g_newFirmwareSize > 0) //new firmware, start update
+static void check_and_update_firmware()
+{
+	g_fatalError = false;
+	if (!fetch_firmware_manifest() || !do_check_firmware())
+		return;
+
+	if (g_newFirmwareSize == 0)
 	{
-		download_and_update_firmware(STRING_c_str(g_blobName), g_newFirmwareSize);
+		//only a manifest that needs no update is cached, a failed update is retried by the next check
+		ota_state_save_validators(g_etag, g_lastModified);
+		return;
 	}
 
+	//an interrupted full image download is closer to the end than a new delta download
+	if (g_patchSize > 0 && !ota_has_pending_update())
+	{
+		download_and_update_firmware(g_patchBlobName, g_patchBlobUrl, g_patchSize, g_newFirmwareSize, g_patchFormat);
+		ESP_LOGW(TAG, "Delta update failed, downloading the full image");
+		g_fatalError = false;
+	}
+	download_and_update_firmware(g_blobName, g_blobUrl, g_compressedSize, g_newFirmwareSize, g_imageFormat);
+
 	if (g_fatalError)
 	{
 		ESP_LOGE(TAG, "OTA update failure.");
 	}
+}
+
+static uint32_t random_between(uint32_t min, uint32_t max)
+{
+	return min + esp_random() % (max - min + 1);
+}
+
+void ota_trigger_check()
+{
+	if (g_otaTask != NULL)
+		xTaskNotifyGive(g_otaTask);
+}
+
+//checks for new firmware every OTA_CHECK_PERIOD_S, ota_trigger_check runs a check right away
+void ota_task(void *pvParameters)
+{
+	g_otaTask = xTaskGetCurrentTaskHandle();
+
+	//an interrupted update continues right away
+	uint32_t delaySeconds = ota_has_pending_update() ? 0 : random_between(OTA_FIRST_CHECK_MIN_S, OTA_FIRST_CHECK_MAX_S);
+	//a firmware on probation is judged before it downloads the next one, the download would skew its measurements
+	while (ota_probation_is_active())
+	{
+		vTaskDelay(OTA_PROBATION_POLL_S * 1000 / portTICK_PERIOD_MS);
+		ota_probation_poll();
+	}
+	while (true)
+	{
+		ulTaskNotifyTake(pdTRUE, delaySeconds * 1000 / portTICK_PERIOD_MS);
+		xEventGroupWaitBits(wifi_event_group, CONNECTED_BIT, false, true, portMAX_DELAY);
+		ESP_LOGI(TAG, "Checking for new firmware, freemem=%d", esp_get_free_heap_size());
 
-	STRING_delete(g_blobName);
-	
-	vTaskDelete(NULL);
-}
\ No newline at end of file
+		check_and_update_firmware();
+
+		uint32_t jitter = OTA_CHECK_PERIOD_S * OTA_CHECK_JITTER_PERCENT / 100;
+		delaySeconds = random_between(OTA_CHECK_PERIOD_S - jitter, OTA_CHECK_PERIOD_S + jitter);
+	}
+}
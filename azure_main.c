@@ -13,6 +13,8 @@
 #include "driver/adc.h"
 #include "iothub_watertank_client.h"
 #include "Common.h"
+#include "ota_scheduler.h"
+#include "ota_probation.h"
 
 
 #define EXAMPLE_WIFI_SSID CONFIG_WIFI_SSID
@@ -90,6 +92,7 @@ void ota_task(void *pvParameters);
 void app_main()
 {
     nvs_flash_init();
+    ota_probation_begin(); //a new firmware that keeps restarting goes back to the previous one here
 
 	ESP_LOGI(TAG, "WaterTankDataLogger\t Firmware Version: %s", get_firmware_version());
 
@@ -97,5 +100,9 @@ void app_main()
     
     xTaskCreate(&azure_task, "azure_task", 8192, NULL, 5, NULL);
 
-    //BaseType_t ret = xTaskCreate(&ota_task, "ota_task", 8192, NULL, 5, NULL);
+    //checks for new firmware periodically, below the telemetry loop the download only uses what telemetry leaves
+    if (xTaskCreate(&ota_task, "ota_task", 8192, NULL, OTA_TASK_PRIORITY, NULL) != pdPASS)
+    {
+        ESP_LOGE(TAG, "unable to create update task");
+    }
 }
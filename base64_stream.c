@@ -0,0 +1,116 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "base64_stream.h"
+
+#define B64_SKIP 64
+#define B64_PAD 65
+#define B64_INVALID 66
+
+#define R4(x) x, x, x, x
+#define R16(x) R4(x), R4(x), R4(x), R4(x)
+
+static const uint8_t g_base64Table[256] =
+{
+	/* 0x00 */ R4(B64_INVALID), R4(B64_INVALID), B64_INVALID, B64_SKIP, B64_SKIP, B64_INVALID, B64_INVALID, B64_SKIP, B64_INVALID, B64_INVALID,
+	/* 0x10 */ R16(B64_INVALID),
+	/* 0x20 */ B64_SKIP, B64_INVALID, B64_SKIP, R4(B64_INVALID), R4(B64_INVALID), 62, B64_INVALID, B64_INVALID, B64_INVALID, 63,
+	/* 0x30 */ 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, B64_INVALID, B64_INVALID, B64_INVALID, B64_PAD, B64_INVALID, B64_INVALID,
+	/* 0x40 */ B64_INVALID, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+	/* 0x50 */ 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, B64_INVALID, B64_INVALID, B64_INVALID, B64_INVALID, B64_INVALID,
+	/* 0x60 */ B64_INVALID, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	/* 0x70 */ 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, B64_INVALID, B64_INVALID, B64_INVALID, B64_INVALID, B64_INVALID,
+	/* 0x80 */ R16(B64_INVALID), R16(B64_INVALID), R16(B64_INVALID), R16(B64_INVALID),
+	/* 0xC0 */ R16(B64_INVALID), R16(B64_INVALID), R16(B64_INVALID), R16(B64_INVALID)
+};
+
+void base64_stream_init(BASE64_STREAM *stream)
+{
+	stream->accumulator = 0;
+	stream->bits = 0;
+	stream->finished = 0;
+}
+
+int base64_stream_decode(BASE64_STREAM *stream, const char *input, size_t length, unsigned char *output)
+{
+	const unsigned char *in = (const unsigned char *)input;
+	const unsigned char *end = in + length;
+	unsigned char *out = output;
+
+	if (stream->finished)
+		return 0;
+
+	while (in < end)
+	{
+		//fast path, 4 characters to 3 bytes when the decoder is aligned on a quantum
+		if (stream->bits == 0)
+		{
+			while (end - in >= 4)
+			{
+				uint32_t a = g_base64Table[in[0]], b = g_base64Table[in[1]], c = g_base64Table[in[2]], d = g_base64Table[in[3]];
+				if ((a | b | c | d) >= 64)
+					break;
+				uint32_t quantum = (a << 18) | (b << 12) | (c << 6) | d;
+				out[0] = (unsigned char)(quantum >> 16);
+				out[1] = (unsigned char)(quantum >> 8);
+				out[2] = (unsigned char)quantum;
+				out += 3;
+				in += 4;
+			}
+			if (in == end)
+				break;
+		}
+
+		uint8_t value = g_base64Table[*in++];
+		if (value == B64_SKIP)
+			continue;
+		if (value == B64_PAD)
+		{
+			stream->finished = 1;
+			break;
+		}
+		if (value == B64_INVALID)
+			return -1;
+
+		stream->accumulator = (stream->accumulator << 6) | value;
+		stream->bits += 6;
+		if (stream->bits >= 8)
+		{
+			stream->bits -= 8;
+			*out++ = (unsigned char)(stream->accumulator >> stream->bits);
+			//drop the consumed bits, once a quantum is complete bits is back to 0 and the fast path resumes
+			stream->accumulator &= (1u << stream->bits) - 1;
+		}
+	}
+	return (int)(out - output);
+}
+
+static const char g_base64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+size_t base64_encode(const unsigned char *data, size_t size, char *output)
+{
+	char *out = output;
+	size_t i = 0;
+	for (; i + 3 <= size; i += 3)
+	{
+		uint32_t quantum = ((uint32_t)data[i] << 16) | ((uint32_t)data[i + 1] << 8) | data[i + 2];
+		out[0] = g_base64Alphabet[quantum >> 18];
+		out[1] = g_base64Alphabet[(quantum >> 12) & 0x3f];
+		out[2] = g_base64Alphabet[(quantum >> 6) & 0x3f];
+		out[3] = g_base64Alphabet[quantum & 0x3f];
+		out += 4;
+	}
+	if (i < size)
+	{
+		uint32_t quantum = (uint32_t)data[i] << 16;
+		if (i + 1 < size)
+			quantum |= (uint32_t)data[i + 1] << 8;
+		out[0] = g_base64Alphabet[quantum >> 18];
+		out[1] = g_base64Alphabet[(quantum >> 12) & 0x3f];
+		out[2] = i + 1 < size ? g_base64Alphabet[(quantum >> 6) & 0x3f] : '=';
+		out[3] = '=';
+		out += 4;
+	}
+	*out = '\0';
+	return (size_t)(out - output);
+}
@@ -0,0 +1,40 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef BASE64_STREAM_H
+#define BASE64_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * Incremental base64 decoder, the input may be split at any character.
+	 * Quotes and white space are skipped, decoding stops at the first '=' padding character.
+	 */
+	typedef struct BASE64_STREAM_TAG
+	{
+		uint32_t accumulator;
+		int bits;
+		int finished;
+	} BASE64_STREAM;
+
+	void base64_stream_init(BASE64_STREAM *stream);
+	//decode the next fragment, output must hold at least BASE64_STREAM_DECODED_SIZE(length) bytes. returns the number of bytes written or -1 on invalid input
+	int base64_stream_decode(BASE64_STREAM *stream, const char *input, size_t length, unsigned char *output);
+
+#define BASE64_STREAM_DECODED_SIZE(length) ((length) / 4 * 3 + 3)
+
+	//encode size bytes with padding, output must hold BASE64_ENCODED_SIZE(size) characters including the terminating zero. returns the length
+	size_t base64_encode(const unsigned char *data, size_t size, char *output);
+
+#define BASE64_ENCODED_SIZE(size) (((size) + 2) / 3 * 4 + 1)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BASE64_STREAM_H */
@@ -227,6 +227,136 @@ CJSON_PUBLIC(void) cJSON_Delete(cJSON *item)
 	}
 }
 
+/* Arena blocks: a header followed by the bump allocated nodes and strings. */
+typedef struct arena_block
+{
+	struct arena_block *next;
+	size_t size; /* bytes after the header */
+} arena_block;
+
+/* the alignment of a node, strings are not aligned */
+typedef union
+{
+	double number;
+	void *pointer;
+} arena_alignment;
+
+#define arena_header_size ((sizeof(arena_block) + sizeof(arena_alignment) - 1) / sizeof(arena_alignment) * sizeof(arena_alignment))
+#define arena_block_data(block) ((unsigned char*)(block) + arena_header_size)
+
+CJSON_PUBLIC(cJSON_bool) cJSON_ArenaInit(cJSON_Arena *arena, void *block, size_t size)
+{
+	arena_block *first = NULL;
+
+	if (arena == NULL)
+	{
+		return false;
+	}
+
+	memset(arena, '\0', sizeof(cJSON_Arena));
+	arena->block_size = (size > arena_header_size) ? size - arena_header_size : CJSON_ARENA_BLOCK_SIZE;
+	if (block == NULL)
+	{
+		return true;
+	}
+	if (size <= arena_header_size)
+	{
+		return false;
+	}
+
+	first = (arena_block*)block;
+	first->next = NULL;
+	first->size = size - arena_header_size;
+	arena->first = first;
+	arena->current = first;
+	arena->first_is_callers = true;
+
+	return true;
+}
+
+/* Bump allocate from the current block, move on to the blocks kept from before the last reset, and take a new
+ * block from the hooks only when the chain is used up. */
+static void *arena_allocate(cJSON_Arena * const arena, size_t size, size_t alignment)
+{
+	arena_block *block = (arena_block*)arena->current;
+	arena_block *new_block = NULL;
+	size_t used = arena->used;
+	size_t offset = 0;
+
+	while (block != NULL)
+	{
+		offset = (used + alignment - 1) / alignment * alignment;
+		if (offset + size <= block->size)
+		{
+			arena->current = block;
+			arena->used = offset + size;
+			return arena_block_data(block) + offset;
+		}
+		if (block->next == NULL)
+		{
+			break;
+		}
+		block = block->next;
+		used = 0;
+	}
+
+	new_block = (arena_block*)global_hooks.allocate(arena_header_size + ((size > arena->block_size) ? size : arena->block_size));
+	if (new_block == NULL)
+	{
+		return NULL;
+	}
+	new_block->next = NULL;
+	new_block->size = (size > arena->block_size) ? size : arena->block_size;
+	if (block == NULL)
+	{
+		arena->first = new_block;
+	}
+	else
+	{
+		block->next = new_block;
+	}
+
+	arena->current = new_block;
+	arena->used = size;
+	return arena_block_data(new_block);
+}
+
+CJSON_PUBLIC(void) cJSON_ArenaReset(cJSON_Arena *arena)
+{
+	if (arena == NULL)
+	{
+		return;
+	}
+
+	/* the blocks stay for the next document */
+	arena->current = arena->first;
+	arena->used = 0;
+}
+
+CJSON_PUBLIC(void) cJSON_ArenaFree(cJSON_Arena *arena)
+{
+	arena_block *block = NULL;
+	arena_block *next = NULL;
+
+	if (arena == NULL)
+	{
+		return;
+	}
+
+	block = (arena_block*)arena->first;
+	if ((block != NULL) && arena->first_is_callers)
+	{
+		block = block->next;
+	}
+	while (block != NULL)
+	{
+		next = block->next;
+		global_hooks.deallocate(block);
+		block = next;
+	}
+	memset(arena, '\0', sizeof(cJSON_Arena));
+}
+
 /* get the decimal point character of the current locale */
 static unsigned char get_decimal_point(void)
 {
@@ -245,8 +375,38 @@ typedef struct
 	size_t offset;
 	size_t depth; /* How deeply nested (in arrays/objects) is the input at the current offset. */
 	internal_hooks hooks;
+	cJSON_Arena *arena; /* NULL unless parsing with cJSON_ParseInArena */
 } parse_buffer;
 
+/* nodes and strings of the document come from the arena when there is one */
+static cJSON *buffer_new_item(parse_buffer * const buffer)
+{
+	cJSON *node = NULL;
+
+	if (buffer->arena == NULL)
+	{
+		return cJSON_New_Item(&buffer->hooks);
+	}
+
+	node = (cJSON*)arena_allocate(buffer->arena, sizeof(cJSON), sizeof(arena_alignment));
+	if (node)
+	{
+		memset(node, '\0', sizeof(cJSON));
+	}
+
+	return node;
+}
+
+static unsigned char *buffer_allocate_string(parse_buffer * const buffer, size_t size)
+{
+	if (buffer->arena == NULL)
+	{
+		return (unsigned char*)buffer->hooks.allocate(size);
+	}
+
+	return (unsigned char*)arena_allocate(buffer->arena, size, 1);
+}
+
 /* check if the given size is left to read in a given parse buffer (starting with 1) */
 #define can_read(buffer, size) ((buffer != NULL) && (((buffer)->offset + size) <= (buffer)->length))
 /* check if the buffer can be accessed at the given index (starting with 0) */
@@ -727,7 +887,7 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
 
 		/* This is at most how much we need for the output */
 		allocation_length = (size_t)(input_end - buffer_at_offset(input_buffer)) - skipped_bytes;
-		output = (unsigned char*)input_buffer->hooks.allocate(allocation_length + sizeof(""));
+		output = buffer_allocate_string(input_buffer, allocation_length + sizeof(""));
 		if (output == NULL)
 		{
 			goto fail; /* allocation failure */
@@ -803,7 +963,7 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
 	return true;
 
 fail:
-	if (output != NULL)
+	if ((output != NULL) && (input_buffer->arena == NULL))
 	{
 		input_buffer->hooks.deallocate(output);
 	}
@@ -990,10 +1150,12 @@ static parse_buffer *skip_utf8_bom(parse_buffer * const buffer)
 }
 
 /* Parse an object - create a new root, and populate. */
-CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated)
+static cJSON *parse_document(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated, cJSON_Arena * const arena)
 {
-	parse_buffer buffer = { 0, 0, 0, 0,{ 0, 0, 0 } };
+	parse_buffer buffer = { 0, 0, 0, 0,{ 0, 0, 0 }, NULL };
 	cJSON *item = NULL;
+	void *arena_current = (arena != NULL) ? arena->current : NULL;
+	size_t arena_used = (arena != NULL) ? arena->used : 0;
 
 	/* reset error position */
 	global_error.json = NULL;
@@ -1008,8 +1170,9 @@ CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return
 	buffer.length = strlen((const char*)value) + sizeof("");
 	buffer.offset = 0;
 	buffer.hooks = global_hooks;
+	buffer.arena = arena;
 
-	item = cJSON_New_Item(&global_hooks);
+	item = buffer_new_item(&buffer);
 	if (item == NULL) /* memory fail */
 	{
 		goto fail;
@@ -1038,7 +1201,13 @@ CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return
 	return item;
 
 fail:
-	if (item != NULL)
+	if (arena != NULL)
+	{
+		/* drop the partial document, the blocks taken meanwhile stay in the chain */
+		arena->current = (arena_current != NULL) ? arena_current : arena->first;
+		arena->used = arena_used;
+	}
+	else if (item != NULL)
 	{
 		cJSON_Delete(item);
 	}
@@ -1069,6 +1238,21 @@ fail:
 	return NULL;
 }
 
+CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated)
+{
+	return parse_document(value, return_parse_end, require_null_terminated, NULL);
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseInArena(cJSON_Arena *arena, const char *value)
+{
+	if (arena == NULL)
+	{
+		return NULL;
+	}
+
+	return parse_document(value, 0, 0, arena);
+}
+
 /* Default options for cJSON_Parse */
 CJSON_PUBLIC(cJSON *) cJSON_Parse(const char *value)
 {
@@ -1371,7 +1555,7 @@ static cJSON_bool parse_array(cJSON * const item, parse_buffer * const input_buf
 	do
 	{
 		/* allocate next item */
-		cJSON *new_item = cJSON_New_Item(&(input_buffer->hooks));
+		cJSON *new_item = buffer_new_item(input_buffer);
 		if (new_item == NULL)
 		{
 			goto fail; /* allocation failure */
@@ -1417,7 +1601,8 @@ success:
 	return true;
 
 fail:
-	if (head != NULL)
+	/* a partial document in an arena goes with the arena */
+	if ((head != NULL) && (input_buffer->arena == NULL))
 	{
 		cJSON_Delete(head);
 	}
@@ -1524,7 +1709,7 @@ static cJSON_bool parse_object(cJSON * const item, parse_buffer * const input_bu
 	do
 	{
 		/* allocate next item */
-		cJSON *new_item = cJSON_New_Item(&(input_buffer->hooks));
+		cJSON *new_item = buffer_new_item(input_buffer);
 		if (new_item == NULL)
 		{
 			goto fail; /* allocation failure */
@@ -1587,7 +1772,8 @@ success:
 	return true;
 
 fail:
-	if (head != NULL)
+	/* a partial document in an arena goes with the arena */
+	if ((head != NULL) && (input_buffer->arena == NULL))
 	{
 		cJSON_Delete(head);
 	}
@@ -2749,4 +2935,433 @@ CJSON_PUBLIC(void *) cJSON_malloc(size_t size)
 CJSON_PUBLIC(void) cJSON_free(void *object)
 {
 	global_hooks.deallocate(object);
-}
\ No newline at end of file
+}
+
+/* states of the selective extractor */
+enum
+{
+	extract_object_start,
+	extract_key_or_end,
+	extract_next_key,
+	extract_key,
+	extract_colon,
+	extract_value,
+	extract_string_value,
+	extract_scalar_value,
+	extract_skip_value,
+	extract_comma_or_end,
+	extract_done,
+	extract_error
+};
+
+static cJSON_bool is_json_whitespace(unsigned char c)
+{
+	return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r');
+}
+
+CJSON_PUBLIC(void) cJSON_ExtractorInit(cJSON_Extractor *extractor, cJSON_Selector *selectors, size_t selector_count)
+{
+	size_t i = 0;
+
+	memset(extractor, '\0', sizeof(*extractor));
+	extractor->selectors = selectors;
+	extractor->selector_count = selector_count;
+	extractor->state = extract_object_start;
+
+	for (i = 0; i < selector_count; i++)
+	{
+		selectors[i].found = false;
+		selectors[i].truncated = false;
+		selectors[i].valuedouble = 0;
+		selectors[i].valueint = 0;
+		if ((selectors[i].valuestring != NULL) && (selectors[i].valuestring_size > 0))
+		{
+			selectors[i].valuestring[0] = '\0';
+		}
+	}
+}
+
+/* one character of a string, unescaped into output. returns 1 at the closing quote, -1 on an invalid escape */
+static int extract_string_char(cJSON_Extractor * const extractor, unsigned char c, unsigned char *output, size_t *output_length)
+{
+	*output_length = 0;
+
+	if (extractor->escape == 0)
+	{
+		if (c == '\"')
+		{
+			return 1;
+		}
+		if (c == '\\')
+		{
+			extractor->escape = 1;
+			return 0;
+		}
+		if (c < 0x20)
+		{
+			return -1;
+		}
+		output[0] = c;
+		*output_length = 1;
+		return 0;
+	}
+
+	if (extractor->escape == 1)
+	{
+		extractor->escape = 0;
+		switch (c)
+		{
+			case 'b': output[0] = '\b'; break;
+			case 'f': output[0] = '\f'; break;
+			case 'n': output[0] = '\n'; break;
+			case 'r': output[0] = '\r'; break;
+			case 't': output[0] = '\t'; break;
+			case '\"':
+			case '\\':
+			case '/':
+				output[0] = c;
+				break;
+			case 'u':
+				extractor->escape = 2;
+				extractor->unicode = 0;
+				return 0;
+			default:
+				return -1;
+		}
+		*output_length = 1;
+		return 0;
+	}
+
+	/* \uXXXX, the hex digits are collected in escape states 2 to 5 */
+	if ((c >= '0') && (c <= '9'))
+	{
+		extractor->unicode = (extractor->unicode << 4) | (unsigned int)(c - '0');
+	}
+	else if (((c | 0x20) >= 'a') && ((c | 0x20) <= 'f'))
+	{
+		extractor->unicode = (extractor->unicode << 4) | (unsigned int)((c | 0x20) - 'a' + 10);
+	}
+	else
+	{
+		return -1;
+	}
+	if (++extractor->escape < 6)
+	{
+		return 0;
+	}
+
+	extractor->escape = 0;
+	if ((extractor->unicode >= 0xD800) && (extractor->unicode <= 0xDFFF))
+	{
+		/* surrogate halves are not combined, the manifest values are ASCII */
+		output[0] = '?';
+		*output_length = 1;
+	}
+	else if (extractor->unicode < 0x80)
+	{
+		output[0] = (unsigned char)extractor->unicode;
+		*output_length = 1;
+	}
+	else if (extractor->unicode < 0x800)
+	{
+		output[0] = (unsigned char)(0xC0 | (extractor->unicode >> 6));
+		output[1] = (unsigned char)(0x80 | (extractor->unicode & 0x3F));
+		*output_length = 2;
+	}
+	else
+	{
+		output[0] = (unsigned char)(0xE0 | (extractor->unicode >> 12));
+		output[1] = (unsigned char)(0x80 | ((extractor->unicode >> 6) & 0x3F));
+		output[2] = (unsigned char)(0x80 | (extractor->unicode & 0x3F));
+		*output_length = 3;
+	}
+	return 0;
+}
+
+static cJSON_Selector *find_selector(const cJSON_Extractor * const extractor)
+{
+	size_t i = 0;
+
+	if (extractor->key_length >= sizeof(extractor->key))
+	{
+		return NULL;
+	}
+	for (i = 0; i < extractor->selector_count; i++)
+	{
+		if ((strlen(extractor->selectors[i].key) == extractor->key_length) && (memcmp(extractor->selectors[i].key, extractor->key, extractor->key_length) == 0))
+		{
+			return &extractor->selectors[i];
+		}
+	}
+	return NULL;
+}
+
+/* a number or a literal ended, returns false when it is invalid */
+static cJSON_bool finish_scalar(cJSON_Extractor * const extractor)
+{
+	char *end = NULL;
+	double number = 0;
+	cJSON_Selector *selector = extractor->current;
+
+	if (extractor->scalar_length >= sizeof(extractor->scalar))
+	{
+		return false;
+	}
+	extractor->scalar[extractor->scalar_length] = '\0';
+
+	if ((strcmp(extractor->scalar, "true") == 0) || (strcmp(extractor->scalar, "false") == 0) || (strcmp(extractor->scalar, "null") == 0))
+	{
+		return true;
+	}
+
+	number = strtod(extractor->scalar, &end);
+	if ((end == extractor->scalar) || (*end != '\0'))
+	{
+		return false;
+	}
+
+	if ((selector != NULL) && (selector->type == cJSON_Number))
+	{
+		selector->valuedouble = number;
+		/* saturate like cJSON_SetNumberHelper */
+		if (number >= INT_MAX)
+		{
+			selector->valueint = INT_MAX;
+		}
+		else if (number <= INT_MIN)
+		{
+			selector->valueint = INT_MIN;
+		}
+		else
+		{
+			selector->valueint = (int)number;
+		}
+		selector->found = true;
+	}
+	return true;
+}
+
+CJSON_PUBLIC(cJSON_bool) cJSON_ExtractorFeed(cJSON_Extractor *extractor, const char *text, size_t length)
+{
+	const unsigned char *input = (const unsigned char*)text;
+	const unsigned char *end = input + length;
+	unsigned char decoded[3];
+	size_t decoded_length = 0;
+	int result = 0;
+
+	while (input < end)
+	{
+		unsigned char c = *input;
+
+		switch (extractor->state)
+		{
+			case extract_object_start:
+				if (c == '{')
+				{
+					extractor->state = extract_key_or_end;
+				}
+				else if (!is_json_whitespace(c))
+				{
+					extractor->state = extract_error;
+				}
+				break;
+
+			case extract_key_or_end:
+			case extract_next_key:
+				if (c == '\"')
+				{
+					extractor->key_length = 0;
+					extractor->state = extract_key;
+				}
+				else if ((c == '}') && (extractor->state == extract_key_or_end))
+				{
+					extractor->state = extract_done;
+				}
+				else if (!is_json_whitespace(c))
+				{
+					extractor->state = extract_error;
+				}
+				break;
+
+			case extract_key:
+				result = extract_string_char(extractor, c, decoded, &decoded_length);
+				if (result < 0)
+				{
+					extractor->state = extract_error;
+				}
+				else if (result > 0)
+				{
+					extractor->state = extract_colon;
+				}
+				else
+				{
+					/* a key longer than the buffer can not match a selector, its length still counts */
+					if (extractor->key_length + decoded_length <= sizeof(extractor->key))
+					{
+						memcpy(extractor->key + extractor->key_length, decoded, decoded_length);
+					}
+					extractor->key_length += decoded_length;
+				}
+				break;
+
+			case extract_colon:
+				if (c == ':')
+				{
+					extractor->current = find_selector(extractor);
+					extractor->state = extract_value;
+				}
+				else if (!is_json_whitespace(c))
+				{
+					extractor->state = extract_error;
+				}
+				break;
+
+			case extract_value:
+				if (is_json_whitespace(c))
+				{
+					break;
+				}
+				if (c == '\"')
+				{
+					extractor->value_length = 0;
+					extractor->state = extract_string_value;
+				}
+				else if ((c == '{') || (c == '['))
+				{
+					extractor->depth = 1;
+					extractor->in_string = false;
+					extractor->state = extract_skip_value;
+				}
+				else
+				{
+					extractor->scalar_length = 0;
+					extractor->state = extract_scalar_value;
+					continue; /* the first character of the scalar */
+				}
+				break;
+
+			case extract_string_value:
+			{
+				cJSON_Selector *selector = extractor->current;
+				cJSON_bool is_selected = (selector != NULL) && (selector->type == cJSON_String) && (selector->valuestring != NULL) && (selector->valuestring_size > 0);
+
+				result = extract_string_char(extractor, c, decoded, &decoded_length);
+				if (result < 0)
+				{
+					extractor->state = extract_error;
+				}
+				else if (result > 0)
+				{
+					if (is_selected)
+					{
+						selector->valuestring[extractor->value_length] = '\0';
+						selector->found = true;
+					}
+					extractor->state = extract_comma_or_end;
+				}
+				else if (is_selected)
+				{
+					if (extractor->value_length + decoded_length < selector->valuestring_size)
+					{
+						memcpy(selector->valuestring + extractor->value_length, decoded, decoded_length);
+						extractor->value_length += decoded_length;
+					}
+					else
+					{
+						selector->truncated = true;
+					}
+				}
+				break;
+			}
+
+			case extract_scalar_value:
+				if (is_json_whitespace(c) || (c == ',') || (c == '}'))
+				{
+					extractor->state = finish_scalar(extractor) ? extract_comma_or_end : extract_error;
+					continue; /* the delimiter belongs to the next state */
+				}
+				if (extractor->scalar_length < sizeof(extractor->scalar))
+				{
+					extractor->scalar[extractor->scalar_length] = (char)c;
+				}
+				extractor->scalar_length++;
+				break;
+
+			case extract_skip_value:
+				if (extractor->in_string)
+				{
+					if (extractor->escape)
+					{
+						extractor->escape = 0;
+					}
+					else if (c == '\\')
+					{
+						extractor->escape = 1;
+					}
+					else if (c == '\"')
+					{
+						extractor->in_string = false;
+					}
+				}
+				else if (c == '\"')
+				{
+					extractor->in_string = true;
+				}
+				else if ((c == '{') || (c == '['))
+				{
+					extractor->depth++;
+				}
+				else if (((c == '}') || (c == ']')) && (--extractor->depth == 0))
+				{
+					extractor->state = extract_comma_or_end;
+				}
+				break;
+
+			case extract_comma_or_end:
+				if (c == ',')
+				{
+					extractor->state = extract_next_key;
+				}
+				else if (c == '}')
+				{
+					extractor->state = extract_done;
+				}
+				else if (!is_json_whitespace(c))
+				{
+					extractor->state = extract_error;
+				}
+				break;
+
+			case extract_done:
+				if (!is_json_whitespace(c) && (c != '\0'))
+				{
+					extractor->state = extract_error;
+				}
+				break;
+
+			default:
+				return false;
+		}
+
+		if (extractor->state == extract_error)
+		{
+			return false;
+		}
+		input++;
+	}
+
+	return true;
+}
+
+CJSON_PUBLIC(cJSON_bool) cJSON_ExtractorIsComplete(const cJSON_Extractor *extractor)
+{
+	return extractor->state == extract_done;
+}
+
+CJSON_PUBLIC(cJSON_bool) cJSON_ExtractSelected(const char *text, size_t length, cJSON_Selector *selectors, size_t selector_count)
+{
+	cJSON_Extractor extractor;
+
+	cJSON_ExtractorInit(&extractor, selectors, selector_count);
+	return cJSON_ExtractorFeed(&extractor, text, length) && cJSON_ExtractorIsComplete(&extractor);
+}
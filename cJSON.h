@@ -142,6 +142,32 @@ extern "C"
 	/* If you supply a ptr in return_parse_end and parsing fails, then return_parse_end will contain a pointer to the error so will match cJSON_GetErrorPtr(). */
 	CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated);
 
+	/* Document arenas: cJSON_ParseInArena bump allocates the nodes and strings of a document from the arena's blocks
+	 * instead of one malloc per node and per string, and cJSON_ArenaReset releases the whole document at once and keeps
+	 * the blocks for the next one. The first block can be the caller's (aligned like a malloc result), further blocks
+	 * come from the cJSON_InitHooks malloc_fn and go back through free_fn in cJSON_ArenaFree.
+	 * The nodes of an arena document must not be passed to cJSON_Delete or to the functions that free or take over
+	 * items (cJSON_AddItemTo..., cJSON_Replace..., cJSON_Delete...). Read and print them, or cJSON_Duplicate what has
+	 * to outlive the reset. */
+#define CJSON_ARENA_BLOCK_SIZE 1024
+
+	typedef struct cJSON_Arena
+	{
+		void *first;
+		void *current;
+		size_t used; /* bytes used in the current block */
+		size_t block_size; /* the size of the blocks taken from malloc_fn */
+		cJSON_bool first_is_callers;
+	} cJSON_Arena;
+
+	/* block can be NULL, then every block comes from malloc_fn and size is their size (0 for CJSON_ARENA_BLOCK_SIZE) */
+	CJSON_PUBLIC(cJSON_bool) cJSON_ArenaInit(cJSON_Arena *arena, void *block, size_t size);
+	/* on failure the partial document is dropped from the arena, the documents parsed before stay valid */
+	CJSON_PUBLIC(cJSON *) cJSON_ParseInArena(cJSON_Arena *arena, const char *value);
+	/* invalidates every document of the arena */
+	CJSON_PUBLIC(void) cJSON_ArenaReset(cJSON_Arena *arena);
+	CJSON_PUBLIC(void) cJSON_ArenaFree(cJSON_Arena *arena);
+
 	/* Render a cJSON entity to text for transfer/storage. */
 	CJSON_PUBLIC(char *) cJSON_Print(const cJSON *item);
 	/* Render a cJSON entity to text for transfer/storage without any formatting. */
@@ -252,6 +278,50 @@ extern "C"
 	/* Macro for iterating over an array or object */
 #define cJSON_ArrayForEach(element, array) for(element = (array != NULL) ? (array)->child : NULL; element != NULL; element = element->next)
 
+	/* Selective extraction of members of the top level object, without a tree and without allocations.
+	 * Each selector names a member and the type it wants, cJSON_String or cJSON_Number. A string is unescaped into
+	 * the caller's valuestring buffer and truncated to fit it, other members and nested values are skipped.
+	 * The text can be passed in fragments of any size as it arrives, it does not have to be null terminated. */
+	typedef struct cJSON_Selector
+	{
+		const char *key;
+		int type;
+		char *valuestring;
+		size_t valuestring_size;
+		double valuedouble;
+		int valueint;
+		cJSON_bool found;
+		cJSON_bool truncated;
+	} cJSON_Selector;
+
+#define CJSON_EXTRACTOR_KEY_LENGTH 32
+#define CJSON_EXTRACTOR_SCALAR_LENGTH 32
+
+	typedef struct cJSON_Extractor
+	{
+		cJSON_Selector *selectors;
+		size_t selector_count;
+		int state;
+		int escape;
+		unsigned int unicode;
+		size_t depth;
+		cJSON_bool in_string;
+		cJSON_Selector *current;
+		size_t value_length;
+		char key[CJSON_EXTRACTOR_KEY_LENGTH];
+		size_t key_length;
+		char scalar[CJSON_EXTRACTOR_SCALAR_LENGTH];
+		size_t scalar_length;
+	} cJSON_Extractor;
+
+	CJSON_PUBLIC(void) cJSON_ExtractorInit(cJSON_Extractor *extractor, cJSON_Selector *selectors, size_t selector_count);
+	/* returns false on invalid JSON, the selectors found before the error keep their values */
+	CJSON_PUBLIC(cJSON_bool) cJSON_ExtractorFeed(cJSON_Extractor *extractor, const char *text, size_t length);
+	/* the closing brace of the top level object was read */
+	CJSON_PUBLIC(cJSON_bool) cJSON_ExtractorIsComplete(const cJSON_Extractor *extractor);
+	/* extract from a complete text in one call */
+	CJSON_PUBLIC(cJSON_bool) cJSON_ExtractSelected(const char *text, size_t length, cJSON_Selector *selectors, size_t selector_count);
+
 	/* malloc/free objects using the malloc/free functions that have been set with cJSON_InitHooks */
 	CJSON_PUBLIC(void *) cJSON_malloc(size_t size);
 	CJSON_PUBLIC(void) cJSON_free(void *object);
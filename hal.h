@@ -0,0 +1,41 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * The hardware the device loop uses: the ADC of the sensors, the status LEDs, the clock and the watchdog.
+	 * hal_esp32.c implements it with the ESP-IDF drivers, tools/host/hal_posix.c with simulated sensors on a Linux host.
+	 * The IoT Hub transport is hal_iothub.h. Flash, the OTA partitions and HTTP stay on the ESP-IDF esp_partition,
+	 * esp_ota_ops and esp_http_client interfaces, tools/host has their host implementations.
+	 */
+
+#define HAL_ADC_MAX 4095 //12 bit readings
+
+	//channel is an ADC1 channel number, the reading is attenuated for the full 0-3.9V range
+	void hal_adc_init(uint32_t channel);
+	uint32_t hal_adc_read(uint32_t channel);
+
+	void hal_gpio_init_output(uint32_t gpio, uint32_t level);
+	void hal_gpio_set(uint32_t gpio, uint32_t level);
+
+	//microseconds since boot
+	int64_t hal_time_us(void);
+	//busy waits, the task keeps the CPU
+	void hal_delay_us(uint32_t us);
+	//blocks the task, other tasks run
+	void hal_sleep_ms(uint32_t ms);
+	void hal_watchdog_feed(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HAL_H */
@@ -0,0 +1,55 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "driver/adc.h"
+#include "esp_timer.h"
+#include "esp_task_wdt.h"
+#include "rom/ets_sys.h"
+#include "hal.h"
+
+void hal_adc_init(uint32_t channel)
+{
+	adc1_config_width(ADC_WIDTH_BIT_12);
+	adc1_config_channel_atten((adc1_channel_t)channel, ADC_ATTEN_DB_11);
+}
+
+uint32_t hal_adc_read(uint32_t channel)
+{
+	return (uint32_t)adc1_get_raw((adc1_channel_t)channel);
+}
+
+void hal_gpio_init_output(uint32_t gpio, uint32_t level)
+{
+	gpio_pad_select_gpio(gpio);
+	/* Set the GPIO as a push/pull output */
+	gpio_set_level(gpio, level);
+	gpio_set_direction(gpio, GPIO_MODE_OUTPUT);
+}
+
+void hal_gpio_set(uint32_t gpio, uint32_t level)
+{
+	gpio_set_level(gpio, level);
+}
+
+int64_t hal_time_us(void)
+{
+	return esp_timer_get_time();
+}
+
+void hal_delay_us(uint32_t us)
+{
+	ets_delay_us(us);
+}
+
+void hal_sleep_ms(uint32_t ms)
+{
+	vTaskDelay(ms / portTICK_PERIOD_MS);
+}
+
+void hal_watchdog_feed(void)
+{
+	esp_task_wdt_reset();
+}
@@ -0,0 +1,66 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef HAL_IOTHUB_H
+#define HAL_IOTHUB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * The IoT Hub transport of the device loop, hal_iothub_esp32.c is the Azure IoT device SDK over MQTT and
+	 * tools/host/hal_iothub_posix.c a local hub for the host build.
+	 * Like the low level SDK the client does nothing by itself, every callback is called from hal_iothub_do_work,
+	 * the confirmations of the pending messages also from hal_iothub_destroy.
+	 * Every telemetry message gets its confirmation, with HAL_IOTHUB_CONFIRMATION_MESSAGE_TIMEOUT when no ack came
+	 * within HAL_IOTHUB_MESSAGE_TIMEOUT_MS of the send.
+	 */
+#define HAL_IOTHUB_MESSAGE_TIMEOUT_MS (5 * 60 * 1000)
+
+	//the values of IOTHUB_CLIENT_CONFIRMATION_RESULT, the trace records decode the same
+	typedef enum HAL_IOTHUB_CONFIRMATION_TAG
+	{
+		HAL_IOTHUB_CONFIRMATION_OK,
+		HAL_IOTHUB_CONFIRMATION_BECAUSE_DESTROY,
+		HAL_IOTHUB_CONFIRMATION_MESSAGE_TIMEOUT,
+		HAL_IOTHUB_CONFIRMATION_ERROR
+	} HAL_IOTHUB_CONFIRMATION;
+
+	typedef struct HAL_IOTHUB_CLIENT_TAG *HAL_IOTHUB_HANDLE;
+
+	//a cloud to device message, it is always accepted
+	typedef void (*HAL_IOTHUB_MESSAGE_CALLBACK)(const unsigned char *payload, size_t size, void *context);
+	//a direct method, *response is malloc'ed by the callback and freed by the transport. returns the status code
+	typedef int (*HAL_IOTHUB_METHOD_CALLBACK)(const char *methodName, const unsigned char *payload, size_t size, unsigned char **response, size_t *responseSize, void *context);
+	typedef void (*HAL_IOTHUB_CONNECTION_CALLBACK)(bool isConnected, int reason, void *context);
+	typedef void (*HAL_IOTHUB_CONFIRMATION_CALLBACK)(HAL_IOTHUB_CONFIRMATION result, void *context);
+	typedef void (*HAL_IOTHUB_REPORTED_STATE_CALLBACK)(int statusCode, void *context);
+
+	typedef struct HAL_IOTHUB_CALLBACKS_TAG
+	{
+		HAL_IOTHUB_MESSAGE_CALLBACK message;
+		HAL_IOTHUB_METHOD_CALLBACK method;
+		HAL_IOTHUB_CONNECTION_CALLBACK connection;
+		void *context;
+	} HAL_IOTHUB_CALLBACKS;
+
+	//the functions returning int return 0 on success
+	int hal_iothub_platform_init(void);
+	void hal_iothub_platform_deinit(void);
+	HAL_IOTHUB_HANDLE hal_iothub_create(const char *connectionString, const HAL_IOTHUB_CALLBACKS *callbacks);
+	//a telemetry message, the payload is copied. a non NULL messageType becomes the messageType application property.
+	//at most TELEMETRY_WINDOW + 1 messages wait for their confirmation, the in-flight window and the runtime statistics
+	int hal_iothub_send_event(HAL_IOTHUB_HANDLE handle, const char *payload, size_t size, const char *messageType, HAL_IOTHUB_CONFIRMATION_CALLBACK confirmation, void *context);
+	int hal_iothub_send_reported_state(HAL_IOTHUB_HANDLE handle, const char *json, size_t size, HAL_IOTHUB_REPORTED_STATE_CALLBACK confirmation, void *context);
+	void hal_iothub_do_work(HAL_IOTHUB_HANDLE handle);
+	void hal_iothub_destroy(HAL_IOTHUB_HANDLE handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HAL_IOTHUB_H */
@@ -0,0 +1,190 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include "esp_system.h"
+#include "esp_log.h"
+#include "iothub_client_ll.h"
+#include "iothub_message.h"
+#include "iothubtransportmqtt.h"
+#include "azure_c_shared_utility/platform.h"
+#include "azure_c_shared_utility/tickcounter.h"
+#include "hal_iothub.h"
+#include "telemetry.h"
+
+#define TAG "IoTHubTransport"
+
+struct HAL_IOTHUB_CLIENT_TAG
+{
+	IOTHUB_CLIENT_LL_HANDLE clientHandle;
+	HAL_IOTHUB_CALLBACKS callbacks;
+};
+
+//the SDK keeps the message until its confirmation, then it is destroyed here. NULL messageHandle for a free slot
+typedef struct PENDING_EVENT_TAG
+{
+	IOTHUB_MESSAGE_HANDLE messageHandle;
+	HAL_IOTHUB_CONFIRMATION_CALLBACK confirmation;
+	void *context;
+} PENDING_EVENT;
+
+//the in-flight window of the device loop and its runtime statistics message, no allocation per message
+#define MAX_PENDING_EVENTS (TELEMETRY_WINDOW + 1)
+
+static PENDING_EVENT g_pendingEvents[MAX_PENDING_EVENTS];
+
+static IOTHUBMESSAGE_DISPOSITION_RESULT receive_message_callback(IOTHUB_MESSAGE_HANDLE message, void *userContextCallback)
+{
+	HAL_IOTHUB_HANDLE handle = (HAL_IOTHUB_HANDLE)userContextCallback;
+	const unsigned char *buffer;
+	size_t size;
+
+	if (IoTHubMessage_GetByteArray(message, &buffer, &size) != IOTHUB_MESSAGE_OK)
+	{
+		ESP_LOGE(TAG, "unable to retrieve the message data");
+		return IOTHUBMESSAGE_ACCEPTED;
+	}
+
+	// Retrieve properties from the message
+	MAP_HANDLE mapProperties = IoTHubMessage_Properties(message);
+	const char *const *keys;
+	const char *const *values;
+	size_t propertyCount = 0;
+	if (mapProperties != NULL && Map_GetInternals(mapProperties, &keys, &values, &propertyCount) == MAP_OK)
+	{
+		for (size_t index = 0; index < propertyCount; index++)
+		{
+			ESP_LOGV(TAG, "\tKey: %s Value: %s", keys[index], values[index]);
+		}
+	}
+
+	handle->callbacks.message(buffer, size, handle->callbacks.context);
+	return IOTHUBMESSAGE_ACCEPTED;
+}
+
+static int device_method_callback(const char *method_name, const unsigned char *payload, size_t size, unsigned char **response, size_t *response_size, void *userContextCallback)
+{
+	HAL_IOTHUB_HANDLE handle = (HAL_IOTHUB_HANDLE)userContextCallback;
+	return handle->callbacks.method(method_name, payload, size, response, response_size, handle->callbacks.context);
+}
+
+static void connection_status_callback(IOTHUB_CLIENT_CONNECTION_STATUS result, IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason, void *userContextCallback)
+{
+	HAL_IOTHUB_HANDLE handle = (HAL_IOTHUB_HANDLE)userContextCallback;
+	handle->callbacks.connection(result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED, (int)reason, handle->callbacks.context);
+}
+
+static void send_confirmation_callback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *userContextCallback)
+{
+	PENDING_EVENT *event = (PENDING_EVENT *)userContextCallback;
+	IoTHubMessage_Destroy(event->messageHandle);
+	event->messageHandle = NULL;
+	event->confirmation((HAL_IOTHUB_CONFIRMATION)result, event->context);
+}
+
+int hal_iothub_platform_init(void)
+{
+	return platform_init();
+}
+
+void hal_iothub_platform_deinit(void)
+{
+	platform_deinit();
+}
+
+HAL_IOTHUB_HANDLE hal_iothub_create(const char *connectionString, const HAL_IOTHUB_CALLBACKS *callbacks)
+{
+	HAL_IOTHUB_HANDLE handle = (HAL_IOTHUB_HANDLE)malloc(sizeof(struct HAL_IOTHUB_CLIENT_TAG));
+	if (handle == NULL)
+		return NULL;
+	handle->callbacks = *callbacks;
+
+	ESP_LOGI(TAG, "size before IoTHubClient_LL_CreateFromConnectionString: %d", esp_get_free_heap_size());
+	if ((handle->clientHandle = IoTHubClient_LL_CreateFromConnectionString(connectionString, MQTT_Protocol)) == NULL)
+	{
+		ESP_LOGE(TAG, "ERROR: iotHubClientHandle is NULL!");
+		free(handle);
+		return NULL;
+	}
+
+	bool traceOn = true;
+	IoTHubClient_LL_SetOption(handle->clientHandle, "logtrace", &traceOn);
+
+	//without a timeout a message whose ack was lost stays pending until the client is destroyed
+	tickcounter_ms_t messageTimeout = HAL_IOTHUB_MESSAGE_TIMEOUT_MS;
+	if (IoTHubClient_LL_SetOption(handle->clientHandle, "messageTimeout", &messageTimeout) != IOTHUB_CLIENT_OK)
+	{
+		ESP_LOGE(TAG, "ERROR: IoTHubClient_LL_SetOption messageTimeout..........FAILED!");
+	}
+
+	/* Setting Message call back, so we can receive Commands. */
+	if (IoTHubClient_LL_SetMessageCallback(handle->clientHandle, receive_message_callback, handle) != IOTHUB_CLIENT_OK)
+	{
+		ESP_LOGE(TAG, "ERROR: IoTHubClient_LL_SetMessageCallback..........FAILED!");
+		IoTHubClient_LL_Destroy(handle->clientHandle);
+		free(handle);
+		return NULL;
+	}
+
+	if (IoTHubClient_LL_SetDeviceMethodCallback(handle->clientHandle, device_method_callback, handle) != IOTHUB_CLIENT_OK)
+	{
+		ESP_LOGE(TAG, "ERROR: IoTHubClient_LL_SetDeviceMethodCallback..........FAILED!");
+	}
+
+	if (IoTHubClient_LL_SetConnectionStatusCallback(handle->clientHandle, connection_status_callback, handle) != IOTHUB_CLIENT_OK)
+	{
+		ESP_LOGE(TAG, "ERROR: IoTHubClient_LL_SetConnectionStatusCallback..........FAILED!");
+	}
+	return handle;
+}
+
+int hal_iothub_send_event(HAL_IOTHUB_HANDLE handle, const char *payload, size_t size, const char *messageType, HAL_IOTHUB_CONFIRMATION_CALLBACK confirmation, void *context)
+{
+	PENDING_EVENT *event = NULL;
+	for (size_t i = 0; i < MAX_PENDING_EVENTS && event == NULL; i++)
+	{
+		if (g_pendingEvents[i].messageHandle == NULL)
+			event = &g_pendingEvents[i];
+	}
+	if (event == NULL)
+	{
+		ESP_LOGE(TAG, "ERROR: all %d message slots are pending", MAX_PENDING_EVENTS);
+		return -1;
+	}
+
+	ESP_LOGV(TAG, "size before IoTHubMessage_CreateFromByteArray: %d", esp_get_free_heap_size());
+	if ((event->messageHandle = IoTHubMessage_CreateFromByteArray((const unsigned char *)payload, size)) == NULL)
+	{
+		ESP_LOGE(TAG, "ERROR: iotHubMessageHandle is NULL!");
+		return -1;
+	}
+	if (messageType != NULL)
+		Map_AddOrUpdate(IoTHubMessage_Properties(event->messageHandle), "messageType", messageType);
+	event->confirmation = confirmation;
+	event->context = context;
+
+	if (IoTHubClient_LL_SendEventAsync(handle->clientHandle, event->messageHandle, send_confirmation_callback, event) != IOTHUB_CLIENT_OK)
+	{
+		ESP_LOGE(TAG, "ERROR: IoTHubClient_LL_SendEventAsync..........FAILED!");
+		IoTHubMessage_Destroy(event->messageHandle);
+		event->messageHandle = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+int hal_iothub_send_reported_state(HAL_IOTHUB_HANDLE handle, const char *json, size_t size, HAL_IOTHUB_REPORTED_STATE_CALLBACK confirmation, void *context)
+{
+	return IoTHubClient_LL_SendReportedState(handle->clientHandle, (const unsigned char *)json, size, confirmation, context) == IOTHUB_CLIENT_OK ? 0 : -1;
+}
+
+void hal_iothub_do_work(HAL_IOTHUB_HANDLE handle)
+{
+	IoTHubClient_LL_DoWork(handle->clientHandle);
+}
+
+void hal_iothub_destroy(HAL_IOTHUB_HANDLE handle)
+{
+	IoTHubClient_LL_Destroy(handle->clientHandle); //completes the pending messages with IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY
+	free(handle);
+}
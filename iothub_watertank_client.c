@@ -5,69 +5,78 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 #include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "freertos/portmacro.h"
-#include "freertos/queue.h"
 #include "esp_log.h"
-#include "driver/gpio.h"
-#include "driver/adc.h"
 #include "esp_system.h"
-#include "esp_adc_cal.h"
-#include "esp_task_wdt.h"
 #include "iothub_watertank_client.h"
-#include "iothub_message.h"
-#include "azure_c_shared_utility/threadapi.h"
-#include "azure_c_shared_utility/crt_abstractions.h"
-#include "azure_c_shared_utility/platform.h"
-#include "iothubtransportmqtt.h"
-#include "sdkconfig.h"
+#include "hal.h"
+#include "hal_iothub.h"
 #include "Common.h"
+#include "trace_log.h"
+#include "runtime_stats.h"
+#include "send_rate.h"
+#include "telemetry.h"
+#include "ota_scheduler.h"
+#include "ota_probation.h"
+#include "base64_stream.h"
+#include "cJSON.h"
 
 //#define TESTDEVICE
 
 #define V_REF   1100
 
+#define TEMPERATURE1_ADC_CHANNEL 5 //ADC1_CHANNEL_5, GPIO 33
+#define TEMPERATURE2_ADC_CHANNEL 6 //ADC1_CHANNEL_6, GPIO 34
+#define CURRENT_ADC_CHANNEL 7 //ADC1_CHANNEL_7, GPIO 35
+
 #define TAG "IoTHubDevice"
 
 #ifdef TESTDEVICE
 //test device
 static const char *connectionString = "HostName=...;DeviceId=...;SharedAccessKey=...";
+static const char deviceId[] = "testdevice";
 #else
 //real device
 static const char *connectionString = "HostName=...;DeviceId=...;SharedAccessKey=...";
+static const char deviceId[] = "watertank";
 #endif
 
 static int activeMessages;
-static char msgText[1024];
+static char msgText[TELEMETRY_MESSAGE_SIZE(sizeof(deviceId))];
 static char propText[1024];
+static char statsText[1024];
 static bool g_continueRunning;
 static bool g_shouldUpdateSoftware = false;
 static bool g_shouldSwitchToPreviousPartition = false;
 static bool g_shouldReboot = false;
+static int64_t g_lastConfirmationTime;
+static bool g_connected = false;
 
-#define MESSAGE_COUNT 128
+#define MESSAGE_COUNT TELEMETRY_WINDOW
+#define DEAD_CLIENT_TIMEOUT_US (10 * 60 * 1000000LL) //10 minutes without any ack
+//the transport confirms every message within HAL_IOTHUB_MESSAGE_TIMEOUT_MS, an older message is released anyway
+#define MESSAGE_EXPIRY_US (2LL * HAL_IOTHUB_MESSAGE_TIMEOUT_MS * 1000)
+#define MAX_RECONNECT_FAILURES 10
+#define RECONNECT_DELAY_MS 5000
 
 const char *SofwareUpdateMessage = "TriggerSoftwareUpdate";
 const char *SwitchToPreviousPartitionMessage = "SwitchToPreviousPartition";
 const char *RebootMessage = "Reboot";
 const char *QuitMessage = "Quit";
+const char *DumpTraceMethod = "DumpTrace";
+const char *SetOtaLimitsMethod = "SetOtaLimits";
 
 
 typedef struct EVENT_INSTANCE_TAG
 {
-    IOTHUB_MESSAGE_HANDLE messageHandle;
+    bool isInFlight;
+    bool isExpired; // released without a confirmation, the slot is reused after the late one
     size_t messageTrackingId;  // For tracking the messages within the user callback.
+    int64_t sendTime;
+    uint32_t telemetryWindow; // the download window the message opened, 0 for none
 } EVENT_INSTANCE;
 
-static unsigned char* bytearray_to_str(const unsigned char *buffer, size_t len)
-{
-    unsigned char* ret = (unsigned char*)malloc(len+1);
-    memcpy(ret, buffer, len);
-    ret[len] = '\0';
-    return ret;
-}
-
 static void update_software()
 {
 	if (get_current_update_offset() > 0) //software update in progress, ignore request
@@ -76,106 +85,229 @@ static void update_software()
 		return;
 	}	
 	
-	ESP_LOGI(TAG, "Starting software update task.");
+	ESP_LOGI(TAG, "Starting software update check.");
 
 	g_shouldUpdateSoftware = false;
 
-	BaseType_t ret = xTaskCreate(&ota_task, "ota_task", 8192, NULL, 5, NULL);
-
-	if (ret != pdPASS)
-	{
-		ESP_LOGE(TAG, "unable to create update task");
-	}
+	//the periodic OTA task checks right away
+	ota_trigger_check();
 }
 
-static IOTHUBMESSAGE_DISPOSITION_RESULT receive_message_callback(IOTHUB_MESSAGE_HANDLE message, void* userContextCallback)
+static void receive_message_callback(const unsigned char *payload, size_t size, void* userContextCallback)
 {
-
     int* counter = (int*)userContextCallback;
-    const char* buffer;
-    size_t size;
+    const char* buffer = (const char *)payload;
 
-    if (IoTHubMessage_GetByteArray(message, (const unsigned char**)&buffer, &size) != IOTHUB_MESSAGE_OK)
+	ESP_LOGI(TAG, "received message: \"%.*s\"", (int)size, buffer);
+
+	if (size == (strlen(SofwareUpdateMessage) * sizeof(char)) && memcmp(buffer, SofwareUpdateMessage, size) == 0)
+	{
+		g_shouldUpdateSoftware = true;
+	}
+
+    // If we receive the word 'quit' then we stop running
+    if (size == (strlen(QuitMessage) * sizeof(char)) && memcmp(buffer, QuitMessage, size) == 0)
     {
-		ESP_LOGE(TAG, "unable to retrieve the message data");
+        g_continueRunning = false;
     }
-    else
-    {
-        unsigned char* message_string = bytearray_to_str((const unsigned char *)buffer, size);
-		ESP_LOGI(TAG, "IoTHubMessage_GetByteArray received message: \"%s\"", message_string);
 
-		if (size == (strlen(SofwareUpdateMessage) * sizeof(char)) && memcmp(buffer, SofwareUpdateMessage, size) == 0)
-		{
-			g_shouldUpdateSoftware = true;
-		}
+	if (size == (strlen(SwitchToPreviousPartitionMessage) * sizeof(char)) && memcmp(buffer, SwitchToPreviousPartitionMessage, size) == 0)
+	{
+		g_shouldSwitchToPreviousPartition = true;
+	}
 
-        free(message_string);
+	if (size == (strlen(RebootMessage) * sizeof(char)) && memcmp(buffer, RebootMessage, size) == 0)
+	{
+		g_shouldReboot = true;
+	}
 
-        // If we receive the word 'quit' then we stop running
-        if (size == (strlen(QuitMessage) * sizeof(char)) && memcmp(buffer, QuitMessage, size) == 0)
-        {
-            g_continueRunning = false;
-        }
+    /* Some device specific action code goes here... */
+    (*counter)++;
+}
 
-		if (size == (strlen(SwitchToPreviousPartitionMessage) * sizeof(char)) && memcmp(buffer, SwitchToPreviousPartitionMessage, size) == 0)
-		{
-			g_shouldSwitchToPreviousPartition = true;
-		}
+static void release_message(EVENT_INSTANCE *eventInstance)
+{
+    activeMessages--;
+    ota_scheduler_telemetry_end(eventInstance->telemetryWindow);
+    eventInstance->isInFlight = false;
+}
 
-		if (size == (strlen(RebootMessage) * sizeof(char)) && memcmp(buffer, RebootMessage, size) == 0)
-		{
-			g_shouldReboot = true;
-		}
-    } 
+static void send_confirmation_callback(HAL_IOTHUB_CONFIRMATION result, void* userContextCallback)
+{
+    EVENT_INSTANCE* eventInstance = (EVENT_INSTANCE*)userContextCallback;
+    size_t id = eventInstance->messageTrackingId;
 
-    // Retrieve properties from the message
-    MAP_HANDLE mapProperties = IoTHubMessage_Properties(message);
-    if (mapProperties != NULL)
+	TRACE_LOG(TRACE_SEND_CONFIRMATION, id, result, activeMessages);
+
+	if (!eventInstance->isInFlight) //the late confirmation of an expired message, it no longer counts
+	{
+		eventInstance->isExpired = false;
+		return;
+	}
+    if (result == HAL_IOTHUB_CONFIRMATION_OK)
     {
-        const char*const* keys;
-        const char*const* values;
-        size_t propertyCount = 0;
-        if (Map_GetInternals(mapProperties, &keys, &values, &propertyCount) == MAP_OK)
-        {
-            if (propertyCount > 0)
-            {
-                size_t index = 0;
-                for (index = 0; index < propertyCount; index++)
-                {
-					ESP_LOGV(TAG, "\tKey: %s Value: %s", keys[index], values[index]);
-                }
-            }
-        }
+        g_lastConfirmationTime = hal_time_us();
+        ota_probation_ack(g_lastConfirmationTime - eventInstance->sendTime);
     }
+    release_message(eventInstance);
+}
 
-    /* Some device specific action code goes here... */
-    (*counter)++;
-    return IOTHUBMESSAGE_ACCEPTED;
+//a message the transport did not confirm in time stops counting against the in-flight window,
+//its slot stays taken until the confirmation comes so a late one can not complete a newer message
+static void expire_message(EVENT_INSTANCE *eventInstance, int64_t now)
+{
+	if (!eventInstance->isInFlight || now - eventInstance->sendTime < MESSAGE_EXPIRY_US)
+		return;
+	TRACE_LOG(TRACE_SEND_EXPIRED, eventInstance->messageTrackingId, (now - eventInstance->sendTime) / 1000000, activeMessages);
+	eventInstance->isExpired = true;
+	release_message(eventInstance);
 }
 
-static void send_confirmation_callback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void* userContextCallback)
+//-1 when every slot is in flight or waits for a late confirmation
+static int find_free_message(const EVENT_INSTANCE *messages)
 {
-    EVENT_INSTANCE* eventInstance = (EVENT_INSTANCE*)userContextCallback;
-    size_t id = eventInstance->messageTrackingId;
+	for (int i = 0; i < MESSAGE_COUNT; i++)
+	{
+		if (!messages[i].isInFlight && !messages[i].isExpired)
+			return i;
+	}
+	return -1;
+}
+
+static void connection_status_callback(bool isConnected, int reason, void* userContextCallback)
+{
+	g_connected = isConnected;
+	if (g_connected)
+		ota_probation_connected();
+	ESP_LOGI(TAG, "Connection status: %s, reason: %d", g_connected ? "authenticated" : "unauthenticated", (int)reason);
+}
 
-	ESP_LOGI(TAG, "Confirmation received for message tracking id = %d with result = %s,  current active messages: %u", (int)id, ENUM_TO_STRING(IOTHUB_CLIENT_CONFIRMATION_RESULT, result), activeMessages);
+static EVENT_INSTANCE g_statsMessage = { false, false, MESSAGE_COUNT, 0, 0 };
 
-    activeMessages--;
-    IoTHubMessage_Destroy(eventInstance->messageHandle);
+//send the CPU load, stack and heap statistics as a telemetry message with messageType=runtimeStats property, one message in flight at most.
+//a lost confirmation does not stop the statistics, the message times out like the telemetry (see expire_message)
+static void send_runtime_stats(HAL_IOTHUB_HANDLE iotHubClientHandle)
+{
+	if (g_statsMessage.isInFlight || g_statsMessage.isExpired)
+		return;
+
+	if (runtime_stats_format(statsText, sizeof(statsText), deviceId) < 0)
+	{
+		ESP_LOGE(TAG, "ERROR: runtime statistics do not fit the message buffer");
+		return;
+	}
+
+	g_statsMessage.sendTime = hal_time_us();
+	if (hal_iothub_send_event(iotHubClientHandle, statsText, strlen(statsText), "runtimeStats", send_confirmation_callback, &g_statsMessage) != 0)
+	{
+		ESP_LOGE(TAG, "ERROR: sending the runtime statistics..........FAILED!");
+		return;
+	}
+	g_statsMessage.isInFlight = true;
+	activeMessages++;
 }
 
 static void send_report_confirmation_callback(int status_code, void* userContextCallback)
 {
-	ESP_LOGI(TAG, "Confirmation received for status %d", status_code);
+	TRACE_LOG(TRACE_REPORT_CONFIRMATION, status_code);
 }
 
-void do_work(size_t time, IOTHUB_CLIENT_LL_HANDLE iotHubClientHandle)
+//the response of a direct method is freed by the SDK
+static int method_response(const char *json, int status, unsigned char **response, size_t *response_size)
+{
+	*response_size = strlen(json);
+	*response = (unsigned char *)malloc(*response_size);
+	if (*response == NULL)
+		return 500;
+	memcpy(*response, json, *response_size);
+	return status;
+}
+
+//a missing field keeps the value
+static bool read_limit(const cJSON *root, const char *name, uint32_t *value)
+{
+	const cJSON *item = cJSON_GetObjectItem(root, name);
+	if (item == NULL)
+		return true;
+	if (!cJSON_IsNumber(item) || item->valuedouble < 0 || item->valuedouble > UINT32_MAX)
+		return false;
+	*value = (uint32_t)item->valuedouble;
+	return true;
+}
+
+//direct method "SetOtaLimits": {"rateLimit":bytes per second or 0 for none,"heapReserve":bytes} replaces the limits of the
+//download scheduler until the next boot, returns the limits in effect
+static int set_ota_limits(const unsigned char *payload, size_t size, unsigned char **response, size_t *response_size)
+{
+	uint32_t rateLimit, heapReserve;
+	ota_scheduler_get_limits(&rateLimit, &heapReserve);
+
+	char text[128];
+	cJSON *root = NULL;
+	if (size < sizeof(text))
+	{
+		memcpy(text, payload, size);
+		text[size] = '\0';
+		root = cJSON_Parse(text);
+	}
+	bool isValid = cJSON_IsObject(root) && read_limit(root, "rateLimit", &rateLimit) && read_limit(root, "heapReserve", &heapReserve);
+	cJSON_Delete(root);
+	if (!isValid)
+		return method_response("{\"error\":\"rateLimit and heapReserve have to be unsigned 32 bit numbers\"}", 400, response, response_size);
+
+	ota_scheduler_set_limits(rateLimit, heapReserve);
+	char json[64];
+	snprintf(json, sizeof(json), "{\"rateLimit\":%u,\"heapReserve\":%u}", rateLimit, heapReserve);
+	return method_response(json, 200, response, response_size);
+}
+
+//direct method "DumpTrace": returns the trace ring buffer as base64 of TRACE_RECORD array, decode it with tools/trace_decode
+static int device_method_callback(const char* method_name, const unsigned char* payload, size_t size, unsigned char** response, size_t* response_size, void* userContextCallback)
+{
+	if (strcmp(method_name, SetOtaLimitsMethod) == 0)
+		return set_ota_limits(payload, size, response, response_size);
+	if (strcmp(method_name, DumpTraceMethod) != 0)
+		return method_response("{\"error\":\"unknown method\"}", 404, response, response_size);
+
+	TRACE_RECORD *records = (TRACE_RECORD *)malloc(sizeof(TRACE_RECORD) * TRACE_LOG_CAPACITY);
+	if (records == NULL)
+	{
+		ESP_LOGE(TAG, "unable to allocate trace dump buffer");
+		*response = NULL;
+		*response_size = 0;
+		return 500;
+	}
+
+	size_t count = trace_log_snapshot(records, TRACE_LOG_CAPACITY);
+	const char *format = "{\"written\":%u,\"recordSize\":%u,\"records\":\"";
+	size_t capacity = 64 + BASE64_ENCODED_SIZE(count * sizeof(TRACE_RECORD));
+	char *json = (char *)malloc(capacity);
+	if (json == NULL)
+	{
+		free(records);
+		*response = NULL;
+		*response_size = 0;
+		return 500;
+	}
+
+	size_t length = (size_t)snprintf(json, capacity, format, trace_log_written(), (unsigned int)sizeof(TRACE_RECORD));
+	length += base64_encode((const unsigned char *)records, count * sizeof(TRACE_RECORD), json + length);
+	free(records);
+	json[length++] = '"';
+	json[length++] = '}';
+
+	*response = (unsigned char *)json;
+	*response_size = length;
+	return 200;
+}
+
+void do_work(size_t time, HAL_IOTHUB_HANDLE iotHubClientHandle)
 {
      size_t index = 0;
     for (index = 0; index <time; index++)
     {
-        IoTHubClient_LL_DoWork(iotHubClientHandle);
-        ThreadAPI_Sleep(1);
+        hal_iothub_do_work(iotHubClientHandle);
+        hal_sleep_ms(1);
     }
 }
 
@@ -183,38 +315,30 @@ void blink_led(uint32_t gpio, int times)
 {
     while (times-- > 0)
     {
-        gpio_set_level(gpio, LED_LIGHT_ON);
-        vTaskDelay(200 / portTICK_PERIOD_MS);
+        hal_gpio_set(gpio, LED_LIGHT_ON);
+        hal_sleep_ms(200);
         /* Blink on (output high) */
-        gpio_set_level(gpio, 1 - LED_LIGHT_ON);
-        vTaskDelay(200 / portTICK_PERIOD_MS);
+        hal_gpio_set(gpio, 1 - LED_LIGHT_ON);
+        hal_sleep_ms(200);
     }
 }
 
 void blink_led_fast(uint32_t gpio)
 {
-    gpio_set_level(gpio, LED_LIGHT_ON);
-    vTaskDelay(10 / portTICK_PERIOD_MS);
-    gpio_set_level(gpio, 1 - LED_LIGHT_ON);
+    hal_gpio_set(gpio, LED_LIGHT_ON);
+    hal_sleep_ms(10);
+    hal_gpio_set(gpio, 1 - LED_LIGHT_ON);
 }
 
 void init_status_led(uint32_t gpio)
 {
-    gpio_pad_select_gpio(gpio);
-    /* Set the GPIO as a push/pull output */
-    gpio_set_level(gpio, 1 - LED_LIGHT_ON);
-    gpio_set_direction(gpio, GPIO_MODE_OUTPUT);
+    hal_gpio_init_output(gpio, 1 - LED_LIGHT_ON);
     blink_led(gpio, 5);
 }
-void init_adc(adc1_channel_t channel)
-{
-    adc1_config_width(ADC_WIDTH_BIT_12);
-    adc1_config_channel_atten(channel, ADC_ATTEN_DB_11);
-}
 
-uint32_t read_adc(adc1_channel_t channel, uint32_t previousRead, double lastReadWeight, bool bHistory)
+uint32_t read_adc(uint32_t channel, uint32_t previousRead, double lastReadWeight, bool bHistory)
 {
-    uint32_t voltage = adc1_get_raw(channel);
+    uint32_t voltage = hal_adc_read(channel);
 
     if (!bHistory)
         return voltage;
@@ -248,48 +372,82 @@ long double TotalEnergy(long double avarage)
 }
 
 
-uint32_t read_ac(adc1_channel_t channel)
+uint32_t read_ac(uint32_t channel)
 {
-    int64_t cycleBegin = esp_timer_get_time();
+    int64_t cycleBegin = hal_time_us();
 
     for (int i = 0; i < SAMPLE_LENGTH; ++i)
     {
-        int64_t readBegin = esp_timer_get_time();
-        double reading = adc1_get_raw(channel);
+        int64_t readBegin = hal_time_us();
+        double reading = hal_adc_read(channel);
         samples[i] = reading;
-        esp_task_wdt_reset();
-        while (esp_timer_get_time() - readBegin < 99) // (2000 * 100E-6)= 1 second ==> 10 cycles of 50HZ
-            ;
+        hal_watchdog_feed();
+        int64_t readTime = hal_time_us() - readBegin;
+        if (readTime < 99) // (2000 * 100E-6)= 1 second ==> 10 cycles of 50HZ
+            hal_delay_us((uint32_t)(99 - readTime));
     }
 
-    int64_t totalTime = esp_timer_get_time() - cycleBegin;
+    int64_t totalTime = hal_time_us() - cycleBegin;
 
     long double avarage = SampleAvarage();
     long double totalEnergy = TotalEnergy(avarage);
 
     uint32_t result = (uint32_t)sqrt(totalEnergy);
-    ESP_LOGI(TAG, "read_ac: Result %u,  time:%ju\n", result, totalTime);
+    TRACE_LOG(TRACE_READ_AC, result, totalTime);
     
     return result;
 }
 
+//create the IoT Hub client and register all the callbacks, returns NULL on failure
+static HAL_IOTHUB_HANDLE create_iothub_client(int *receiveContext)
+{
+	HAL_IOTHUB_HANDLE iotHubClientHandle;
+	HAL_IOTHUB_CALLBACKS callbacks = { receive_message_callback, device_method_callback, connection_status_callback, receiveContext };
+
+	ESP_LOGI(TAG, "size before hal_iothub_create: %d", esp_get_free_heap_size());
+	if ((iotHubClientHandle = hal_iothub_create(connectionString, &callbacks)) == NULL)
+	{
+		ESP_LOGE(TAG, "ERROR: iotHubClientHandle is NULL!");
+		blink_led(ERROR_STATUS_LED, 50);
+		return NULL;
+	}
+
+	g_lastConfirmationTime = hal_time_us();
+	return iotHubClientHandle;
+}
+
+//a client is dead when it is disconnected, or its in-flight window is full, and nothing was acknowledged for DEAD_CLIENT_TIMEOUT_US
+static bool is_client_dead()
+{
+	if (activeMessages == 0 || hal_time_us() - g_lastConfirmationTime <= DEAD_CLIENT_TIMEOUT_US)
+		return false;
+	return !g_connected || activeMessages >= MESSAGE_COUNT;
+}
+
 void iothub_client_run(void)
 {
 	ESP_LOGI(TAG, "\nFile:%s Compile Time:%s %s", __FILE__, __DATE__, __TIME__);
    // esp_task_wdt_init(5000, false); //5 seconds, dont panic
 
 	//Init ADC and Characteristics
-	init_adc(ADC1_CHANNEL_5); //GPIO 33
-	init_adc(ADC1_CHANNEL_6); //GPIO 34
-	init_adc(ADC1_CHANNEL_7); //GPIO 35
+	hal_adc_init(TEMPERATURE1_ADC_CHANNEL);
+	hal_adc_init(TEMPERATURE2_ADC_CHANNEL);
+	hal_adc_init(CURRENT_ADC_CHANNEL);
 	init_status_led(OK_STATUS_LED);
 	init_status_led(ERROR_STATUS_LED);
 	uint32_t voltage5 = 0, voltage6 = 0, voltage7 = 0;
     bool bInitialized = false;
+	int statsCycle = 0;
+	int reconnectFailures = 0;
+	SEND_RATE_CONTROLLER sendRate;
+
+	runtime_stats_init();
+	send_rate_init(&sendRate);
 
-	IOTHUB_CLIENT_LL_HANDLE iotHubClientHandle;
+	HAL_IOTHUB_HANDLE iotHubClientHandle;
 
 	EVENT_INSTANCE messages[MESSAGE_COUNT];
+	memset(messages, 0, sizeof(messages));
 
 	g_continueRunning = true;
 	srand((unsigned int)time(NULL));
@@ -297,7 +455,7 @@ void iothub_client_run(void)
 	activeMessages = 0;
 	int receiveContext = 0;
 	ESP_LOGI(TAG, "Connected to access point success, size before platform_init: %d", esp_get_free_heap_size());
-	if (platform_init() != 0)
+	if (hal_iothub_platform_init() != 0)
 	{
 		ESP_LOGE(TAG, "Failed to initialize the platform.");
 		blink_led(ERROR_STATUS_LED, 100);
@@ -305,104 +463,104 @@ void iothub_client_run(void)
 		return;
 	}
 
-
-	ESP_LOGI(TAG, "size before IoTHubClient_LL_CreateFromConnectionString: %d", esp_get_free_heap_size());
-	if ((iotHubClientHandle = IoTHubClient_LL_CreateFromConnectionString(connectionString, MQTT_Protocol)) == NULL)
-	{
-		ESP_LOGE(TAG, "ERROR: iotHubClientHandle is NULL!");
-		blink_led(ERROR_STATUS_LED, 50);
-		esp_restart();
-		return;
-	}
-
-	bool traceOn = true;
-	ESP_LOGI(TAG, "size before IoTHubClient_LL_SetOption: %d", esp_get_free_heap_size());
-	IoTHubClient_LL_SetOption(iotHubClientHandle, "logtrace", &traceOn);
-
-	/* Setting Message call back, so we can receive Commands. */
-	ESP_LOGI(TAG, "size before IoTHubClient_LL_SetMessageCallback: %d", esp_get_free_heap_size());
-	if (IoTHubClient_LL_SetMessageCallback(iotHubClientHandle, receive_message_callback, &receiveContext) != IOTHUB_CLIENT_OK)
+	if ((iotHubClientHandle = create_iothub_client(&receiveContext)) == NULL)
 	{
-		ESP_LOGE(TAG, "ERROR: IoTHubClient_LL_SetMessageCallback..........FAILED!");
-		blink_led(ERROR_STATUS_LED, 25);
 		esp_restart();
 		return;
 	}
 
-	ESP_LOGI(TAG, "IoTHubClient_LL_SetMessageCallback...successful.");
-
 	/* Now that we are ready to receive commands, let's send some messages */
-	size_t msgIndex = 0;
 	blink_led(OK_STATUS_LED, 3);
 
 	while (g_continueRunning) //the main device loop, until a "quit" command is received
 	{
+		ota_probation_loop(); //a new firmware is measured against the previous one
         for (int i = 0; i < 10; ++i) //take 10 samples, each sample has 0.1 ratio effect on the result
         {
-            voltage5 = read_adc(ADC1_CHANNEL_5, voltage5, 0.1, bInitialized);
-            voltage6 = read_adc(ADC1_CHANNEL_6, voltage6, 0.1, bInitialized);
+            voltage5 = read_adc(TEMPERATURE1_ADC_CHANNEL, voltage5, 0.1, bInitialized);
+            voltage6 = read_adc(TEMPERATURE2_ADC_CHANNEL, voltage6, 0.1, bInitialized);
             bInitialized = true;
-			ets_delay_us(10000); //delay 10 milisecond
+			hal_delay_us(10000); //delay 10 milisecond
 
         }
-        voltage7 = read_ac(ADC1_CHANNEL_7);
+        voltage7 = read_ac(CURRENT_ADC_CHANNEL);
 
-		ESP_LOGI(TAG, "5) %d mV\t6) %d mV\t7) %d mV", voltage5, voltage6, voltage7);
+		TRACE_LOG(TRACE_ADC_READING, voltage5, voltage6, voltage7);
 
-		esp_task_wdt_reset(); //make sure the watchdog is satisfied
+		hal_watchdog_feed(); //make sure the watchdog is satisfied
 
-#ifdef TESTDEVICE
-		sprintf_s(msgText, sizeof(msgText), "{\"deviceId\":\"testdevice\",\"watertemperature1\":%d,\"watertemperature2\":%d,\"current\":%d}", voltage5, voltage6, voltage7);
-#else
-		sprintf_s(msgText, sizeof(msgText), "{\"deviceId\":\"watertank\",\"watertemperature1\":%d,\"watertemperature2\":%d,\"current\":%d}", voltage5, voltage6, voltage7);
-#endif
-
-		ESP_LOGI(TAG, "Ready to Send String:%s", msgText);
-		ESP_LOGV(TAG, "size before IoTHubMessage_CreateFromByteArray: %d", esp_get_free_heap_size());
-		if ((messages[msgIndex].messageHandle = IoTHubMessage_CreateFromByteArray((const unsigned char*)msgText, strlen(msgText))) == NULL)
+		uint32_t readings[SEND_RATE_CHANNELS] = { voltage5, voltage6, voltage7 };
+		uint32_t averages[SEND_RATE_CHANNELS];
+		int msgIndex = find_free_message(messages);
+		//without a free slot the readings are aggregated like with a full window
+		int msgLength = telemetry_add_readings(&sendRate, readings, msgIndex >= 0 ? activeMessages : MESSAGE_COUNT, deviceId, msgText, sizeof(msgText), averages);
+		if (msgLength < 0)
+			ESP_LOGE(TAG, "ERROR: telemetry message does not fit the message buffer, the averaged readings are lost");
+		else if (msgLength > 0)
 		{
-			ESP_LOGE(TAG, "ERROR: iotHubMessageHandle is NULL!");
-			blink_led(ERROR_STATUS_LED, 8);
-			continue;
+			TRACE_LOG(TRACE_READY_TO_SEND, averages[0], averages[1], averages[2]);
+			messages[msgIndex].messageTrackingId = msgIndex;
+			messages[msgIndex].sendTime = hal_time_us();
+			messages[msgIndex].telemetryWindow = ota_scheduler_telemetry_begin(); //a running firmware download pauses until the message is acknowledged
+			ESP_LOGV(TAG, "free heap size before hal_iothub_send_event: %d", esp_get_free_heap_size());
+			if (hal_iothub_send_event(iotHubClientHandle, msgText, msgLength, NULL, send_confirmation_callback, &messages[msgIndex]) != 0)
+			{
+				ESP_LOGE(TAG, "ERROR: hal_iothub_send_event..........FAILED!");
+				blink_led(ERROR_STATUS_LED, 4);
+				ota_scheduler_telemetry_end(messages[msgIndex].telemetryWindow);
+			}
+			else
+			{
+				messages[msgIndex].isInFlight = true;
+				TRACE_LOG(TRACE_SEND_ACCEPTED, msgIndex);
+				blink_led(OK_STATUS_LED, 2);
+				activeMessages++;
+			}
 		}
 
-		messages[msgIndex].messageTrackingId = msgIndex;
-		ESP_LOGV(TAG, "size before IoTHubMessage_Properties: %d", esp_get_free_heap_size());
-
-		ESP_LOGV(TAG, "free heap size before IoTHubClient_LL_SendEventAsync: %d", esp_get_free_heap_size());
-		if (IoTHubClient_LL_SendEventAsync(iotHubClientHandle, messages[msgIndex].messageHandle, send_confirmation_callback, &messages[msgIndex]) != IOTHUB_CLIENT_OK)
-		{
-			ESP_LOGE(TAG, "ERROR: IoTHubClient_LL_SendEventAsync..........FAILED!");
-			blink_led(ERROR_STATUS_LED, 4);
-			IoTHubMessage_Destroy(messages[msgIndex].messageHandle);
-		}
-		else
+		if (telemetry_should_report(activeMessages))
 		{
-			ESP_LOGI(TAG, "IoTHubClient_LL_SendEventAsync accepted message [%d] for transmission to IoT Hub.", (int)msgIndex);
-			blink_led(OK_STATUS_LED, 2);
+			TELEMETRY_REPORTED_STATE state = { get_firmware_version(), get_current_update_offset(), get_update_progress(), ota_scheduler_throughput(), ota_probation_is_active() };
+			int propLength = telemetry_format_reported_state(propText, sizeof(propText), &state);
+			if (propLength < 0)
+				ESP_LOGE(TAG, "ERROR: reported state does not fit the message buffer");
+			else if (hal_iothub_send_reported_state(iotHubClientHandle, propText, propLength, send_report_confirmation_callback, NULL) != 0)
+			{
+				ESP_LOGE(TAG, "ERROR: hal_iothub_send_reported_state..........FAILED!");
+				blink_led(ERROR_STATUS_LED, 4);
+			}
 		}
 
-		sprintf_s(propText, sizeof(propText), "{\"firmwareVersion\":\"%s\",\"currentUpdateOffset\":%u,\"currentUpdateProgress\":%u }", get_firmware_version(), get_current_update_offset(), get_update_progress());
-		if (IoTHubClient_LL_SendReportedState(iotHubClientHandle, (const unsigned char *)propText, strlen(propText), send_report_confirmation_callback, NULL) != IOTHUB_CLIENT_OK)
+		if (++statsCycle >= RUNTIME_STATS_PERIOD)
 		{
-			ESP_LOGE(TAG, "ERROR: IoTHubClient_LL_SendReportedState..........FAILED!");
-			blink_led(ERROR_STATUS_LED, 4);
+			send_runtime_stats(iotHubClientHandle);
+			statsCycle = 0;
 		}
 
 		do_work(5000, iotHubClientHandle); //let the IoT Hub Client SDK system to work
-		msgIndex = (msgIndex + 1) % MESSAGE_COUNT;
-		activeMessages++;
 
-		if (activeMessages >= MESSAGE_COUNT) //error, sent many messages without an ack
+		int64_t now = hal_time_us();
+		for (int i = 0; i < MESSAGE_COUNT; i++)
+			expire_message(&messages[i], now);
+		expire_message(&g_statsMessage, now);
+
+		if (is_client_dead()) //nothing was acknowledged for a long time, reconnect without losing the device state
 		{
-			ESP_LOGE(TAG, "ERROR: sent many messages without an ack");
-			do_work(50000, iotHubClientHandle); //second chance
-			if (activeMessages >= MESSAGE_COUNT) //restart the device
+			ESP_LOGE(TAG, "ERROR: no ack for %d seconds with %d active messages, reconnecting", (int)(DEAD_CLIENT_TIMEOUT_US / 1000000), activeMessages);
+			blink_led(ERROR_STATUS_LED, 10);
+			hal_iothub_destroy(iotHubClientHandle); //completes the pending messages with HAL_IOTHUB_CONFIRMATION_BECAUSE_DESTROY
+			activeMessages = 0;
+			memset(messages, 0, sizeof(messages));
+			while ((iotHubClientHandle = create_iothub_client(&receiveContext)) == NULL)
 			{
-				ESP_LOGE(TAG, "ERROR: reset the device to be able to send telemetry");
-				blink_led(ERROR_STATUS_LED, 10);
-				esp_restart();
+				if (++reconnectFailures >= MAX_RECONNECT_FAILURES) //the SDK can not even create a client, last resort
+				{
+					ESP_LOGE(TAG, "ERROR: reset the device to be able to send telemetry");
+					esp_restart();
+				}
+				hal_sleep_ms(RECONNECT_DELAY_MS * reconnectFailures);
 			}
+			reconnectFailures = 0;
 		}
 
 		if (g_shouldUpdateSoftware)
@@ -420,8 +578,6 @@ void iothub_client_run(void)
 		if (g_shouldReboot)
 			esp_restart();
 	}
-	IoTHubClient_LL_Destroy(iotHubClientHandle);
-	platform_deinit();
+	hal_iothub_destroy(iotHubClientHandle);
+	hal_iothub_platform_deinit();
 }
-
-
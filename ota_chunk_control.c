@@ -0,0 +1,85 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <math.h>
+#include "ota_chunk_control.h"
+
+//weight of the older samples, about the last 10 chunks count
+#define FORGETTING_FACTOR 0.95f
+//consecutive failed chunks that halve the chunk size
+#define OTA_CHUNK_CONTROL_FAILURE_RUN 5
+
+void ota_chunk_control_init(OTA_CHUNK_CONTROL *control, size_t minChunkSize, size_t maxChunkSize, size_t chunkSize)
+{
+	control->minChunkSize = minChunkSize;
+	control->maxChunkSize = maxChunkSize;
+	control->chunkSize = chunkSize < minChunkSize ? minChunkSize : chunkSize > maxChunkSize ? maxChunkSize : chunkSize;
+	control->weight = control->sumSize = control->sumSize2 = control->sumTime = control->sumSizeTime = 0;
+	control->failures = control->attemptedBytes = 0;
+	control->consecutiveFailures = 0;
+}
+
+size_t ota_chunk_control_target(const OTA_CHUNK_CONTROL *control)
+{
+	float determinant = control->weight * control->sumSize2 - control->sumSize * control->sumSize;
+	//until chunks of different sizes were measured the rtt and bandwidth can not be told apart, keep growing
+	if (control->weight < 2 || determinant <= control->weight * control->sumSize2 * 1e-4f)
+		return control->maxChunkSize;
+
+	float usPerByte = (control->weight * control->sumSizeTime - control->sumSize * control->sumTime) / determinant;
+	float rtt = (control->sumTime - usPerByte * control->sumSize) / control->weight;
+	float lossPerByte = control->attemptedBytes > 0 ? control->failures / control->attemptedBytes : 0;
+	if (lossPerByte <= 0 || rtt <= 0)
+		return control->maxChunkSize;
+	if (usPerByte <= 0)
+		usPerByte = 1e-3f;
+
+	//maximum of size * (1 - loss)^size / (rtt + size * usPerByte), the positive root of usPerByte * loss * x^2 + rtt * loss * x - rtt
+	float a = usPerByte * lossPerByte;
+	float b = rtt * lossPerByte;
+	float target = (-b + sqrtf(b * b + 4 * a * rtt)) / (2 * a);
+
+	if (target < control->minChunkSize)
+		return control->minChunkSize;
+	if (target > control->maxChunkSize)
+		return control->maxChunkSize;
+	return (size_t)target;
+}
+
+void ota_chunk_control_success(OTA_CHUNK_CONTROL *control, size_t chunkSize, uint32_t elapsedUs)
+{
+	float size = (float)chunkSize;
+	float time = (float)elapsedUs;
+	control->weight = control->weight * FORGETTING_FACTOR + 1;
+	control->sumSize = control->sumSize * FORGETTING_FACTOR + size;
+	control->sumSize2 = control->sumSize2 * FORGETTING_FACTOR + size * size;
+	control->sumTime = control->sumTime * FORGETTING_FACTOR + time;
+	control->sumSizeTime = control->sumSizeTime * FORGETTING_FACTOR + size * time;
+	control->failures *= FORGETTING_FACTOR;
+	control->attemptedBytes = control->attemptedBytes * FORGETTING_FACTOR + size;
+
+	control->consecutiveFailures = 0;
+
+	//grow by half toward the target, a target below the current size is approached half way per chunk
+	size_t target = ota_chunk_control_target(control);
+	if (control->chunkSize < target)
+		control->chunkSize = control->chunkSize + control->chunkSize / 2 < target ? control->chunkSize + control->chunkSize / 2 : target;
+	else
+		control->chunkSize = (control->chunkSize + target) / 2;
+}
+
+void ota_chunk_control_failure(OTA_CHUNK_CONTROL *control, size_t chunkSize)
+{
+	control->failures = control->failures * FORGETTING_FACTOR + 1;
+	control->attemptedBytes = control->attemptedBytes * FORGETTING_FACTOR + (float)chunkSize;
+
+	//a random loss moves the size toward the target of the new loss estimate,
+	//only a run of failures, like a weak signal, halves it
+	size_t target = ota_chunk_control_target(control);
+	if (++control->consecutiveFailures >= OTA_CHUNK_CONTROL_FAILURE_RUN)
+		control->chunkSize /= 2;
+	else if (control->chunkSize > target)
+		control->chunkSize = (control->chunkSize + target) / 2;
+	if (control->chunkSize < control->minChunkSize)
+		control->chunkSize = control->minChunkSize;
+}
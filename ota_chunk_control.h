@@ -0,0 +1,47 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef OTA_CHUNK_CONTROL_H
+#define OTA_CHUNK_CONTROL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * Chunk size controller of the chunked OTA download.
+	 * Every chunk is a request, its time is modeled as rtt + size / bandwidth and a chunk is lost with a per byte probability.
+	 * Both are fitted from the measured chunks, the size with the best expected goodput is the target.
+	 * The size grows toward the target by half of itself per chunk and is halved after a run of failed chunks.
+	 */
+	typedef struct OTA_CHUNK_CONTROL_TAG
+	{
+		size_t chunkSize;
+		size_t minChunkSize;
+		size_t maxChunkSize;
+		//weighted least squares sums of time = rtt + size * usPerByte
+		float weight;
+		float sumSize;
+		float sumSize2;
+		float sumTime;
+		float sumSizeTime;
+		//recent failures per attempted byte
+		float failures;
+		float attemptedBytes;
+		int consecutiveFailures;
+	} OTA_CHUNK_CONTROL;
+
+	void ota_chunk_control_init(OTA_CHUNK_CONTROL *control, size_t minChunkSize, size_t maxChunkSize, size_t chunkSize);
+	void ota_chunk_control_success(OTA_CHUNK_CONTROL *control, size_t chunkSize, uint32_t elapsedUs);
+	void ota_chunk_control_failure(OTA_CHUNK_CONTROL *control, size_t chunkSize);
+	//the chunk size with the best expected goodput by the current estimates, within the bounds
+	size_t ota_chunk_control_target(const OTA_CHUNK_CONTROL *control);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OTA_CHUNK_CONTROL_H */
@@ -0,0 +1,66 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "esp_log.h"
+#include "rom/miniz.h"
+#include "ota_inflate.h"
+
+#define TAG "ota_inflate"
+
+//the decompressor tables are about 11KB, static like the other OTA buffers
+static tinfl_decompressor g_inflator;
+//decompressed data, also the dictionary of the back references
+static unsigned char g_window[OTA_INFLATE_WINDOW_SIZE] __attribute__((aligned(4)));
+static size_t g_windowOffset = 0;
+static tinfl_status g_status = TINFL_STATUS_NEEDS_MORE_INPUT;
+static OTA_INFLATE_WRITE g_write = NULL;
+
+void ota_inflate_begin(OTA_INFLATE_WRITE write)
+{
+	tinfl_init(&g_inflator);
+	g_windowOffset = 0;
+	g_status = TINFL_STATUS_NEEDS_MORE_INPUT;
+	g_write = write;
+}
+
+esp_err_t ota_inflate_write(const void *data, size_t length)
+{
+	const unsigned char *in = (const unsigned char *)data;
+
+	//the window wraps around, every call decodes up to its end and passes the new bytes on
+	while (length > 0 || g_status == TINFL_STATUS_HAS_MORE_OUTPUT)
+	{
+		if (g_status == TINFL_STATUS_DONE)
+		{
+			ESP_LOGE(TAG, "%u bytes after the end of the compressed stream", length);
+			return ESP_ERR_INVALID_SIZE;
+		}
+
+		size_t inLength = length;
+		size_t outLength = OTA_INFLATE_WINDOW_SIZE - g_windowOffset;
+		g_status = tinfl_decompress(&g_inflator, in, &inLength, g_window, g_window + g_windowOffset, &outLength,
+			TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT | TINFL_FLAG_COMPUTE_ADLER32);
+		in += inLength;
+		length -= inLength;
+
+		if (g_status < TINFL_STATUS_DONE)
+		{
+			ESP_LOGE(TAG, "Invalid compressed data, status=%d", g_status);
+			return ESP_ERR_INVALID_ARG;
+		}
+
+		if (outLength > 0)
+		{
+			esp_err_t err = g_write(g_window + g_windowOffset, outLength);
+			if (err != ESP_OK)
+				return err;
+			g_windowOffset = (g_windowOffset + outLength) & (OTA_INFLATE_WINDOW_SIZE - 1);
+		}
+	}
+	return ESP_OK;
+}
+
+bool ota_inflate_is_complete()
+{
+	return g_status == TINFL_STATUS_DONE;
+}
@@ -0,0 +1,33 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef OTA_INFLATE_H
+#define OTA_INFLATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * Streaming zlib decompression with the miniz inflater in the ESP32 ROM.
+	 * The output window is OTA_INFLATE_WINDOW_SIZE bytes, the image must be compressed with a matching window
+	 * (zlib windowBits 12, tools/ota_compress does that). The input may be split at any byte.
+	 */
+#define OTA_INFLATE_WINDOW_SIZE 4096
+
+	typedef esp_err_t (*OTA_INFLATE_WRITE)(const void *data, size_t length);
+
+	void ota_inflate_begin(OTA_INFLATE_WRITE write);
+	esp_err_t ota_inflate_write(const void *data, size_t length);
+	//the end of the compressed stream was decoded and its checksum is valid
+	bool ota_inflate_is_complete();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OTA_INFLATE_H */
@@ -0,0 +1,133 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <string.h>
+#include "ota_patch.h"
+
+enum
+{
+	PATCH_STATE_HEADER,
+	PATCH_STATE_OPERATION,
+	PATCH_STATE_INSERT,
+	PATCH_STATE_DONE,
+	PATCH_STATE_ERROR
+};
+
+//opcode and two arguments
+#define PATCH_OPERATION_SIZE 9
+
+static uint32_t read_u32(const uint8_t *data)
+{
+	return data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+void ota_patch_init(OTA_PATCH *patch, OTA_PATCH_READ read, OTA_PATCH_WRITE write, void *context)
+{
+	memset(patch, 0, sizeof(*patch));
+	patch->read = read;
+	patch->write = write;
+	patch->context = context;
+	patch->state = PATCH_STATE_HEADER;
+}
+
+static int copy_source(OTA_PATCH *patch, uint32_t offset, uint32_t length)
+{
+	if (offset > patch->sourceSize || length > patch->sourceSize - offset || length > patch->targetSize - patch->written)
+		return -1;
+
+	while (length > 0)
+	{
+		size_t blockLength = length < sizeof(patch->copyBuffer) ? length : sizeof(patch->copyBuffer);
+		if (patch->read(patch->context, offset, patch->copyBuffer, blockLength) != 0
+			|| patch->write(patch->context, patch->copyBuffer, blockLength) != 0)
+			return -1;
+		offset += blockLength;
+		length -= blockLength;
+		patch->written += blockLength;
+	}
+	return 0;
+}
+
+//the operation is complete in field, run it
+static int run_operation(OTA_PATCH *patch)
+{
+	if (patch->field[0] == OTA_PATCH_OP_COPY)
+		return copy_source(patch, read_u32(patch->field + 1), read_u32(patch->field + 5));
+
+	uint32_t length = read_u32(patch->field + 1);
+	if (patch->field[0] != OTA_PATCH_OP_INSERT || length > patch->targetSize - patch->written)
+		return -1;
+	patch->insertRemaining = length;
+	if (length > 0)
+		patch->state = PATCH_STATE_INSERT;
+	return 0;
+}
+
+int ota_patch_feed(OTA_PATCH *patch, const void *data, size_t length)
+{
+	const uint8_t *in = (const uint8_t *)data;
+	const uint8_t *end = in + length;
+
+	while (in < end)
+	{
+		switch (patch->state)
+		{
+		case PATCH_STATE_HEADER:
+			patch->field[patch->fieldLength++] = *in++;
+			if (patch->fieldLength < OTA_PATCH_HEADER_SIZE)
+				break;
+			if (memcmp(patch->field, OTA_PATCH_MAGIC, 4) != 0)
+			{
+				patch->state = PATCH_STATE_ERROR;
+				return -1;
+			}
+			patch->sourceSize = read_u32(patch->field + 4);
+			patch->targetSize = read_u32(patch->field + 8);
+			patch->fieldLength = 0;
+			patch->state = patch->targetSize == 0 ? PATCH_STATE_DONE : PATCH_STATE_OPERATION;
+			break;
+
+		case PATCH_STATE_OPERATION:
+			patch->field[patch->fieldLength++] = *in++;
+			//an insert operation is 5 bytes, a copy 9
+			if (patch->fieldLength < (patch->field[0] == OTA_PATCH_OP_INSERT ? 5 : PATCH_OPERATION_SIZE))
+				break;
+			patch->fieldLength = 0;
+			patch->state = PATCH_STATE_OPERATION;
+			if (run_operation(patch) != 0)
+			{
+				patch->state = PATCH_STATE_ERROR;
+				return -1;
+			}
+			if (patch->written == patch->targetSize)
+				patch->state = PATCH_STATE_DONE;
+			break;
+
+		case PATCH_STATE_INSERT:
+		{
+			size_t insertLength = (size_t)(end - in) < patch->insertRemaining ? (size_t)(end - in) : patch->insertRemaining;
+			if (patch->write(patch->context, in, insertLength) != 0)
+			{
+				patch->state = PATCH_STATE_ERROR;
+				return -1;
+			}
+			in += insertLength;
+			patch->insertRemaining -= insertLength;
+			patch->written += insertLength;
+			if (patch->insertRemaining == 0)
+				patch->state = patch->written == patch->targetSize ? PATCH_STATE_DONE : PATCH_STATE_OPERATION;
+			break;
+		}
+
+		default: //data after the end of the patch or after an error
+			patch->state = PATCH_STATE_ERROR;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int ota_patch_is_complete(const OTA_PATCH *patch)
+{
+	return patch->state == PATCH_STATE_DONE;
+}
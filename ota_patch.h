@@ -0,0 +1,57 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef OTA_PATCH_H
+#define OTA_PATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * Streaming applier of a delta update, the patch may be split at any byte.
+	 * Patch format, all numbers are little endian uint32:
+	 *   header: "WTP1" sourceSize targetSize
+	 *   'C' sourceOffset length     copy length bytes of the running image
+	 *   'I' length <length bytes>   insert new bytes
+	 * The operations produce the target image in order, the patch ends when targetSize bytes are written.
+	 * tools/ota_delta creates the patches.
+	 */
+#define OTA_PATCH_MAGIC "WTP1"
+#define OTA_PATCH_HEADER_SIZE 12
+#define OTA_PATCH_OP_COPY 'C'
+#define OTA_PATCH_OP_INSERT 'I'
+#define OTA_PATCH_COPY_BUFFER_SIZE 512
+
+	//both callbacks return 0 on success
+	typedef int (*OTA_PATCH_READ)(void *context, size_t offset, void *buffer, size_t length);
+	typedef int (*OTA_PATCH_WRITE)(void *context, const void *data, size_t length);
+
+	typedef struct OTA_PATCH_TAG
+	{
+		OTA_PATCH_READ read;
+		OTA_PATCH_WRITE write;
+		void *context;
+		uint32_t sourceSize;
+		uint32_t targetSize;
+		uint32_t written;
+		uint32_t insertRemaining;
+		int state;
+		uint8_t field[OTA_PATCH_HEADER_SIZE];
+		size_t fieldLength;
+		uint8_t copyBuffer[OTA_PATCH_COPY_BUFFER_SIZE];
+	} OTA_PATCH;
+
+	void ota_patch_init(OTA_PATCH *patch, OTA_PATCH_READ read, OTA_PATCH_WRITE write, void *context);
+	//apply the next fragment of the patch. returns 0, or -1 on an invalid patch or a failed callback
+	int ota_patch_feed(OTA_PATCH *patch, const void *data, size_t length);
+	int ota_patch_is_complete(const OTA_PATCH *patch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OTA_PATCH_H */
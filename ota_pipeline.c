@@ -0,0 +1,112 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "ota_pipeline.h"
+#include "ota_scheduler.h"
+
+#define TAG "ota_pipeline"
+
+#define OTA_PIPELINE_STACK_SIZE 4096
+//the buffer index of the item that stops the writer
+#define OTA_PIPELINE_STOP -1
+
+typedef struct OTA_PIPELINE_ITEM_TAG
+{
+	int index;
+	size_t length;
+} OTA_PIPELINE_ITEM;
+
+static unsigned char g_buffers[OTA_PIPELINE_BUFFER_COUNT][OTA_PIPELINE_BUFFER_SIZE] __attribute__((aligned(4)));
+static QueueHandle_t g_freeQueue = NULL;
+static QueueHandle_t g_writeQueue = NULL;
+static SemaphoreHandle_t g_writerStopped = NULL;
+static OTA_PIPELINE_WRITE g_write = NULL;
+static int g_currentIndex = OTA_PIPELINE_STOP;
+static volatile esp_err_t g_writeError = ESP_OK;
+static volatile int64_t g_writeTime = 0;
+
+static void pipeline_writer_task(void *pvParameters)
+{
+	OTA_PIPELINE_ITEM item;
+	while (xQueueReceive(g_writeQueue, &item, portMAX_DELAY) == pdTRUE && item.index != OTA_PIPELINE_STOP)
+	{
+		//after an error the remaining buffers are only returned, the download stops at its next submit
+		if (item.length > 0 && g_writeError == ESP_OK)
+		{
+			int64_t writeBegin = esp_timer_get_time();
+			g_writeError = g_write(g_buffers[item.index], item.length);
+			g_writeTime += esp_timer_get_time() - writeBegin;
+		}
+		xQueueSend(g_freeQueue, &item.index, portMAX_DELAY);
+	}
+
+	xSemaphoreGive(g_writerStopped);
+	vTaskDelete(NULL);
+}
+
+esp_err_t ota_pipeline_begin(OTA_PIPELINE_WRITE write)
+{
+	if (g_freeQueue == NULL)
+	{
+		g_freeQueue = xQueueCreate(OTA_PIPELINE_BUFFER_COUNT, sizeof(int));
+		g_writeQueue = xQueueCreate(OTA_PIPELINE_BUFFER_COUNT + 1, sizeof(OTA_PIPELINE_ITEM)); //room for the stop item
+		g_writerStopped = xSemaphoreCreateBinary();
+		if (g_freeQueue == NULL || g_writeQueue == NULL || g_writerStopped == NULL)
+		{
+			ESP_LOGE(TAG, "Creating the pipeline queues failed");
+			return ESP_ERR_NO_MEM;
+		}
+		for (int i = 0; i < OTA_PIPELINE_BUFFER_COUNT; ++i)
+			xQueueSend(g_freeQueue, &i, 0);
+	}
+
+	g_write = write;
+	g_writeError = ESP_OK;
+	g_writeTime = 0;
+	g_currentIndex = OTA_PIPELINE_STOP;
+	if (xTaskCreate(&pipeline_writer_task, "ota_pipeline", OTA_PIPELINE_STACK_SIZE, NULL, OTA_TASK_PRIORITY, NULL) != pdPASS)
+	{
+		ESP_LOGE(TAG, "Creating the writer task failed");
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
+
+unsigned char *ota_pipeline_get_buffer()
+{
+	if (g_currentIndex == OTA_PIPELINE_STOP)
+		xQueueReceive(g_freeQueue, &g_currentIndex, portMAX_DELAY);
+	return g_buffers[g_currentIndex];
+}
+
+esp_err_t ota_pipeline_submit(size_t length)
+{
+	if (g_currentIndex != OTA_PIPELINE_STOP)
+	{
+		OTA_PIPELINE_ITEM item = { g_currentIndex, length };
+		xQueueSend(g_writeQueue, &item, portMAX_DELAY);
+		g_currentIndex = OTA_PIPELINE_STOP;
+	}
+	return g_writeError;
+}
+
+esp_err_t ota_pipeline_end()
+{
+	ota_pipeline_submit(0); //a buffer that was taken and not submitted
+
+	OTA_PIPELINE_ITEM stop = { OTA_PIPELINE_STOP, 0 };
+	xQueueSend(g_writeQueue, &stop, portMAX_DELAY);
+	xSemaphoreTake(g_writerStopped, portMAX_DELAY);
+	return g_writeError;
+}
+
+int64_t ota_pipeline_write_time()
+{
+	return g_writeTime;
+}
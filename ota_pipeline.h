@@ -0,0 +1,41 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef OTA_PIPELINE_H
+#define OTA_PIPELINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_spi_flash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * Two stage OTA pipeline: the download task fills buffers of a small pool and a writer task passes them
+	 * to the write function, so the next chunk is received while the previous one is written to flash.
+	 * Buffers are written in the order they are submitted.
+	 */
+#define OTA_PIPELINE_BUFFER_COUNT 3
+	//a flash sector, with slack for the worst case estimate of the streaming base64 decoder
+#define OTA_PIPELINE_BUFFER_SIZE (SPI_FLASH_SEC_SIZE + 4)
+
+	typedef esp_err_t (*OTA_PIPELINE_WRITE)(const void *data, size_t length);
+
+	esp_err_t ota_pipeline_begin(OTA_PIPELINE_WRITE write);
+	//blocks until the writer returns a buffer
+	unsigned char *ota_pipeline_get_buffer();
+	//queue the buffer of the last ota_pipeline_get_buffer, 0 length returns it unwritten. returns the first write error so far
+	esp_err_t ota_pipeline_submit(size_t length);
+	//wait for the queued buffers and stop the writer, returns the first write error
+	esp_err_t ota_pipeline_end();
+	//the time that the writer spent in the write function since ota_pipeline_begin
+	int64_t ota_pipeline_write_time();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OTA_PIPELINE_H */
@@ -0,0 +1,306 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_ota_ops.h"
+#include "nvs.h"
+#include "Common.h"
+#include "ota_probation.h"
+
+#define TAG "ota_probation"
+
+#define OTA_PROBATION_NAMESPACE "probation"
+#define OTA_PROBATION_TRIAL_KEY "trial"
+#define OTA_PROBATION_BASELINE_KEY "baseline"
+#define OTA_PROBATION_REJECTED_KEY "rejected"
+#define OTA_PROBATION_STATE_VERSION 1
+
+//the metrics of a firmware that was not on probation
+typedef struct OTA_PROBATION_BASELINE_TAG
+{
+	uint32_t version;
+	char firmwareVersion[OTA_PROBATION_VERSION_LENGTH];
+	OTA_PROBATION_METRICS metrics;
+} OTA_PROBATION_BASELINE;
+
+//an update that boots for the first time
+typedef struct OTA_PROBATION_TRIAL_TAG
+{
+	uint32_t version;
+	char previousVersion[OTA_PROBATION_VERSION_LENGTH];
+	char newVersion[OTA_PROBATION_VERSION_LENGTH];
+	uint32_t previousAddress;
+	int32_t previousSubtype;
+	uint32_t boots;
+} OTA_PROBATION_TRIAL;
+
+static OTA_PROBATION_TRIAL g_trial;
+static bool g_isActive = false;
+static bool g_isJudged = false;
+static int64_t g_connectTime = -1;
+static int g_loops = 0;
+static int64_t g_firstLoopTime = 0;
+static int64_t g_ackTime = 0;
+static uint32_t g_acks = 0;
+static esp_timer_handle_t g_connectTimer = NULL;
+//set by the timer, the rollback writes flash and restarts, which an esp_timer callback must not do
+static volatile bool g_isConnectTimedOut = false;
+
+static bool load_blob(const char *key, void *blob, size_t size)
+{
+	nvs_handle handle;
+	if (nvs_open(OTA_PROBATION_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+		return false;
+
+	size_t length = size;
+	bool isValid = nvs_get_blob(handle, key, blob, &length) == ESP_OK && length == size
+		&& *(const uint32_t *)blob == OTA_PROBATION_STATE_VERSION; //the first member of the blobs is the version
+	nvs_close(handle);
+	return isValid;
+}
+
+static esp_err_t save_blob(const char *key, const void *blob, size_t size)
+{
+	nvs_handle handle;
+	esp_err_t err = nvs_open(OTA_PROBATION_NAMESPACE, NVS_READWRITE, &handle);
+	if (err != ESP_OK)
+		return err;
+
+	err = nvs_set_blob(handle, key, blob, size);
+	if (err == ESP_OK)
+		err = nvs_commit(handle);
+	nvs_close(handle);
+	if (err != ESP_OK)
+		ESP_LOGE(TAG, "Saving %s failed, err=0x%x", key, err);
+	return err;
+}
+
+static void erase_key(const char *key)
+{
+	nvs_handle handle;
+	if (nvs_open(OTA_PROBATION_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+		return;
+
+	nvs_erase_key(handle, key);
+	nvs_commit(handle);
+	nvs_close(handle);
+}
+
+//boots the previous firmware, the trial stays in NVS so that the previous firmware rejects the version
+static void roll_back(const char *reason)
+{
+	ESP_LOGE(TAG, "Firmware %s failed probation: %s, rolling back to %s", get_firmware_version(), reason, g_trial.previousVersion);
+
+	const esp_partition_t *previous = esp_partition_find_first(ESP_PARTITION_TYPE_APP, (esp_partition_subtype_t)g_trial.previousSubtype, NULL);
+	if (previous == NULL || previous->address != g_trial.previousAddress)
+	{
+		ESP_LOGE(TAG, "The previous partition at 0x%x is gone, keeping the new firmware", g_trial.previousAddress);
+		erase_key(OTA_PROBATION_TRIAL_KEY);
+		g_isActive = false;
+		return;
+	}
+
+	esp_err_t err = esp_ota_set_boot_partition(previous);
+	if (err != ESP_OK)
+	{
+		//the previous image does not verify any more, the new one is the better choice
+		ESP_LOGE(TAG, "esp_ota_set_boot_partition failed! err=0x%x, keeping the new firmware", err);
+		erase_key(OTA_PROBATION_TRIAL_KEY);
+		g_isActive = false;
+		return;
+	}
+	esp_restart();
+}
+
+static void connect_timeout(void *arg)
+{
+	g_isConnectTimedOut = true;
+}
+
+void ota_probation_poll()
+{
+	if (g_isConnectTimedOut && g_isActive && g_connectTime < 0)
+		roll_back("no IoT Hub connection");
+}
+
+void ota_probation_begin()
+{
+	g_isActive = false;
+	if (!load_blob(OTA_PROBATION_TRIAL_KEY, &g_trial, sizeof(g_trial)))
+		return;
+
+	const esp_partition_t *running = esp_ota_get_running_partition();
+	if (running == NULL || running->address == g_trial.previousAddress)
+	{
+		//rolled back, or the bootloader did not start the new image
+		ESP_LOGW(TAG, "Firmware %s was rolled back, it is not installed again", g_trial.newVersion);
+		save_blob(OTA_PROBATION_REJECTED_KEY, g_trial.newVersion, sizeof(g_trial.newVersion));
+		erase_key(OTA_PROBATION_TRIAL_KEY);
+		return;
+	}
+
+	g_isActive = true;
+	if (++g_trial.boots > OTA_PROBATION_MAX_BOOTS)
+	{
+		roll_back("too many restarts");
+		return;
+	}
+	save_blob(OTA_PROBATION_TRIAL_KEY, &g_trial, sizeof(g_trial));
+	ESP_LOGI(TAG, "Firmware %s is on probation, boot %u, previous firmware %s", get_firmware_version(), g_trial.boots, g_trial.previousVersion);
+
+	esp_timer_create_args_t timerArgs =
+	{
+		.callback = &connect_timeout,
+		.name = "probation",
+	};
+	if (esp_timer_create(&timerArgs, &g_connectTimer) == ESP_OK)
+		esp_timer_start_once(g_connectTimer, OTA_PROBATION_CONNECT_TIMEOUT_S * 1000000ULL);
+}
+
+esp_err_t ota_probation_arm(const esp_partition_t *previous, const char *newVersion)
+{
+	OTA_PROBATION_TRIAL trial;
+	memset(&trial, 0, sizeof(trial));
+	trial.version = OTA_PROBATION_STATE_VERSION;
+	snprintf(trial.previousVersion, sizeof(trial.previousVersion), "%s", get_firmware_version());
+	snprintf(trial.newVersion, sizeof(trial.newVersion), "%s", newVersion);
+	trial.previousAddress = previous->address;
+	trial.previousSubtype = previous->subtype;
+	return save_blob(OTA_PROBATION_TRIAL_KEY, &trial, sizeof(trial));
+}
+
+bool ota_probation_is_active()
+{
+	return g_isActive;
+}
+
+bool ota_probation_is_rejected(const char *version)
+{
+	char rejected[OTA_PROBATION_VERSION_LENGTH];
+	nvs_handle handle;
+	if (nvs_open(OTA_PROBATION_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+		return false;
+
+	size_t length = sizeof(rejected);
+	bool isRejected = nvs_get_blob(handle, OTA_PROBATION_REJECTED_KEY, rejected, &length) == ESP_OK
+		&& length == sizeof(rejected) && strncmp(rejected, version, sizeof(rejected)) == 0;
+	nvs_close(handle);
+	return isRejected;
+}
+
+void ota_probation_connected()
+{
+	if (g_connectTime >= 0)
+		return;
+
+	g_connectTime = esp_timer_get_time();
+	if (g_connectTimer != NULL)
+		esp_timer_stop(g_connectTimer);
+}
+
+void ota_probation_ack(int64_t latencyUs)
+{
+	if (g_isJudged)
+		return;
+
+	g_ackTime += latencyUs;
+	g_acks++;
+}
+
+//worse than the baseline by more than percent and slack, lower is better
+static bool is_regression(const char *name, uint32_t value, uint32_t baseline, uint32_t percent, uint32_t slack)
+{
+	bool isRegression = value > baseline + (uint64_t)baseline * percent / 100 + slack;
+	ESP_LOGI(TAG, "%s: %u, baseline %u%s", name, value, baseline, isRegression ? ", regression" : "");
+	return isRegression;
+}
+
+//the new firmware passes when none of the metrics regressed against the previous firmware
+static bool is_acceptable(const OTA_PROBATION_METRICS *metrics)
+{
+	OTA_PROBATION_BASELINE baseline;
+	if (!load_blob(OTA_PROBATION_BASELINE_KEY, &baseline, sizeof(baseline)) || strncmp(baseline.firmwareVersion, g_trial.previousVersion, sizeof(baseline.firmwareVersion)) != 0)
+	{
+		ESP_LOGW(TAG, "There is no baseline of firmware %s, accepting the new firmware", g_trial.previousVersion);
+		return true;
+	}
+
+	const OTA_PROBATION_METRICS *base = &baseline.metrics;
+	bool isRegression = is_regression("Boot to connected ms", metrics->bootToConnectedMs, base->bootToConnectedMs, OTA_PROBATION_CONNECT_PERCENT, OTA_PROBATION_CONNECT_SLACK_MS);
+	isRegression |= is_regression("Loop period ms", metrics->loopPeriodMs, base->loopPeriodMs, OTA_PROBATION_LOOP_PERIOD_PERCENT, OTA_PROBATION_LOOP_PERIOD_SLACK_MS);
+	//for the heap higher is better
+	bool isHeapRegression = metrics->heapLowWater + base->heapLowWater * OTA_PROBATION_HEAP_PERCENT / 100 + OTA_PROBATION_HEAP_SLACK < base->heapLowWater;
+	ESP_LOGI(TAG, "Heap low water: %u, baseline %u%s", metrics->heapLowWater, base->heapLowWater, isHeapRegression ? ", regression" : "");
+	isRegression |= isHeapRegression;
+	if (metrics->ackLatencyMs > 0 && base->ackLatencyMs > 0)
+		isRegression |= is_regression("Ack latency ms", metrics->ackLatencyMs, base->ackLatencyMs, OTA_PROBATION_ACK_PERCENT, OTA_PROBATION_ACK_SLACK_MS);
+	return !isRegression;
+}
+
+//a firmware off probation keeps the average with its earlier boots as its baseline
+static void save_baseline(const OTA_PROBATION_METRICS *metrics)
+{
+	OTA_PROBATION_BASELINE baseline;
+	if (load_blob(OTA_PROBATION_BASELINE_KEY, &baseline, sizeof(baseline)) && strncmp(baseline.firmwareVersion, get_firmware_version(), sizeof(baseline.firmwareVersion)) == 0)
+	{
+		baseline.metrics.bootToConnectedMs = (baseline.metrics.bootToConnectedMs + metrics->bootToConnectedMs) / 2;
+		baseline.metrics.loopPeriodMs = (baseline.metrics.loopPeriodMs + metrics->loopPeriodMs) / 2;
+		baseline.metrics.heapLowWater = (baseline.metrics.heapLowWater + metrics->heapLowWater) / 2;
+		if (baseline.metrics.ackLatencyMs == 0 || metrics->ackLatencyMs == 0)
+			baseline.metrics.ackLatencyMs += metrics->ackLatencyMs;
+		else
+			baseline.metrics.ackLatencyMs = (baseline.metrics.ackLatencyMs + metrics->ackLatencyMs) / 2;
+	}
+	else
+	{
+		memset(&baseline, 0, sizeof(baseline));
+		baseline.version = OTA_PROBATION_STATE_VERSION;
+		snprintf(baseline.firmwareVersion, sizeof(baseline.firmwareVersion), "%s", get_firmware_version());
+		baseline.metrics = *metrics;
+	}
+	save_blob(OTA_PROBATION_BASELINE_KEY, &baseline, sizeof(baseline));
+}
+
+void ota_probation_loop()
+{
+	if (g_isJudged)
+		return;
+
+	int64_t now = esp_timer_get_time();
+	if (g_loops++ == 0)
+		g_firstLoopTime = now;
+	//the window needs the connection time as well, a firmware that does not connect is rolled back after the timer by ota_probation_poll
+	if (g_loops <= OTA_PROBATION_LOOPS || g_connectTime < 0)
+		return;
+
+	OTA_PROBATION_METRICS metrics;
+	metrics.bootToConnectedMs = (uint32_t)(g_connectTime / 1000);
+	metrics.loopPeriodMs = (uint32_t)((now - g_firstLoopTime) / (g_loops - 1) / 1000);
+	metrics.heapLowWater = esp_get_minimum_free_heap_size();
+	metrics.ackLatencyMs = g_acks == 0 ? 0 : (uint32_t)(g_ackTime / g_acks / 1000);
+	g_isJudged = true;
+	ESP_LOGI(TAG, "Firmware %s: connected after %u ms, loop period %u ms, heap low water %u, ack latency %u ms",
+		get_firmware_version(), metrics.bootToConnectedMs, metrics.loopPeriodMs, metrics.heapLowWater, metrics.ackLatencyMs);
+
+	if (!g_isActive)
+	{
+		save_baseline(&metrics);
+		return;
+	}
+
+	if (!is_acceptable(&metrics))
+	{
+		roll_back("performance regression");
+		return;
+	}
+
+	ESP_LOGI(TAG, "Firmware %s passed probation", get_firmware_version());
+	erase_key(OTA_PROBATION_TRIAL_KEY);
+	erase_key(OTA_PROBATION_REJECTED_KEY);
+	g_isActive = false;
+	save_baseline(&metrics);
+}
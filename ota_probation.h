@@ -0,0 +1,65 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef OTA_PROBATION_H
+#define OTA_PROBATION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * Probation of a new firmware: the first OTA_PROBATION_LOOPS main loop cycles after every boot are measured,
+	 * a firmware that runs without an update to judge saves them in NVS as the baseline. After an update the new
+	 * firmware is compared with the baseline of the previous one and boots the previous partition again when it
+	 * regresses beyond the thresholds below, crashes OTA_PROBATION_MAX_BOOTS times or does not connect in time.
+	 */
+	//main loop cycles of the measurement window, about 6 minutes
+#define OTA_PROBATION_LOOPS 60
+#define OTA_PROBATION_VERSION_LENGTH 32
+	//boots of the new firmware that do not reach the end of the window
+#define OTA_PROBATION_MAX_BOOTS 3
+#define OTA_PROBATION_CONNECT_TIMEOUT_S (10 * 60)
+	//a metric regresses when it is worse than the baseline by the percent and the slack
+#define OTA_PROBATION_CONNECT_PERCENT 100
+#define OTA_PROBATION_CONNECT_SLACK_MS 5000
+#define OTA_PROBATION_LOOP_PERIOD_PERCENT 20
+#define OTA_PROBATION_LOOP_PERIOD_SLACK_MS 200
+#define OTA_PROBATION_HEAP_PERCENT 10
+#define OTA_PROBATION_HEAP_SLACK 4096
+#define OTA_PROBATION_ACK_PERCENT 100
+#define OTA_PROBATION_ACK_SLACK_MS 500
+
+	typedef struct OTA_PROBATION_METRICS_TAG
+	{
+		uint32_t bootToConnectedMs;
+		uint32_t loopPeriodMs;
+		uint32_t heapLowWater;
+		uint32_t ackLatencyMs; //0 when no message was acknowledged
+	} OTA_PROBATION_METRICS;
+
+	//call once after nvs_flash_init, rolls back right away after too many boots of the new firmware
+	void ota_probation_begin();
+	//the updated image is about to boot, previous is the partition that runs now
+	esp_err_t ota_probation_arm(const esp_partition_t *previous, const char *newVersion);
+	bool ota_probation_is_active();
+	//called by the OTA task while the firmware is on probation, rolls back when the connect timeout expired
+	void ota_probation_poll();
+	//the version was rolled back on this device, it is not installed again
+	bool ota_probation_is_rejected(const char *version);
+	//the measurements, called by the telemetry loop
+	void ota_probation_connected();
+	void ota_probation_ack(int64_t latencyUs);
+	//once per main loop cycle, judges the new firmware at the end of the window
+	void ota_probation_loop();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OTA_PROBATION_H */
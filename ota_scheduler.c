@@ -0,0 +1,117 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "ota_scheduler.h"
+
+#define TAG "ota_scheduler"
+
+#define WAIT_STEP_MS 50
+
+static int64_t g_downloadBegin = 0;
+static volatile uint32_t g_downloadedBytes = 0;
+static volatile uint32_t g_throughput = 0;
+//set by the telemetry task, read by the download task
+static volatile uint32_t g_rateLimit = OTA_RATE_LIMIT_BYTES_PER_SECOND;
+static volatile uint32_t g_heapReserve = OTA_HEAP_RESERVE;
+//the millisecond stamp of the open telemetry window, 0 when none. only the telemetry task writes it and a 32 bit stamp
+//is read whole by the download task on the other core
+static volatile uint32_t g_telemetryWindow = 0;
+//the expired window the download task logged last
+static uint32_t g_loggedWindow = 0;
+
+static uint32_t now_ms()
+{
+	uint32_t now = (uint32_t)(esp_timer_get_time() / 1000);
+	return now != 0 ? now : 1;
+}
+
+static bool is_window_open(uint32_t window, uint32_t now)
+{
+	return window != 0 && now - window < OTA_TELEMETRY_WINDOW_MAX_US / 1000;
+}
+
+void ota_scheduler_begin()
+{
+	g_downloadBegin = esp_timer_get_time();
+	g_downloadedBytes = 0;
+	g_throughput = 0;
+}
+
+uint32_t ota_scheduler_telemetry_begin()
+{
+	uint32_t now = now_ms();
+	if (is_window_open(g_telemetryWindow, now))
+		return 0;
+	g_telemetryWindow = now;
+	return now;
+}
+
+void ota_scheduler_telemetry_end(uint32_t window)
+{
+	if (window != 0 && g_telemetryWindow == window)
+		g_telemetryWindow = 0;
+}
+
+uint32_t ota_scheduler_throughput()
+{
+	return g_throughput;
+}
+
+void ota_scheduler_set_limits(uint32_t rateLimit, uint32_t heapReserve)
+{
+	g_rateLimit = rateLimit;
+	g_heapReserve = heapReserve;
+	ESP_LOGI(TAG, "Download rate limit %u bytes/s, heap reserve %u", rateLimit, heapReserve);
+}
+
+void ota_scheduler_get_limits(uint32_t *rateLimit, uint32_t *heapReserve)
+{
+	*rateLimit = g_rateLimit;
+	*heapReserve = g_heapReserve;
+}
+
+void ota_scheduler_throttle(size_t bytes)
+{
+	g_downloadedBytes += bytes;
+
+	//give the radio to the telemetry message until it is acknowledged
+	uint32_t window = g_telemetryWindow;
+	while (is_window_open(window, now_ms()) && g_telemetryWindow == window)
+		vTaskDelay(WAIT_STEP_MS / portTICK_PERIOD_MS);
+	if (window != 0 && g_telemetryWindow == window && window != g_loggedWindow)
+	{
+		ESP_LOGW(TAG, "No telemetry ack within %d ms, the download goes on", OTA_TELEMETRY_WINDOW_MAX_US / 1000);
+		g_loggedWindow = window;
+	}
+
+	//the TLS buffers of the next block come from the same heap as the IoT Hub client
+	bool isLogged = false;
+	while (esp_get_free_heap_size() < g_heapReserve)
+	{
+		if (!isLogged)
+			ESP_LOGW(TAG, "Free heap %d is below the reserve, pausing the download", esp_get_free_heap_size());
+		isLogged = true;
+		vTaskDelay(WAIT_STEP_MS / portTICK_PERIOD_MS);
+	}
+
+	//the download may not get ahead of the time it would take at the rate limit
+	int64_t elapsed = esp_timer_get_time() - g_downloadBegin;
+	uint32_t rateLimit = g_rateLimit;
+	if (rateLimit > 0)
+	{
+		int64_t earliest = (int64_t)g_downloadedBytes * 1000000 / rateLimit;
+		if (earliest > elapsed)
+		{
+			vTaskDelay((earliest - elapsed) / 1000 / portTICK_PERIOD_MS + 1);
+			elapsed = esp_timer_get_time() - g_downloadBegin;
+		}
+	}
+	if (elapsed > 0)
+		g_throughput = (uint32_t)((int64_t)g_downloadedBytes * 1000000 / elapsed);
+}
@@ -0,0 +1,51 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef OTA_SCHEDULER_H
+#define OTA_SCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * Keeps a firmware download in the background of the telemetry loop:
+	 * the download is capped at OTA_RATE_LIMIT_BYTES_PER_SECOND, pauses while a telemetry message waits for its ack
+	 * and while the free heap is below OTA_HEAP_RESERVE. Both are the defaults of a build, the "SetOtaLimits" direct
+	 * method changes them at runtime through ota_scheduler_set_limits.
+	 */
+	//0 for no limit
+#ifndef OTA_RATE_LIMIT_BYTES_PER_SECOND
+#define OTA_RATE_LIMIT_BYTES_PER_SECOND 16384
+#endif
+	//the IoT Hub client needs this much heap to send and reconnect
+#ifndef OTA_HEAP_RESERVE
+#define OTA_HEAP_RESERVE 40000
+#endif
+	//a telemetry send window never blocks the download longer than this
+#define OTA_TELEMETRY_WINDOW_MAX_US 3000000
+	//below azure_task
+#define OTA_TASK_PRIORITY 4
+
+	void ota_scheduler_begin();
+	//called by the download for every received block, blocks while the download has to give way
+	void ota_scheduler_throttle(size_t bytes);
+	//the telemetry loop opens a window when it sends, the window closes with the confirmation of the message that opened it
+	//or after OTA_TELEMETRY_WINDOW_MAX_US. returns the window the message opened, 0 when one was open already
+	uint32_t ota_scheduler_telemetry_begin();
+	//the confirmation of a message, with what ota_scheduler_telemetry_begin returned for it
+	void ota_scheduler_telemetry_end(uint32_t window);
+	//bytes per second of the running or the last download
+	uint32_t ota_scheduler_throughput();
+	//replaces OTA_RATE_LIMIT_BYTES_PER_SECOND and OTA_HEAP_RESERVE until the next boot, a running download follows right away
+	void ota_scheduler_set_limits(uint32_t rateLimit, uint32_t heapReserve);
+	void ota_scheduler_get_limits(uint32_t *rateLimit, uint32_t *heapReserve);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OTA_SCHEDULER_H */
@@ -0,0 +1,116 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <string.h>
+#include "esp_log.h"
+#include "nvs.h"
+#include "ota_state.h"
+
+#define TAG "ota_state"
+
+#define OTA_STATE_NAMESPACE "ota"
+#define OTA_STATE_KEY "state"
+#define OTA_OFFSET_KEY "offset"
+#define OTA_ETAG_KEY "etag"
+#define OTA_LAST_MODIFIED_KEY "lastmod"
+#define OTA_STATE_VERSION 1
+
+bool ota_state_load(OTA_STATE *state, uint32_t *committedOffset)
+{
+	nvs_handle handle;
+	if (nvs_open(OTA_STATE_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+		return false;
+
+	size_t length = sizeof(*state);
+	bool isValid = nvs_get_blob(handle, OTA_STATE_KEY, state, &length) == ESP_OK
+		&& length == sizeof(*state)
+		&& state->version == OTA_STATE_VERSION
+		&& nvs_get_u32(handle, OTA_OFFSET_KEY, committedOffset) == ESP_OK
+		&& *committedOffset <= state->blobSize;
+	state->blobName[sizeof(state->blobName) - 1] = '\0';
+
+	nvs_close(handle);
+	return isValid;
+}
+
+esp_err_t ota_state_save(const OTA_STATE *state)
+{
+	nvs_handle handle;
+	esp_err_t err = nvs_open(OTA_STATE_NAMESPACE, NVS_READWRITE, &handle);
+	if (err != ESP_OK)
+		return err;
+
+	OTA_STATE versioned = *state;
+	versioned.version = OTA_STATE_VERSION;
+	err = nvs_set_blob(handle, OTA_STATE_KEY, &versioned, sizeof(versioned));
+	if (err == ESP_OK)
+		err = nvs_set_u32(handle, OTA_OFFSET_KEY, 0);
+	if (err == ESP_OK)
+		err = nvs_commit(handle);
+
+	nvs_close(handle);
+	if (err != ESP_OK)
+		ESP_LOGE(TAG, "Saving the OTA state failed, err=0x%x", err);
+	return err;
+}
+
+esp_err_t ota_state_commit_offset(uint32_t committedOffset)
+{
+	nvs_handle handle;
+	esp_err_t err = nvs_open(OTA_STATE_NAMESPACE, NVS_READWRITE, &handle);
+	if (err != ESP_OK)
+		return err;
+
+	err = nvs_set_u32(handle, OTA_OFFSET_KEY, committedOffset);
+	if (err == ESP_OK)
+		err = nvs_commit(handle);
+
+	nvs_close(handle);
+	return err;
+}
+
+void ota_state_clear()
+{
+	nvs_handle handle;
+	if (nvs_open(OTA_STATE_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+		return;
+
+	nvs_erase_key(handle, OTA_STATE_KEY);
+	nvs_erase_key(handle, OTA_OFFSET_KEY);
+	nvs_commit(handle);
+	nvs_close(handle);
+}
+
+void ota_state_load_validators(char *etag, size_t etagSize, char *lastModified, size_t lastModifiedSize)
+{
+	etag[0] = '\0';
+	lastModified[0] = '\0';
+
+	nvs_handle handle;
+	if (nvs_open(OTA_STATE_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+		return;
+
+	if (nvs_get_str(handle, OTA_ETAG_KEY, etag, &etagSize) != ESP_OK)
+		etag[0] = '\0';
+	if (nvs_get_str(handle, OTA_LAST_MODIFIED_KEY, lastModified, &lastModifiedSize) != ESP_OK)
+		lastModified[0] = '\0';
+	nvs_close(handle);
+}
+
+void ota_state_save_validators(const char *etag, const char *lastModified)
+{
+	nvs_handle handle;
+	if (nvs_open(OTA_STATE_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+		return;
+
+	//the flash is written only when a validator changed
+	char stored[64];
+	size_t length = sizeof(stored);
+	if (nvs_get_str(handle, OTA_ETAG_KEY, stored, &length) != ESP_OK || strcmp(stored, etag) != 0)
+		nvs_set_str(handle, OTA_ETAG_KEY, etag);
+	length = sizeof(stored);
+	if (nvs_get_str(handle, OTA_LAST_MODIFIED_KEY, stored, &length) != ESP_OK || strcmp(stored, lastModified) != 0)
+		nvs_set_str(handle, OTA_LAST_MODIFIED_KEY, lastModified);
+	nvs_commit(handle);
+	nvs_close(handle);
+}
@@ -0,0 +1,43 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef OTA_STATE_H
+#define OTA_STATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OTA_STATE_BLOB_NAME_LENGTH 128
+
+	//the download in progress, kept in NVS so it survives a reboot or a lost connection
+	typedef struct OTA_STATE_TAG
+	{
+		uint32_t version;
+		char blobName[OTA_STATE_BLOB_NAME_LENGTH];
+		uint32_t blobSize;
+		uint8_t sha256[32];
+		uint8_t hasSha256;
+		uint32_t partitionAddress;
+	} OTA_STATE;
+
+	bool ota_state_load(OTA_STATE *state, uint32_t *committedOffset);
+	esp_err_t ota_state_save(const OTA_STATE *state);
+	//checkpoint the verified part of the image, called at sector boundaries
+	esp_err_t ota_state_commit_offset(uint32_t committedOffset);
+	void ota_state_clear();
+
+	//the ETag and Last-Modified of the last firmware manifest that needed no update, empty strings when there are none
+	void ota_state_load_validators(char *etag, size_t etagSize, char *lastModified, size_t lastModifiedSize);
+	void ota_state_save_validators(const char *etag, const char *lastModified);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OTA_STATE_H */
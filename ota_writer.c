@@ -0,0 +1,131 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_spi_flash.h"
+#include "esp_timer.h"
+#include "ota_writer.h"
+
+#define TAG "ota_writer"
+
+static const esp_partition_t *g_partition = NULL;
+static size_t g_imageSize = 0;
+static size_t g_flushedOffset = 0;
+//the image bytes from g_flushedOffset that do not fill a sector yet
+static unsigned char g_sector[SPI_FLASH_SEC_SIZE];
+static size_t g_sectorLength = 0;
+static OTA_WRITER_STATS g_stats;
+
+esp_err_t ota_writer_begin(const esp_partition_t *partition, size_t imageSize, size_t offset)
+{
+	if (partition == NULL || imageSize > partition->size || (offset % SPI_FLASH_SEC_SIZE != 0 && offset != imageSize) || offset > imageSize)
+	{
+		ESP_LOGE(TAG, "Invalid image size %u or offset %u", imageSize, offset);
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	g_partition = partition;
+	g_imageSize = imageSize;
+	g_flushedOffset = offset; //the sector at offset may hold a partial write of the interrupted download, it is erased again
+	g_sectorLength = 0;
+	memset(&g_stats, 0, sizeof(g_stats));
+	return ESP_OK;
+}
+
+//erase the sectors of length bytes at g_flushedOffset and write them, length is a sector multiple except at the image end
+static esp_err_t flush(const void *data, size_t length)
+{
+	size_t eraseLength = (length + SPI_FLASH_SEC_SIZE - 1) & ~(size_t)(SPI_FLASH_SEC_SIZE - 1);
+	int64_t start = esp_timer_get_time();
+	esp_err_t err = esp_partition_erase_range(g_partition, g_flushedOffset, eraseLength);
+	int64_t erased = esp_timer_get_time();
+	g_stats.eraseTime += erased - start;
+	if (err != ESP_OK)
+	{
+		ESP_LOGE(TAG, "Erase of %u bytes at 0x%x failed, err=0x%x", eraseLength, g_flushedOffset, err);
+		return err;
+	}
+	g_stats.erases += eraseLength / SPI_FLASH_SEC_SIZE;
+
+	err = esp_partition_write(g_partition, g_flushedOffset, data, length);
+	g_stats.writeTime += esp_timer_get_time() - erased;
+	if (err != ESP_OK)
+	{
+		ESP_LOGE(TAG, "Write of %u bytes at 0x%x failed, err=0x%x", length, g_flushedOffset, err);
+		return err;
+	}
+	g_stats.writes++;
+	g_stats.bytes += length;
+	g_flushedOffset += length;
+	return ESP_OK;
+}
+
+esp_err_t ota_writer_write(const void *data, size_t length)
+{
+	if (g_partition == NULL)
+		return ESP_ERR_INVALID_STATE;
+	if (length > g_imageSize - ota_writer_offset())
+		return ESP_ERR_INVALID_SIZE;
+
+	const unsigned char *input = (const unsigned char *)data;
+	while (length > 0)
+	{
+		esp_err_t err = ESP_OK;
+		size_t used = 0;
+		if (g_sectorLength == 0 && length >= SPI_FLASH_SEC_SIZE)
+		{
+			//whole sectors go to flash without the copy
+			used = length & ~(size_t)(SPI_FLASH_SEC_SIZE - 1);
+			err = flush(input, used);
+		}
+		else
+		{
+			used = SPI_FLASH_SEC_SIZE - g_sectorLength < length ? SPI_FLASH_SEC_SIZE - g_sectorLength : length;
+			memcpy(g_sector + g_sectorLength, input, used);
+			g_sectorLength += used;
+			if (g_sectorLength == SPI_FLASH_SEC_SIZE || g_flushedOffset + g_sectorLength == g_imageSize)
+			{
+				err = flush(g_sector, g_sectorLength);
+				if (err == ESP_OK)
+					g_sectorLength = 0;
+			}
+		}
+		if (err != ESP_OK)
+			return err;
+		input += used;
+		length -= used;
+	}
+	return ESP_OK;
+}
+
+size_t ota_writer_offset()
+{
+	return g_flushedOffset + g_sectorLength;
+}
+
+size_t ota_writer_committed_offset()
+{
+	return g_flushedOffset;
+}
+
+esp_err_t ota_writer_end()
+{
+	if (g_partition == NULL)
+		return ESP_ERR_INVALID_STATE;
+
+	esp_err_t err = g_flushedOffset == g_imageSize ? ESP_OK : ESP_ERR_INVALID_SIZE;
+	if (g_stats.bytes > 0)
+	{
+		ESP_LOGI(TAG, "Flash: %u bytes in %u writes and %u sector erases, %d ms write and %d ms erase per MB", g_stats.bytes, g_stats.writes, g_stats.erases,
+			(int)(g_stats.writeTime * 1024 * 1024 / 1000 / (int64_t)g_stats.bytes), (int)(g_stats.eraseTime * 1024 * 1024 / 1000 / (int64_t)g_stats.bytes));
+	}
+	g_partition = NULL;
+	g_sectorLength = 0;
+	return err;
+}
+
+void ota_writer_get_stats(OTA_WRITER_STATS *stats)
+{
+	*stats = g_stats;
+}
@@ -0,0 +1,48 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef OTA_WRITER_H
+#define OTA_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * Sequential image writer on top of esp_partition_write.
+	 * Unlike esp_ota_begin, nothing is erased up front: every sector is erased right before the
+	 * first write into it, so a download can continue at any sector aligned offset of a partially written image,
+	 * or at its end when the power went after the last sector but before the image was made bootable.
+	 * Writes of any size are collected in a sector buffer, flash only sees whole sector erases and writes,
+	 * except for the last sector of the image.
+	 */
+	typedef struct OTA_WRITER_STATS
+	{
+		uint32_t writes;
+		uint32_t erases; //sectors
+		size_t bytes;
+		int64_t writeTime; //us
+		int64_t eraseTime; //us
+	} OTA_WRITER_STATS;
+
+	esp_err_t ota_writer_begin(const esp_partition_t *partition, size_t imageSize, size_t offset);
+	esp_err_t ota_writer_write(const void *data, size_t length);
+	//the image end offset written so far, including the bytes that wait in the sector buffer
+	size_t ota_writer_offset();
+	//the offset up to which the image is completely on flash, sector aligned except at the image end
+	size_t ota_writer_committed_offset();
+	//a partial last sector is dropped unless the image is complete, a resumed download writes it again
+	esp_err_t ota_writer_end();
+	//the flash operations since ota_writer_begin
+	void ota_writer_get_stats(OTA_WRITER_STATS *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OTA_WRITER_H */
@@ -0,0 +1,135 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_freertos_hooks.h"
+#include "esp_log.h"
+#include "runtime_stats.h"
+
+#define TAG "RuntimeStats"
+
+//ticks in which the idle task of the core was running, 32 bit so the other core reads them whole
+static volatile uint32_t g_idleTicks[portNUM_PROCESSORS];
+static uint32_t g_windowIdleTicks[portNUM_PROCESSORS];
+static TickType_t g_windowBeginTick;
+
+#if (configUSE_TRACE_FACILITY == 1) && (configGENERATE_RUN_TIME_STATS == 1)
+#define HAS_TASK_RUNTIME 1
+static TaskStatus_t g_tasks[RUNTIME_STATS_MAX_TASKS];
+static UBaseType_t g_previousTaskNumber[RUNTIME_STATS_MAX_TASKS];
+static uint32_t g_previousRunTime[RUNTIME_STATS_MAX_TASKS];
+static int g_previousTaskCount;
+static uint32_t g_previousTotalRunTime;
+#endif
+
+//the idle time is sampled on the tick of each core, an idle hook would have to keep the idle task out of WFI to measure it
+static void tick_hook(int core)
+{
+	if (xTaskGetCurrentTaskHandleForCPU(core) == xTaskGetIdleTaskHandleForCPU(core))
+		++g_idleTicks[core];
+}
+
+static void tick_hook_core0()
+{
+	tick_hook(0);
+}
+
+#if portNUM_PROCESSORS > 1
+static void tick_hook_core1()
+{
+	tick_hook(1);
+}
+#endif
+
+void runtime_stats_init(void)
+{
+	g_windowBeginTick = xTaskGetTickCount();
+	esp_register_freertos_tick_hook_for_cpu(tick_hook_core0, 0);
+#if portNUM_PROCESSORS > 1
+	esp_register_freertos_tick_hook_for_cpu(tick_hook_core1, 1);
+#endif
+}
+
+#ifdef HAS_TASK_RUNTIME
+static uint32_t previous_run_time(UBaseType_t taskNumber)
+{
+	for (int i = 0; i < g_previousTaskCount; ++i)
+	{
+		if (g_previousTaskNumber[i] == taskNumber)
+			return g_previousRunTime[i];
+	}
+	return 0;
+}
+#endif
+
+#define APPEND(...) do { \
+		int n = snprintf(buffer + length, size - length, __VA_ARGS__); \
+		if (n < 0 || (size_t)n >= size - length) return -1; \
+		length += n; \
+	} while (0)
+
+int runtime_stats_format(char *buffer, size_t size, const char *deviceId)
+{
+	size_t length = 0;
+	int64_t now = esp_timer_get_time();
+	TickType_t nowTick = xTaskGetTickCount();
+	uint32_t windowTicks = (uint32_t)(nowTick - g_windowBeginTick);
+	g_windowBeginTick = nowTick;
+	if (windowTicks == 0)
+		windowTicks = 1;
+
+	APPEND("{\"deviceId\":\"%s\",\"uptime\":%u,\"cpuLoad\":[", deviceId, (unsigned int)(now / 1000000));
+	for (int core = 0; core < portNUM_PROCESSORS; ++core)
+	{
+		uint32_t idle = g_idleTicks[core];
+		uint32_t windowIdle = idle - g_windowIdleTicks[core];
+		g_windowIdleTicks[core] = idle;
+		int load = 100 - (int)((uint64_t)windowIdle * 100 / windowTicks);
+		APPEND("%s%d", core == 0 ? "" : ",", load < 0 ? 0 : load);
+	}
+
+	//fragmentation is the part of the free heap that can not be returned by a single allocation
+	size_t freeHeap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+	size_t largestFreeBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+	unsigned int fragmentation = freeHeap == 0 ? 0 : (unsigned int)(100 - largestFreeBlock * 100 / freeHeap);
+
+	APPEND("],\"freeHeap\":%u,\"minFreeHeap\":%u,\"largestFreeBlock\":%u,\"heapFragmentation\":%u,\"tasks\":[",
+		(unsigned int)freeHeap, (unsigned int)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT), (unsigned int)largestFreeBlock, fragmentation);
+
+#ifdef HAS_TASK_RUNTIME
+	uint32_t totalRunTime = 0;
+	UBaseType_t taskCount = uxTaskGetSystemState(g_tasks, RUNTIME_STATS_MAX_TASKS, &totalRunTime);
+	//the run time counter of each core advances with the total run time, so a task that owns a full core for the window gets 100%
+	uint32_t windowRunTime = (totalRunTime - g_previousTotalRunTime) * portNUM_PROCESSORS;
+	if (windowRunTime == 0)
+		windowRunTime = 1;
+
+	for (UBaseType_t i = 0; i < taskCount; ++i)
+	{
+		uint32_t taskRunTime = g_tasks[i].ulRunTimeCounter - previous_run_time(g_tasks[i].xTaskNumber);
+		APPEND("%s{\"name\":\"%s\",\"cpu\":%u,\"stackFree\":%u}", i == 0 ? "" : ",",
+			g_tasks[i].pcTaskName, (unsigned int)((uint64_t)taskRunTime * 100 / windowRunTime), (unsigned int)g_tasks[i].usStackHighWaterMark);
+	}
+
+	for (UBaseType_t i = 0; i < taskCount; ++i)
+	{
+		g_previousTaskNumber[i] = g_tasks[i].xTaskNumber;
+		g_previousRunTime[i] = g_tasks[i].ulRunTimeCounter;
+	}
+	g_previousTaskCount = taskCount;
+	g_previousTotalRunTime = totalRunTime;
+#else
+	//without CONFIG_FREERTOS_USE_TRACE_FACILITY and CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS only the calling task is visible
+	APPEND("{\"name\":\"%s\",\"stackFree\":%u}", pcTaskGetTaskName(NULL), (unsigned int)uxTaskGetStackHighWaterMark(NULL));
+#endif
+
+	APPEND("]}");
+	return (int)length;
+}
@@ -0,0 +1,26 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef RUNTIME_STATS_H
+#define RUNTIME_STATS_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//number of main loop cycles between two runtime statistics telemetry messages
+#define RUNTIME_STATS_PERIOD 60
+#define RUNTIME_STATS_MAX_TASKS 24
+
+	//register the idle hooks of both cores, call once before the first runtime_stats_format
+	void runtime_stats_init(void);
+	//format the statistics of the window since the previous call as a JSON telemetry message, returns the length or -1 if the buffer is too small
+	int runtime_stats_format(char *buffer, size_t size, const char *deviceId);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RUNTIME_STATS_H */
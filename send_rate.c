@@ -0,0 +1,47 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <string.h>
+#include "send_rate.h"
+
+void send_rate_init(SEND_RATE_CONTROLLER *controller)
+{
+	memset(controller, 0, sizeof(*controller));
+}
+
+int send_rate_interval(int activeMessages, int capacity)
+{
+	if (activeMessages >= capacity) //no free message slot, keep aggregating
+		return 0;
+	if (activeMessages < capacity / 4)
+		return 1;
+	if (activeMessages < capacity / 2)
+		return 2;
+	if (activeMessages < capacity * 3 / 4)
+		return 4;
+	return SEND_RATE_MAX_INTERVAL;
+}
+
+bool send_rate_add_sample(SEND_RATE_CONTROLLER *controller, const uint32_t values[SEND_RATE_CHANNELS], int activeMessages, int capacity)
+{
+	for (int i = 0; i < SEND_RATE_CHANNELS; ++i)
+	{
+		controller->sums[i] += values[i];
+	}
+	controller->sampleCount++;
+	controller->cyclesSinceSend++;
+
+	int interval = send_rate_interval(activeMessages, capacity);
+	return interval != 0 && controller->cyclesSinceSend >= interval;
+}
+
+uint32_t send_rate_take(SEND_RATE_CONTROLLER *controller, uint32_t averages[SEND_RATE_CHANNELS])
+{
+	uint32_t count = controller->sampleCount;
+	for (int i = 0; i < SEND_RATE_CHANNELS; ++i)
+	{
+		averages[i] = count == 0 ? 0 : (uint32_t)(controller->sums[i] / count);
+	}
+	send_rate_init(controller);
+	return count;
+}
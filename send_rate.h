@@ -0,0 +1,42 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef SEND_RATE_H
+#define SEND_RATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SEND_RATE_CHANNELS 3
+//the longest send interval, in main loop cycles, used when the in-flight window is almost full
+#define SEND_RATE_MAX_INTERVAL 8
+
+	/*
+	 * Adaptive telemetry rate controller.
+	 * While the number of unacknowledged messages grows, readings are aggregated locally
+	 * and a message is produced only every 2, 4 or 8 cycles, so the hub has a chance to catch up.
+	 */
+	typedef struct SEND_RATE_CONTROLLER_TAG
+	{
+		int cyclesSinceSend;
+		uint32_t sampleCount;
+		uint64_t sums[SEND_RATE_CHANNELS];
+	} SEND_RATE_CONTROLLER;
+
+	void send_rate_init(SEND_RATE_CONTROLLER *controller);
+	//number of cycles between two messages for the given in-flight count and capacity, 0 when no message must be produced at all
+	int send_rate_interval(int activeMessages, int capacity);
+	//add one reading, returns true when a message should be sent now
+	bool send_rate_add_sample(SEND_RATE_CONTROLLER *controller, const uint32_t values[SEND_RATE_CHANNELS], int activeMessages, int capacity);
+	//get the average of the aggregated readings and restart the aggregation, returns the number of aggregated readings
+	uint32_t send_rate_take(SEND_RATE_CONTROLLER *controller, uint32_t averages[SEND_RATE_CHANNELS]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SEND_RATE_H */
@@ -0,0 +1,35 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include "telemetry.h"
+
+static int checked_length(int length, size_t size)
+{
+	return length < 0 || (size_t)length >= size ? -1 : length;
+}
+
+int telemetry_add_readings(SEND_RATE_CONTROLLER *sendRate, const uint32_t readings[SEND_RATE_CHANNELS], int activeMessages,
+	const char *deviceId, char *buffer, size_t size, uint32_t averages[SEND_RATE_CHANNELS])
+{
+	//when the hub does not keep up, aggregate the readings and send less often instead of piling up messages
+	if (!send_rate_add_sample(sendRate, readings, activeMessages, TELEMETRY_WINDOW))
+		return 0;
+
+	uint32_t samples = send_rate_take(sendRate, averages);
+	int length = snprintf(buffer, size, "{\"deviceId\":\"%s\",\"watertemperature1\":%u,\"watertemperature2\":%u,\"current\":%u,\"samples\":%u}",
+		deviceId, averages[0], averages[1], averages[2], samples);
+	return checked_length(length, size);
+}
+
+bool telemetry_should_report(int activeMessages)
+{
+	return activeMessages < TELEMETRY_WINDOW / 4;
+}
+
+int telemetry_format_reported_state(char *buffer, size_t size, const TELEMETRY_REPORTED_STATE *state)
+{
+	int length = snprintf(buffer, size, "{\"firmwareVersion\":\"%s\",\"currentUpdateOffset\":%u,\"currentUpdateProgress\":%u,\"updateThroughput\":%u,\"onProbation\":%s }",
+		state->firmwareVersion, state->updateOffset, state->updateProgress, state->updateThroughput, state->onProbation ? "true" : "false");
+	return checked_length(length, size);
+}
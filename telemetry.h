@@ -0,0 +1,48 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "send_rate.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//the in-flight window of the main loop, the number of telemetry messages that wait for their ack at most
+#define TELEMETRY_WINDOW 128
+//a buffer of this size fits every message of telemetry_add_readings, deviceIdSize counts the terminator of the id
+#define TELEMETRY_MESSAGE_SIZE(deviceIdSize) ((deviceIdSize) + 119)
+
+	/*
+	 * The messages of the main loop, shared with the host load generator (tools/telemetry_load) so a virtual fleet
+	 * sends what the devices send. A loop cycle adds its readings with telemetry_add_readings, the reported state
+	 * follows when telemetry_should_report allows it.
+	 */
+	typedef struct TELEMETRY_REPORTED_STATE_TAG
+	{
+		const char *firmwareVersion;
+		uint32_t updateOffset;
+		uint32_t updateProgress;
+		uint32_t updateThroughput;
+		bool onProbation;
+	} TELEMETRY_REPORTED_STATE;
+
+	//adds the readings of a cycle to the send rate controller. when a message is due it is formatted into buffer and
+	//its averages are returned, returns the length, 0 when no message is due and -1 when it does not fit
+	int telemetry_add_readings(SEND_RATE_CONTROLLER *sendRate, const uint32_t readings[SEND_RATE_CHANNELS], int activeMessages,
+		const char *deviceId, char *buffer, size_t size, uint32_t averages[SEND_RATE_CHANNELS]);
+	//the reported state is not critical, it is skipped while telemetry is backed up
+	bool telemetry_should_report(int activeMessages);
+	//returns the length or -1 if the buffer is too small
+	int telemetry_format_reported_state(char *buffer, size_t size, const TELEMETRY_REPORTED_STATE *state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TELEMETRY_H */
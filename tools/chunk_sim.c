@@ -0,0 +1,185 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/*
+ * Host side simulation of the chunked OTA download, compares the chunk size controller (see ota_chunk_control.h)
+ * with the previous fixed factor heuristic over links with different latency, bandwidth and loss.
+ *   chunk_sim                                       the built in scenarios
+ *   chunk_sim <rtt ms> <KB/s> <loss per byte>       one link
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "../ota_chunk_control.h"
+
+#define IMAGE_SIZE (1024 * 1024)
+#define MIN_CHUNK_SIZE 128
+#define MAX_CHUNK_SIZE 4096
+#define INITIAL_CHUNK_SIZE 512
+//consecutive failed chunks that abort the download, nMaxDownloadPacketRetries
+#define MAX_RETRIES 20
+//HTTP headers of a request and its response
+#define REQUEST_OVERHEAD 600
+#define RUNS 50
+
+typedef struct LINK_TAG
+{
+	const char *name;
+	double rttMs;
+	double kBytesPerSecond;
+	double lossPerByte;
+} LINK;
+
+typedef struct RESULT_TAG
+{
+	double seconds;
+	int requests;
+	int aborts;
+} RESULT;
+
+static double uniform()
+{
+	return (rand() + 0.5) / ((double)RAND_MAX + 1);
+}
+
+//one request, returns its time in us and whether the chunk arrived intact
+static double transfer(const LINK *link, size_t chunkSize, int *isOk)
+{
+	double wireBytes = chunkSize * 4.0 / 3 + REQUEST_OVERHEAD; //base64
+	double rttUs = link->rttMs * 1000 * (0.8 + 0.4 * uniform());
+	*isOk = uniform() < pow(1 - link->lossPerByte, wireBytes);
+	return rttUs + wireBytes * 1000 / link->kBytesPerSecond;
+}
+
+//the heuristic that download_chunked used before the controller
+static RESULT run_fixed_factor(const LINK *link)
+{
+	RESULT result = { 0, 0, 0 };
+	size_t chunkSize = INITIAL_CHUNK_SIZE, maxChunkSize = MAX_CHUNK_SIZE, offset = 0;
+	int noErrorCounter = 0, retries = 0;
+	while (offset < IMAGE_SIZE)
+	{
+		size_t size = IMAGE_SIZE - offset < chunkSize ? IMAGE_SIZE - offset : chunkSize;
+		int isOk;
+		result.seconds += transfer(link, size, &isOk) / 1e6;
+		++result.requests;
+		if (isOk)
+		{
+			offset += size;
+			retries = 0;
+		}
+		else if (++retries >= MAX_RETRIES)
+		{
+			++result.aborts; //the device gives up, the next attempt resumes
+			retries = 0;
+		}
+
+		if (retries == 0)
+		{
+			if (++noErrorCounter > 10)
+			{
+				maxChunkSize = maxChunkSize * 1.5;
+				if (maxChunkSize > MAX_CHUNK_SIZE)
+					maxChunkSize = MAX_CHUNK_SIZE;
+				noErrorCounter = 0;
+			}
+			if (chunkSize < maxChunkSize)
+				chunkSize *= 1.5;
+			if (chunkSize > maxChunkSize)
+				chunkSize = maxChunkSize;
+		}
+		if (retries > 0)
+			noErrorCounter = 0;
+		if (retries > 10)
+		{
+			chunkSize /= 2;
+			if (chunkSize < MIN_CHUNK_SIZE)
+				chunkSize = MIN_CHUNK_SIZE;
+			maxChunkSize = chunkSize;
+		}
+	}
+	return result;
+}
+
+static RESULT run_controller(const LINK *link)
+{
+	RESULT result = { 0, 0, 0 };
+	OTA_CHUNK_CONTROL control;
+	ota_chunk_control_init(&control, MIN_CHUNK_SIZE, MAX_CHUNK_SIZE, INITIAL_CHUNK_SIZE);
+	size_t offset = 0;
+	int retries = 0;
+	while (offset < IMAGE_SIZE)
+	{
+		size_t size = IMAGE_SIZE - offset < control.chunkSize ? IMAGE_SIZE - offset : control.chunkSize;
+		int isOk;
+		double us = transfer(link, size, &isOk);
+		result.seconds += us / 1e6;
+		++result.requests;
+		if (isOk)
+		{
+			ota_chunk_control_success(&control, size, (uint32_t)us);
+			offset += size;
+			retries = 0;
+		}
+		else
+		{
+			ota_chunk_control_failure(&control, size);
+			if (++retries >= MAX_RETRIES)
+			{
+				++result.aborts;
+				retries = 0;
+			}
+		}
+	}
+	return result;
+}
+
+static void simulate(const LINK *link)
+{
+	RESULT fixed = { 0, 0, 0 }, controlled = { 0, 0, 0 };
+	for (int run = 0; run < RUNS; ++run)
+	{
+		srand(run);
+		RESULT r = run_fixed_factor(link);
+		fixed.seconds += r.seconds / RUNS;
+		fixed.requests += r.requests;
+		fixed.aborts += r.aborts;
+
+		srand(run);
+		r = run_controller(link);
+		controlled.seconds += r.seconds / RUNS;
+		controlled.requests += r.requests;
+		controlled.aborts += r.aborts;
+	}
+	printf("%-12s %5.0fms %6.0fKB/s %8.0e | %8.1fs %6d %4d | %8.1fs %6d %4d | %+6.1f%%\n",
+		link->name, link->rttMs, link->kBytesPerSecond, link->lossPerByte,
+		fixed.seconds, fixed.requests / RUNS, fixed.aborts,
+		controlled.seconds, controlled.requests / RUNS, controlled.aborts,
+		(fixed.seconds - controlled.seconds) * 100 / fixed.seconds);
+}
+
+int main(int argc, char *argv[])
+{
+	static const LINK links[] =
+	{
+		{ "clean", 50, 200, 0 },
+		{ "slow", 300, 30, 1e-6 },
+		{ "lossy", 100, 100, 5e-5 },
+		{ "very lossy", 200, 50, 3e-4 },
+		{ "mid", 80, 150, 1e-4 },
+		{ "weak", 250, 20, 1e-3 },
+	};
+
+	printf("1MB image, %d runs each. time, requests per run and aborted attempts\n", RUNS);
+	printf("%-12s %7s %11s %8s | %-21s | %-21s | %s\n", "link", "rtt", "bandwidth", "loss", "fixed factor", "controller", "faster");
+	if (argc == 4)
+	{
+		LINK link = { "custom", atof(argv[1]), atof(argv[2]), atof(argv[3]) };
+		simulate(&link);
+		return 0;
+	}
+	for (size_t i = 0; i < sizeof(links) / sizeof(links[0]); ++i)
+		simulate(&links[i]);
+	return 0;
+}
@@ -0,0 +1,248 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <string.h>
+#include "digest.h"
+
+#define ROTATE_LEFT(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTATE_RIGHT(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t g_md5Sines[64] =
+{
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const unsigned char g_md5Shifts[64] =
+{
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+static const uint32_t g_sha256Constants[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void md5_block(uint32_t state[4], const unsigned char block[64])
+{
+	uint32_t words[16];
+	for (int i = 0; i < 16; i++)
+		words[i] = (uint32_t)block[i * 4] | (uint32_t)block[i * 4 + 1] << 8 | (uint32_t)block[i * 4 + 2] << 16 | (uint32_t)block[i * 4 + 3] << 24;
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	for (int i = 0; i < 64; i++)
+	{
+		uint32_t f;
+		int g;
+		if (i < 16)
+		{
+			f = (b & c) | (~b & d);
+			g = i;
+		}
+		else if (i < 32)
+		{
+			f = (d & b) | (~d & c);
+			g = (5 * i + 1) % 16;
+		}
+		else if (i < 48)
+		{
+			f = b ^ c ^ d;
+			g = (3 * i + 5) % 16;
+		}
+		else
+		{
+			f = c ^ (b | ~d);
+			g = (7 * i) % 16;
+		}
+		uint32_t rotated = a + f + g_md5Sines[i] + words[g];
+		a = d;
+		d = c;
+		c = b;
+		b += ROTATE_LEFT(rotated, g_md5Shifts[i]);
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+}
+
+static void sha256_block(uint32_t state[8], const unsigned char block[64])
+{
+	uint32_t words[64];
+	for (int i = 0; i < 16; i++)
+		words[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+	for (int i = 16; i < 64; i++)
+	{
+		uint32_t s0 = ROTATE_RIGHT(words[i - 15], 7) ^ ROTATE_RIGHT(words[i - 15], 18) ^ (words[i - 15] >> 3);
+		uint32_t s1 = ROTATE_RIGHT(words[i - 2], 17) ^ ROTATE_RIGHT(words[i - 2], 19) ^ (words[i - 2] >> 10);
+		words[i] = words[i - 16] + s0 + words[i - 7] + s1;
+	}
+
+	uint32_t v[8];
+	memcpy(v, state, sizeof(v));
+	for (int i = 0; i < 64; i++)
+	{
+		uint32_t s1 = ROTATE_RIGHT(v[4], 6) ^ ROTATE_RIGHT(v[4], 11) ^ ROTATE_RIGHT(v[4], 25);
+		uint32_t choice = (v[4] & v[5]) ^ (~v[4] & v[6]);
+		uint32_t temp1 = v[7] + s1 + choice + g_sha256Constants[i] + words[i];
+		uint32_t s0 = ROTATE_RIGHT(v[0], 2) ^ ROTATE_RIGHT(v[0], 13) ^ ROTATE_RIGHT(v[0], 22);
+		uint32_t majority = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+		memmove(v + 1, v, 7 * sizeof(uint32_t));
+		v[4] += temp1;
+		v[0] = temp1 + s0 + majority;
+	}
+	for (int i = 0; i < 8; i++)
+		state[i] += v[i];
+}
+
+//both digests use 64 byte blocks, they differ in the block function and the byte order of the length
+static void update_blocks(uint32_t *state, uint64_t *total, unsigned char *block, const void *data, size_t length, void (*process)(uint32_t *, const unsigned char *))
+{
+	const unsigned char *input = (const unsigned char *)data;
+	size_t used = (size_t)(*total % 64);
+	*total += length;
+	while (length > 0)
+	{
+		size_t copied = 64 - used < length ? 64 - used : length;
+		memcpy(block + used, input, copied);
+		used += copied;
+		input += copied;
+		length -= copied;
+		if (used == 64)
+		{
+			process(state, block);
+			used = 0;
+		}
+	}
+}
+
+static void pad_blocks(uint32_t *state, uint64_t total, unsigned char *block, int isBigEndian, void (*process)(uint32_t *, const unsigned char *))
+{
+	size_t used = (size_t)(total % 64);
+	block[used++] = 0x80;
+	if (used > 56)
+	{
+		memset(block + used, 0, 64 - used);
+		process(state, block);
+		used = 0;
+	}
+	memset(block + used, 0, 56 - used);
+	uint64_t bits = total * 8;
+	for (int i = 0; i < 8; i++)
+		block[56 + i] = (unsigned char)(bits >> (isBigEndian ? 56 - 8 * i : 8 * i));
+	process(state, block);
+}
+
+static void md5_process(uint32_t *state, const unsigned char *block)
+{
+	md5_block(state, block);
+}
+
+static void sha256_process(uint32_t *state, const unsigned char *block)
+{
+	sha256_block(state, block);
+}
+
+void digest_md5_init(DIGEST_MD5 *md5)
+{
+	md5->state[0] = 0x67452301;
+	md5->state[1] = 0xefcdab89;
+	md5->state[2] = 0x98badcfe;
+	md5->state[3] = 0x10325476;
+	md5->length = 0;
+}
+
+void digest_md5_update(DIGEST_MD5 *md5, const void *data, size_t length)
+{
+	update_blocks(md5->state, &md5->length, md5->block, data, length, md5_process);
+}
+
+void digest_md5_finish(DIGEST_MD5 *md5, unsigned char digest[16])
+{
+	pad_blocks(md5->state, md5->length, md5->block, 0, md5_process);
+	for (int i = 0; i < 16; i++)
+		digest[i] = (unsigned char)(md5->state[i / 4] >> (8 * (i % 4)));
+}
+
+void digest_md5(const void *data, size_t length, unsigned char digest[16])
+{
+	DIGEST_MD5 md5;
+	digest_md5_init(&md5);
+	digest_md5_update(&md5, data, length);
+	digest_md5_finish(&md5, digest);
+}
+
+void digest_sha256_init(DIGEST_SHA256 *sha256)
+{
+	static const uint32_t initial[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+	memcpy(sha256->state, initial, sizeof(initial));
+	sha256->length = 0;
+}
+
+void digest_sha256_update(DIGEST_SHA256 *sha256, const void *data, size_t length)
+{
+	update_blocks(sha256->state, &sha256->length, sha256->block, data, length, sha256_process);
+}
+
+void digest_sha256_finish(DIGEST_SHA256 *sha256, unsigned char digest[32])
+{
+	pad_blocks(sha256->state, sha256->length, sha256->block, 1, sha256_process);
+	for (int i = 0; i < 32; i++)
+		digest[i] = (unsigned char)(sha256->state[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+void digest_sha256(const void *data, size_t length, unsigned char digest[32])
+{
+	DIGEST_SHA256 sha256;
+	digest_sha256_init(&sha256);
+	digest_sha256_update(&sha256, data, length);
+	digest_sha256_finish(&sha256, digest);
+}
+
+size_t digest_base64(const void *data, size_t length, char *output)
+{
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	const unsigned char *input = (const unsigned char *)data;
+	char *start = output;
+	for (size_t i = 0; i < length; i += 3)
+	{
+		uint32_t triple = (uint32_t)input[i] << 16;
+		if (i + 1 < length)
+			triple |= (uint32_t)input[i + 1] << 8;
+		if (i + 2 < length)
+			triple |= input[i + 2];
+		*output++ = alphabet[(triple >> 18) & 0x3F];
+		*output++ = alphabet[(triple >> 12) & 0x3F];
+		*output++ = i + 1 < length ? alphabet[(triple >> 6) & 0x3F] : '=';
+		*output++ = i + 2 < length ? alphabet[triple & 0x3F] : '=';
+	}
+	*output = '\0';
+	return (size_t)(output - start);
+}
+
+void digest_hex(const unsigned char *data, size_t length, char *output)
+{
+	static const char digits[] = "0123456789abcdef";
+	for (size_t i = 0; i < length; i++)
+	{
+		*output++ = digits[data[i] >> 4];
+		*output++ = digits[data[i] & 0xF];
+	}
+	*output = '\0';
+}
@@ -0,0 +1,52 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * MD5 and SHA-256 for the host tools, the device uses mbedtls for the same digests.
+	 * Content-MD5 of the chunks and the manifest sha256 are checked against these.
+	 */
+	typedef struct DIGEST_MD5_TAG
+	{
+		uint32_t state[4];
+		uint64_t length;
+		unsigned char block[64];
+	} DIGEST_MD5;
+
+	typedef struct DIGEST_SHA256_TAG
+	{
+		uint32_t state[8];
+		uint64_t length;
+		unsigned char block[64];
+	} DIGEST_SHA256;
+
+	void digest_md5_init(DIGEST_MD5 *md5);
+	void digest_md5_update(DIGEST_MD5 *md5, const void *data, size_t length);
+	void digest_md5_finish(DIGEST_MD5 *md5, unsigned char digest[16]);
+	void digest_md5(const void *data, size_t length, unsigned char digest[16]);
+
+	void digest_sha256_init(DIGEST_SHA256 *sha256);
+	void digest_sha256_update(DIGEST_SHA256 *sha256, const void *data, size_t length);
+	void digest_sha256_finish(DIGEST_SHA256 *sha256, unsigned char digest[32]);
+	void digest_sha256(const void *data, size_t length, unsigned char digest[32]);
+
+	//base64 with padding, output needs DIGEST_BASE64_SIZE(length) bytes including the terminating zero
+#define DIGEST_BASE64_SIZE(length) (((length) + 2) / 3 * 4 + 1)
+	size_t digest_base64(const void *data, size_t length, char *output);
+	//lower case hex, output needs 2 * length + 1 bytes
+	void digest_hex(const unsigned char *data, size_t length, char *output);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DIGEST_H */
@@ -0,0 +1,166 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/*
+ * Host side check of the OTA flash writer (see ota_writer.h) on the fake flash of host/fake_flash.c.
+ * Writes an image in chunks of the sizes the downloads produce, once straight to flash the way the writer
+ * did before it buffered sectors and once through ota_writer, checks the flash content, an interrupted and resumed
+ * write and a resume after the last byte, and compares the flash operations and their simulated time.
+ *   flash_sim
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_spi_flash.h"
+#include "esp_timer.h"
+#include "host/fake_flash.h"
+#include "../ota_writer.h"
+
+#define PARTITION_SIZE (1536 * 1024)
+//not a sector multiple, the last sector is partial
+#define IMAGE_SIZE (1000 * 1000 + 3)
+
+typedef struct SCENARIO_TAG
+{
+	const char *name;
+	size_t minChunk;
+	size_t maxChunk;
+} SCENARIO;
+
+static const SCENARIO g_scenarios[] =
+{
+	{ "raw stream reads", 100, 1460 },
+	{ "chunked base64", 128, 12288 },
+	{ "whole sectors", SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE },
+};
+
+typedef struct RESULT_TAG
+{
+	FAKE_FLASH_STATS flash;
+	int64_t time;
+	int chunks;
+	int isValid;
+} RESULT;
+
+static unsigned char *g_image = NULL;
+
+static size_t next_chunk(const SCENARIO *scenario)
+{
+	return scenario->minChunk + (size_t)rand() % (scenario->maxChunk - scenario->minChunk + 1);
+}
+
+//the writer before it buffered sectors: every chunk goes to flash as it is, a sector is erased at the first write into it
+static int write_unbuffered(const esp_partition_t *partition, const SCENARIO *scenario, RESULT *result)
+{
+	size_t offset = 0, erasedEnd = 0;
+	while (offset < IMAGE_SIZE)
+	{
+		size_t length = next_chunk(scenario);
+		if (length > IMAGE_SIZE - offset)
+			length = IMAGE_SIZE - offset;
+		while (erasedEnd < offset + length)
+		{
+			if (esp_partition_erase_range(partition, erasedEnd, SPI_FLASH_SEC_SIZE) != ESP_OK)
+				return 0;
+			erasedEnd += SPI_FLASH_SEC_SIZE;
+		}
+		if (esp_partition_write(partition, offset, g_image + offset, length) != ESP_OK)
+			return 0;
+		offset += length;
+		result->chunks++;
+	}
+	return 1;
+}
+
+//writes from offset to the image end, or stops at stopOffset like an interrupted download
+static int write_buffered(const esp_partition_t *partition, const SCENARIO *scenario, size_t offset, size_t stopOffset, RESULT *result)
+{
+	if (ota_writer_begin(partition, IMAGE_SIZE, offset) != ESP_OK)
+		return 0;
+	while (offset < stopOffset)
+	{
+		size_t length = next_chunk(scenario);
+		if (length > stopOffset - offset)
+			length = stopOffset - offset;
+		if (ota_writer_write(g_image + offset, length) != ESP_OK)
+			return 0;
+		offset += length;
+		result->chunks++;
+	}
+	return ota_writer_end() == (stopOffset == IMAGE_SIZE ? ESP_OK : ESP_ERR_INVALID_SIZE);
+}
+
+static void run(const esp_partition_t *partition, const SCENARIO *scenario, int isBuffered, RESULT *result)
+{
+	memset(result, 0, sizeof(*result));
+	fake_flash_init(PARTITION_SIZE, 1);
+	int64_t start = esp_timer_get_time();
+	int isWritten = isBuffered ? write_buffered(partition, scenario, 0, IMAGE_SIZE, result) : write_unbuffered(partition, scenario, result);
+	result->time = esp_timer_get_time() - start;
+	fake_flash_get_stats(&result->flash);
+	result->isValid = isWritten && result->flash.violations == 0 && memcmp(fake_flash_data(), g_image, IMAGE_SIZE) == 0;
+}
+
+//an interrupted download continues at the committed offset, the bytes after it are written again
+static int check_resume(const esp_partition_t *partition, const SCENARIO *scenario)
+{
+	RESULT result;
+	memset(&result, 0, sizeof(result));
+	fake_flash_init(PARTITION_SIZE, 2);
+	if (!write_buffered(partition, scenario, 0, IMAGE_SIZE / 2 + 1234, &result))
+		return 0;
+	size_t committedOffset = ota_writer_committed_offset();
+	if (committedOffset % SPI_FLASH_SEC_SIZE != 0 || committedOffset > IMAGE_SIZE / 2 + 1234)
+		return 0;
+	if (!write_buffered(partition, scenario, committedOffset, IMAGE_SIZE, &result))
+		return 0;
+
+	//interrupted between the last byte and the restart: the writer begins at the image end and finishes without a write
+	FAKE_FLASH_STATS written;
+	fake_flash_get_stats(&written);
+	if (!write_buffered(partition, scenario, IMAGE_SIZE, IMAGE_SIZE, &result))
+		return 0;
+	fake_flash_get_stats(&result.flash);
+	return result.flash.violations == 0 && result.flash.sectorErases == written.sectorErases && result.flash.writeCalls == written.writeCalls
+		&& memcmp(fake_flash_data(), g_image, IMAGE_SIZE) == 0;
+}
+
+int main()
+{
+	g_image = (unsigned char *)malloc(IMAGE_SIZE);
+	const esp_partition_t *partition = fake_flash_init(PARTITION_SIZE, 1);
+	if (g_image == NULL || partition == NULL)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	srand(7);
+	for (size_t i = 0; i < IMAGE_SIZE; i++)
+		g_image[i] = (unsigned char)rand();
+
+	int isOk = 1;
+	double megabytes = IMAGE_SIZE / (1024.0 * 1024.0);
+	printf("%u byte image, simulated flash time per MB\n", IMAGE_SIZE);
+	printf("%-18s %-10s %7s %7s %8s %7s %9s %6s\n", "chunks", "writer", "chunks", "writes", "programs", "erases", "ms/MB", "valid");
+	for (size_t i = 0; i < sizeof(g_scenarios) / sizeof(g_scenarios[0]); i++)
+	{
+		for (int isBuffered = 0; isBuffered <= 1; isBuffered++)
+		{
+			RESULT result;
+			srand(100 + (unsigned int)i);
+			run(partition, &g_scenarios[i], isBuffered, &result);
+			printf("%-18s %-10s %7d %7u %8u %7u %9.0f %6s\n", g_scenarios[i].name, isBuffered ? "sectors" : "unbuffered", result.chunks,
+				result.flash.writeCalls, result.flash.pagePrograms, result.flash.sectorErases, result.time / 1000.0 / megabytes, result.isValid ? "yes" : "NO");
+			isOk &= result.isValid;
+		}
+		srand(200 + (unsigned int)i);
+		int isResumed = check_resume(partition, &g_scenarios[i]);
+		printf("%-18s resume %s\n", g_scenarios[i].name, isResumed ? "ok" : "FAILED");
+		isOk &= isResumed;
+	}
+
+	fake_flash_free();
+	free(g_image);
+	return isOk ? 0 : 1;
+}
@@ -0,0 +1,677 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/*
+ * Fleet rollout simulator: the OTA code of the firmware, OTA.c with its writer, pipeline and decoders, runs in
+ * one process per device against tools/ota_server, over the simulated network of host/host_network.h.
+ *   fleet_sim <host> <port> [-n devices] [-v device version] [-s running image] [-p partition KB]
+ *     [-r rtt ms] [-j jitter ms] [-b bytes/s] [-d drops per MB] [-c corrupt probability] [-x time scale] [-t timeout s] [-m raw|chunked] [-i]
+ *     [-B broker host:port] [-R power cuts] [-k] [-S seed]
+ * The time is simulated time, x times faster than real time. Without -i every device waits for its own first check
+ * like after a boot, with -i all of them check at once. The image written by a device is verified by the sha256 of the
+ * manifest, a device that does not restart into the new image within the timeout failed.
+ * -m chunked blocks the blob urls, the devices fall back to the base64 chunks, which are the responses with a
+ * Content-MD5 that -c corrupts.
+ * -B also runs the device loop of iothub_watertank_client.c in every device, connected to tools/iothub_broker as
+ * device-<n>, and adds the telemetry rate, the ack latency and the reconnects to the report. The broker runs in real
+ * time, its delays take x times longer in the simulated time of the devices.
+ * -R cuts the power of every device that many times during its download, at a random progress each time. The device
+ * process ends there and a fresh one boots with the flash and NVS of the old one, like the hardware: the OTA code has to
+ * find its checkpoint, hash the part of the image already on flash again and continue at the sector boundary. In every
+ * mode the new partition is checked against the sha256 of the manifest once more after the device restarted into it.
+ * -k opens a new connection for every request, the cost of the handshakes without keep alive.
+ * -S changes the random numbers, the losses and the power cuts of every device, the same seed repeats a run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "esp_spi_flash.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "esp_ota_ops.h"
+#include "host_clock.h"
+#include "host_network.h"
+#include "host_system.h"
+#include "fake_flash.h"
+#include "fake_nvs.h"
+#include "hal_posix.h"
+#include "Common.h"
+#include "iothub_watertank_client.h"
+#include "ota_state.h"
+#include "digest.h"
+#include "cJSON.h"
+
+#define DEFAULT_DEVICES 50
+#define DEFAULT_PARTITION_KB 1536
+#define DEFAULT_RTT_MS 150
+#define DEFAULT_JITTER_MS 50
+#define DEFAULT_BYTES_PER_SECOND 50000
+#define DEFAULT_TIME_SCALE 10
+#define DEFAULT_TIMEOUT_S 3600
+//the heap a running IoT Hub client leaves free
+#define DEVICE_FREE_HEAP 120000
+#define STATS_PERIOD_MS 1000
+//the path of the blob urls of ota_server
+#define BLOB_PATH "/blobs/"
+#define POWER_CUT_POLL_MS 10
+//the exit code of a device process after a power cut, its supervisor boots the next one
+#define POWER_CUT_EXIT 3
+
+//what a device carries from one boot to the next besides its flash and NVS, the counters of the earlier boots
+typedef struct DEVICE_BOOT_TAG
+{
+	uint32_t restarts;
+	int64_t elapsedTime;
+	int64_t firstRequestTime; //-1 before the first request
+	HOST_NETWORK_STATS network;
+	uint32_t sectorErases;
+	uint32_t nvsWrites;
+	//the checkpoints the boots after a power cut found, and the ones that were not at a sector boundary
+	uint32_t checkpoints;
+	uint64_t checkpointBytes;
+	uint32_t misalignedCheckpoints;
+} DEVICE_BOOT;
+
+typedef struct DEVICE_RESULT_TAG
+{
+	int device;
+	int isUpdated;
+	//the new partition has the sha256 of the manifest
+	int isVerified;
+	int64_t firstRequestTime;
+	int64_t endTime;
+	HOST_NETWORK_STATS network;
+	FAKE_FLASH_STATS flash;
+	uint32_t nvsWrites;
+	HAL_POSIX_HUB_STATS hub;
+	DEVICE_BOOT boot;
+} DEVICE_RESULT;
+
+typedef struct SERVER_STATS_TAG
+{
+	double connections;
+	double requests;
+	double manifests;
+	double notModified;
+	double chunks;
+	double blobs;
+	double errors;
+	double bytesSent;
+	double openConnections;
+} SERVER_STATS;
+
+//the firmware globals that the application defines
+int CONNECTED_BIT = 1; //BIT0, like azure_main.c
+EventGroupHandle_t wifi_event_group = NULL;
+extern const char *g_currentFirmwareVersion;
+
+static HOST_NETWORK g_network;
+static const char *g_version = "0.0.0.0";
+static const char *g_imagePath = NULL;
+static size_t g_partitionSize = DEFAULT_PARTITION_KB * 1024;
+static double g_timeScale = DEFAULT_TIME_SCALE;
+static int g_timeoutSeconds = DEFAULT_TIMEOUT_S;
+static int g_isImmediate = 0;
+static const char *g_brokerHost = NULL;
+static int g_brokerPort = 0;
+static int g_powerCuts = 0;
+static uint32_t g_seed = 0;
+//the image of the manifest, each device checks its new partition against it
+static size_t g_imageSize = 0;
+static unsigned char g_imageSha256[32];
+
+//one device per process, these are the globals of the child
+static int g_resultFd = -1;
+static int g_device = 0;
+static const esp_partition_t *g_runningPartition = NULL;
+static const esp_partition_t *g_updatePartition = NULL;
+//the flash, the NVS and the counters pass from boot to boot through this file of the supervisor
+static FILE *g_bootFile = NULL;
+static DEVICE_BOOT g_boot;
+static int g_cutPercent = 0;
+
+static void add_network_stats(HOST_NETWORK_STATS *total, const HOST_NETWORK_STATS *stats)
+{
+	total->connections += stats->connections;
+	total->failedConnections += stats->failedConnections;
+	total->requests += stats->requests;
+	total->bytesReceived += stats->bytesReceived;
+	total->drops += stats->drops;
+	total->corruptions += stats->corruptions;
+}
+
+//the counters of this boot on top of those of the earlier ones
+static void add_boot(DEVICE_BOOT *boot)
+{
+	*boot = g_boot;
+	HOST_NETWORK_STATS network;
+	host_network_get_stats(&network);
+	if (boot->firstRequestTime < 0 && network.requests > 0)
+		boot->firstRequestTime = boot->elapsedTime + network.firstRequestTime;
+	add_network_stats(&boot->network, &network);
+	FAKE_FLASH_STATS flash;
+	fake_flash_get_stats(&flash);
+	boot->sectorErases += flash.sectorErases;
+	boot->nvsWrites += fake_nvs_get_write_count();
+	boot->elapsedTime += esp_timer_get_time();
+}
+
+static void report(int isUpdated, int isVerified)
+{
+	DEVICE_RESULT result;
+	memset(&result, 0, sizeof(result));
+	result.device = g_device;
+	result.isUpdated = isUpdated;
+	result.isVerified = isVerified;
+	add_boot(&result.boot);
+	result.endTime = result.boot.elapsedTime;
+	result.network = result.boot.network;
+	result.firstRequestTime = result.boot.firstRequestTime;
+	fake_flash_get_stats(&result.flash);
+	result.flash.sectorErases = result.boot.sectorErases;
+	result.nvsWrites = result.boot.nvsWrites;
+	hal_posix_hub_get_stats(&result.hub);
+	//smaller than PIPE_BUF, the write is atomic
+	if (write(g_resultFd, &result, sizeof(result)) != sizeof(result))
+		_exit(2);
+	_exit(0);
+}
+
+//the firmware restarts after it made the new image the boot partition
+static void device_restart(const esp_partition_t *bootPartition)
+{
+	int isUpdated = bootPartition != g_runningPartition;
+	unsigned char sha256[32];
+	if (isUpdated && g_imageSize <= bootPartition->size)
+		digest_sha256(fake_flash_partition_data(bootPartition), g_imageSize, sha256);
+	report(isUpdated, isUpdated && g_imageSize <= bootPartition->size && memcmp(sha256, g_imageSha256, sizeof(sha256)) == 0);
+}
+
+//the state of the device as the power goes, the writes still in flight are torn like on the hardware
+static void power_cut()
+{
+	DEVICE_BOOT boot;
+	add_boot(&boot);
+	boot.restarts++;
+	rewind(g_bootFile);
+	//NVS first, the writer checkpoints a sector only after it is on flash, so the flash copy is never behind the checkpoint
+	if (fwrite(&boot, sizeof(boot), 1, g_bootFile) != 1 || !fake_nvs_save(g_bootFile)
+		|| fwrite(fake_flash_partition_data(g_updatePartition), g_updatePartition->size, 1, g_bootFile) != 1 || fflush(g_bootFile) != 0)
+		_exit(2);
+	_exit(POWER_CUT_EXIT);
+}
+
+static void power_cut_task(void *parameters)
+{
+	while (get_update_progress() < g_cutPercent)
+		vTaskDelay(POWER_CUT_POLL_MS / portTICK_PERIOD_MS);
+	power_cut();
+}
+
+//the flash and NVS the previous boot left, and where the download will continue
+static int load_boot()
+{
+	rewind(g_bootFile);
+	if (fread(&g_boot, sizeof(g_boot), 1, g_bootFile) != 1 || !fake_nvs_load(g_bootFile)
+		|| fread(fake_flash_partition_data(g_updatePartition), g_updatePartition->size, 1, g_bootFile) != 1)
+		return 0;
+	OTA_STATE state;
+	uint32_t committedOffset;
+	if (ota_state_load(&state, &committedOffset) && committedOffset > 0)
+	{
+		g_boot.checkpoints++;
+		g_boot.checkpointBytes += committedOffset;
+		if (committedOffset % SPI_FLASH_SEC_SIZE != 0 && committedOffset != state.blobSize)
+			g_boot.misalignedCheckpoints++;
+	}
+	return 1;
+}
+
+static void iothub_task(void *parameters)
+{
+	iothub_client_run();
+	vTaskDelete(NULL);
+}
+
+static int load_running_image(const esp_partition_t *partition)
+{
+	FILE *file = fopen(g_imagePath, "rb");
+	if (file == NULL)
+		return 0;
+	size_t length = fread(fake_flash_partition_data(partition), 1, partition->size, file);
+	fclose(file);
+	return length > 0;
+}
+
+static void boot_device(int device)
+{
+	//every boot sees other random numbers and network losses
+	uint32_t boot = g_boot.restarts + 1;
+	host_clock_set_realtime(g_timeScale);
+	host_system_init((0x9E3779B9u * (uint32_t)(device + 1) * boot) ^ g_seed, DEVICE_FREE_HEAP);
+	host_system_set_restart_handler(device_restart);
+	HOST_NETWORK network = g_network;
+	network.seed = (0x85EBCA6Bu * (uint32_t)(device + 1) * boot) ^ g_seed;
+	host_network_init(&network);
+
+	//a zeroed running partition takes no memory, a patch from it fails and the device falls back to the full image
+	g_runningPartition = fake_flash_init(g_partitionSize, 0);
+	g_updatePartition = g_runningPartition != NULL ? fake_flash_add("ota_1", ESP_PARTITION_SUBTYPE_APP_OTA_1, g_partitionSize, 0) : NULL;
+	if (g_updatePartition == NULL || (g_imagePath != NULL && !load_running_image(g_runningPartition))
+		|| (g_boot.restarts > 0 && !load_boot()))
+	{
+		fprintf(stderr, "device %d: creating the flash failed\n", device);
+		_exit(1);
+	}
+	host_system_set_running_partition(g_runningPartition);
+	g_currentFirmwareVersion = g_version;
+
+	wifi_event_group = xEventGroupCreate();
+	xEventGroupSetBits(wifi_event_group, CONNECTED_BIT);
+	if (xTaskCreate(&ota_task, "ota_task", 8192, NULL, 5, NULL) != pdPASS)
+		_exit(1);
+	if (g_boot.restarts < (uint32_t)g_powerCuts)
+	{
+		//somewhere after the checkpoint, at 100 between the last byte and the restart
+		unsigned int seed = (0xC2B2AE35u * (uint32_t)(device + 1) * boot) ^ g_seed;
+		OTA_STATE state;
+		uint32_t committedOffset = 0;
+		int fromPercent = ota_state_load(&state, &committedOffset) && state.blobSize > 0 ? (int)((uint64_t)committedOffset * 100 / state.blobSize) : 0;
+		g_cutPercent = fromPercent < 100 ? fromPercent + 1 + (int)(rand_r(&seed) % (unsigned int)(100 - fromPercent)) : 101;
+		if (g_cutPercent <= 100 && xTaskCreate(&power_cut_task, "power_cut", 4096, NULL, 5, NULL) != pdPASS)
+			_exit(1);
+	}
+	if (g_brokerHost != NULL)
+	{
+		static char deviceId[32]; //the client copies it when the task creates it
+		snprintf(deviceId, sizeof(deviceId), "device-%d", device);
+		HAL_POSIX_HUB hub = { 0, 0, 0, network.seed, g_brokerHost, g_brokerPort, deviceId };
+		hal_posix_hub_init(&hub);
+		if (xTaskCreate(&iothub_task, "iothub", 8192, NULL, 5, NULL) != pdPASS)
+			_exit(1);
+	}
+	if (g_isImmediate)
+	{
+		//the task takes its handle first, a notification before that is lost
+		vTaskDelay(100 / portTICK_PERIOD_MS);
+		ota_trigger_check();
+	}
+
+	host_clock_sleep((int64_t)g_timeoutSeconds * 1000000);
+	report(0, 0);
+}
+
+static void run_device(int device)
+{
+	g_device = device;
+	memset(&g_boot, 0, sizeof(g_boot));
+	g_boot.firstRequestTime = -1;
+	if (g_powerCuts == 0)
+		boot_device(device);
+
+	//this process only supervises, each boot is a fresh process, the result pipe goes to the one that does not lose its power
+	//unbuffered, the processes share the file position but not their stdio buffers
+	if ((g_bootFile = tmpfile()) == NULL || setvbuf(g_bootFile, NULL, _IONBF, 0) != 0)
+		_exit(1);
+	for (;;)
+	{
+		pid_t pid = fork();
+		if (pid == 0)
+			boot_device(device);
+		int status = 0;
+		if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+			_exit(1);
+		if (WEXITSTATUS(status) != POWER_CUT_EXIT)
+			_exit(WEXITSTATUS(status));
+		rewind(g_bootFile);
+		if (fread(&g_boot, sizeof(g_boot), 1, g_bootFile) != 1)
+			_exit(1);
+	}
+}
+
+//the JSON body of a GET to the server, NULL on any failure
+static cJSON *get_json(const char *path)
+{
+	char port[16];
+	snprintf(port, sizeof(port), "%d", g_network.serverPort);
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *address = NULL;
+	if (getaddrinfo(g_network.serverHost, port, &hints, &address) != 0)
+		return 0;
+	int fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+	int isConnected = fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) == 0;
+	freeaddrinfo(address);
+
+	char response[4096];
+	size_t length = 0;
+	char request[512];
+	int requestLength = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: ota-server\r\nConnection: close\r\n\r\n", path);
+	if (isConnected && requestLength < (int)sizeof(request) && send(fd, request, (size_t)requestLength, MSG_NOSIGNAL) == requestLength)
+	{
+		ssize_t received;
+		while (length < sizeof(response) - 1 && (received = recv(fd, response + length, sizeof(response) - 1 - length, 0)) > 0)
+			length += (size_t)received;
+	}
+	if (fd >= 0)
+		close(fd);
+	response[length] = '\0';
+
+	const char *body = strstr(response, "\r\n\r\n");
+	return body != NULL ? cJSON_Parse(body + 4) : NULL;
+}
+
+static int read_server_stats(SERVER_STATS *stats)
+{
+	cJSON *json = get_json("/stats");
+	if (json == NULL)
+		return 0;
+	const char *names[] = { "connections", "requests", "manifests", "notModified", "chunks", "blobs", "errors", "bytesSent", "openConnections" };
+	double *values[] = { &stats->connections, &stats->requests, &stats->manifests, &stats->notModified, &stats->chunks, &stats->blobs, &stats->errors, &stats->bytesSent, &stats->openConnections };
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+	{
+		cJSON *item = cJSON_GetObjectItem(json, names[i]);
+		*values[i] = item != NULL ? item->valuedouble : 0;
+	}
+	cJSON_Delete(json);
+	return 1;
+}
+
+//the image size and sha256 the manifest gives a device of g_version
+static int read_manifest()
+{
+	char path[256];
+	snprintf(path, sizeof(path), "/api/CheckForNewFirmware?version=%s", g_version);
+	cJSON *json = get_json(path);
+	cJSON *blobSize = cJSON_GetObjectItem(json, "blobSize");
+	cJSON *sha256 = cJSON_GetObjectItem(json, "sha256");
+	int isRead = cJSON_IsNumber(blobSize) && cJSON_IsString(sha256) && strlen(sha256->valuestring) == 2 * sizeof(g_imageSha256);
+	for (size_t i = 0; isRead && i < sizeof(g_imageSha256); i++)
+	{
+		unsigned int byte;
+		isRead = sscanf(sha256->valuestring + 2 * i, "%2x", &byte) == 1;
+		g_imageSha256[i] = (unsigned char)byte;
+	}
+	if (isRead)
+		g_imageSize = (size_t)blobSize->valuedouble;
+	cJSON_Delete(json);
+	return isRead;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, int count, double fraction)
+{
+	if (count == 0)
+		return 0;
+	int index = (int)(fraction * count);
+	return sorted[index < count ? index : count - 1];
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: fleet_sim <host> <port> [-n devices] [-v device version] [-s running image] [-p partition KB]\n"
+		"  [-r rtt ms] [-j jitter ms] [-b bytes/s] [-d drops per MB] [-c corrupt probability] [-x time scale] [-t timeout s] [-m raw|chunked] [-i]\n"
+		"  [-B broker host:port] [-R power cuts] [-k] [-S seed]\n");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		usage();
+		return 1;
+	}
+	g_network.serverHost = argv[1];
+	g_network.serverPort = atoi(argv[2]);
+	g_network.rttMs = DEFAULT_RTT_MS;
+	g_network.rttJitterMs = DEFAULT_JITTER_MS;
+	g_network.bytesPerSecond = DEFAULT_BYTES_PER_SECOND;
+	int devices = DEFAULT_DEVICES;
+	for (int i = 3; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-i") == 0)
+		{
+			g_isImmediate = 1;
+			continue;
+		}
+		if (strcmp(argv[i], "-k") == 0)
+		{
+			g_network.isKeepAliveDisabled = true;
+			continue;
+		}
+		if (i + 1 == argc)
+		{
+			usage();
+			return 1;
+		}
+		const char *value = argv[++i];
+		if (strcmp(argv[i - 1], "-n") == 0)
+			devices = atoi(value);
+		else if (strcmp(argv[i - 1], "-v") == 0)
+			g_version = value;
+		else if (strcmp(argv[i - 1], "-s") == 0)
+			g_imagePath = value;
+		else if (strcmp(argv[i - 1], "-p") == 0)
+			g_partitionSize = (size_t)atoi(value) * 1024;
+		else if (strcmp(argv[i - 1], "-r") == 0)
+			g_network.rttMs = (uint32_t)atoi(value);
+		else if (strcmp(argv[i - 1], "-j") == 0)
+			g_network.rttJitterMs = (uint32_t)atoi(value);
+		else if (strcmp(argv[i - 1], "-b") == 0)
+			g_network.bytesPerSecond = (uint32_t)atoi(value);
+		else if (strcmp(argv[i - 1], "-d") == 0)
+			g_network.dropsPerMegabyte = atof(value);
+		else if (strcmp(argv[i - 1], "-c") == 0)
+			g_network.corruptProbability = atof(value);
+		else if (strcmp(argv[i - 1], "-x") == 0)
+			g_timeScale = atof(value);
+		else if (strcmp(argv[i - 1], "-t") == 0)
+			g_timeoutSeconds = atoi(value);
+		else if (strcmp(argv[i - 1], "-m") == 0 && (strcmp(value, "raw") == 0 || strcmp(value, "chunked") == 0))
+			g_network.blockedPath = strcmp(value, "chunked") == 0 ? BLOB_PATH : NULL;
+		else if (strcmp(argv[i - 1], "-R") == 0)
+			g_powerCuts = atoi(value);
+		else if (strcmp(argv[i - 1], "-S") == 0)
+			g_seed = (uint32_t)strtoul(value, NULL, 0);
+		else if (strcmp(argv[i - 1], "-B") == 0 && strchr(value, ':') != NULL)
+		{
+			*strchr(argv[i], ':') = '\0';
+			g_brokerHost = argv[i];
+			g_brokerPort = atoi(argv[i] + strlen(argv[i]) + 1);
+		}
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+	if (devices <= 0 || g_network.serverPort <= 0 || g_partitionSize == 0 || g_timeScale <= 0 || g_timeoutSeconds <= 0 || g_powerCuts < 0 || (g_brokerHost != NULL && g_brokerPort <= 0))
+	{
+		usage();
+		return 1;
+	}
+
+	SERVER_STATS before, after, current;
+	memset(&before, 0, sizeof(before));
+	if (!read_server_stats(&before))
+	{
+		fprintf(stderr, "No ota_server at %s:%d\n", g_network.serverHost, g_network.serverPort);
+		return 1;
+	}
+	if (!read_manifest())
+	{
+		fprintf(stderr, "No firmware manifest for version %s\n", g_version);
+		return 1;
+	}
+
+	int *fds = (int *)malloc(sizeof(int) * devices);
+	pid_t *pids = (pid_t *)malloc(sizeof(pid_t) * devices);
+	DEVICE_RESULT *results = (DEVICE_RESULT *)calloc(devices, sizeof(DEVICE_RESULT));
+	struct pollfd *polls = (struct pollfd *)malloc(sizeof(struct pollfd) * devices);
+	double *durations = (double *)malloc(sizeof(double) * devices);
+	double *endTimes = (double *)malloc(sizeof(double) * devices);
+	if (fds == NULL || pids == NULL || results == NULL || polls == NULL || durations == NULL || endTimes == NULL)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	printf("%d devices, version %s, %s%s, rtt %u+%u ms, %u bytes/s, %.2f drops/MB, %.1f%% corrupt responses, %gx time, %d power cuts\n", devices, g_version,
+		g_network.blockedPath != NULL ? "chunked" : "raw", g_network.isKeepAliveDisabled ? " without keep alive" : "", g_network.rttMs, g_network.rttJitterMs, g_network.bytesPerSecond,
+		g_network.dropsPerMegabyte, g_network.corruptProbability * 100, g_timeScale, g_powerCuts);
+	fflush(stdout);
+	for (int i = 0; i < devices; i++)
+	{
+		int pipeFds[2];
+		if (pipe(pipeFds) != 0)
+		{
+			fprintf(stderr, "pipe failed: %s\n", strerror(errno));
+			return 1;
+		}
+		pids[i] = fork();
+		if (pids[i] == 0)
+		{
+			close(pipeFds[0]);
+			g_resultFd = pipeFds[1];
+			run_device(i);
+		}
+		close(pipeFds[1]);
+		fds[i] = pipeFds[0];
+		results[i].device = -1;
+	}
+
+	//the results arrive as the devices restart, the server is sampled meanwhile for its peak load
+	int remaining = devices;
+	double peakConnections = 0, peakRequestRate = 0, lastRequests = before.requests;
+	while (remaining > 0)
+	{
+		int count = 0;
+		for (int i = 0; i < devices; i++)
+		{
+			if (fds[i] < 0)
+				continue;
+			polls[count].fd = fds[i];
+			polls[count].events = POLLIN;
+			count++;
+		}
+		int ready = poll(polls, count, STATS_PERIOD_MS);
+		for (int i = 0, p = 0; ready > 0 && i < devices; i++)
+		{
+			if (fds[i] < 0)
+				continue;
+			if (polls[p++].revents != 0)
+			{
+				if (read(fds[i], &results[i], sizeof(results[i])) != sizeof(results[i]))
+					results[i].device = -1; //the device crashed
+				close(fds[i]);
+				fds[i] = -1;
+				remaining--;
+			}
+		}
+		if (read_server_stats(&current))
+		{
+			if (current.openConnections > peakConnections)
+				peakConnections = current.openConnections;
+			double rate = (current.requests - lastRequests) * 1000.0 / STATS_PERIOD_MS / g_timeScale;
+			if (rate > peakRequestRate)
+				peakRequestRate = rate;
+			lastRequests = current.requests;
+		}
+	}
+	for (int i = 0; i < devices; i++)
+		waitpid(pids[i], NULL, 0);
+	if (!read_server_stats(&after))
+		after = current;
+
+	int updated = 0, verified = 0, crashed = 0;
+	DEVICE_BOOT boots;
+	memset(&boots, 0, sizeof(boots));
+	HOST_NETWORK_STATS total;
+	memset(&total, 0, sizeof(total));
+	uint64_t sectorErases = 0, nvsWrites = 0;
+	HAL_POSIX_HUB_STATS hub;
+	memset(&hub, 0, sizeof(hub));
+	double deviceSeconds = 0;
+	for (int i = 0; i < devices; i++)
+	{
+		DEVICE_RESULT *result = &results[i];
+		if (result->device < 0)
+		{
+			crashed++;
+			continue;
+		}
+		add_network_stats(&total, &result->network);
+		boots.restarts += result->boot.restarts;
+		boots.checkpoints += result->boot.checkpoints;
+		boots.checkpointBytes += result->boot.checkpointBytes;
+		boots.misalignedCheckpoints += result->boot.misalignedCheckpoints;
+		sectorErases += result->flash.sectorErases;
+		nvsWrites += result->nvsWrites;
+		hub.events += result->hub.events;
+		hub.confirmed += result->hub.confirmed;
+		hub.reportedStates += result->hub.reportedStates;
+		hub.confirmationTime += result->hub.confirmationTime;
+		if (result->hub.maxConfirmationTime > hub.maxConfirmationTime)
+			hub.maxConfirmationTime = result->hub.maxConfirmationTime;
+		hub.pending += result->hub.pending;
+		hub.connects += result->hub.connects;
+		hub.disconnects += result->hub.disconnects;
+		hub.resent += result->hub.resent;
+		deviceSeconds += result->endTime / 1e6;
+		verified += result->isVerified;
+		if (result->isUpdated)
+		{
+			durations[updated] = (result->endTime - result->firstRequestTime) / 1e6;
+			endTimes[updated] = result->endTime / 1e6;
+			updated++;
+		}
+	}
+	qsort(durations, updated, sizeof(double), compare_doubles);
+	qsort(endTimes, updated, sizeof(double), compare_doubles);
+
+	int reporting = devices - crashed;
+	printf("updated %d of %d devices, %d timed out, %d crashed, %d images differ from the manifest\n", updated, devices, reporting - updated, crashed, updated - verified);
+	printf("OTA duration s:  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n", percentile(durations, updated, 0.5), percentile(durations, updated, 0.9),
+		percentile(durations, updated, 0.99), percentile(durations, updated, 1));
+	printf("updated after s: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n", percentile(endTimes, updated, 0.5), percentile(endTimes, updated, 0.9),
+		percentile(endTimes, updated, 0.99), percentile(endTimes, updated, 1));
+	if (reporting > 0)
+	{
+		printf("per device: %.1f requests, %.1f connections, %.1f KB, %.2f drops, %.2f corrupt responses, %.1f sector erases, %.1f NVS writes\n",
+			(double)total.requests / reporting, (double)total.connections / reporting, total.bytesReceived / 1024.0 / reporting,
+			(double)total.drops / reporting, (double)total.corruptions / reporting, (double)sectorErases / reporting, (double)nvsWrites / reporting);
+	}
+	if (g_powerCuts > 0)
+	{
+		printf("power cuts: %u, %u boots resumed from a checkpoint, %.1f KB kept per resume, %u checkpoints not at a sector boundary\n", boots.restarts,
+			boots.checkpoints, boots.checkpoints > 0 ? boots.checkpointBytes / 1024.0 / boots.checkpoints : 0, boots.misalignedCheckpoints);
+	}
+	printf("server: %.0f connections, %.0f requests, %.0f manifests (%.0f not modified), %.0f chunks, %.0f blobs, %.0f errors, %.1f MB sent\n",
+		after.connections - before.connections, after.requests - before.requests, after.manifests - before.manifests, after.notModified - before.notModified, after.chunks - before.chunks,
+		after.blobs - before.blobs, after.errors - before.errors, (after.bytesSent - before.bytesSent) / 1048576);
+	printf("server peak: %.0f open connections, %.1f requests per simulated s\n", peakConnections, peakRequestRate);
+	if (g_brokerHost != NULL && reporting > 0)
+	{
+		printf("telemetry: %u sent, %u confirmed, %u in flight at the end, %.3f msgs per device and simulated s, %u reported states\n", hub.events,
+			hub.confirmed, hub.pending, deviceSeconds > 0 ? hub.events / deviceSeconds : 0, hub.reportedStates);
+		printf("ack latency ms: mean %.0f  max %.0f, per device: %.1f connects, %.1f disconnects, %.1f messages sent again\n",
+			hub.confirmed > 0 ? hub.confirmationTime / 1000.0 / hub.confirmed : 0, hub.maxConfirmationTime / 1000.0,
+			(double)hub.connects / reporting, (double)hub.disconnects / reporting, (double)hub.resent / reporting);
+	}
+	return updated == devices && verified == updated && boots.misalignedCheckpoints == 0 ? 0 : 1;
+}
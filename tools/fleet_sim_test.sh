@@ -0,0 +1,118 @@
+#!/bin/sh
+# Copyright (c) Microsoft. All rights reserved.
+# Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+# The ctest driver of fleet_sim: writes a firmware directory with two generated images, starts tools/ota_server on it
+# and runs fleet_sim against it.
+#   fleet_sim_test.sh <tools build directory> full|patch|truncated|corrupt [fleet_sim options]
+# full       the devices run 1.0.0.0 without an image and download the raw 2.0.0.0 image, with -R every power cut
+#            after the first sector has to resume from the checkpoint
+# patch      the devices run the 1.0.0.0 image and apply the zlib compressed patch of ota_delta, none of them may need
+#            the full image
+# truncated  the patch on the server lacks its last third, every device has to fall back to the full image
+# corrupt    the patch on the server has changed bytes in the middle, every device has to fall back to the full image
+# fleet_sim checks the new partition of every device against the sha256 of the manifest.
+
+set -e
+bin=$1
+mode=$2
+shift 2
+
+work=$(mktemp -d)
+pid=
+trap '[ -z "$pid" ] || kill $pid; rm -rf "$work"' EXIT
+
+#the same bytes on every run: 16 byte instructions picked from a table, like code
+image() {
+	LC_ALL=C awk -v seed="$1" -v size="$2" 'BEGIN {
+		srand(seed)
+		for (i = 0; i < 4096; i++)
+			for (j = 0; j < 16; j++)
+				table[i, j] = int(rand() * 256)
+		for (n = 0; n < size; n += 16)
+		{
+			k = int(rand() * 4096)
+			for (j = 0; j < 16; j++)
+				printf "%c", table[k, j]
+		}
+	}'
+}
+
+#the new version changes a few ranges and grows by a function in the middle and one at the end
+image 1 409600 > "$work/esp32_1.0.0.0.bin"
+image 2 4096 > "$work/changes"
+cp "$work/esp32_1.0.0.0.bin" "$work/changed"
+for offset in 17 40 95 230 310; do
+	dd if="$work/changes" of="$work/changed" bs=256 count=1 skip=$((offset % 16)) seek=$offset conv=notrunc 2>/dev/null
+done
+{
+	head -c 204800 "$work/changed"
+	head -c 1536 "$work/changes"
+	tail -c +204801 "$work/changed"
+	tail -c 2048 "$work/changes"
+} > "$work/esp32_2.0.0.0.bin"
+rm "$work/changes" "$work/changed"
+
+if [ "$mode" != full ]; then
+	"$bin/ota_compress" "$work/esp32_2.0.0.0.bin" "$work/esp32_2.0.0.0.bin.zlib" > /dev/null
+	"$bin/ota_delta" diff "$work/esp32_1.0.0.0.bin" "$work/esp32_2.0.0.0.bin" "$work/update.patch" > /dev/null
+	"$bin/ota_compress" "$work/update.patch" "$work/esp32_1.0.0.0_2.0.0.0.patch.zlib" > /dev/null
+	patch="$work/esp32_1.0.0.0_2.0.0.0.patch.zlib"
+	size=$(wc -c < "$patch")
+	case $mode in
+	patch)
+		;;
+	truncated)
+		head -c $((size * 2 / 3)) "$patch" > "$work/patch"
+		mv "$work/patch" "$patch"
+		;;
+	corrupt)
+		printf 'corrupt' | dd of="$patch" bs=1 seek=$((size / 2)) conv=notrunc 2>/dev/null
+		;;
+	*)
+		echo "unknown mode $mode" >&2
+		exit 1
+		;;
+	esac
+	set -- -s "$work/esp32_1.0.0.0.bin" "$@"
+fi
+
+#a port of its own for every test run in parallel
+port=$((20000 + $$ % 20000))
+"$bin/ota_server" "$work" 2.0.0.0 -p $port > "$work/server.log" 2>&1 &
+pid=$!
+tries=0
+until grep -q Serving "$work/server.log"; do
+	tries=$((tries + 1))
+	if [ $tries -gt 50 ] || ! kill -0 $pid 2>/dev/null; then
+		cat "$work/server.log" >&2
+		exit 1
+	fi
+	sleep 0.1
+done
+
+status=0
+"$bin/fleet_sim" 127.0.0.1 $port -v 1.0.0.0 "$@" > "$work/fleet.log" || status=$?
+cat "$work/fleet.log"
+[ $status -eq 0 ] || exit $status
+
+resumes=$(sed -n 's/^power cuts: [0-9]*, \([0-9]*\) boots resumed .*/\1/p' "$work/fleet.log")
+if [ "${resumes:-1}" -eq 0 ]; then
+	echo "no boot resumed from a checkpoint" >&2
+	exit 1
+fi
+
+#the patch is one blob request per device, a bad patch has to be followed by the image on every device
+devices=$(sed -n 's/^\([0-9]*\) devices, version .*/\1/p' "$work/fleet.log")
+blobs=$(sed -n 's/^server: .* \([0-9]*\) blobs, .*/\1/p' "$work/fleet.log")
+case $mode in
+patch)
+	[ "$blobs" -eq "$devices" ]
+	;;
+truncated|corrupt)
+	[ "$blobs" -ge $((devices * 2)) ]
+	;;
+esac || {
+	echo "$blobs blob requests for $devices devices in the $mode mode" >&2
+	exit 1
+}
@@ -0,0 +1,10 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//host stand in for the ESP-IDF header, the host tools do not use the event loop
+#ifndef ESP_EVENT_LOOP_H
+#define ESP_EVENT_LOOP_H
+
+#include "esp_err.h"
+
+#endif /* ESP_EVENT_LOOP_H */
@@ -0,0 +1,29 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//host stand in for the ESP-IDF header, the heap is the modelled free heap of host_system.c and never fragments
+#ifndef ESP_HEAP_CAPS_H
+#define ESP_HEAP_CAPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_system.h"
+
+#define MALLOC_CAP_8BIT (1 << 2)
+
+static inline size_t heap_caps_get_free_size(uint32_t caps)
+{
+	return esp_get_free_heap_size();
+}
+
+static inline size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+	return esp_get_minimum_free_heap_size();
+}
+
+static inline size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+	return esp_get_free_heap_size();
+}
+
+#endif /* ESP_HEAP_CAPS_H */
@@ -0,0 +1,77 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//host stand in for the ESP-IDF header, host_network.c sends the requests over the simulated network of host_network.h
+#ifndef ESP_HTTP_CLIENT_H
+#define ESP_HTTP_CLIENT_H
+
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	typedef struct esp_http_client *esp_http_client_handle_t;
+
+	typedef enum
+	{
+		HTTP_EVENT_ERROR = 0,
+		HTTP_EVENT_ON_CONNECTED,
+		HTTP_EVENT_HEADER_SENT,
+		HTTP_EVENT_ON_HEADER,
+		HTTP_EVENT_ON_DATA,
+		HTTP_EVENT_ON_FINISH,
+		HTTP_EVENT_DISCONNECTED,
+	} esp_http_client_event_id_t;
+
+	typedef struct esp_http_client_event
+	{
+		esp_http_client_event_id_t event_id;
+		esp_http_client_handle_t client;
+		void *data;
+		int data_len;
+		void *user_data;
+		char *header_key;
+		char *header_value;
+	} esp_http_client_event_t;
+
+	typedef esp_err_t (*http_event_handle_cb)(esp_http_client_event_t *evt);
+
+	typedef enum
+	{
+		HTTP_METHOD_GET = 0,
+		HTTP_METHOD_POST,
+		HTTP_METHOD_PUT,
+		HTTP_METHOD_PATCH,
+		HTTP_METHOD_DELETE,
+		HTTP_METHOD_HEAD,
+	} esp_http_client_method_t;
+
+	//only the members the firmware sets, the transport is plain TCP whatever the scheme of the url
+	typedef struct
+	{
+		const char *url;
+		esp_http_client_method_t method;
+		int timeout_ms;
+		http_event_handle_cb event_handler;
+		void *user_data;
+	} esp_http_client_config_t;
+
+	esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config);
+	esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url);
+	esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value);
+	esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len);
+	int esp_http_client_fetch_headers(esp_http_client_handle_t client);
+	int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len);
+	int esp_http_client_get_status_code(esp_http_client_handle_t client);
+	int esp_http_client_get_content_length(esp_http_client_handle_t client);
+	bool esp_http_client_is_chunked_response(esp_http_client_handle_t client);
+	esp_err_t esp_http_client_close(esp_http_client_handle_t client);
+	esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESP_HTTP_CLIENT_H */
@@ -0,0 +1,24 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//host stand in for the ESP-IDF header, implemented by host_system.c on the partitions of fake_flash.c
+#ifndef ESP_OTA_OPS_H
+#define ESP_OTA_OPS_H
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	const esp_partition_t *esp_ota_get_boot_partition(void);
+	const esp_partition_t *esp_ota_get_running_partition(void);
+	const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from);
+	esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESP_OTA_OPS_H */
@@ -0,0 +1,10 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//host stand in for the ESP-IDF header
+#ifndef ESP_SPI_FLASH_H
+#define ESP_SPI_FLASH_H
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+#endif /* ESP_SPI_FLASH_H */
@@ -0,0 +1,35 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//host stand in for the ESP-IDF header, the clock and the timers are those of host_clock.c
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	typedef struct esp_timer *esp_timer_handle_t;
+	typedef void (*esp_timer_cb_t)(void *arg);
+
+	typedef struct
+	{
+		esp_timer_cb_t callback;
+		void *arg;
+		const char *name;
+	} esp_timer_create_args_t;
+
+	int64_t esp_timer_get_time(void);
+	esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle);
+	esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+	esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+	esp_err_t esp_timer_delete(esp_timer_handle_t timer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESP_TIMER_H */
@@ -0,0 +1,10 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//host stand in for the ESP-IDF header, the host tools do not use the WiFi driver
+#ifndef ESP_WIFI_H
+#define ESP_WIFI_H
+
+#include "esp_err.h"
+
+#endif /* ESP_WIFI_H */
@@ -0,0 +1,173 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_spi_flash.h"
+#include "fake_flash.h"
+#include "host_clock.h"
+
+#define TAG "fake_flash"
+//where ota_0 is in the partition table of the firmware, app partitions are 64 KB aligned
+#define FAKE_FLASH_FIRST_ADDRESS 0x110000
+#define FAKE_FLASH_PARTITION_ALIGN 0x10000
+
+static esp_partition_t g_partitions[FAKE_FLASH_MAX_PARTITIONS];
+static unsigned char *g_data[FAKE_FLASH_MAX_PARTITIONS];
+static int g_partitionCount = 0;
+static FAKE_FLASH_STATS g_stats;
+
+const esp_partition_t *fake_flash_init(size_t size, unsigned int seed)
+{
+	fake_flash_free();
+	fake_flash_reset_stats();
+	return fake_flash_add("ota_0", ESP_PARTITION_SUBTYPE_APP_OTA_0, size, seed);
+}
+
+const esp_partition_t *fake_flash_add(const char *label, esp_partition_subtype_t subtype, size_t size, unsigned int seed)
+{
+	if (g_partitionCount == FAKE_FLASH_MAX_PARTITIONS)
+		return NULL;
+
+	unsigned char *data = (unsigned char *)(seed == 0 ? calloc(1, size) : malloc(size));
+	if (data == NULL)
+		return NULL;
+	if (seed != 0)
+	{
+		srand(seed);
+		for (size_t i = 0; i < size; i++)
+			data[i] = (unsigned char)rand();
+	}
+
+	esp_partition_t *partition = &g_partitions[g_partitionCount];
+	memset(partition, 0, sizeof(*partition));
+	partition->type = ESP_PARTITION_TYPE_APP;
+	partition->subtype = subtype;
+	if (g_partitionCount == 0)
+	{
+		partition->address = FAKE_FLASH_FIRST_ADDRESS;
+	}
+	else
+	{
+		const esp_partition_t *previous = &g_partitions[g_partitionCount - 1];
+		partition->address = (previous->address + previous->size + FAKE_FLASH_PARTITION_ALIGN - 1) & ~(uint32_t)(FAKE_FLASH_PARTITION_ALIGN - 1);
+	}
+	partition->size = (uint32_t)size;
+	snprintf(partition->label, sizeof(partition->label), "%s", label);
+	g_data[g_partitionCount++] = data;
+	return partition;
+}
+
+const unsigned char *fake_flash_data()
+{
+	return g_data[0];
+}
+
+static int find_partition(const esp_partition_t *partition)
+{
+	for (int i = 0; i < g_partitionCount; i++)
+	{
+		if (partition == &g_partitions[i])
+			return i;
+	}
+	return -1;
+}
+
+unsigned char *fake_flash_partition_data(const esp_partition_t *partition)
+{
+	int index = find_partition(partition);
+	return index < 0 ? NULL : g_data[index];
+}
+
+void fake_flash_get_stats(FAKE_FLASH_STATS *stats)
+{
+	*stats = g_stats;
+}
+
+void fake_flash_reset_stats()
+{
+	memset(&g_stats, 0, sizeof(g_stats));
+}
+
+void fake_flash_free()
+{
+	for (int i = 0; i < g_partitionCount; i++)
+	{
+		free(g_data[i]);
+		g_data[i] = NULL;
+	}
+	g_partitionCount = 0;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+	for (int i = 0; i < g_partitionCount; i++)
+	{
+		const esp_partition_t *partition = &g_partitions[i];
+		if (partition->type == type && (subtype == ESP_PARTITION_SUBTYPE_ANY || partition->subtype == subtype)
+			&& (label == NULL || strcmp(partition->label, label) == 0))
+			return partition;
+	}
+	return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+	int index = find_partition(partition);
+	if (index < 0 || src_offset > partition->size || size > partition->size - src_offset)
+		return ESP_ERR_INVALID_ARG;
+
+	memcpy(dst, g_data[index] + src_offset, size);
+	host_clock_sleep(FAKE_FLASH_CALL_US);
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+	int index = find_partition(partition);
+	if (index < 0 || dst_offset > partition->size || size > partition->size - dst_offset)
+		return ESP_ERR_INVALID_ARG;
+
+	unsigned char *data = g_data[index];
+	const unsigned char *input = (const unsigned char *)src;
+	for (size_t i = 0; i < size; i++)
+	{
+		//programming sets bits to 0 only, a 1 over a 0 means the sector was not erased
+		if ((input[i] & ~data[dst_offset + i]) != 0)
+		{
+			ESP_LOGE(TAG, "Write over a not erased byte at 0x%x", (unsigned int)(dst_offset + i));
+			g_stats.violations++;
+			return ESP_FAIL;
+		}
+	}
+	for (size_t i = 0; i < size; i++)
+		data[dst_offset + i] &= input[i];
+
+	//the flash programs up to a page per command, a write that is not page aligned needs one more
+	uint32_t pages = size == 0 ? 0 : (uint32_t)((dst_offset + size - 1) / FAKE_FLASH_PAGE_SIZE - dst_offset / FAKE_FLASH_PAGE_SIZE + 1);
+	g_stats.writeCalls++;
+	g_stats.pagePrograms += pages;
+	host_clock_sleep(FAKE_FLASH_CALL_US + (int64_t)pages * FAKE_FLASH_PAGE_PROGRAM_US);
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t start_addr, size_t size)
+{
+	int index = find_partition(partition);
+	if (index < 0 || start_addr > partition->size || size > partition->size - start_addr)
+		return ESP_ERR_INVALID_ARG;
+	if (start_addr % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0)
+	{
+		ESP_LOGE(TAG, "Erase of 0x%x bytes at 0x%x is not sector aligned", (unsigned int)size, (unsigned int)start_addr);
+		g_stats.violations++;
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	memset(g_data[index] + start_addr, 0xFF, size);
+	g_stats.eraseCalls++;
+	g_stats.sectorErases += (uint32_t)(size / SPI_FLASH_SEC_SIZE);
+	host_clock_sleep(FAKE_FLASH_CALL_US + (int64_t)(size / SPI_FLASH_SEC_SIZE) * FAKE_FLASH_SECTOR_ERASE_US);
+	return ESP_OK;
+}
@@ -0,0 +1,53 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef FAKE_FLASH_H
+#define FAKE_FLASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_partition.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * Host backend of esp_partition_read/write/erase_range on app partitions in memory.
+	 * It behaves like NOR flash: erase works on whole sectors and sets them to 0xFF, a write can only clear bits.
+	 * Every operation takes a typical SPI flash duration of the clock of host_clock.h.
+	 */
+#define FAKE_FLASH_MAX_PARTITIONS 4
+#define FAKE_FLASH_PAGE_SIZE 256
+	//typical 4 MB SPI NOR flash, the call overhead is the cache disable and enable of spi_flash_write
+#define FAKE_FLASH_SECTOR_ERASE_US 45000
+#define FAKE_FLASH_PAGE_PROGRAM_US 700
+#define FAKE_FLASH_CALL_US 25
+
+	typedef struct FAKE_FLASH_STATS
+	{
+		uint32_t writeCalls;
+		uint32_t pagePrograms;
+		uint32_t eraseCalls;
+		uint32_t sectorErases;
+		//writes that needed an erase first and erases that were not sector aligned, both fail
+		uint32_t violations;
+	} FAKE_FLASH_STATS;
+
+	//removes all partitions and adds ota_0, returns NULL without memory
+	const esp_partition_t *fake_flash_init(size_t size, unsigned int seed);
+	//a partition starts with the pseudo random content of an old image, a seed of 0 leaves it zeroed,
+	//which takes no memory until it is written
+	const esp_partition_t *fake_flash_add(const char *label, esp_partition_subtype_t subtype, size_t size, unsigned int seed);
+	//the content of the first partition
+	const unsigned char *fake_flash_data();
+	unsigned char *fake_flash_partition_data(const esp_partition_t *partition);
+	void fake_flash_get_stats(FAKE_FLASH_STATS *stats);
+	void fake_flash_reset_stats();
+	void fake_flash_free();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FAKE_FLASH_H */
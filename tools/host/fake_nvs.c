@@ -0,0 +1,304 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "fake_nvs.h"
+
+//a handle is the namespace index plus one, the top bit marks a read only handle
+#define NVS_HANDLE_READONLY 0x80000000u
+#define NVS_MAX_NAMESPACES 16
+
+typedef enum
+{
+	NVS_TYPE_U32,
+	NVS_TYPE_STR,
+	NVS_TYPE_BLOB
+} NVS_TYPE;
+
+typedef struct NVS_ENTRY_TAG
+{
+	int namespaceIndex;
+	char key[FAKE_NVS_NAME_LENGTH];
+	NVS_TYPE type;
+	size_t length;
+	unsigned char *value;
+} NVS_ENTRY;
+
+static char g_namespaces[NVS_MAX_NAMESPACES][FAKE_NVS_NAME_LENGTH];
+static int g_namespaceCount = 0;
+static NVS_ENTRY g_entries[FAKE_NVS_MAX_ENTRIES];
+static int g_entryCount = 0;
+static uint32_t g_writeCount = 0;
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void fake_nvs_clear()
+{
+	pthread_mutex_lock(&g_mutex);
+	for (int i = 0; i < g_entryCount; i++)
+		free(g_entries[i].value);
+	g_entryCount = 0;
+	g_namespaceCount = 0;
+	g_writeCount = 0;
+	pthread_mutex_unlock(&g_mutex);
+}
+
+uint32_t fake_nvs_get_write_count()
+{
+	return g_writeCount;
+}
+
+int fake_nvs_save(FILE *file)
+{
+	pthread_mutex_lock(&g_mutex);
+	int isSaved = fwrite(&g_namespaceCount, sizeof(g_namespaceCount), 1, file) == 1
+		&& fwrite(g_namespaces, sizeof(g_namespaces), 1, file) == 1
+		&& fwrite(&g_entryCount, sizeof(g_entryCount), 1, file) == 1;
+	for (int i = 0; isSaved && i < g_entryCount; i++)
+	{
+		//the value pointer is written too, fake_nvs_load replaces it
+		isSaved = fwrite(&g_entries[i], sizeof(g_entries[i]), 1, file) == 1
+			&& (g_entries[i].length == 0 || fwrite(g_entries[i].value, g_entries[i].length, 1, file) == 1);
+	}
+	pthread_mutex_unlock(&g_mutex);
+	return isSaved;
+}
+
+int fake_nvs_load(FILE *file)
+{
+	fake_nvs_clear();
+	pthread_mutex_lock(&g_mutex);
+	int entryCount = 0;
+	int isLoaded = fread(&g_namespaceCount, sizeof(g_namespaceCount), 1, file) == 1
+		&& g_namespaceCount >= 0 && g_namespaceCount <= NVS_MAX_NAMESPACES
+		&& fread(g_namespaces, sizeof(g_namespaces), 1, file) == 1
+		&& fread(&entryCount, sizeof(entryCount), 1, file) == 1 && entryCount >= 0 && entryCount <= FAKE_NVS_MAX_ENTRIES;
+	for (int i = 0; isLoaded && i < entryCount; i++)
+	{
+		NVS_ENTRY *entry = &g_entries[i];
+		isLoaded = fread(entry, sizeof(*entry), 1, file) == 1 && (entry->value = (unsigned char *)malloc(entry->length > 0 ? entry->length : 1)) != NULL;
+		if (!isLoaded)
+			break;
+		g_entryCount++;
+		isLoaded = entry->length == 0 || fread(entry->value, entry->length, 1, file) == 1;
+	}
+	pthread_mutex_unlock(&g_mutex);
+	if (!isLoaded)
+		fake_nvs_clear();
+	return isLoaded;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+	return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+	fake_nvs_clear();
+	return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle)
+{
+	if (name == NULL || strlen(name) >= FAKE_NVS_NAME_LENGTH)
+		return ESP_ERR_NVS_INVALID_NAME;
+
+	pthread_mutex_lock(&g_mutex);
+	int index = 0;
+	while (index < g_namespaceCount && strcmp(g_namespaces[index], name) != 0)
+		index++;
+
+	esp_err_t err = ESP_OK;
+	if (index == g_namespaceCount)
+	{
+		//like NVS a read only open does not create the namespace
+		if (open_mode == NVS_READONLY)
+			err = ESP_ERR_NVS_NOT_FOUND;
+		else if (g_namespaceCount == NVS_MAX_NAMESPACES)
+			err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+		else
+			strcpy(g_namespaces[g_namespaceCount++], name);
+	}
+	pthread_mutex_unlock(&g_mutex);
+
+	if (err == ESP_OK)
+		*out_handle = (nvs_handle)(index + 1) | (open_mode == NVS_READONLY ? NVS_HANDLE_READONLY : 0);
+	return err;
+}
+
+void nvs_close(nvs_handle handle)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle handle)
+{
+	return ESP_OK;
+}
+
+static int namespace_of(nvs_handle handle)
+{
+	int index = (int)(handle & ~NVS_HANDLE_READONLY) - 1;
+	return index >= 0 && index < g_namespaceCount ? index : -1;
+}
+
+//called with the mutex held
+static NVS_ENTRY *find_entry(int namespaceIndex, const char *key)
+{
+	for (int i = 0; i < g_entryCount; i++)
+	{
+		if (g_entries[i].namespaceIndex == namespaceIndex && strcmp(g_entries[i].key, key) == 0)
+			return &g_entries[i];
+	}
+	return NULL;
+}
+
+static esp_err_t set_value(nvs_handle handle, const char *key, NVS_TYPE type, const void *value, size_t length)
+{
+	if ((handle & NVS_HANDLE_READONLY) != 0)
+		return ESP_ERR_NVS_READ_ONLY;
+	if (key == NULL || strlen(key) >= FAKE_NVS_NAME_LENGTH)
+		return ESP_ERR_NVS_INVALID_NAME;
+
+	unsigned char *copy = (unsigned char *)malloc(length > 0 ? length : 1);
+	if (copy == NULL)
+		return ESP_ERR_NO_MEM;
+	memcpy(copy, value, length);
+
+	pthread_mutex_lock(&g_mutex);
+	esp_err_t err = ESP_OK;
+	int namespaceIndex = namespace_of(handle);
+	NVS_ENTRY *entry = namespaceIndex < 0 ? NULL : find_entry(namespaceIndex, key);
+	if (namespaceIndex < 0)
+	{
+		err = ESP_ERR_NVS_INVALID_HANDLE;
+	}
+	else if (entry == NULL && g_entryCount == FAKE_NVS_MAX_ENTRIES)
+	{
+		err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+	}
+	else
+	{
+		if (entry == NULL)
+		{
+			entry = &g_entries[g_entryCount++];
+			entry->namespaceIndex = namespaceIndex;
+			strcpy(entry->key, key);
+		}
+		else
+		{
+			free(entry->value);
+		}
+		entry->type = type;
+		entry->length = length;
+		entry->value = copy;
+		copy = NULL;
+		g_writeCount++;
+	}
+	pthread_mutex_unlock(&g_mutex);
+
+	free(copy);
+	return err;
+}
+
+//a NULL value asks for the length only
+static esp_err_t get_value(nvs_handle handle, const char *key, NVS_TYPE type, void *value, size_t *length)
+{
+	pthread_mutex_lock(&g_mutex);
+	esp_err_t err = ESP_OK;
+	int namespaceIndex = namespace_of(handle);
+	NVS_ENTRY *entry = namespaceIndex < 0 ? NULL : find_entry(namespaceIndex, key);
+	if (namespaceIndex < 0)
+		err = ESP_ERR_NVS_INVALID_HANDLE;
+	else if (entry == NULL)
+		err = ESP_ERR_NVS_NOT_FOUND;
+	else if (entry->type != type)
+		err = ESP_ERR_NVS_TYPE_MISMATCH;
+	else if (value != NULL && *length < entry->length)
+		err = ESP_ERR_NVS_INVALID_LENGTH;
+
+	if (err == ESP_OK)
+	{
+		if (value != NULL)
+			memcpy(value, entry->value, entry->length);
+		*length = entry->length;
+	}
+	pthread_mutex_unlock(&g_mutex);
+	return err;
+}
+
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key)
+{
+	if ((handle & NVS_HANDLE_READONLY) != 0)
+		return ESP_ERR_NVS_READ_ONLY;
+
+	pthread_mutex_lock(&g_mutex);
+	int namespaceIndex = namespace_of(handle);
+	NVS_ENTRY *entry = namespaceIndex < 0 ? NULL : find_entry(namespaceIndex, key);
+	if (entry != NULL)
+	{
+		free(entry->value);
+		*entry = g_entries[--g_entryCount];
+		g_writeCount++;
+	}
+	pthread_mutex_unlock(&g_mutex);
+	return namespaceIndex < 0 ? ESP_ERR_NVS_INVALID_HANDLE : entry == NULL ? ESP_ERR_NVS_NOT_FOUND : ESP_OK;
+}
+
+esp_err_t nvs_erase_all(nvs_handle handle)
+{
+	if ((handle & NVS_HANDLE_READONLY) != 0)
+		return ESP_ERR_NVS_READ_ONLY;
+
+	pthread_mutex_lock(&g_mutex);
+	int namespaceIndex = namespace_of(handle);
+	for (int i = 0; i < g_entryCount; )
+	{
+		if (g_entries[i].namespaceIndex == namespaceIndex)
+		{
+			free(g_entries[i].value);
+			g_entries[i] = g_entries[--g_entryCount];
+			g_writeCount++;
+		}
+		else
+		{
+			i++;
+		}
+	}
+	pthread_mutex_unlock(&g_mutex);
+	return namespaceIndex < 0 ? ESP_ERR_NVS_INVALID_HANDLE : ESP_OK;
+}
+
+esp_err_t nvs_set_u32(nvs_handle handle, const char *key, uint32_t value)
+{
+	return set_value(handle, key, NVS_TYPE_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle handle, const char *key, uint32_t *out_value)
+{
+	size_t length = sizeof(*out_value);
+	return get_value(handle, key, NVS_TYPE_U32, out_value, &length);
+}
+
+esp_err_t nvs_set_str(nvs_handle handle, const char *key, const char *value)
+{
+	return set_value(handle, key, NVS_TYPE_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_str(nvs_handle handle, const char *key, char *out_value, size_t *length)
+{
+	return get_value(handle, key, NVS_TYPE_STR, out_value, length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length)
+{
+	return set_value(handle, key, NVS_TYPE_BLOB, value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length)
+{
+	return get_value(handle, key, NVS_TYPE_BLOB, out_value, length);
+}
@@ -0,0 +1,33 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef FAKE_NVS_H
+#define FAKE_NVS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * Host backend of the nvs.h functions, the entries live in memory until fake_nvs_clear.
+	 * A value is typed like in NVS, reading it with another type is ESP_ERR_NVS_TYPE_MISMATCH.
+	 */
+#define FAKE_NVS_MAX_ENTRIES 64
+#define FAKE_NVS_NAME_LENGTH 16
+
+	void fake_nvs_clear();
+	//the number of set and erase calls, each one costs flash wear on the device
+	uint32_t fake_nvs_get_write_count();
+	//the entries outlive the process, a restarted device loads what the previous one saved. 0 on an I/O error
+	int fake_nvs_save(FILE *file);
+	//replaces the entries with those fake_nvs_save wrote, the write count starts over
+	int fake_nvs_load(FILE *file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FAKE_NVS_H */
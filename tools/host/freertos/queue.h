@@ -0,0 +1,26 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//host stand in for the FreeRTOS header of ESP-IDF
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	typedef struct HOST_QUEUE_TAG *QueueHandle_t;
+
+	QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize);
+	BaseType_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait);
+	BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait);
+	UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue);
+	void vQueueDelete(QueueHandle_t xQueue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QUEUE_H */
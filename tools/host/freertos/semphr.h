@@ -0,0 +1,27 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//host stand in for the FreeRTOS header of ESP-IDF, a semaphore is a queue of empty items like in FreeRTOS
+#ifndef SEMPHR_H
+#define SEMPHR_H
+
+#include "queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	typedef QueueHandle_t SemaphoreHandle_t;
+
+	SemaphoreHandle_t xSemaphoreCreateMutex(void);
+
+#define xSemaphoreCreateBinary() xQueueCreate(1, 0)
+#define xSemaphoreGive(xSemaphore) xQueueSend((xSemaphore), NULL, 0)
+#define xSemaphoreTake(xSemaphore, xBlockTime) xQueueReceive((xSemaphore), NULL, (xBlockTime))
+#define vSemaphoreDelete(xSemaphore) vQueueDelete(xSemaphore)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SEMPHR_H */
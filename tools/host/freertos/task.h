@@ -0,0 +1,37 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//host stand in for the FreeRTOS header of ESP-IDF
+#ifndef TASK_H
+#define TASK_H
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	typedef struct HOST_TASK_TAG *TaskHandle_t;
+	typedef void (*TaskFunction_t)(void *pvParameters);
+
+	//the stack size and the priority are ignored, every task is a thread
+	BaseType_t xTaskCreate(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth, void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pvCreatedTask);
+	//only the calling task can delete itself
+	void vTaskDelete(TaskHandle_t xTaskToDelete);
+	void vTaskDelay(TickType_t xTicksToDelay);
+	TickType_t xTaskGetTickCount(void);
+	TaskHandle_t xTaskGetCurrentTaskHandle(void);
+	//every task runs on core 0, which has no idle task
+	TaskHandle_t xTaskGetCurrentTaskHandleForCPU(BaseType_t cpuid);
+	TaskHandle_t xTaskGetIdleTaskHandleForCPU(UBaseType_t cpuid);
+	uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait);
+	BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify);
+	//NULL is the calling task. the stack of a thread is not measured, its high water mark is the requested depth
+	char *pcTaskGetTaskName(TaskHandle_t xTaskToQuery);
+	UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TASK_H */
@@ -0,0 +1,318 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "host_clock.h"
+
+//the task notification of FreeRTOS is a counting semaphore of the task
+struct HOST_TASK_TAG
+{
+	TaskFunction_t function;
+	void *parameters;
+	char name[16];
+	uint32_t stackDepth;
+	pthread_mutex_t mutex;
+	pthread_cond_t notified;
+	uint32_t notifications;
+};
+
+struct HOST_QUEUE_TAG
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t changed;
+	UBaseType_t length;
+	UBaseType_t itemSize;
+	UBaseType_t count;
+	UBaseType_t head;
+	unsigned char items[];
+};
+
+struct HOST_EVENT_GROUP_TAG
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t changed;
+	EventBits_t bits;
+};
+
+static __thread TaskHandle_t g_currentTask = NULL;
+
+static void init_cond(pthread_cond_t *cond)
+{
+	pthread_condattr_t attributes;
+	pthread_condattr_init(&attributes);
+	pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attributes);
+	pthread_condattr_destroy(&attributes);
+}
+
+//a change wakes the waiters of the object, and those of the virtual clock
+static void broadcast(pthread_cond_t *cond)
+{
+	pthread_cond_broadcast(cond);
+	host_clock_notify();
+}
+
+static void get_deadline(TickType_t ticks, HOST_CLOCK_DEADLINE *deadline)
+{
+	host_clock_deadline(ticks == portMAX_DELAY ? -1 : (int64_t)ticks * portTICK_PERIOD_MS * 1000, deadline);
+}
+
+static TaskHandle_t create_task(TaskFunction_t function, void *parameters, const char *name, uint32_t stackDepth)
+{
+	TaskHandle_t task = (TaskHandle_t)calloc(1, sizeof(struct HOST_TASK_TAG));
+	if (task == NULL)
+		return NULL;
+	task->function = function;
+	task->parameters = parameters;
+	strncpy(task->name, name, sizeof(task->name) - 1);
+	task->stackDepth = stackDepth;
+	pthread_mutex_init(&task->mutex, NULL);
+	init_cond(&task->notified);
+	return task;
+}
+
+static void *task_thread(void *arg)
+{
+	g_currentTask = (TaskHandle_t)arg;
+	g_currentTask->function(g_currentTask->parameters);
+	host_clock_thread_exit();
+	return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth, void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pvCreatedTask)
+{
+	TaskHandle_t task = create_task(pvTaskCode, pvParameters, pcName, usStackDepth);
+	if (task == NULL)
+		return pdFAIL;
+
+	pthread_t thread;
+	host_clock_thread_start();
+	if (pthread_create(&thread, NULL, task_thread, task) != 0)
+	{
+		host_clock_thread_exit();
+		free(task);
+		return pdFAIL;
+	}
+	pthread_detach(thread);
+	if (pvCreatedTask != NULL)
+		*pvCreatedTask = task;
+	return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete)
+{
+	//another task may still notify this one, its handle stays valid
+	assert(xTaskToDelete == NULL || xTaskToDelete == g_currentTask);
+	host_clock_thread_exit();
+	pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t xTicksToDelay)
+{
+	host_clock_sleep((int64_t)xTicksToDelay * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return (TickType_t)(esp_timer_get_time() / 1000 / portTICK_PERIOD_MS);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	//a thread that xTaskCreate did not start, like main, becomes a task when it first asks
+	if (g_currentTask == NULL)
+		g_currentTask = create_task(NULL, NULL, "main", 0);
+	return g_currentTask;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandleForCPU(BaseType_t cpuid)
+{
+	return cpuid == 0 ? xTaskGetCurrentTaskHandle() : NULL;
+}
+
+TaskHandle_t xTaskGetIdleTaskHandleForCPU(UBaseType_t cpuid)
+{
+	return NULL;
+}
+
+char *pcTaskGetTaskName(TaskHandle_t xTaskToQuery)
+{
+	return (xTaskToQuery != NULL ? xTaskToQuery : xTaskGetCurrentTaskHandle())->name;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask)
+{
+	return (xTask != NULL ? xTask : xTaskGetCurrentTaskHandle())->stackDepth;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+	TaskHandle_t task = xTaskGetCurrentTaskHandle();
+	HOST_CLOCK_DEADLINE deadline;
+	get_deadline(xTicksToWait, &deadline);
+
+	pthread_mutex_lock(&task->mutex);
+	while (task->notifications == 0 && xTicksToWait > 0 && host_clock_wait(&task->notified, &task->mutex, &deadline))
+		;
+	uint32_t notifications = task->notifications;
+	if (notifications > 0)
+		task->notifications = xClearCountOnExit ? 0 : notifications - 1;
+	pthread_mutex_unlock(&task->mutex);
+	return notifications;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify)
+{
+	pthread_mutex_lock(&xTaskToNotify->mutex);
+	++xTaskToNotify->notifications;
+	broadcast(&xTaskToNotify->notified);
+	pthread_mutex_unlock(&xTaskToNotify->mutex);
+	return pdPASS;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize)
+{
+	QueueHandle_t queue = (QueueHandle_t)calloc(1, sizeof(struct HOST_QUEUE_TAG) + (size_t)uxQueueLength * uxItemSize);
+	if (queue == NULL)
+		return NULL;
+	pthread_mutex_init(&queue->mutex, NULL);
+	init_cond(&queue->changed);
+	queue->length = uxQueueLength;
+	queue->itemSize = uxItemSize;
+	return queue;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	//a queue of one empty item that starts full, given without xQueueSend, which copies items
+	SemaphoreHandle_t mutex = xQueueCreate(1, 0);
+	if (mutex != NULL)
+		mutex->count = 1;
+	return mutex;
+}
+
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+	HOST_CLOCK_DEADLINE deadline;
+	get_deadline(xTicksToWait, &deadline);
+
+	pthread_mutex_lock(&xQueue->mutex);
+	while (xQueue->count == xQueue->length && xTicksToWait > 0 && host_clock_wait(&xQueue->changed, &xQueue->mutex, &deadline))
+		;
+	BaseType_t result = pdFAIL;
+	if (xQueue->count < xQueue->length)
+	{
+		UBaseType_t tail = (xQueue->head + xQueue->count) % xQueue->length;
+		if (xQueue->itemSize > 0)
+			memcpy(xQueue->items + (size_t)tail * xQueue->itemSize, pvItemToQueue, xQueue->itemSize);
+		++xQueue->count;
+		broadcast(&xQueue->changed);
+		result = pdPASS;
+	}
+	pthread_mutex_unlock(&xQueue->mutex);
+	return result;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+	HOST_CLOCK_DEADLINE deadline;
+	get_deadline(xTicksToWait, &deadline);
+
+	pthread_mutex_lock(&xQueue->mutex);
+	while (xQueue->count == 0 && xTicksToWait > 0 && host_clock_wait(&xQueue->changed, &xQueue->mutex, &deadline))
+		;
+	BaseType_t result = pdFAIL;
+	if (xQueue->count > 0)
+	{
+		if (xQueue->itemSize > 0)
+			memcpy(pvBuffer, xQueue->items + (size_t)xQueue->head * xQueue->itemSize, xQueue->itemSize);
+		xQueue->head = (xQueue->head + 1) % xQueue->length;
+		--xQueue->count;
+		broadcast(&xQueue->changed);
+		result = pdPASS;
+	}
+	pthread_mutex_unlock(&xQueue->mutex);
+	return result;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue)
+{
+	pthread_mutex_lock(&xQueue->mutex);
+	UBaseType_t count = xQueue->count;
+	pthread_mutex_unlock(&xQueue->mutex);
+	return count;
+}
+
+void vQueueDelete(QueueHandle_t xQueue)
+{
+	pthread_cond_destroy(&xQueue->changed);
+	pthread_mutex_destroy(&xQueue->mutex);
+	free(xQueue);
+}
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+	EventGroupHandle_t group = (EventGroupHandle_t)calloc(1, sizeof(struct HOST_EVENT_GROUP_TAG));
+	if (group == NULL)
+		return NULL;
+	pthread_mutex_init(&group->mutex, NULL);
+	init_cond(&group->changed);
+	return group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToSet)
+{
+	pthread_mutex_lock(&xEventGroup->mutex);
+	xEventGroup->bits |= uxBitsToSet;
+	EventBits_t bits = xEventGroup->bits;
+	broadcast(&xEventGroup->changed);
+	pthread_mutex_unlock(&xEventGroup->mutex);
+	return bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToClear)
+{
+	pthread_mutex_lock(&xEventGroup->mutex);
+	EventBits_t bits = xEventGroup->bits;
+	xEventGroup->bits &= ~uxBitsToClear;
+	pthread_mutex_unlock(&xEventGroup->mutex);
+	return bits;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t xEventGroup)
+{
+	pthread_mutex_lock(&xEventGroup->mutex);
+	EventBits_t bits = xEventGroup->bits;
+	pthread_mutex_unlock(&xEventGroup->mutex);
+	return bits;
+}
+
+static int is_waited_for(EventBits_t bits, EventBits_t waitFor, BaseType_t isAll)
+{
+	return isAll ? (bits & waitFor) == waitFor : (bits & waitFor) != 0;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToWaitFor, const BaseType_t xClearOnExit,
+	const BaseType_t xWaitForAllBits, TickType_t xTicksToWait)
+{
+	HOST_CLOCK_DEADLINE deadline;
+	get_deadline(xTicksToWait, &deadline);
+
+	pthread_mutex_lock(&xEventGroup->mutex);
+	while (!is_waited_for(xEventGroup->bits, uxBitsToWaitFor, xWaitForAllBits) && xTicksToWait > 0
+		&& host_clock_wait(&xEventGroup->changed, &xEventGroup->mutex, &deadline))
+		;
+	EventBits_t bits = xEventGroup->bits;
+	if (xClearOnExit && is_waited_for(bits, uxBitsToWaitFor, xWaitForAllBits))
+		xEventGroup->bits &= ~uxBitsToWaitFor;
+	pthread_mutex_unlock(&xEventGroup->mutex);
+	return bits;
+}
@@ -0,0 +1,792 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "hal.h"
+#include "hal_iothub.h"
+#include "hal_posix.h"
+#include "mqtt_packet.h"
+
+//the keep alive of the SDK, and its exponential backoff between the connection attempts
+#define MQTT_KEEP_ALIVE_S 240
+#define RECONNECT_MIN_MS 1000
+#define RECONNECT_MAX_MS 60000
+#define MAX_DEVICE_ID_LENGTH 128
+#define MAX_TOPIC_LENGTH 256
+#define READ_BUFFER_SIZE 4096
+
+typedef struct PENDING_TAG
+{
+	struct PENDING_TAG *next;
+	int64_t sendTime;
+	int64_t dueTime;
+	bool isLost;
+	//the confirmation of a telemetry message or of a reported state
+	HAL_IOTHUB_CONFIRMATION_CALLBACK confirmation;
+	HAL_IOTHUB_REPORTED_STATE_CALLBACK reportConfirmation;
+	void *context;
+	//the packet on the broker connection, the PUBACK matches packetId and the twin response requestId
+	uint16_t packetId;
+	uint32_t requestId;
+	bool isSent;
+	size_t packetLength;
+	uint8_t *packet;
+} PENDING;
+
+typedef struct INBOX_ITEM_TAG
+{
+	struct INBOX_ITEM_TAG *next;
+	//a direct method when response is not NULL
+	HAL_POSIX_METHOD_RESPONSE response;
+	void *context;
+	char text[];
+} INBOX_ITEM;
+
+typedef struct BUFFER_TAG
+{
+	uint8_t *data;
+	size_t length;
+	size_t capacity;
+} BUFFER;
+
+struct HAL_IOTHUB_CLIENT_TAG
+{
+	HAL_IOTHUB_CALLBACKS callbacks;
+	bool isConnected;
+	PENDING *pending;
+	PENDING *pendingTail;
+	//the broker connection, fd is -1 between the connections
+	char deviceId[MAX_DEVICE_ID_LENGTH];
+	int fd;
+	BUFFER input;
+	BUFFER output;
+	uint16_t nextPacketId;
+	uint32_t nextRequestId;
+	int64_t nextConnectTime;
+	uint32_t backoffMs;
+	int64_t lastSendTime;
+	int64_t pingTime;
+};
+
+static HAL_POSIX_HUB g_hub = { 0, 0, 0, 1, NULL, 0, NULL };
+static HAL_POSIX_HUB_STATS g_stats;
+static uint32_t g_randomState = 1;
+static INBOX_ITEM *g_inbox = NULL;
+static INBOX_ITEM *g_inboxTail = NULL;
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t next_random(void)
+{
+	uint32_t x = g_randomState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	g_randomState = x;
+	return x;
+}
+
+void hal_posix_hub_init(const HAL_POSIX_HUB *hub)
+{
+	pthread_mutex_lock(&g_mutex);
+	g_hub = *hub;
+	g_randomState = hub->seed != 0 ? hub->seed : 1;
+	memset(&g_stats, 0, sizeof(g_stats));
+	pthread_mutex_unlock(&g_mutex);
+}
+
+static void add_to_inbox(const char *text, HAL_POSIX_METHOD_RESPONSE response, void *context)
+{
+	size_t length = strlen(text);
+	INBOX_ITEM *item = (INBOX_ITEM *)malloc(sizeof(INBOX_ITEM) + length + 1);
+	if (item == NULL)
+		return;
+	item->next = NULL;
+	item->response = response;
+	item->context = context;
+	memcpy(item->text, text, length + 1);
+
+	pthread_mutex_lock(&g_mutex);
+	if (g_inboxTail != NULL)
+		g_inboxTail->next = item;
+	else
+		g_inbox = item;
+	g_inboxTail = item;
+	pthread_mutex_unlock(&g_mutex);
+}
+
+void hal_posix_hub_send_message(const char *message)
+{
+	add_to_inbox(message, NULL, NULL);
+}
+
+void hal_posix_hub_invoke_method(const char *methodName, HAL_POSIX_METHOD_RESPONSE response, void *context)
+{
+	add_to_inbox(methodName, response, context);
+}
+
+void hal_posix_hub_get_stats(HAL_POSIX_HUB_STATS *stats)
+{
+	pthread_mutex_lock(&g_mutex);
+	*stats = g_stats;
+	pthread_mutex_unlock(&g_mutex);
+}
+
+int hal_iothub_platform_init(void)
+{
+	return 0;
+}
+
+void hal_iothub_platform_deinit(void)
+{
+}
+
+//the DeviceId=... of a connection string
+static void parse_device_id(const char *connectionString, char *deviceId)
+{
+	const char *start = strstr(connectionString, "DeviceId=");
+	size_t length = 0;
+	if (start != NULL)
+	{
+		start += strlen("DeviceId=");
+		length = strcspn(start, ";");
+	}
+	if (length == 0 || length >= MAX_DEVICE_ID_LENGTH)
+	{
+		start = "watertank";
+		length = strlen(start);
+	}
+	memcpy(deviceId, start, length);
+	deviceId[length] = '\0';
+}
+
+HAL_IOTHUB_HANDLE hal_iothub_create(const char *connectionString, const HAL_IOTHUB_CALLBACKS *callbacks)
+{
+	HAL_IOTHUB_HANDLE handle = (HAL_IOTHUB_HANDLE)calloc(1, sizeof(struct HAL_IOTHUB_CLIENT_TAG));
+	if (handle == NULL)
+		return NULL;
+	handle->callbacks = *callbacks;
+	handle->fd = -1;
+	handle->nextPacketId = 1;
+	handle->nextRequestId = 1;
+	handle->backoffMs = RECONNECT_MIN_MS;
+
+	pthread_mutex_lock(&g_mutex);
+	++g_stats.clients;
+	if (g_hub.deviceId != NULL && strlen(g_hub.deviceId) < MAX_DEVICE_ID_LENGTH)
+		strcpy(handle->deviceId, g_hub.deviceId);
+	else
+		parse_device_id(connectionString, handle->deviceId);
+	pthread_mutex_unlock(&g_mutex);
+	return handle;
+}
+
+static void update_pending_stats(HAL_IOTHUB_HANDLE handle)
+{
+	uint32_t count = 0;
+	int64_t oldest = 0;
+	for (PENDING *pending = handle->pending; pending != NULL; pending = pending->next)
+	{
+		if (pending->confirmation == NULL)
+			continue;
+		if (count++ == 0)
+			oldest = pending->sendTime;
+	}
+	pthread_mutex_lock(&g_mutex);
+	g_stats.pending = count;
+	g_stats.oldestPendingTime = oldest;
+	pthread_mutex_unlock(&g_mutex);
+}
+
+static PENDING *add_pending(HAL_IOTHUB_HANDLE handle, uint32_t latencyMs, bool isLost)
+{
+	PENDING *pending = (PENDING *)calloc(1, sizeof(PENDING));
+	if (pending == NULL)
+		return NULL;
+	pending->sendTime = hal_time_us();
+	pending->dueTime = pending->sendTime + (int64_t)latencyMs * 1000;
+	pending->isLost = isLost;
+	if (handle->pendingTail != NULL)
+		handle->pendingTail->next = pending;
+	else
+		handle->pending = pending;
+	handle->pendingTail = pending;
+	return pending;
+}
+
+static void remove_pending(HAL_IOTHUB_HANDLE handle, PENDING *pending, PENDING *previous)
+{
+	if (previous != NULL)
+		previous->next = pending->next;
+	else
+		handle->pending = pending->next;
+	if (handle->pendingTail == pending)
+		handle->pendingTail = previous;
+	free(pending->packet);
+	free(pending);
+}
+
+static void confirm_event(PENDING *pending, int64_t now)
+{
+	int64_t latency = now - pending->sendTime;
+	pthread_mutex_lock(&g_mutex);
+	++g_stats.confirmed;
+	g_stats.confirmationTime += latency;
+	if (latency > g_stats.maxConfirmationTime)
+		g_stats.maxConfirmationTime = latency;
+	pthread_mutex_unlock(&g_mutex);
+	pending->confirmation(HAL_IOTHUB_CONFIRMATION_OK, pending->context);
+}
+
+//the message timeout of the SDK, the oldest messages first
+static void expire_pending(HAL_IOTHUB_HANDLE handle, int64_t now)
+{
+	bool isExpired = false;
+	PENDING *previous = NULL;
+	PENDING *pending = handle->pending;
+	while (pending != NULL && now - pending->sendTime >= (int64_t)HAL_IOTHUB_MESSAGE_TIMEOUT_MS * 1000)
+	{
+		PENDING *next = pending->next;
+		if (pending->confirmation == NULL)
+		{
+			previous = pending;
+			pending = next;
+			continue;
+		}
+		pthread_mutex_lock(&g_mutex);
+		++g_stats.timedOut;
+		pthread_mutex_unlock(&g_mutex);
+		pending->confirmation(HAL_IOTHUB_CONFIRMATION_MESSAGE_TIMEOUT, pending->context);
+		remove_pending(handle, pending, previous);
+		isExpired = true;
+		pending = next;
+	}
+	if (isExpired)
+		update_pending_stats(handle);
+}
+
+static bool reserve(BUFFER *buffer, size_t size)
+{
+	if (buffer->capacity >= size)
+		return true;
+	size_t capacity = buffer->capacity > 0 ? buffer->capacity : READ_BUFFER_SIZE;
+	while (capacity < size)
+		capacity *= 2;
+	uint8_t *data = (uint8_t *)realloc(buffer->data, capacity);
+	if (data == NULL)
+		return false;
+	buffer->data = data;
+	buffer->capacity = capacity;
+	return true;
+}
+
+//closes the broker connection or ends a failed attempt, the next attempt comes after the backoff
+static void disconnect(HAL_IOTHUB_HANDLE handle, int reason)
+{
+	if (handle->fd >= 0)
+		close(handle->fd);
+	handle->fd = -1;
+	handle->input.length = 0;
+	handle->output.length = 0;
+	handle->pingTime = 0;
+
+	//up to half of the backoff as jitter, so a fleet does not reconnect at once
+	pthread_mutex_lock(&g_mutex);
+	uint32_t jitterMs = next_random() % (handle->backoffMs / 2 + 1);
+	if (handle->isConnected)
+		++g_stats.disconnects;
+	pthread_mutex_unlock(&g_mutex);
+	handle->nextConnectTime = hal_time_us() + (int64_t)(handle->backoffMs + jitterMs) * 1000;
+	handle->backoffMs = handle->backoffMs * 2 < RECONNECT_MAX_MS ? handle->backoffMs * 2 : RECONNECT_MAX_MS;
+
+	for (PENDING *pending = handle->pending; pending != NULL; pending = pending->next)
+		pending->isSent = false;
+	if (handle->isConnected)
+	{
+		handle->isConnected = false;
+		handle->callbacks.connection(false, reason, handle->callbacks.context);
+	}
+}
+
+//sends what the socket takes, the rest waits for the next hal_iothub_do_work
+static bool flush_output(HAL_IOTHUB_HANDLE handle)
+{
+	size_t sent = 0;
+	while (sent < handle->output.length)
+	{
+		ssize_t length = send(handle->fd, handle->output.data + sent, handle->output.length - sent, MSG_NOSIGNAL);
+		if (length < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return false;
+			break;
+		}
+		sent += (size_t)length;
+	}
+	memmove(handle->output.data, handle->output.data + sent, handle->output.length - sent);
+	handle->output.length -= sent;
+	if (sent > 0)
+		handle->lastSendTime = hal_time_us();
+	return true;
+}
+
+static bool queue_packet(HAL_IOTHUB_HANDLE handle, const uint8_t *packet, size_t length)
+{
+	if (length == 0 || !reserve(&handle->output, handle->output.length + length))
+		return false;
+	memcpy(handle->output.data + handle->output.length, packet, length);
+	handle->output.length += length;
+	return true;
+}
+
+static void send_pending(HAL_IOTHUB_HANDLE handle, PENDING *pending)
+{
+	if (!handle->isConnected || pending->isSent)
+		return;
+	if (pending->packetId != 0 && pending->packet[0] & 0x08)
+	{
+		pthread_mutex_lock(&g_mutex);
+		++g_stats.resent;
+		pthread_mutex_unlock(&g_mutex);
+	}
+	if (queue_packet(handle, pending->packet, pending->packetLength))
+		pending->isSent = true;
+	//a PUBLISH QoS 1 that was sent once is a duplicate from now on
+	if (pending->packetId != 0)
+		pending->packet[0] |= 0x08;
+}
+
+static bool connect_to_broker(HAL_IOTHUB_HANDLE handle)
+{
+	char port[16];
+	snprintf(port, sizeof(port), "%d", g_hub.brokerPort);
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *address = NULL;
+	if (getaddrinfo(g_hub.brokerHost, port, &hints, &address) != 0)
+		return false;
+	handle->fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+	bool isConnected = handle->fd >= 0 && connect(handle->fd, address->ai_addr, address->ai_addrlen) == 0;
+	freeaddrinfo(address);
+	if (!isConnected)
+		return false;
+
+	int noDelay = 1;
+	setsockopt(handle->fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+	fcntl(handle->fd, F_SETFL, fcntl(handle->fd, F_GETFL) | O_NONBLOCK);
+
+	//the user name of IoT Hub, the broker does not check a SAS token so there is no password
+	char userName[MAX_DEVICE_ID_LENGTH + 64];
+	snprintf(userName, sizeof(userName), "%s/%s/?api-version=2018-06-30", g_hub.brokerHost, handle->deviceId);
+	uint8_t packet[MQTT_MAX_HEADER_SIZE + 12 + sizeof(userName) + MAX_DEVICE_ID_LENGTH];
+	return queue_packet(handle, packet, mqtt_packet_connect(packet, sizeof(packet), handle->deviceId, userName, MQTT_KEEP_ALIVE_S)) && flush_output(handle);
+}
+
+static void on_connack(HAL_IOTHUB_HANDLE handle, const MQTT_PACKET *packet)
+{
+	if (packet->length < 2 || packet->body[1] != 0)
+	{
+		disconnect(handle, packet->length < 2 ? -1 : packet->body[1]);
+		return;
+	}
+
+	char topics[3][MAX_TOPIC_LENGTH];
+	snprintf(topics[0], MAX_TOPIC_LENGTH, "devices/%s/messages/devicebound/#", handle->deviceId);
+	snprintf(topics[1], MAX_TOPIC_LENGTH, "$iothub/twin/res/#");
+	snprintf(topics[2], MAX_TOPIC_LENGTH, "$iothub/methods/POST/#");
+	const char *names[] = { topics[0], topics[1], topics[2] };
+	uint8_t subscribe[MQTT_MAX_HEADER_SIZE + 2 + sizeof(topics) + 9];
+	queue_packet(handle, subscribe, mqtt_packet_subscribe(subscribe, sizeof(subscribe), handle->nextPacketId++, names, 3));
+
+	handle->isConnected = true;
+	handle->backoffMs = RECONNECT_MIN_MS;
+	pthread_mutex_lock(&g_mutex);
+	++g_stats.connects;
+	pthread_mutex_unlock(&g_mutex);
+	handle->callbacks.connection(true, 0, handle->callbacks.context);
+	for (PENDING *pending = handle->pending; pending != NULL; pending = pending->next)
+		send_pending(handle, pending);
+}
+
+static void on_puback(HAL_IOTHUB_HANDLE handle, uint16_t packetId)
+{
+	PENDING *previous = NULL;
+	for (PENDING *pending = handle->pending; pending != NULL; previous = pending, pending = pending->next)
+	{
+		if (pending->packetId == packetId && pending->confirmation != NULL)
+		{
+			confirm_event(pending, hal_time_us());
+			remove_pending(handle, pending, previous);
+			update_pending_stats(handle);
+			return;
+		}
+	}
+}
+
+static void on_twin_response(HAL_IOTHUB_HANDLE handle, int status, uint32_t requestId)
+{
+	PENDING *previous = NULL;
+	for (PENDING *pending = handle->pending; pending != NULL; previous = pending, pending = pending->next)
+	{
+		if (pending->requestId == requestId && pending->reportConfirmation != NULL)
+		{
+			pending->reportConfirmation(status, pending->context);
+			remove_pending(handle, pending, previous);
+			return;
+		}
+	}
+}
+
+static void on_method(HAL_IOTHUB_HANDLE handle, const char *name, const char *requestId, const MQTT_PUBLISH_PACKET *publish)
+{
+	unsigned char *response = NULL;
+	size_t responseSize = 0;
+	int status = handle->callbacks.method(name, publish->payload, publish->payloadLength, &response, &responseSize, handle->callbacks.context);
+	pthread_mutex_lock(&g_mutex);
+	++g_stats.methods;
+	pthread_mutex_unlock(&g_mutex);
+
+	char topic[MAX_TOPIC_LENGTH];
+	int topicLength = snprintf(topic, sizeof(topic), "$iothub/methods/res/%d/?$rid=%s", status, requestId);
+	uint8_t *packet = (uint8_t *)malloc(MQTT_PUBLISH_SIZE(topicLength, responseSize));
+	if (packet != NULL)
+		queue_packet(handle, packet, mqtt_packet_publish(packet, MQTT_PUBLISH_SIZE(topicLength, responseSize), topic, (size_t)topicLength, 0, false, response, responseSize));
+	free(packet);
+	free(response);
+}
+
+static void on_publish(HAL_IOTHUB_HANDLE handle, const MQTT_PUBLISH_PACKET *publish)
+{
+	char topic[MAX_TOPIC_LENGTH];
+	if (publish->topicLength >= sizeof(topic))
+		return;
+	memcpy(topic, publish->topic, publish->topicLength);
+	topic[publish->topicLength] = '\0';
+	if (publish->qos == 1)
+	{
+		uint8_t ack[4];
+		queue_packet(handle, ack, mqtt_packet_ack(ack, sizeof(ack), MQTT_PUBACK, publish->packetId));
+	}
+
+	const char *requestId = strstr(topic, "$rid=");
+	requestId = requestId != NULL ? requestId + strlen("$rid=") : "";
+	if (strncmp(topic, "$iothub/twin/res/", strlen("$iothub/twin/res/")) == 0)
+		on_twin_response(handle, atoi(topic + strlen("$iothub/twin/res/")), (uint32_t)strtoul(requestId, NULL, 10));
+	else if (strncmp(topic, "$iothub/methods/POST/", strlen("$iothub/methods/POST/")) == 0)
+	{
+		//$iothub/methods/POST/{name}/?$rid={rid}, the rid is the first query parameter
+		char *name = topic + strlen("$iothub/methods/POST/");
+		char *nameEnd = strchr(name, '/');
+		if (nameEnd != NULL && strncmp(nameEnd + 1, "?$rid=", strlen("?$rid=")) == 0)
+		{
+			*nameEnd = '\0';
+			on_method(handle, name, nameEnd + 1 + strlen("?$rid="), publish);
+		}
+	}
+	else
+	{
+		handle->callbacks.message(publish->payload, publish->payloadLength, handle->callbacks.context);
+		pthread_mutex_lock(&g_mutex);
+		++g_stats.messages;
+		pthread_mutex_unlock(&g_mutex);
+	}
+}
+
+//the packets that arrived, false when the connection failed
+static bool receive_packets(HAL_IOTHUB_HANDLE handle)
+{
+	for (;;)
+	{
+		if (!reserve(&handle->input, handle->input.length + READ_BUFFER_SIZE))
+			return false;
+		ssize_t length = recv(handle->fd, handle->input.data + handle->input.length, handle->input.capacity - handle->input.length, 0);
+		if (length > 0)
+		{
+			handle->input.length += (size_t)length;
+			continue;
+		}
+		if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		return false;
+	}
+
+	size_t offset = 0;
+	while (handle->fd >= 0)
+	{
+		MQTT_PACKET packet;
+		int length = mqtt_packet_parse(handle->input.data + offset, handle->input.length - offset, &packet);
+		if (length == 0)
+			break;
+		if (length < 0)
+			return false;
+		offset += (size_t)length;
+
+		MQTT_PUBLISH_PACKET publish;
+		if (packet.type == MQTT_CONNACK)
+			on_connack(handle, &packet);
+		else if (packet.type == MQTT_PUBACK)
+			on_puback(handle, mqtt_packet_read_id(&packet));
+		else if (packet.type == MQTT_PINGRESP)
+			handle->pingTime = 0;
+		else if (packet.type == MQTT_PUBLISH && mqtt_packet_read_publish(&packet, &publish))
+			on_publish(handle, &publish);
+	}
+	if (handle->fd >= 0)
+	{
+		memmove(handle->input.data, handle->input.data + offset, handle->input.length - offset);
+		handle->input.length -= offset;
+	}
+	return true;
+}
+
+static void do_work_on_broker(HAL_IOTHUB_HANDLE handle)
+{
+	int64_t now = hal_time_us();
+	if (handle->fd < 0)
+	{
+		if (now < handle->nextConnectTime)
+			return;
+		if (!connect_to_broker(handle))
+		{
+			disconnect(handle, ECONNREFUSED);
+			return;
+		}
+		handle->lastSendTime = now;
+	}
+
+	if (!receive_packets(handle))
+	{
+		disconnect(handle, ECONNRESET);
+		return;
+	}
+	if (handle->fd < 0)
+		return; //refused by the CONNACK
+
+	//a PINGREQ after a silent keep alive period, the connection is dead when its PINGRESP does not come within another
+	if (handle->pingTime != 0 && now - handle->pingTime > (int64_t)MQTT_KEEP_ALIVE_S * 1000000)
+	{
+		disconnect(handle, ETIMEDOUT);
+		return;
+	}
+	if (handle->isConnected && handle->pingTime == 0 && now - handle->lastSendTime >= (int64_t)MQTT_KEEP_ALIVE_S * 1000000)
+	{
+		uint8_t ping[4];
+		queue_packet(handle, ping, mqtt_packet_ack(ping, sizeof(ping), MQTT_PINGREQ, 0));
+		handle->pingTime = now;
+	}
+	if (!flush_output(handle))
+		disconnect(handle, ECONNRESET);
+}
+
+//the PUBLISH of a message to the broker, malloc'ed. NULL when it does not fit
+static uint8_t *create_publish(const char *topic, int topicLength, uint16_t packetId, const void *payload, size_t size, size_t *length)
+{
+	if (topicLength < 0 || topicLength >= MAX_TOPIC_LENGTH)
+		return NULL;
+	uint8_t *packet = (uint8_t *)malloc(MQTT_PUBLISH_SIZE(topicLength, size));
+	*length = packet != NULL ? mqtt_packet_publish(packet, MQTT_PUBLISH_SIZE(topicLength, size), topic, (size_t)topicLength, packetId, false, payload, size) : 0;
+	if (*length == 0)
+	{
+		free(packet);
+		return NULL;
+	}
+	return packet;
+}
+
+int hal_iothub_send_event(HAL_IOTHUB_HANDLE handle, const char *payload, size_t size, const char *messageType, HAL_IOTHUB_CONFIRMATION_CALLBACK confirmation, void *context)
+{
+	uint8_t *packet = NULL;
+	size_t packetLength = 0;
+	uint16_t packetId = 0;
+	if (g_hub.brokerHost != NULL)
+	{
+		//the message properties are the url encoded last segment of the topic
+		char topic[MAX_TOPIC_LENGTH];
+		int topicLength = snprintf(topic, sizeof(topic), "devices/%s/messages/events/%s%s", handle->deviceId, messageType != NULL ? "messageType=" : "", messageType != NULL ? messageType : "");
+		packetId = handle->nextPacketId;
+		if ((packet = create_publish(topic, topicLength, packetId, payload, size, &packetLength)) == NULL)
+			return -1;
+		if (++handle->nextPacketId == 0)
+			handle->nextPacketId = 1;
+	}
+
+	pthread_mutex_lock(&g_mutex);
+	uint32_t latencyMs = g_hub.ackLatencyMs + (g_hub.ackJitterMs > 0 ? next_random() % (g_hub.ackJitterMs + 1) : 0);
+	bool isLost = packet == NULL && g_hub.lossProbability > 0 && next_random() < g_hub.lossProbability * UINT32_MAX;
+	++g_stats.events;
+	g_stats.eventBytes += size;
+	if (isLost)
+		++g_stats.lost;
+	pthread_mutex_unlock(&g_mutex);
+
+	PENDING *pending = add_pending(handle, latencyMs, isLost);
+	if (pending == NULL)
+	{
+		free(packet);
+		return -1;
+	}
+	pending->confirmation = confirmation;
+	pending->context = context;
+	pending->packetId = packetId;
+	pending->packet = packet;
+	pending->packetLength = packetLength;
+	if (packet != NULL)
+		send_pending(handle, pending);
+	update_pending_stats(handle);
+	return 0;
+}
+
+int hal_iothub_send_reported_state(HAL_IOTHUB_HANDLE handle, const char *json, size_t size, HAL_IOTHUB_REPORTED_STATE_CALLBACK confirmation, void *context)
+{
+	uint8_t *packet = NULL;
+	size_t packetLength = 0;
+	uint32_t requestId = 0;
+	if (g_hub.brokerHost != NULL)
+	{
+		char topic[MAX_TOPIC_LENGTH];
+		requestId = handle->nextRequestId;
+		int topicLength = snprintf(topic, sizeof(topic), "$iothub/twin/PATCH/properties/reported/?$rid=%u", requestId);
+		if ((packet = create_publish(topic, topicLength, 0, json, size, &packetLength)) == NULL)
+			return -1;
+		handle->nextRequestId++;
+	}
+
+	pthread_mutex_lock(&g_mutex);
+	uint32_t latencyMs = g_hub.ackLatencyMs;
+	++g_stats.reportedStates;
+	pthread_mutex_unlock(&g_mutex);
+
+	PENDING *pending = add_pending(handle, latencyMs, false);
+	if (pending == NULL)
+	{
+		free(packet);
+		return -1;
+	}
+	pending->reportConfirmation = confirmation;
+	pending->context = context;
+	pending->requestId = requestId;
+	pending->packet = packet;
+	pending->packetLength = packetLength;
+	if (packet != NULL)
+		send_pending(handle, pending);
+	return 0;
+}
+
+static void deliver_inbox(HAL_IOTHUB_HANDLE handle)
+{
+	pthread_mutex_lock(&g_mutex);
+	INBOX_ITEM *item = g_inbox;
+	g_inbox = g_inboxTail = NULL;
+	pthread_mutex_unlock(&g_mutex);
+
+	while (item != NULL)
+	{
+		INBOX_ITEM *next = item->next;
+		if (item->response == NULL)
+		{
+			handle->callbacks.message((const unsigned char *)item->text, strlen(item->text), handle->callbacks.context);
+			pthread_mutex_lock(&g_mutex);
+			++g_stats.messages;
+			pthread_mutex_unlock(&g_mutex);
+		}
+		else
+		{
+			unsigned char *response = NULL;
+			size_t responseSize = 0;
+			int status = handle->callbacks.method(item->text, NULL, 0, &response, &responseSize, handle->callbacks.context);
+			item->response(status, response, responseSize, item->context);
+			free(response);
+			pthread_mutex_lock(&g_mutex);
+			++g_stats.methods;
+			pthread_mutex_unlock(&g_mutex);
+		}
+		free(item);
+		item = next;
+	}
+}
+
+void hal_iothub_do_work(HAL_IOTHUB_HANDLE handle)
+{
+	if (g_hub.brokerHost != NULL)
+	{
+		do_work_on_broker(handle);
+		deliver_inbox(handle);
+		expire_pending(handle, hal_time_us());
+		return;
+	}
+
+	if (!handle->isConnected)
+	{
+		handle->isConnected = true;
+		handle->callbacks.connection(true, 0, handle->callbacks.context);
+	}
+	deliver_inbox(handle);
+
+	int64_t now = hal_time_us();
+	bool isConfirmed = false;
+	PENDING *previous = NULL;
+	PENDING *pending = handle->pending;
+	while (pending != NULL)
+	{
+		PENDING *next = pending->next;
+		if (pending->isLost || pending->dueTime > now)
+		{
+			previous = pending;
+			pending = next;
+			continue;
+		}
+
+		if (pending->confirmation != NULL)
+		{
+			confirm_event(pending, now);
+			isConfirmed = true;
+		}
+		else if (pending->reportConfirmation != NULL)
+			pending->reportConfirmation(204, pending->context);
+		remove_pending(handle, pending, previous);
+		pending = next;
+	}
+	if (isConfirmed)
+		update_pending_stats(handle);
+	expire_pending(handle, now);
+}
+
+void hal_iothub_destroy(HAL_IOTHUB_HANDLE handle)
+{
+	if (handle->fd >= 0)
+	{
+		uint8_t packet[4];
+		queue_packet(handle, packet, mqtt_packet_ack(packet, sizeof(packet), MQTT_DISCONNECT, 0));
+		flush_output(handle);
+		close(handle->fd);
+		pthread_mutex_lock(&g_mutex);
+		if (handle->isConnected)
+			++g_stats.disconnects;
+		pthread_mutex_unlock(&g_mutex);
+	}
+	PENDING *pending = handle->pending;
+	while (pending != NULL)
+	{
+		PENDING *next = pending->next;
+		if (pending->confirmation != NULL)
+			pending->confirmation(HAL_IOTHUB_CONFIRMATION_BECAUSE_DESTROY, pending->context);
+		free(pending->packet);
+		free(pending);
+		pending = next;
+	}
+	handle->pending = handle->pendingTail = NULL;
+	update_pending_stats(handle);
+	free(handle->input.data);
+	free(handle->output.data);
+	free(handle);
+}
@@ -0,0 +1,111 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "hal.h"
+#include "hal_posix.h"
+#include "host_clock.h"
+
+#define GPIO_COUNT 40
+#define TEMPERATURE_PERIOD_S 3600.0
+#define MAINS_HZ 50.0
+#define NOISE 16
+
+static HAL_POSIX_ADC_SOURCE g_adcSource = NULL;
+static uint32_t g_gpioLevel[GPIO_COUNT];
+static uint32_t g_gpioChanges[GPIO_COUNT];
+static uint32_t g_noiseState = 0x2545F491u;
+
+static uint32_t noise(void)
+{
+	//xorshift32, the races of the tasks only make it noisier
+	uint32_t x = g_noiseState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	g_noiseState = x;
+	return x % (2 * NOISE + 1);
+}
+
+static uint32_t default_adc_source(uint32_t channel, int64_t timeUs)
+{
+	double seconds = timeUs / 1000000.0;
+	double value;
+	switch (channel)
+	{
+	case 5:
+		value = 1500 + 300 * sin(2 * M_PI * seconds / TEMPERATURE_PERIOD_S);
+		break;
+	case 6:
+		value = 1700 + 200 * sin(2 * M_PI * seconds / TEMPERATURE_PERIOD_S + 1);
+		break;
+	case 7:
+		//a heater that is on for two thirds of the temperature period
+		value = 1850 + (fmod(seconds, TEMPERATURE_PERIOD_S) < TEMPERATURE_PERIOD_S * 2 / 3 ? 600 : 0) * sin(2 * M_PI * MAINS_HZ * seconds);
+		break;
+	default:
+		return 0;
+	}
+	value += (double)noise() - NOISE;
+	return value < 0 ? 0 : value > HAL_ADC_MAX ? HAL_ADC_MAX : (uint32_t)value;
+}
+
+void hal_posix_set_adc_source(HAL_POSIX_ADC_SOURCE source)
+{
+	g_adcSource = source;
+}
+
+uint32_t hal_posix_gpio_level(uint32_t gpio)
+{
+	return gpio < GPIO_COUNT ? g_gpioLevel[gpio] : 0;
+}
+
+uint32_t hal_posix_gpio_changes(uint32_t gpio)
+{
+	return gpio < GPIO_COUNT ? g_gpioChanges[gpio] : 0;
+}
+
+void hal_adc_init(uint32_t channel)
+{
+}
+
+uint32_t hal_adc_read(uint32_t channel)
+{
+	return (g_adcSource != NULL ? g_adcSource : default_adc_source)(channel, esp_timer_get_time());
+}
+
+void hal_gpio_init_output(uint32_t gpio, uint32_t level)
+{
+	if (gpio < GPIO_COUNT)
+		g_gpioLevel[gpio] = level;
+}
+
+void hal_gpio_set(uint32_t gpio, uint32_t level)
+{
+	if (gpio >= GPIO_COUNT || g_gpioLevel[gpio] == level)
+		return;
+	g_gpioLevel[gpio] = level;
+	++g_gpioChanges[gpio];
+}
+
+int64_t hal_time_us(void)
+{
+	return esp_timer_get_time();
+}
+
+void hal_delay_us(uint32_t us)
+{
+	host_clock_delay(us);
+}
+
+void hal_sleep_ms(uint32_t ms)
+{
+	vTaskDelay(ms / portTICK_PERIOD_MS);
+}
+
+void hal_watchdog_feed(void)
+{
+}
@@ -0,0 +1,84 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef HAL_POSIX_H
+#define HAL_POSIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * The controls of the host implementations of hal.h and hal_iothub.h.
+	 * By default the ADC channels 5 and 6 read two slowly drifting water temperatures and channel 7 a 50 Hz current,
+	 * all with some noise, in the time of host_clock.h.
+	 */
+	typedef uint32_t (*HAL_POSIX_ADC_SOURCE)(uint32_t channel, int64_t timeUs);
+
+	//NULL restores the default sensors
+	void hal_posix_set_adc_source(HAL_POSIX_ADC_SOURCE source);
+	uint32_t hal_posix_gpio_level(uint32_t gpio);
+	//the number of level changes of the output
+	uint32_t hal_posix_gpio_changes(uint32_t gpio);
+
+	/*
+	 * The local hub of hal_iothub_posix.c, it serves one client.
+	 * A telemetry message is acknowledged ackLatencyMs plus up to ackJitterMs later, or never with lossProbability,
+	 * a reported state after ackLatencyMs. Like with the SDK a message without an ack is completed with
+	 * HAL_IOTHUB_CONFIRMATION_MESSAGE_TIMEOUT after HAL_IOTHUB_MESSAGE_TIMEOUT_MS. Cloud to device messages and direct methods queued from any thread are
+	 * delivered by the next hal_iothub_do_work, like the messages the SDK received.
+	 * With a brokerHost the client speaks the IoT Hub MQTT protocol to tools/iothub_broker instead, which then decides
+	 * the acks. A lost connection is reported to the device loop and retried with an exponential backoff, the
+	 * unacknowledged messages are sent again after the reconnect. The queued messages are still delivered.
+	 */
+	typedef struct HAL_POSIX_HUB_TAG
+	{
+		uint32_t ackLatencyMs;
+		uint32_t ackJitterMs;
+		double lossProbability;
+		uint32_t seed;
+		const char *brokerHost;
+		int brokerPort;
+		//NULL for the DeviceId of the connection string
+		const char *deviceId;
+	} HAL_POSIX_HUB;
+
+	typedef struct HAL_POSIX_HUB_STATS_TAG
+	{
+		uint32_t clients;
+		uint32_t events;
+		uint32_t confirmed;
+		uint32_t lost;
+		uint32_t timedOut;
+		uint32_t reportedStates;
+		uint32_t messages;
+		uint32_t methods;
+		uint64_t eventBytes;
+		//the sum of the latencies of the confirmed events, in microseconds
+		int64_t confirmationTime;
+		int64_t maxConfirmationTime;
+		//the events waiting for their ack and the send time of the oldest, 0 without one
+		uint32_t pending;
+		int64_t oldestPendingTime;
+		//of the broker connection, the events sent again after a reconnect
+		uint32_t connects;
+		uint32_t disconnects;
+		uint32_t resent;
+	} HAL_POSIX_HUB_STATS;
+
+	//the response is freed after the call
+	typedef void (*HAL_POSIX_METHOD_RESPONSE)(int status, const unsigned char *response, size_t size, void *context);
+
+	void hal_posix_hub_init(const HAL_POSIX_HUB *hub);
+	void hal_posix_hub_send_message(const char *message);
+	void hal_posix_hub_invoke_method(const char *methodName, HAL_POSIX_METHOD_RESPONSE response, void *context);
+	void hal_posix_hub_get_stats(HAL_POSIX_HUB_STATS *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HAL_POSIX_H */
@@ -0,0 +1,314 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#include "esp_timer.h"
+#include "host_clock.h"
+
+#define MAX_BLOCKED_THREADS 64
+
+struct esp_timer
+{
+	esp_timer_create_args_t args;
+	pthread_mutex_t mutex;
+	pthread_cond_t changed;
+	//a start or a stop ends the wait of the thread of the previous start
+	uint64_t generation;
+	uint64_t timeoutUs;
+};
+
+//a thread blocked on the virtual clock, it stays blocked until another thread unblocks it
+typedef struct BLOCKED_THREAD_TAG
+{
+	int64_t wakeTime;
+	bool isWaitingForChange;
+	bool isBlocked;
+} BLOCKED_THREAD;
+
+static volatile int64_t g_clock = 0;
+static double g_scale = 0; //0 while the clock is simulated or virtual
+static struct timespec g_realtimeBegin;
+
+static bool g_isVirtual = false;
+static pthread_mutex_t g_virtualMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_virtualChanged = PTHREAD_COND_INITIALIZER;
+static int g_runnableThreads = 0;
+static BLOCKED_THREAD *g_blockedThreads[MAX_BLOCKED_THREADS];
+static int g_blockedCount = 0;
+static __thread BLOCKED_THREAD g_thisThread;
+
+static int64_t monotonic_us(const struct timespec *time)
+{
+	return (int64_t)time->tv_sec * 1000000 + time->tv_nsec / 1000;
+}
+
+void host_clock_set_realtime(double scale)
+{
+	clock_gettime(CLOCK_MONOTONIC, &g_realtimeBegin);
+	g_scale = scale;
+}
+
+void host_clock_set_virtual(void)
+{
+	g_isVirtual = true;
+	g_runnableThreads = 1;
+}
+
+int64_t esp_timer_get_time(void)
+{
+	if (g_scale == 0)
+		return g_clock;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return g_clock + (int64_t)((monotonic_us(&now) - monotonic_us(&g_realtimeBegin)) * g_scale);
+}
+
+//unblocks the thread at index, with the virtual mutex held
+static void unblock(int index)
+{
+	g_blockedThreads[index]->isBlocked = false;
+	g_blockedThreads[index] = g_blockedThreads[--g_blockedCount];
+	++g_runnableThreads;
+}
+
+//no thread runs, the clock jumps to the first wake up
+static void advance(void)
+{
+	int64_t next = INT64_MAX;
+	for (int i = 0; i < g_blockedCount; i++)
+	{
+		if (g_blockedThreads[i]->wakeTime < next)
+			next = g_blockedThreads[i]->wakeTime;
+	}
+	if (next == INT64_MAX)
+	{
+		fprintf(stderr, "host_clock: every thread waits forever\n");
+		return;
+	}
+
+	g_clock = next;
+	for (int i = g_blockedCount - 1; i >= 0; i--)
+	{
+		if (g_blockedThreads[i]->wakeTime <= next)
+			unblock(i);
+	}
+	pthread_cond_broadcast(&g_virtualChanged);
+}
+
+//blocks the calling thread until wakeTime or, when isWaitingForChange, until a host_clock_notify. returns false at wakeTime
+static bool block(int64_t wakeTime, bool isWaitingForChange)
+{
+	if (wakeTime <= g_clock)
+		return false;
+	if (g_blockedCount == MAX_BLOCKED_THREADS)
+		abort();
+
+	g_thisThread.wakeTime = wakeTime;
+	g_thisThread.isWaitingForChange = isWaitingForChange;
+	g_thisThread.isBlocked = true;
+	g_blockedThreads[g_blockedCount++] = &g_thisThread;
+	if (--g_runnableThreads == 0)
+		advance();
+	while (g_thisThread.isBlocked)
+		pthread_cond_wait(&g_virtualChanged, &g_virtualMutex);
+	return g_clock < wakeTime;
+}
+
+void host_clock_sleep(int64_t us)
+{
+	if (us <= 0)
+		return;
+	if (g_isVirtual)
+	{
+		pthread_mutex_lock(&g_virtualMutex);
+		block(g_clock + us, false);
+		pthread_mutex_unlock(&g_virtualMutex);
+		return;
+	}
+	if (g_scale == 0)
+	{
+		__sync_fetch_and_add(&g_clock, us);
+		return;
+	}
+
+	int64_t realUs = (int64_t)(us / g_scale);
+	struct timespec duration = { (time_t)(realUs / 1000000), (long)(realUs % 1000000 * 1000) };
+	while (nanosleep(&duration, &duration) != 0)
+		;
+}
+
+void host_clock_delay(int64_t us)
+{
+	if (g_scale == 0)
+	{
+		host_clock_sleep(us);
+		return;
+	}
+
+	int64_t end = esp_timer_get_time() + us;
+	while (esp_timer_get_time() < end)
+		;
+}
+
+void host_clock_deadline(int64_t us, HOST_CLOCK_DEADLINE *deadline)
+{
+	deadline->isForever = us < 0;
+	if (deadline->isForever)
+		return;
+	deadline->time = g_clock + us;
+
+	//a simulated clock does not pass while the thread waits, the wait is as long as in real time
+	int64_t realUs = g_scale == 0 ? us : (int64_t)(us / g_scale);
+	clock_gettime(CLOCK_MONOTONIC, &deadline->monotonic);
+	int64_t nsec = deadline->monotonic.tv_nsec + realUs % 1000000 * 1000;
+	deadline->monotonic.tv_sec += (time_t)(realUs / 1000000 + nsec / 1000000000);
+	deadline->monotonic.tv_nsec = (long)(nsec % 1000000000);
+}
+
+bool host_clock_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, const HOST_CLOCK_DEADLINE *deadline)
+{
+	if (!g_isVirtual)
+	{
+		if (deadline->isForever)
+			return pthread_cond_wait(cond, mutex) == 0;
+		return pthread_cond_timedwait(cond, mutex, &deadline->monotonic) != ETIMEDOUT;
+	}
+
+	//a change of the waited for object takes the mutex first, it can not come between the unlock and the block
+	pthread_mutex_lock(&g_virtualMutex);
+	pthread_mutex_unlock(mutex);
+	bool isChanged = block(deadline->isForever ? INT64_MAX : deadline->time, true);
+	pthread_mutex_unlock(&g_virtualMutex);
+	pthread_mutex_lock(mutex);
+	return isChanged;
+}
+
+void host_clock_notify(void)
+{
+	if (!g_isVirtual)
+		return;
+
+	pthread_mutex_lock(&g_virtualMutex);
+	bool isUnblocked = false;
+	for (int i = g_blockedCount - 1; i >= 0; i--)
+	{
+		if (g_blockedThreads[i]->isWaitingForChange)
+		{
+			unblock(i);
+			isUnblocked = true;
+		}
+	}
+	if (isUnblocked)
+		pthread_cond_broadcast(&g_virtualChanged);
+	pthread_mutex_unlock(&g_virtualMutex);
+}
+
+void host_clock_thread_start(void)
+{
+	if (!g_isVirtual)
+		return;
+	pthread_mutex_lock(&g_virtualMutex);
+	++g_runnableThreads;
+	pthread_mutex_unlock(&g_virtualMutex);
+}
+
+void host_clock_thread_exit(void)
+{
+	if (!g_isVirtual)
+		return;
+	pthread_mutex_lock(&g_virtualMutex);
+	if (--g_runnableThreads == 0)
+		advance();
+	pthread_mutex_unlock(&g_virtualMutex);
+}
+
+typedef struct TIMER_RUN_TAG
+{
+	esp_timer_handle_t timer;
+	uint64_t generation;
+} TIMER_RUN;
+
+static void *timer_thread(void *arg)
+{
+	TIMER_RUN run = *(TIMER_RUN *)arg;
+	free(arg);
+
+	esp_timer_handle_t timer = run.timer;
+	HOST_CLOCK_DEADLINE deadline;
+	pthread_mutex_lock(&timer->mutex);
+	host_clock_deadline((int64_t)timer->timeoutUs, &deadline);
+	while (timer->generation == run.generation && host_clock_wait(&timer->changed, &timer->mutex, &deadline))
+		;
+	bool isExpired = timer->generation == run.generation;
+	pthread_mutex_unlock(&timer->mutex);
+
+	if (isExpired)
+		timer->args.callback(timer->args.arg);
+	host_clock_thread_exit();
+	return NULL;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+	esp_timer_handle_t timer = (esp_timer_handle_t)calloc(1, sizeof(struct esp_timer));
+	if (timer == NULL)
+		return ESP_ERR_NO_MEM;
+
+	timer->args = *create_args;
+	pthread_mutex_init(&timer->mutex, NULL);
+	pthread_condattr_t attributes;
+	pthread_condattr_init(&attributes);
+	pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+	pthread_cond_init(&timer->changed, &attributes);
+	pthread_condattr_destroy(&attributes);
+	*out_handle = timer;
+	return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+	TIMER_RUN *run = (TIMER_RUN *)malloc(sizeof(TIMER_RUN));
+	if (run == NULL)
+		return ESP_ERR_NO_MEM;
+
+	pthread_mutex_lock(&timer->mutex);
+	run->timer = timer;
+	run->generation = ++timer->generation;
+	timer->timeoutUs = timeout_us;
+	pthread_cond_broadcast(&timer->changed);
+	host_clock_notify();
+	pthread_mutex_unlock(&timer->mutex);
+
+	pthread_t thread;
+	host_clock_thread_start();
+	if (pthread_create(&thread, NULL, timer_thread, run) != 0)
+	{
+		host_clock_thread_exit();
+		free(run);
+		return ESP_ERR_NO_MEM;
+	}
+	pthread_detach(thread);
+	return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+	pthread_mutex_lock(&timer->mutex);
+	++timer->generation;
+	pthread_cond_broadcast(&timer->changed);
+	host_clock_notify();
+	pthread_mutex_unlock(&timer->mutex);
+	return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+	//a thread of a stopped timer may still hold the mutex, the timer is leaked rather than freed under it
+	esp_timer_stop(timer);
+	return ESP_OK;
+}
@@ -0,0 +1,54 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef HOST_CLOCK_H
+#define HOST_CLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * The time of esp_timer_get_time on the host.
+	 * By default the clock is simulated: it stands still and only host_clock_sleep moves it, so a single threaded
+	 * tool measures the modelled durations exactly. host_clock_set_realtime makes it the monotonic clock sped up
+	 * by a factor, host_clock_sleep then blocks the calling thread for the scaled down time.
+	 * host_clock_set_virtual makes it a discrete event clock for many tasks: it stands still while any task runs,
+	 * and when all of them sleep or wait it jumps to the earliest time one of them wakes up. The threads of the
+	 * stand ins take part with host_clock_thread_start and host_clock_thread_exit and block only in host_clock_sleep
+	 * and host_clock_wait, a thread that blocks anywhere else, on a socket for example, holds the clock.
+	 */
+	void host_clock_set_realtime(double scale);
+	//call it on the main thread before any other thread starts, the main thread takes part
+	void host_clock_set_virtual(void);
+	void host_clock_sleep(int64_t us);
+	//like host_clock_sleep, but a running clock is polled instead of sleeping, as ets_delay_us does. short waits do not oversleep
+	void host_clock_delay(int64_t us);
+
+	typedef struct HOST_CLOCK_DEADLINE_TAG
+	{
+		bool isForever;
+		struct timespec monotonic;
+		int64_t time;
+	} HOST_CLOCK_DEADLINE;
+
+	//the end of a wait of us microseconds of the clock, forever when us is negative
+	void host_clock_deadline(int64_t us, HOST_CLOCK_DEADLINE *deadline);
+	//pthread_cond_wait until the deadline with the mutex held, returns false once the deadline passed
+	bool host_clock_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, const HOST_CLOCK_DEADLINE *deadline);
+	//after each change that a host_clock_wait may wait for, next to the pthread_cond_broadcast
+	void host_clock_notify(void);
+	//by the creator of a thread before pthread_create, and again if that fails
+	void host_clock_thread_start(void);
+	void host_clock_thread_exit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_CLOCK_H */
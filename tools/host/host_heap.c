@@ -0,0 +1,40 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include "host_heap.h"
+
+//any thread of the stand ins can call into the firmware
+static volatile uint32_t g_allocations = 0;
+static volatile uint32_t g_frees = 0;
+
+void *host_heap_malloc(size_t size)
+{
+	__sync_fetch_and_add(&g_allocations, 1);
+	return malloc(size);
+}
+
+void *host_heap_calloc(size_t count, size_t size)
+{
+	__sync_fetch_and_add(&g_allocations, 1);
+	return calloc(count, size);
+}
+
+void *host_heap_realloc(void *pointer, size_t size)
+{
+	__sync_fetch_and_add(&g_allocations, 1);
+	return realloc(pointer, size);
+}
+
+void host_heap_free(void *pointer)
+{
+	if (pointer != NULL)
+		__sync_fetch_and_add(&g_frees, 1);
+	free(pointer);
+}
+
+void host_heap_get_stats(HOST_HEAP_STATS *stats)
+{
+	stats->allocations = __sync_fetch_and_add(&g_allocations, 0);
+	stats->frees = __sync_fetch_and_add(&g_frees, 0);
+}
@@ -0,0 +1,34 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef HOST_HEAP_H
+#define HOST_HEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * The heap of the firmware sources on the host. tools/CMakeLists.txt builds them with malloc, calloc, realloc and
+	 * free defined to these, so the allocations of the firmware are counted apart from those of the stand ins.
+	 */
+	typedef struct HOST_HEAP_STATS_TAG
+	{
+		uint32_t allocations; //malloc, calloc and realloc
+		uint32_t frees;
+	} HOST_HEAP_STATS;
+
+	void *host_heap_malloc(size_t size);
+	void *host_heap_calloc(size_t count, size_t size);
+	void *host_heap_realloc(void *pointer, size_t size);
+	void host_heap_free(void *pointer);
+	void host_heap_get_stats(HOST_HEAP_STATS *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_HEAP_H */
@@ -0,0 +1,469 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "esp_http_client.h"
+#include "esp_timer.h"
+#include "host_clock.h"
+#include "host_network.h"
+
+#define HTTP_MAX_URL_LENGTH 512
+#define HTTP_MAX_HOST_LENGTH 128
+#define HTTP_MAX_HEADERS 8
+#define HTTP_MAX_HEADER_LENGTH 128
+#define HTTP_RESPONSE_HEADER_SIZE 4096
+//the socket timeout in real time, a stalled server does not hang the simulation
+#define HTTP_SOCKET_TIMEOUT_S 30
+
+typedef struct HTTP_HEADER_TAG
+{
+	char key[32];
+	char value[HTTP_MAX_HEADER_LENGTH];
+} HTTP_HEADER;
+
+struct esp_http_client
+{
+	esp_http_client_config_t config;
+	char url[HTTP_MAX_URL_LENGTH];
+	char host[HTTP_MAX_HOST_LENGTH];
+	const char *path;
+	HTTP_HEADER headers[HTTP_MAX_HEADERS];
+	int headerCount;
+
+	int socket;
+	//the host the connection was opened for, a url of another host needs a new one
+	char connectedHost[HTTP_MAX_HOST_LENGTH];
+	int64_t bytesUntilDrop;
+
+	int statusCode;
+	int contentLength;
+	int bodyRead;
+	bool isChunked;
+	bool isCloseAfterResponse;
+	//the byte of the body that is changed, -1 for none
+	int corruptOffset;
+	//body bytes that were received with the response header
+	char response[HTTP_RESPONSE_HEADER_SIZE];
+	int responseOffset;
+	int responseLength;
+};
+
+static HOST_NETWORK g_network;
+static HOST_NETWORK_STATS g_stats;
+static uint32_t g_randomState = 1;
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void host_network_init(const HOST_NETWORK *network)
+{
+	g_network = *network;
+	g_randomState = network->seed != 0 ? network->seed : 1;
+	memset(&g_stats, 0, sizeof(g_stats));
+}
+
+void host_network_get_stats(HOST_NETWORK_STATS *stats)
+{
+	pthread_mutex_lock(&g_mutex);
+	*stats = g_stats;
+	pthread_mutex_unlock(&g_mutex);
+}
+
+//uniform in [0, 1), the network has its own sequence so that the faults do not change what the firmware draws
+static double random_unit()
+{
+	pthread_mutex_lock(&g_mutex);
+	uint32_t x = g_randomState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	g_randomState = x;
+	pthread_mutex_unlock(&g_mutex);
+	return x / 4294967296.0;
+}
+
+static void count(uint32_t *counter)
+{
+	pthread_mutex_lock(&g_mutex);
+	++*counter;
+	pthread_mutex_unlock(&g_mutex);
+}
+
+static void round_trips(int count)
+{
+	for (int i = 0; i < count; i++)
+		host_clock_sleep(((int64_t)g_network.rttMs + (int64_t)(random_unit() * g_network.rttJitterMs)) * 1000);
+}
+
+static void send_event(esp_http_client_handle_t client, esp_http_client_event_id_t eventId, void *data, int length, char *key, char *value)
+{
+	if (client->config.event_handler == NULL)
+		return;
+
+	esp_http_client_event_t event;
+	memset(&event, 0, sizeof(event));
+	event.event_id = eventId;
+	event.client = client;
+	event.data = data;
+	event.data_len = length;
+	event.user_data = client->config.user_data;
+	event.header_key = key;
+	event.header_value = value;
+	client->config.event_handler(&event);
+}
+
+//the scheme and the port are ignored, every host is the server of the simulated network
+static esp_err_t parse_url(esp_http_client_handle_t client, const char *url)
+{
+	if (strlen(url) >= sizeof(client->url))
+		return ESP_ERR_INVALID_ARG;
+	strcpy(client->url, url);
+
+	const char *host = strstr(client->url, "://");
+	host = host != NULL ? host + 3 : client->url;
+	size_t hostLength = strcspn(host, ":/?");
+	if (hostLength == 0 || hostLength >= sizeof(client->host))
+		return ESP_ERR_INVALID_ARG;
+	memcpy(client->host, host, hostLength);
+	client->host[hostLength] = '\0';
+
+	const char *path = strchr(host, '/');
+	client->path = path != NULL ? path : "/";
+	return ESP_OK;
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+	esp_http_client_handle_t client = (esp_http_client_handle_t)calloc(1, sizeof(struct esp_http_client));
+	if (client == NULL)
+		return NULL;
+
+	client->config = *config;
+	client->socket = -1;
+	if (config->url == NULL || parse_url(client, config->url) != ESP_OK)
+	{
+		free(client);
+		return NULL;
+	}
+	return client;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url)
+{
+	return parse_url(client, url);
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+	int index = 0;
+	while (index < client->headerCount && strcasecmp(client->headers[index].key, key) != 0)
+		index++;
+	if (index == HTTP_MAX_HEADERS || strlen(key) >= sizeof(client->headers[index].key) || strlen(value) >= sizeof(client->headers[index].value))
+		return ESP_ERR_NO_MEM;
+
+	strcpy(client->headers[index].key, key);
+	strcpy(client->headers[index].value, value);
+	if (index == client->headerCount)
+		client->headerCount++;
+	return ESP_OK;
+}
+
+static void close_socket(esp_http_client_handle_t client)
+{
+	if (client->socket < 0)
+		return;
+	close(client->socket);
+	client->socket = -1;
+	send_event(client, HTTP_EVENT_DISCONNECTED, NULL, 0, NULL, NULL);
+}
+
+//a kept alive connection can be used again if the last response was read and the server did not close it
+static bool is_reusable(esp_http_client_handle_t client)
+{
+	if (client->socket < 0 || g_network.isKeepAliveDisabled || client->isCloseAfterResponse || client->bodyRead < client->contentLength
+		|| client->responseOffset < client->responseLength || strcmp(client->connectedHost, client->host) != 0)
+		return false;
+
+	char byte;
+	ssize_t result = recv(client->socket, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+	return result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+static esp_err_t connect_to_server(esp_http_client_handle_t client)
+{
+	char port[16];
+	snprintf(port, sizeof(port), "%d", g_network.serverPort);
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *addresses = NULL;
+	if (getaddrinfo(g_network.serverHost, port, &hints, &addresses) != 0)
+		return ESP_FAIL;
+
+	int fd = -1;
+	for (struct addrinfo *address = addresses; address != NULL && fd < 0; address = address->ai_next)
+	{
+		fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) != 0)
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(addresses);
+	if (fd < 0)
+		return ESP_FAIL;
+
+	int isNoDelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &isNoDelay, sizeof(isNoDelay));
+	struct timeval timeout = { HTTP_SOCKET_TIMEOUT_S, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	client->socket = fd;
+	strcpy(client->connectedHost, client->host);
+	//exponential, the bytes of a connection are lost independently of each other
+	client->bytesUntilDrop = g_network.dropsPerMegabyte > 0 ? (int64_t)(-log(1.0 - random_unit()) * 1048576 / g_network.dropsPerMegabyte) : INT64_MAX;
+	round_trips(HOST_NETWORK_HANDSHAKE_RTTS);
+	send_event(client, HTTP_EVENT_ON_CONNECTED, NULL, 0, NULL, NULL);
+	return ESP_OK;
+}
+
+static bool send_all(int fd, const char *data, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+		if (sent <= 0)
+			return false;
+		data += sent;
+		length -= (size_t)sent;
+	}
+	return true;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len)
+{
+	if (g_network.blockedPath != NULL && strncmp(client->path, g_network.blockedPath, strlen(g_network.blockedPath)) == 0)
+	{
+		close_socket(client);
+		count(&g_stats.failedConnections);
+		round_trips(1);
+		send_event(client, HTTP_EVENT_ERROR, NULL, 0, NULL, NULL);
+		return ESP_FAIL;
+	}
+	if (!is_reusable(client))
+	{
+		close_socket(client);
+		count(&g_stats.connections);
+		if (connect_to_server(client) != ESP_OK)
+		{
+			count(&g_stats.failedConnections);
+			send_event(client, HTTP_EVENT_ERROR, NULL, 0, NULL, NULL);
+			return ESP_FAIL;
+		}
+	}
+
+	static const char *methods[] = { "GET", "POST", "PUT", "PATCH", "DELETE", "HEAD" };
+	char request[HTTP_MAX_URL_LENGTH + HTTP_MAX_HEADERS * (HTTP_MAX_HEADER_LENGTH + 36) + 256];
+	int length = snprintf(request, sizeof(request), "%s %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: ESP32 HTTP Client/1.0\r\n",
+		methods[client->config.method], client->path, client->host);
+	for (int i = 0; i < client->headerCount; i++)
+		length += snprintf(request + length, sizeof(request) - length, "%s: %s\r\n", client->headers[i].key, client->headers[i].value);
+	if (write_len > 0)
+		length += snprintf(request + length, sizeof(request) - length, "Content-Length: %d\r\n", write_len);
+	length += snprintf(request + length, sizeof(request) - length, "\r\n");
+
+	client->statusCode = 0;
+	client->contentLength = 0;
+	client->bodyRead = 0;
+	client->isChunked = false;
+	client->isCloseAfterResponse = false;
+	client->corruptOffset = -1;
+	client->responseOffset = 0;
+	client->responseLength = 0;
+	pthread_mutex_lock(&g_mutex);
+	g_stats.requests++;
+	if (g_stats.firstRequestTime == 0)
+		g_stats.firstRequestTime = esp_timer_get_time();
+	pthread_mutex_unlock(&g_mutex);
+	if (!send_all(client->socket, request, (size_t)length))
+	{
+		close_socket(client);
+		send_event(client, HTTP_EVENT_ERROR, NULL, 0, NULL, NULL);
+		return ESP_FAIL;
+	}
+	send_event(client, HTTP_EVENT_HEADER_SENT, NULL, 0, NULL, NULL);
+	return ESP_OK;
+}
+
+//returns the content length, or -1 if the response header did not arrive
+int esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+	if (client->socket < 0)
+		return -1;
+	round_trips(1);
+
+	char *end = NULL;
+	while (end == NULL)
+	{
+		if (client->responseLength == sizeof(client->response) - 1)
+			break;
+		ssize_t received = recv(client->socket, client->response + client->responseLength, sizeof(client->response) - 1 - client->responseLength, 0);
+		if (received <= 0)
+			break;
+		client->responseLength += (int)received;
+		client->response[client->responseLength] = '\0';
+		end = strstr(client->response, "\r\n\r\n");
+	}
+	if (end == NULL || sscanf(client->response, "HTTP/1.%*d %d", &client->statusCode) != 1)
+	{
+		close_socket(client);
+		send_event(client, HTTP_EVENT_ERROR, NULL, 0, NULL, NULL);
+		return -1;
+	}
+
+	//the header lines are split in place, the body bytes after them stay in the buffer
+	*end = '\0';
+	client->responseOffset = (int)(end + 4 - client->response);
+	bool hasContentMd5 = false;
+	char *line = strstr(client->response, "\r\n");
+	while (line != NULL)
+	{
+		line += 2;
+		char *next = strstr(line, "\r\n");
+		if (next != NULL)
+			*next = '\0';
+		char *colon = strchr(line, ':');
+		if (colon != NULL)
+		{
+			*colon = '\0';
+			char *value = colon + 1;
+			while (*value == ' ')
+				value++;
+			if (strcasecmp(line, "Content-Length") == 0)
+				client->contentLength = atoi(value);
+			else if (strcasecmp(line, "Transfer-Encoding") == 0)
+				client->isChunked = strcasecmp(value, "chunked") == 0;
+			else if (strcasecmp(line, "Connection") == 0)
+				client->isCloseAfterResponse = strcasecmp(value, "close") == 0;
+			else if (strcasecmp(line, "Content-MD5") == 0)
+				hasContentMd5 = true;
+			send_event(client, HTTP_EVENT_ON_HEADER, NULL, 0, line, value);
+		}
+		line = next;
+	}
+
+	//in the middle of the body, which is away from the quotes of a base64 string
+	if (hasContentMd5 && client->contentLength > 0 && random_unit() < g_network.corruptProbability)
+	{
+		client->corruptOffset = client->contentLength / 4 + (int)(random_unit() * (client->contentLength / 2));
+		count(&g_stats.corruptions);
+	}
+	return client->contentLength;
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len)
+{
+	int remaining = client->contentLength - client->bodyRead;
+	if (len > remaining)
+		len = remaining;
+	if (len <= 0)
+		return 0;
+	if (client->socket < 0)
+		return -1;
+
+	if (client->bytesUntilDrop == 0)
+	{
+		count(&g_stats.drops);
+		close_socket(client);
+		return -1;
+	}
+	if (len > client->bytesUntilDrop)
+		len = (int)client->bytesUntilDrop;
+
+	int length;
+	if (client->responseOffset < client->responseLength)
+	{
+		length = client->responseLength - client->responseOffset;
+		if (length > len)
+			length = len;
+		memcpy(buffer, client->response + client->responseOffset, length);
+		client->responseOffset += length;
+	}
+	else
+	{
+		ssize_t received = recv(client->socket, buffer, len, 0);
+		if (received <= 0)
+		{
+			close_socket(client);
+			return -1;
+		}
+		length = (int)received;
+	}
+
+	if (client->corruptOffset >= client->bodyRead && client->corruptOffset < client->bodyRead + length)
+	{
+		//another base64 letter, the body still decodes but to different bytes
+		char *byte = &buffer[client->corruptOffset - client->bodyRead];
+		*byte = *byte == 'A' ? 'B' : 'A';
+	}
+	client->bodyRead += length;
+	client->bytesUntilDrop -= length;
+
+	pthread_mutex_lock(&g_mutex);
+	g_stats.bytesReceived += (uint64_t)length;
+	pthread_mutex_unlock(&g_mutex);
+	if (g_network.bytesPerSecond > 0)
+		host_clock_sleep((int64_t)length * 1000000 / g_network.bytesPerSecond);
+
+	send_event(client, HTTP_EVENT_ON_DATA, buffer, length, NULL, NULL);
+	if (client->bodyRead == client->contentLength)
+	{
+		send_event(client, HTTP_EVENT_ON_FINISH, NULL, 0, NULL, NULL);
+		if (client->isCloseAfterResponse)
+			close_socket(client);
+	}
+	return length;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+	return client->statusCode;
+}
+
+int esp_http_client_get_content_length(esp_http_client_handle_t client)
+{
+	return client->contentLength;
+}
+
+bool esp_http_client_is_chunked_response(esp_http_client_handle_t client)
+{
+	return client->isChunked;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+	close_socket(client);
+	return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+	if (client == NULL)
+		return ESP_FAIL;
+	close_socket(client);
+	free(client);
+	return ESP_OK;
+}
@@ -0,0 +1,63 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef HOST_NETWORK_H
+#define HOST_NETWORK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * The network between the esp_http_client of a simulated device and a local server.
+	 * Every host name resolves to the server. The delays are in the time of host_clock.h:
+	 * a new connection waits HOST_NETWORK_HANDSHAKE_RTTS round trips for TCP and TLS, a request one more,
+	 * and the body arrives at no more than bytesPerSecond.
+	 * A connection drops after a random number of bytes, on average 1 MB / dropsPerMegabyte.
+	 * A response with a Content-MD5 header has one byte changed with probability corruptProbability,
+	 * so the device sees a digest mismatch and not a cut off or invalid body.
+	 * Requests for paths that start with blockedPath are refused, like by a firewall.
+	 * isKeepAliveDisabled opens a new connection for every request, like a client that is created and cleaned up per request.
+	 */
+#define HOST_NETWORK_HANDSHAKE_RTTS 3
+
+	typedef struct HOST_NETWORK_TAG
+	{
+		const char *serverHost;
+		int serverPort;
+		uint32_t rttMs;
+		//each round trip takes up to this much longer
+		uint32_t rttJitterMs;
+		//0 for no limit
+		uint32_t bytesPerSecond;
+		double dropsPerMegabyte;
+		double corruptProbability;
+		//NULL for none
+		const char *blockedPath;
+		bool isKeepAliveDisabled;
+		uint32_t seed;
+	} HOST_NETWORK;
+
+	typedef struct HOST_NETWORK_STATS_TAG
+	{
+		uint32_t connections;
+		uint32_t failedConnections;
+		uint32_t requests;
+		uint64_t bytesReceived;
+		uint32_t drops;
+		uint32_t corruptions;
+		//the esp_timer_get_time of the first request, 0 before it
+		int64_t firstRequestTime;
+	} HOST_NETWORK_STATS;
+
+	void host_network_init(const HOST_NETWORK *network);
+	void host_network_get_stats(HOST_NETWORK_STATS *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_NETWORK_H */
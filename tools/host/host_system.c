@@ -0,0 +1,102 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "esp_system.h"
+#include "esp_ota_ops.h"
+#include "host_system.h"
+
+static HOST_SYSTEM_RESTART g_restart = NULL;
+static uint32_t g_randomState = 1;
+static uint32_t g_freeHeap = 160000;
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static const esp_partition_t *g_bootPartition = NULL;
+static const esp_partition_t *g_runningPartition = NULL;
+
+void host_system_init(uint32_t randomSeed, uint32_t freeHeap)
+{
+	g_randomState = randomSeed != 0 ? randomSeed : 1;
+	g_freeHeap = freeHeap;
+}
+
+void host_system_set_restart_handler(HOST_SYSTEM_RESTART restart)
+{
+	g_restart = restart;
+}
+
+void host_system_set_running_partition(const esp_partition_t *partition)
+{
+	g_runningPartition = partition;
+	g_bootPartition = partition;
+}
+
+uint32_t esp_random(void)
+{
+	//xorshift32, a device sequence repeats with its seed
+	pthread_mutex_lock(&g_mutex);
+	uint32_t x = g_randomState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	g_randomState = x;
+	pthread_mutex_unlock(&g_mutex);
+	return x;
+}
+
+void esp_restart(void)
+{
+	if (g_restart != NULL)
+		g_restart(esp_ota_get_boot_partition());
+	exit(0);
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+	return g_freeHeap;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+	return g_freeHeap;
+}
+
+const esp_partition_t *esp_ota_get_boot_partition(void)
+{
+	return g_bootPartition != NULL ? g_bootPartition : esp_ota_get_running_partition();
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+	if (g_runningPartition == NULL)
+		g_runningPartition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, NULL);
+	return g_runningPartition;
+}
+
+//the app partition after the running one, like with two OTA slots
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from)
+{
+	const esp_partition_t *running = start_from != NULL ? start_from : esp_ota_get_running_partition();
+	const esp_partition_t *first = NULL;
+	const esp_partition_t *next = NULL;
+	for (int subtype = ESP_PARTITION_SUBTYPE_APP_OTA_0; subtype <= ESP_PARTITION_SUBTYPE_APP_OTA_1; subtype++)
+	{
+		const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, (esp_partition_subtype_t)subtype, NULL);
+		if (partition == NULL)
+			continue;
+		if (first == NULL)
+			first = partition;
+		if (next == NULL && running != NULL && partition->address > running->address)
+			next = partition;
+	}
+	next = next != NULL ? next : first;
+	return next != running ? next : NULL;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+	if (partition == NULL || partition->type != ESP_PARTITION_TYPE_APP)
+		return ESP_ERR_INVALID_ARG;
+	g_bootPartition = partition;
+	return ESP_OK;
+}
@@ -0,0 +1,26 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef HOST_SYSTEM_H
+#define HOST_SYSTEM_H
+
+#include <stdint.h>
+#include "esp_partition.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	//esp_restart calls the handler, which must not return, without one the process exits
+	typedef void (*HOST_SYSTEM_RESTART)(const esp_partition_t *bootPartition);
+
+	void host_system_init(uint32_t randomSeed, uint32_t freeHeap);
+	void host_system_set_restart_handler(HOST_SYSTEM_RESTART restart);
+	//the partition the device runs from, the boot partition until the next restart
+	void host_system_set_running_partition(const esp_partition_t *partition);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_SYSTEM_H */
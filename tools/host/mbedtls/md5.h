@@ -0,0 +1,19 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//host stand in for the mbedTLS header on the MD5 of tools/digest.c
+#ifndef MBEDTLS_MD5_H
+#define MBEDTLS_MD5_H
+
+#include <string.h>
+#include "digest.h"
+
+typedef DIGEST_MD5 mbedtls_md5_context;
+
+static inline void mbedtls_md5_init(mbedtls_md5_context *ctx) { memset(ctx, 0, sizeof(*ctx)); }
+static inline void mbedtls_md5_free(mbedtls_md5_context *ctx) { }
+static inline void mbedtls_md5_starts(mbedtls_md5_context *ctx) { digest_md5_init(ctx); }
+static inline void mbedtls_md5_update(mbedtls_md5_context *ctx, const unsigned char *input, size_t ilen) { digest_md5_update(ctx, input, ilen); }
+static inline void mbedtls_md5_finish(mbedtls_md5_context *ctx, unsigned char output[16]) { digest_md5_finish(ctx, output); }
+
+#endif /* MBEDTLS_MD5_H */
@@ -0,0 +1,20 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//host stand in for the mbedTLS header on the SHA-256 of tools/digest.c, SHA-224 is not supported
+#ifndef MBEDTLS_SHA256_H
+#define MBEDTLS_SHA256_H
+
+#include <assert.h>
+#include <string.h>
+#include "digest.h"
+
+typedef DIGEST_SHA256 mbedtls_sha256_context;
+
+static inline void mbedtls_sha256_init(mbedtls_sha256_context *ctx) { memset(ctx, 0, sizeof(*ctx)); }
+static inline void mbedtls_sha256_free(mbedtls_sha256_context *ctx) { }
+static inline void mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int is224) { assert(is224 == 0); digest_sha256_init(ctx); }
+static inline void mbedtls_sha256_update(mbedtls_sha256_context *ctx, const unsigned char *input, size_t ilen) { digest_sha256_update(ctx, input, ilen); }
+static inline void mbedtls_sha256_finish(mbedtls_sha256_context *ctx, unsigned char output[32]) { digest_sha256_finish(ctx, output); }
+
+#endif /* MBEDTLS_SHA256_H */
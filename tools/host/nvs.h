@@ -0,0 +1,49 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//host stand in for the ESP-IDF header, fake_nvs.c keeps the entries in memory
+#ifndef NVS_H
+#define NVS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESP_ERR_NVS_BASE 0x1100
+#define ESP_ERR_NVS_NOT_FOUND (ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_TYPE_MISMATCH (ESP_ERR_NVS_BASE + 0x03)
+#define ESP_ERR_NVS_READ_ONLY (ESP_ERR_NVS_BASE + 0x04)
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE (ESP_ERR_NVS_BASE + 0x05)
+#define ESP_ERR_NVS_INVALID_NAME (ESP_ERR_NVS_BASE + 0x06)
+#define ESP_ERR_NVS_INVALID_HANDLE (ESP_ERR_NVS_BASE + 0x07)
+#define ESP_ERR_NVS_INVALID_LENGTH (ESP_ERR_NVS_BASE + 0x0c)
+
+	typedef uint32_t nvs_handle;
+
+	typedef enum
+	{
+		NVS_READONLY,
+		NVS_READWRITE
+	} nvs_open_mode;
+
+	esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle);
+	void nvs_close(nvs_handle handle);
+	esp_err_t nvs_commit(nvs_handle handle);
+	esp_err_t nvs_erase_key(nvs_handle handle, const char *key);
+	esp_err_t nvs_erase_all(nvs_handle handle);
+	esp_err_t nvs_set_u32(nvs_handle handle, const char *key, uint32_t value);
+	esp_err_t nvs_get_u32(nvs_handle handle, const char *key, uint32_t *out_value);
+	esp_err_t nvs_set_str(nvs_handle handle, const char *key, const char *value);
+	esp_err_t nvs_get_str(nvs_handle handle, const char *key, char *out_value, size_t *length);
+	esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length);
+	esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NVS_H */
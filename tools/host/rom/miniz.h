@@ -0,0 +1,66 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//host stand in for the tinfl part of the ROM miniz, decompressing with zlib, which keeps its own window
+#ifndef ROM_MINIZ_H
+#define ROM_MINIZ_H
+
+#include <stddef.h>
+#include <zlib.h>
+
+#define TINFL_FLAG_PARSE_ZLIB_HEADER 1
+#define TINFL_FLAG_HAS_MORE_INPUT 2
+#define TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF 4
+#define TINFL_FLAG_COMPUTE_ADLER32 8
+
+typedef enum
+{
+	TINFL_STATUS_BAD_PARAM = -3,
+	TINFL_STATUS_ADLER32_MISMATCH = -2,
+	TINFL_STATUS_FAILED = -1,
+	TINFL_STATUS_DONE = 0,
+	TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+	TINFL_STATUS_HAS_MORE_OUTPUT = 2
+} tinfl_status;
+
+typedef struct
+{
+	z_stream stream;
+	int isInitialized;
+} tinfl_decompressor;
+
+static inline void tinfl_init(tinfl_decompressor *r)
+{
+	if (r->isInitialized)
+		inflateEnd(&r->stream);
+	r->stream.zalloc = Z_NULL;
+	r->stream.zfree = Z_NULL;
+	r->stream.opaque = Z_NULL;
+	r->stream.next_in = Z_NULL;
+	r->stream.avail_in = 0;
+	r->isInitialized = inflateInit(&r->stream) == Z_OK;
+}
+
+//the output goes to pOut_buf_next like with miniz, pOut_buf_start is only the start of the window there
+static inline tinfl_status tinfl_decompress(tinfl_decompressor *r, const unsigned char *pIn_buf_next, size_t *pIn_buf_size,
+	unsigned char *pOut_buf_start, unsigned char *pOut_buf_next, size_t *pOut_buf_size, unsigned int decomp_flags)
+{
+	if (!r->isInitialized || (decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER) == 0)
+		return TINFL_STATUS_BAD_PARAM;
+
+	r->stream.next_in = (unsigned char *)pIn_buf_next;
+	r->stream.avail_in = (unsigned int)*pIn_buf_size;
+	r->stream.next_out = pOut_buf_next;
+	r->stream.avail_out = (unsigned int)*pOut_buf_size;
+	int result = inflate(&r->stream, Z_NO_FLUSH);
+	*pIn_buf_size -= r->stream.avail_in;
+	*pOut_buf_size -= r->stream.avail_out;
+
+	if (result == Z_STREAM_END)
+		return TINFL_STATUS_DONE;
+	if (result != Z_OK && result != Z_BUF_ERROR)
+		return TINFL_STATUS_FAILED;
+	return r->stream.avail_out == 0 ? TINFL_STATUS_HAS_MORE_OUTPUT : TINFL_STATUS_NEEDS_MORE_INPUT;
+}
+
+#endif /* ROM_MINIZ_H */
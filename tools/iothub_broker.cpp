@@ -0,0 +1,964 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/*
+ * Local IoT Hub stand in: an MQTT 3.1.1 broker with the topics of the IoT Hub device protocol, so the telemetry
+ * path can be loaded and measured without a hub.
+ *   iothub_broker [-p mqtt port] [-c control port] [-a PUBACK delay ms] [-j PUBACK jitter ms] [-d drop probability] [-v]
+ *
+ * Device side, on the MQTT port:
+ *   devices/{id}/messages/events/...               telemetry, acknowledged after the delay, or never with the drop probability
+ *   $iothub/twin/PATCH/properties/reported/?$rid=  answered on $iothub/twin/res/204/?$rid=&$version= after the delay
+ *   $iothub/twin/GET/?$rid=                        answered on $iothub/twin/res/200/?$rid= with the reported properties
+ *   devices/{id}/messages/devicebound/             cloud to device messages, QoS 1
+ *   $iothub/methods/POST/{name}/?$rid=             direct methods, answered on $iothub/methods/res/{status}/?$rid=
+ * Service side, plain HTTP on the control port:
+ *   GET  /stats                                    the totals and the counters of every open connection
+ *   POST /devices/{id}/messages                    the body as a cloud to device message
+ *   POST /devices/{id}/methods/{name}              the body as the method payload, the response waits for the device
+ *   POST /outage?seconds=                          closes every device connection and refuses new ones meanwhile
+ *   POST /config?delayMs=&jitterMs=&dropProbability=  changes the PUBACK behaviour of the running broker
+ *
+ * One epoll thread serves all the connections, the delayed acks wait in a timer queue. There is no TLS and the
+ * SAS token of the user name is not checked, a device id connects once, a second connection replaces the first
+ * like on IoT Hub.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include "mqtt_packet.h"
+
+#define DEFAULT_MQTT_PORT 1883
+#define DEFAULT_CONTROL_PORT 8081
+#define DEFAULT_DELAY_MS 20
+#define MAX_EVENTS 256
+#define READ_BUFFER_SIZE 16384
+#define MAX_CONTROL_REQUEST (64 * 1024)
+#define METHOD_TIMEOUT_S 30
+#define CONNECT_TIMEOUT_S 10
+//the return code of a CONNACK that refuses the connection while the server is unavailable
+#define CONNACK_SERVER_UNAVAILABLE 3
+
+//the traffic of one device connection, the totals add those of the closed connections
+struct COUNTERS
+{
+	uint64_t telemetry = 0;
+	uint64_t telemetryBytes = 0;
+	uint64_t duplicates = 0;
+	uint64_t pubacks = 0;
+	uint64_t dropped = 0;
+	uint64_t twinPatches = 0;
+	uint64_t twinGets = 0;
+	uint64_t c2dSent = 0;
+	uint64_t c2dAcked = 0;
+	uint64_t methodRequests = 0;
+	uint64_t methodResponses = 0;
+	uint64_t bytesIn = 0;
+	uint64_t bytesOut = 0;
+
+	void add(const COUNTERS &other)
+	{
+		telemetry += other.telemetry;
+		telemetryBytes += other.telemetryBytes;
+		duplicates += other.duplicates;
+		pubacks += other.pubacks;
+		dropped += other.dropped;
+		twinPatches += other.twinPatches;
+		twinGets += other.twinGets;
+		c2dSent += other.c2dSent;
+		c2dAcked += other.c2dAcked;
+		methodRequests += other.methodRequests;
+		methodResponses += other.methodResponses;
+		bytesIn += other.bytesIn;
+		bytesOut += other.bytesOut;
+	}
+};
+
+struct CONNECTION
+{
+	int fd = -1;
+	uint64_t id = 0;
+	bool isControl = false;
+	std::string input;
+	std::string output;
+	size_t outputSent = 0;
+	bool isWaitingForOutput = false;
+	bool closeAfterOutput = false;
+	//a control connection takes one request
+	bool hasRequest = false;
+	//a device, after its CONNECT
+	std::string deviceId;
+	bool isConnected = false;
+	int64_t acceptTime = 0;
+	int64_t connectTime = 0;
+	int64_t lastPacketTime = 0;
+	int64_t keepAliveUs = 0;
+	//PUBACKs leave in the order of the PUBLISHes, a later one is never due before an earlier one
+	int64_t lastAckTime = 0;
+	uint16_t nextPacketId = 1;
+	std::string reportedProperties = "{}";
+	uint64_t twinVersion = 1;
+	COUNTERS counters;
+};
+
+//an answer of the broker that waits for the PUBACK delay
+struct TIMER
+{
+	uint64_t connectionId;
+	int fd;
+	std::string packet;
+	bool isPuback;
+};
+
+//a direct method waiting for the device, the control connection gets its response
+struct METHOD_CALL
+{
+	int controlFd;
+	uint64_t controlId;
+	int deviceFd;
+	uint64_t deviceId;
+	int64_t deadline;
+};
+
+struct STATS
+{
+	uint64_t connections = 0;
+	uint64_t openConnections = 0;
+	uint64_t refused = 0;
+	uint64_t replaced = 0;
+	uint64_t keepAliveTimeouts = 0;
+	uint64_t protocolErrors = 0;
+	uint64_t methodTimeouts = 0;
+	uint64_t outages = 0;
+	COUNTERS closed;
+};
+
+static uint32_t g_delayMs = DEFAULT_DELAY_MS;
+static uint32_t g_jitterMs = 0;
+static double g_dropProbability = 0;
+static bool g_isVerbose = false;
+static int g_epoll = -1;
+static int g_mqttListener = -1;
+static int g_controlListener = -1;
+static uint64_t g_nextConnectionId = 1;
+static uint64_t g_nextRequestId = 1;
+static int64_t g_startTime = 0;
+static int64_t g_outageEnd = 0;
+static STATS g_stats;
+static std::mt19937 g_random(1);
+static std::unordered_map<int, std::unique_ptr<CONNECTION>> g_connections;
+static std::unordered_map<std::string, int> g_devices;
+static std::multimap<int64_t, TIMER> g_timers;
+static std::unordered_map<std::string, METHOD_CALL> g_methodCalls;
+
+static int64_t now_us()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static std::string json_escape(const std::string &text)
+{
+	std::string escaped;
+	for (unsigned char c : text)
+	{
+		if (c == '"' || c == '\\')
+		{
+			escaped += '\\';
+			escaped += (char)c;
+		}
+		else if (c < 0x20)
+		{
+			char unicode[8];
+			snprintf(unicode, sizeof(unicode), "\\u%04x", c);
+			escaped += unicode;
+		}
+		else
+		{
+			escaped += (char)c;
+		}
+	}
+	return escaped;
+}
+
+static std::string url_decode(const std::string &text)
+{
+	std::string decoded;
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		if (text[i] == '%' && i + 2 < text.size() && isxdigit((unsigned char)text[i + 1]) && isxdigit((unsigned char)text[i + 2]))
+		{
+			decoded += (char)strtol(text.substr(i + 1, 2).c_str(), nullptr, 16);
+			i += 2;
+		}
+		else
+		{
+			decoded += text[i] == '+' ? ' ' : text[i];
+		}
+	}
+	return decoded;
+}
+
+//the value of name in a query string, the part after '?' of a topic or of a url
+static std::string query_value(const std::string &query, const std::string &name)
+{
+	size_t start = 0;
+	while (start < query.size())
+	{
+		size_t end = query.find('&', start);
+		if (end == std::string::npos)
+			end = query.size();
+		size_t equals = query.find('=', start);
+		if (equals != std::string::npos && equals < end && url_decode(query.substr(start, equals - start)) == name)
+			return url_decode(query.substr(equals + 1, end - equals - 1));
+		start = end + 1;
+	}
+	return "";
+}
+
+static bool starts_with(const std::string &text, const std::string &prefix)
+{
+	return text.compare(0, prefix.size(), prefix) == 0;
+}
+
+static CONNECTION *find_connection(int fd, uint64_t id)
+{
+	auto found = g_connections.find(fd);
+	return found != g_connections.end() && found->second->id == id ? found->second.get() : nullptr;
+}
+
+static void update_interest(CONNECTION *connection)
+{
+	bool isWaiting = connection->outputSent < connection->output.size();
+	if (isWaiting == connection->isWaitingForOutput)
+		return;
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	//a device connection keeps reading while its output waits, the acks of its PUBLISHes depend on it
+	event.events = EPOLLIN | (isWaiting ? EPOLLOUT : 0);
+	event.data.fd = connection->fd;
+	epoll_ctl(g_epoll, EPOLL_CTL_MOD, connection->fd, &event);
+	connection->isWaitingForOutput = isWaiting;
+}
+
+static void send_packet(CONNECTION *connection, const uint8_t *packet, size_t length)
+{
+	connection->output.append((const char *)packet, length);
+	connection->counters.bytesOut += length;
+}
+
+static void close_connection(CONNECTION *connection)
+{
+	if (g_isVerbose)
+		printf("%d closed %s\n", connection->fd, connection->deviceId.c_str());
+	epoll_ctl(g_epoll, EPOLL_CTL_DEL, connection->fd, nullptr);
+	close(connection->fd);
+	if (!connection->isControl)
+	{
+		g_stats.openConnections--;
+		g_stats.closed.add(connection->counters);
+		auto device = g_devices.find(connection->deviceId);
+		if (device != g_devices.end() && device->second == connection->fd)
+			g_devices.erase(device);
+	}
+	//the timers and method calls of the connection find it gone by its id
+	g_connections.erase(connection->fd);
+}
+
+//sends what the socket takes, false when the connection failed
+static bool flush_output(CONNECTION *connection)
+{
+	while (connection->outputSent < connection->output.size())
+	{
+		ssize_t sent = send(connection->fd, connection->output.data() + connection->outputSent, connection->output.size() - connection->outputSent, MSG_NOSIGNAL);
+		if (sent < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		connection->outputSent += (size_t)sent;
+	}
+	connection->output.clear();
+	connection->outputSent = 0;
+	return !connection->closeAfterOutput;
+}
+
+static void flush_or_close(CONNECTION *connection)
+{
+	if (!flush_output(connection))
+		close_connection(connection);
+	else
+		update_interest(connection);
+}
+
+static void send_http(CONNECTION *connection, int status, const char *reason, const std::string &body)
+{
+	char head[256];
+	snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nServer: iothub_broker\r\nContent-Type: application/json\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+		status, reason, body.size());
+	connection->output += head;
+	connection->output += body;
+	connection->closeAfterOutput = true;
+}
+
+//a PUBLISH from the broker to a device, QoS 1 takes the next packet id of the connection
+static void publish(CONNECTION *connection, const std::string &topic, const std::string &payload, bool isQos1)
+{
+	std::vector<uint8_t> packet(MQTT_PUBLISH_SIZE(topic.size(), payload.size()));
+	uint16_t packetId = 0;
+	if (isQos1)
+	{
+		packetId = connection->nextPacketId++;
+		if (connection->nextPacketId == 0)
+			connection->nextPacketId = 1;
+	}
+	size_t length = mqtt_packet_publish(packet.data(), packet.size(), topic.data(), topic.size(), packetId, false, payload.data(), payload.size());
+	send_packet(connection, packet.data(), length);
+}
+
+//queues an answer for after the PUBACK delay, an empty packet is dropped
+static void schedule(CONNECTION *connection, std::string packet, bool isPuback)
+{
+	int64_t delay = (int64_t)g_delayMs * 1000;
+	if (g_jitterMs > 0)
+		delay += (int64_t)(g_random() % (g_jitterMs + 1)) * 1000;
+	int64_t due = std::max(now_us() + delay, connection->lastAckTime);
+	connection->lastAckTime = due;
+	g_timers.emplace(due, TIMER{ connection->id, connection->fd, std::move(packet), isPuback });
+}
+
+static bool is_dropped()
+{
+	return g_dropProbability > 0 && std::uniform_real_distribution<double>(0, 1)(g_random) < g_dropProbability;
+}
+
+static void on_telemetry(CONNECTION *connection, const MQTT_PUBLISH_PACKET &publish)
+{
+	connection->counters.telemetry++;
+	connection->counters.telemetryBytes += publish.payloadLength;
+	if (publish.isDuplicate)
+		connection->counters.duplicates++;
+	if (publish.qos == 0)
+		return;
+	if (is_dropped())
+	{
+		connection->counters.dropped++;
+		return;
+	}
+	uint8_t ack[4];
+	size_t length = mqtt_packet_ack(ack, sizeof(ack), MQTT_PUBACK, publish.packetId);
+	schedule(connection, std::string((const char *)ack, length), true);
+}
+
+static void on_twin_request(CONNECTION *connection, const std::string &topic, const MQTT_PUBLISH_PACKET &publish)
+{
+	size_t question = topic.find('?');
+	std::string rid = question != std::string::npos ? query_value(topic.substr(question + 1), "$rid") : "";
+	std::string payload;
+	char responseTopic[160];
+	if (starts_with(topic, "$iothub/twin/PATCH/properties/reported/"))
+	{
+		connection->counters.twinPatches++;
+		connection->reportedProperties.assign((const char *)publish.payload, publish.payloadLength);
+		connection->twinVersion++;
+		snprintf(responseTopic, sizeof(responseTopic), "$iothub/twin/res/204/?$rid=%s&$version=%llu", rid.c_str(), (unsigned long long)connection->twinVersion);
+	}
+	else
+	{
+		connection->counters.twinGets++;
+		snprintf(responseTopic, sizeof(responseTopic), "$iothub/twin/res/200/?$rid=%s", rid.c_str());
+		payload = "{\"desired\":{\"$version\":1},\"reported\":" + connection->reportedProperties + "}";
+	}
+
+	std::vector<uint8_t> packet(MQTT_PUBLISH_SIZE(strlen(responseTopic), payload.size()));
+	size_t length = mqtt_packet_publish(packet.data(), packet.size(), responseTopic, strlen(responseTopic), 0, false, payload.data(), payload.size());
+	schedule(connection, std::string((const char *)packet.data(), length), false);
+}
+
+static void on_method_response(CONNECTION *connection, const std::string &topic, const MQTT_PUBLISH_PACKET &publish)
+{
+	//$iothub/methods/res/{status}/?$rid={rid}
+	connection->counters.methodResponses++;
+	int status = atoi(topic.c_str() + strlen("$iothub/methods/res/"));
+	size_t question = topic.find('?');
+	auto call = g_methodCalls.find(question != std::string::npos ? query_value(topic.substr(question + 1), "$rid") : "");
+	if (call == g_methodCalls.end())
+		return;
+	CONNECTION *control = find_connection(call->second.controlFd, call->second.controlId);
+	g_methodCalls.erase(call);
+	if (control == nullptr)
+		return;
+
+	std::string payload((const char *)publish.payload, publish.payloadLength);
+	char head[32];
+	snprintf(head, sizeof(head), "{\"status\":%d,\"payload\":", status);
+	send_http(control, 200, "OK", head + (payload.empty() ? std::string("null") : payload) + "}");
+	flush_or_close(control);
+}
+
+static void on_publish(CONNECTION *connection, const MQTT_PUBLISH_PACKET &publish)
+{
+	std::string topic(publish.topic, publish.topicLength);
+	if (starts_with(topic, "devices/" + connection->deviceId + "/messages/events/"))
+	{
+		on_telemetry(connection, publish);
+		return;
+	}
+
+	//everything else is QoS 0 from the SDK, a QoS 1 one is acknowledged right away
+	if (publish.qos == 1)
+	{
+		uint8_t ack[4];
+		send_packet(connection, ack, mqtt_packet_ack(ack, sizeof(ack), MQTT_PUBACK, publish.packetId));
+	}
+	if (starts_with(topic, "$iothub/twin/PATCH/properties/reported/") || starts_with(topic, "$iothub/twin/GET/"))
+		on_twin_request(connection, topic, publish);
+	else if (starts_with(topic, "$iothub/methods/res/"))
+		on_method_response(connection, topic, publish);
+	else if (g_isVerbose)
+		printf("%d unknown topic %s\n", connection->fd, topic.c_str());
+}
+
+//the CONNECT of a device, false when the connection has to be closed
+static bool on_connect(CONNECTION *connection, const MQTT_PACKET &packet)
+{
+	//protocol name, level, flags and keep alive, then the client id
+	uint32_t offset = 0;
+	const char *text;
+	uint16_t length;
+	if (!mqtt_packet_read_string(&packet, &offset, &text, &length) || length != 4 || memcmp(text, "MQTT", 4) != 0 || packet.length < offset + 4)
+		return false;
+	uint8_t flags = packet.body[offset + 1];
+	uint16_t keepAlive = (uint16_t)(packet.body[offset + 2] << 8 | packet.body[offset + 3]);
+	offset += 4;
+	if (!mqtt_packet_read_string(&packet, &offset, &text, &length) || length == 0 || (flags & 0x04) != 0)
+		return false; //IoT Hub needs the device id and does not support wills
+
+	uint8_t connack[4];
+	if (now_us() < g_outageEnd)
+	{
+		g_stats.refused++;
+		send_packet(connection, connack, mqtt_packet_connack(connack, sizeof(connack), CONNACK_SERVER_UNAVAILABLE));
+		connection->closeAfterOutput = true;
+		return true;
+	}
+
+	connection->deviceId.assign(text, length);
+	connection->isConnected = true;
+	connection->connectTime = now_us();
+	//IoT Hub closes a connection that was silent for one and a half keep alive periods
+	connection->keepAliveUs = (int64_t)keepAlive * 1500000;
+	auto previous = g_devices.find(connection->deviceId);
+	if (previous != g_devices.end())
+	{
+		auto found = g_connections.find(previous->second);
+		if (found != g_connections.end())
+		{
+			g_stats.replaced++;
+			close_connection(found->second.get());
+		}
+	}
+	g_devices[connection->deviceId] = connection->fd;
+	send_packet(connection, connack, mqtt_packet_connack(connack, sizeof(connack), 0));
+	if (g_isVerbose)
+		printf("%d connected %s\n", connection->fd, connection->deviceId.c_str());
+	return true;
+}
+
+static bool on_subscribe(CONNECTION *connection, const MQTT_PACKET &packet)
+{
+	uint32_t offset = 2;
+	std::vector<uint8_t> codes;
+	while (offset < packet.length)
+	{
+		const char *topic;
+		uint16_t length;
+		if (!mqtt_packet_read_string(&packet, &offset, &topic, &length) || offset >= packet.length)
+			return false;
+		uint8_t qos = packet.body[offset++];
+		codes.push_back(qos > 1 ? 1 : qos);
+	}
+	if (codes.empty())
+		return false;
+	std::vector<uint8_t> suback(MQTT_MAX_HEADER_SIZE + 2 + codes.size());
+	send_packet(connection, suback.data(), mqtt_packet_suback(suback.data(), suback.size(), mqtt_packet_read_id(&packet), codes.data(), (int)codes.size()));
+	return true;
+}
+
+//false when the packet breaks the protocol and the connection has to be closed
+static bool handle_packet(CONNECTION *connection, const MQTT_PACKET &packet)
+{
+	connection->lastPacketTime = now_us();
+	if (!connection->isConnected)
+		return packet.type == MQTT_CONNECT && on_connect(connection, packet);
+
+	switch (packet.type)
+	{
+	case MQTT_PUBLISH:
+	{
+		MQTT_PUBLISH_PACKET publish;
+		if (!mqtt_packet_read_publish(&packet, &publish))
+			return false;
+		on_publish(connection, publish);
+		return true;
+	}
+	case MQTT_PUBACK:
+		connection->counters.c2dAcked++;
+		return true;
+	case MQTT_SUBSCRIBE:
+		return on_subscribe(connection, packet);
+	case MQTT_UNSUBSCRIBE:
+	{
+		uint8_t ack[4];
+		send_packet(connection, ack, mqtt_packet_ack(ack, sizeof(ack), MQTT_UNSUBACK, mqtt_packet_read_id(&packet)));
+		return true;
+	}
+	case MQTT_PINGREQ:
+	{
+		uint8_t ack[4];
+		send_packet(connection, ack, mqtt_packet_ack(ack, sizeof(ack), MQTT_PINGRESP, 0));
+		return true;
+	}
+	default:
+		//DISCONNECT, a second CONNECT or a packet the broker does not send
+		return false;
+	}
+}
+
+static bool process_mqtt_input(CONNECTION *connection)
+{
+	size_t offset = 0;
+	bool isValid = true;
+	while (isValid && !connection->closeAfterOutput)
+	{
+		MQTT_PACKET packet;
+		int length = mqtt_packet_parse((const uint8_t *)connection->input.data() + offset, connection->input.size() - offset, &packet);
+		if (length == 0)
+			break;
+		isValid = length > 0 && handle_packet(connection, packet);
+		if (length > 0)
+			offset += (size_t)length;
+	}
+	connection->input.erase(0, offset);
+	if (!isValid && connection->isConnected)
+		g_stats.protocolErrors++;
+	return isValid;
+}
+
+static std::string connection_json(const CONNECTION *connection, int64_t now)
+{
+	const COUNTERS &c = connection->counters;
+	char json[768];
+	snprintf(json, sizeof(json),
+		"{\"deviceId\":\"%s\",\"connectedSeconds\":%.1f,\"telemetry\":%llu,\"telemetryBytes\":%llu,\"duplicates\":%llu,\"pubacks\":%llu,\"dropped\":%llu,"
+		"\"twinPatches\":%llu,\"twinGets\":%llu,\"c2dSent\":%llu,\"c2dAcked\":%llu,\"methodRequests\":%llu,\"methodResponses\":%llu,\"bytesIn\":%llu,\"bytesOut\":%llu}",
+		json_escape(connection->deviceId).c_str(), (now - connection->connectTime) / 1e6, (unsigned long long)c.telemetry, (unsigned long long)c.telemetryBytes,
+		(unsigned long long)c.duplicates, (unsigned long long)c.pubacks, (unsigned long long)c.dropped, (unsigned long long)c.twinPatches,
+		(unsigned long long)c.twinGets, (unsigned long long)c.c2dSent, (unsigned long long)c.c2dAcked, (unsigned long long)c.methodRequests,
+		(unsigned long long)c.methodResponses, (unsigned long long)c.bytesIn, (unsigned long long)c.bytesOut);
+	return json;
+}
+
+static void handle_stats(CONNECTION *control)
+{
+	int64_t now = now_us();
+	COUNTERS total = g_stats.closed;
+	std::string devices;
+	for (auto &entry : g_connections)
+	{
+		const CONNECTION *connection = entry.second.get();
+		if (connection->isControl)
+			continue;
+		total.add(connection->counters);
+		if (!connection->isConnected)
+			continue;
+		if (!devices.empty())
+			devices += ',';
+		devices += connection_json(connection, now);
+	}
+
+	char json[1024];
+	snprintf(json, sizeof(json),
+		"{\"uptimeSeconds\":%.1f,\"connections\":%llu,\"openConnections\":%llu,\"refused\":%llu,\"replaced\":%llu,\"keepAliveTimeouts\":%llu,\"protocolErrors\":%llu,"
+		"\"methodTimeouts\":%llu,\"outages\":%llu,\"outage\":%s,\"telemetry\":%llu,\"telemetryBytes\":%llu,\"duplicates\":%llu,\"pubacks\":%llu,\"dropped\":%llu,"
+		"\"twinPatches\":%llu,\"twinGets\":%llu,\"c2dSent\":%llu,\"c2dAcked\":%llu,\"methodRequests\":%llu,\"methodResponses\":%llu,\"bytesIn\":%llu,\"bytesOut\":%llu,\"devices\":[",
+		(now - g_startTime) / 1e6, (unsigned long long)g_stats.connections, (unsigned long long)g_stats.openConnections, (unsigned long long)g_stats.refused,
+		(unsigned long long)g_stats.replaced, (unsigned long long)g_stats.keepAliveTimeouts, (unsigned long long)g_stats.protocolErrors,
+		(unsigned long long)g_stats.methodTimeouts, (unsigned long long)g_stats.outages, now < g_outageEnd ? "true" : "false",
+		(unsigned long long)total.telemetry, (unsigned long long)total.telemetryBytes, (unsigned long long)total.duplicates, (unsigned long long)total.pubacks,
+		(unsigned long long)total.dropped, (unsigned long long)total.twinPatches, (unsigned long long)total.twinGets, (unsigned long long)total.c2dSent,
+		(unsigned long long)total.c2dAcked, (unsigned long long)total.methodRequests, (unsigned long long)total.methodResponses,
+		(unsigned long long)total.bytesIn, (unsigned long long)total.bytesOut);
+	send_http(control, 200, "OK", json + devices + "]}");
+}
+
+static CONNECTION *find_device(const std::string &deviceId)
+{
+	auto device = g_devices.find(deviceId);
+	if (device == g_devices.end())
+		return nullptr;
+	auto found = g_connections.find(device->second);
+	return found != g_connections.end() ? found->second.get() : nullptr;
+}
+
+static void handle_message(CONNECTION *control, const std::string &deviceId, const std::string &body)
+{
+	CONNECTION *device = find_device(deviceId);
+	if (device == nullptr)
+	{
+		send_http(control, 404, "Not Found", "{\"error\":\"device not connected\"}");
+		return;
+	}
+	publish(device, "devices/" + deviceId + "/messages/devicebound/", body, true);
+	device->counters.c2dSent++;
+	flush_or_close(device);
+	send_http(control, 204, "No Content", "");
+}
+
+static void handle_method(CONNECTION *control, const std::string &deviceId, const std::string &name, const std::string &body)
+{
+	CONNECTION *device = find_device(deviceId);
+	if (device == nullptr)
+	{
+		send_http(control, 404, "Not Found", "{\"error\":\"device not connected\"}");
+		return;
+	}
+	char rid[32];
+	snprintf(rid, sizeof(rid), "%llx", (unsigned long long)g_nextRequestId++);
+	g_methodCalls[rid] = METHOD_CALL{ control->fd, control->id, device->fd, device->id, now_us() + (int64_t)METHOD_TIMEOUT_S * 1000000 };
+	publish(device, "$iothub/methods/POST/" + name + "/?$rid=" + rid, body, false);
+	device->counters.methodRequests++;
+	flush_or_close(device);
+}
+
+static void start_outage(CONNECTION *control, int seconds)
+{
+	g_stats.outages++;
+	g_outageEnd = now_us() + (int64_t)seconds * 1000000;
+	std::vector<CONNECTION *> devices;
+	for (auto &entry : g_connections)
+	{
+		if (!entry.second->isControl)
+			devices.push_back(entry.second.get());
+	}
+	for (CONNECTION *device : devices)
+		close_connection(device);
+	char json[64];
+	snprintf(json, sizeof(json), "{\"closed\":%zu}", devices.size());
+	send_http(control, 200, "OK", json);
+}
+
+static void handle_config(CONNECTION *control, const std::string &query)
+{
+	std::string delay = query_value(query, "delayMs"), jitter = query_value(query, "jitterMs"), drop = query_value(query, "dropProbability");
+	if (!delay.empty())
+		g_delayMs = (uint32_t)atoi(delay.c_str());
+	if (!jitter.empty())
+		g_jitterMs = (uint32_t)atoi(jitter.c_str());
+	if (!drop.empty())
+		g_dropProbability = atof(drop.c_str());
+	char json[128];
+	snprintf(json, sizeof(json), "{\"delayMs\":%u,\"jitterMs\":%u,\"dropProbability\":%g}", g_delayMs, g_jitterMs, g_dropProbability);
+	send_http(control, 200, "OK", json);
+}
+
+//one request per control connection, false while it is incomplete
+static bool process_control_input(CONNECTION *control)
+{
+	size_t headEnd = control->input.find("\r\n\r\n");
+	if (headEnd == std::string::npos)
+		return false;
+	std::string head = control->input.substr(0, headEnd);
+	size_t contentLength = 0;
+	for (size_t start = head.find("\r\n"); start != std::string::npos; start = head.find("\r\n", start + 2))
+	{
+		if (strncasecmp(head.c_str() + start + 2, "content-length:", 15) == 0)
+			contentLength = (size_t)strtoul(head.c_str() + start + 17, nullptr, 10);
+	}
+	if (control->input.size() < headEnd + 4 + contentLength)
+		return false;
+	std::string body = control->input.substr(headEnd + 4, contentLength);
+	control->input.clear();
+	control->hasRequest = true;
+
+	std::string line = head.substr(0, head.find("\r\n"));
+	size_t space1 = line.find(' '), space2 = line.find(' ', space1 + 1);
+	std::string method = line.substr(0, space1);
+	std::string target = space1 != std::string::npos ? line.substr(space1 + 1, space2 - space1 - 1) : "";
+	size_t question = target.find('?');
+	std::string path = url_decode(target.substr(0, question));
+	std::string query = question != std::string::npos ? target.substr(question + 1) : "";
+	if (g_isVerbose)
+		printf("%d %s %s\n", control->fd, method.c_str(), target.c_str());
+
+	//devices/{id}/messages and devices/{id}/methods/{name}
+	size_t idEnd = starts_with(path, "/devices/") ? path.find('/', 9) : std::string::npos;
+	std::string deviceId = idEnd != std::string::npos ? path.substr(9, idEnd - 9) : "";
+	if (method == "GET" && path == "/stats")
+		handle_stats(control);
+	else if (method == "POST" && idEnd != std::string::npos && path.compare(idEnd, std::string::npos, "/messages") == 0)
+		handle_message(control, deviceId, body);
+	else if (method == "POST" && idEnd != std::string::npos && starts_with(path.substr(idEnd), "/methods/") && path.size() > idEnd + 9)
+		handle_method(control, deviceId, path.substr(idEnd + 9), body);
+	else if (method == "POST" && path == "/outage" && atoi(query_value(query, "seconds").c_str()) > 0)
+		start_outage(control, atoi(query_value(query, "seconds").c_str()));
+	else if (method == "POST" && path == "/config")
+		handle_config(control, query);
+	else
+		send_http(control, 404, "Not Found", "{\"error\":\"not found\"}");
+	return true;
+}
+
+static void on_readable(CONNECTION *connection)
+{
+	char buffer[READ_BUFFER_SIZE];
+	while (true)
+	{
+		ssize_t length = recv(connection->fd, buffer, sizeof(buffer), 0);
+		if (length > 0)
+		{
+			connection->input.append(buffer, (size_t)length);
+			connection->counters.bytesIn += (uint64_t)length;
+			continue;
+		}
+		if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		close_connection(connection); //closed by the peer or failed
+		return;
+	}
+
+	if (connection->isControl)
+	{
+		if (connection->input.size() > MAX_CONTROL_REQUEST)
+		{
+			close_connection(connection);
+			return;
+		}
+		//a method call answers later, from the response of the device
+		if (connection->hasRequest || !process_control_input(connection) || !connection->closeAfterOutput)
+			return;
+	}
+	else if (!process_mqtt_input(connection))
+	{
+		close_connection(connection);
+		return;
+	}
+	flush_or_close(connection);
+}
+
+static void accept_connections(int listener)
+{
+	while (true)
+	{
+		int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			return;
+
+		int noDelay = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+		std::unique_ptr<CONNECTION> connection(new CONNECTION());
+		connection->fd = fd;
+		connection->id = g_nextConnectionId++;
+		connection->isControl = listener == g_controlListener;
+		connection->acceptTime = now_us();
+
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.fd = fd;
+		if (epoll_ctl(g_epoll, EPOLL_CTL_ADD, fd, &event) != 0)
+		{
+			close(fd);
+			continue;
+		}
+		if (!connection->isControl)
+		{
+			g_stats.connections++;
+			g_stats.openConnections++;
+		}
+		g_connections[fd] = std::move(connection);
+	}
+}
+
+static void run_timers(int64_t now)
+{
+	while (!g_timers.empty() && g_timers.begin()->first <= now)
+	{
+		TIMER timer = std::move(g_timers.begin()->second);
+		g_timers.erase(g_timers.begin());
+		CONNECTION *connection = find_connection(timer.fd, timer.connectionId);
+		if (connection == nullptr)
+			continue; //the device disconnected, its acks are lost like on IoT Hub
+		send_packet(connection, (const uint8_t *)timer.packet.data(), timer.packet.size());
+		if (timer.isPuback)
+			connection->counters.pubacks++;
+		flush_or_close(connection);
+	}
+}
+
+//closes the silent device connections and answers the method calls that timed out
+static void sweep(int64_t now)
+{
+	std::vector<CONNECTION *> expired;
+	for (auto &entry : g_connections)
+	{
+		CONNECTION *connection = entry.second.get();
+		if (connection->isControl)
+			continue;
+		if (!connection->isConnected ? now - connection->acceptTime > (int64_t)CONNECT_TIMEOUT_S * 1000000
+			: connection->keepAliveUs > 0 && now - connection->lastPacketTime > connection->keepAliveUs)
+			expired.push_back(connection);
+	}
+	for (CONNECTION *connection : expired)
+	{
+		if (connection->isConnected)
+			g_stats.keepAliveTimeouts++;
+		close_connection(connection);
+	}
+
+	for (auto call = g_methodCalls.begin(); call != g_methodCalls.end();)
+	{
+		bool isDeviceGone = find_connection(call->second.deviceFd, call->second.deviceId) == nullptr;
+		if (now < call->second.deadline && !isDeviceGone)
+		{
+			++call;
+			continue;
+		}
+		CONNECTION *control = find_connection(call->second.controlFd, call->second.controlId);
+		if (control != nullptr)
+		{
+			g_stats.methodTimeouts++;
+			send_http(control, 504, "Gateway Timeout", isDeviceGone ? "{\"error\":\"device disconnected\"}" : "{\"error\":\"timeout\"}");
+			flush_or_close(control);
+		}
+		call = g_methodCalls.erase(call);
+	}
+}
+
+static int create_listener(int port)
+{
+	int listener = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listener < 0)
+		return -1;
+
+	int option = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
+	option = 0;
+	setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &option, sizeof(option));
+
+	struct sockaddr_in6 address;
+	memset(&address, 0, sizeof(address));
+	address.sin6_family = AF_INET6;
+	address.sin6_addr = in6addr_any;
+	address.sin6_port = htons((uint16_t)port);
+	if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 4096) != 0)
+	{
+		close(listener);
+		return -1;
+	}
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = listener;
+	epoll_ctl(g_epoll, EPOLL_CTL_ADD, listener, &event);
+	return listener;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: iothub_broker [-p mqtt port] [-c control port] [-a PUBACK delay ms] [-j PUBACK jitter ms] [-d drop probability] [-v]\n");
+}
+
+int main(int argc, char **argv)
+{
+	int mqttPort = DEFAULT_MQTT_PORT, controlPort = DEFAULT_CONTROL_PORT;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-v") == 0)
+			g_isVerbose = true;
+		else if (i + 1 == argc)
+		{
+			usage();
+			return 1;
+		}
+		else if (strcmp(argv[i], "-p") == 0)
+			mqttPort = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-c") == 0)
+			controlPort = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-a") == 0)
+			g_delayMs = (uint32_t)atoi(argv[++i]);
+		else if (strcmp(argv[i], "-j") == 0)
+			g_jitterMs = (uint32_t)atoi(argv[++i]);
+		else if (strcmp(argv[i], "-d") == 0)
+			g_dropProbability = atof(argv[++i]);
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	g_startTime = now_us();
+	g_random.seed((uint32_t)g_startTime);
+	g_epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (g_epoll < 0 || (g_mqttListener = create_listener(mqttPort)) < 0 || (g_controlListener = create_listener(controlPort)) < 0)
+	{
+		fprintf(stderr, "Listening on ports %d and %d failed: %s\n", mqttPort, controlPort, strerror(errno));
+		return 1;
+	}
+	printf("MQTT on port %d, control on port %d, PUBACK after %u+%u ms, %g dropped\n", mqttPort, controlPort, g_delayMs, g_jitterMs, g_dropProbability);
+	fflush(stdout);
+
+	struct epoll_event events[MAX_EVENTS];
+	int64_t lastSweep = now_us();
+	while (true)
+	{
+		//until the next ack is due, at least once a second for the sweep
+		int timeoutMs = 1000;
+		if (!g_timers.empty())
+			timeoutMs = (int)std::min<int64_t>(timeoutMs, std::max<int64_t>(0, (g_timers.begin()->first - now_us() + 999) / 1000));
+		int count = epoll_wait(g_epoll, events, MAX_EVENTS, timeoutMs);
+		for (int i = 0; i < count; i++)
+		{
+			int fd = events[i].data.fd;
+			if (fd == g_mqttListener || fd == g_controlListener)
+			{
+				accept_connections(fd);
+				continue;
+			}
+			auto found = g_connections.find(fd);
+			if (found == g_connections.end())
+				continue;
+			CONNECTION *connection = found->second.get();
+			if (events[i].events & (EPOLLERR | EPOLLHUP))
+				close_connection(connection);
+			else if (events[i].events & EPOLLIN)
+				on_readable(connection);
+			else
+				flush_or_close(connection);
+		}
+
+		int64_t now = now_us();
+		run_timers(now);
+		if (now - lastSweep >= 1000000)
+		{
+			sweep(now);
+			lastSweep = now;
+		}
+	}
+}
@@ -0,0 +1,203 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/*
+ * Host side benchmark of the cJSON document allocation: cJSON_Parse/cJSON_Delete against cJSON_ParseInArena/cJSON_ArenaReset,
+ * with blocks from the hooks and with a block of the caller. The allocations are counted through cJSON_InitHooks.
+ *   json_bench [-n iterations] [document.json ...]    without documents a twin and an OTA manifest
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../cJSON.h"
+
+#define DEFAULT_ITERATIONS 100000
+#define CALLER_BLOCK_SIZE 4096
+
+typedef struct DOCUMENT_TAG
+{
+	const char *name;
+	char *text;
+} DOCUMENT;
+
+typedef struct RESULT_TAG
+{
+	unsigned long allocations;
+	unsigned long frees;
+	double nanoseconds; //per document
+} RESULT;
+
+//a full twin as the device gets it after a reconnect, desired and reported properties with their metadata
+static const char g_twin[] =
+	"{\"desired\":{\"firmwareVersion\":\"2.0.0.0\",\"blobName\":\"watertank-2.0.0.0.bin\",\"sendInterval\":5,"
+	"\"probation\":{\"seconds\":600,\"minTelemetry\":10},"
+	"\"$metadata\":{\"$lastUpdated\":\"2026-10-18T12:00:00.0000000Z\",\"$lastUpdatedVersion\":12,"
+	"\"firmwareVersion\":{\"$lastUpdated\":\"2026-10-18T12:00:00.0000000Z\",\"$lastUpdatedVersion\":12},"
+	"\"blobName\":{\"$lastUpdated\":\"2026-10-18T12:00:00.0000000Z\",\"$lastUpdatedVersion\":12},"
+	"\"sendInterval\":{\"$lastUpdated\":\"2026-10-17T08:30:00.0000000Z\",\"$lastUpdatedVersion\":9}},"
+	"\"$version\":12},"
+	"\"reported\":{\"firmwareVersion\":\"1.0.0.0\",\"currentUpdateOffset\":0,\"currentUpdateProgress\":0,\"updateThroughput\":0,"
+	"\"onProbation\":false,\"$metadata\":{\"$lastUpdated\":\"2026-10-18T11:59:55.0000000Z\"},\"$version\":4031}}";
+
+static const char g_manifest[] =
+	"{\"latestVersion\":\"2.0.0.0\",\"blobName\":\"watertank-2.0.0.0.bin\",\"blobSize\":912384,"
+	"\"blobUrl\":\"https://watertankota.blob.core.windows.net/firmware/watertank-2.0.0.0.bin?sv=2018-03-28&sr=b&sig=0123456789abcdef\","
+	"\"sha256\":\"9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08\",\"encoding\":\"deflate\",\"compressedSize\":503211,"
+	"\"patchBaseVersion\":\"1.0.0.0\",\"patchBlobName\":\"watertank-1.0.0.0-2.0.0.0.patch\",\"patchSize\":48122,"
+	"\"patchBlobUrl\":\"https://watertankota.blob.core.windows.net/firmware/watertank-1.0.0.0-2.0.0.0.patch?sv=2018-03-28&sr=b&sig=fedcba9876543210\","
+	"\"patchEncoding\":\"deflate\"}";
+
+static unsigned long g_allocations = 0;
+static unsigned long g_frees = 0;
+
+static void *counting_malloc(size_t size)
+{
+	g_allocations++;
+	return malloc(size);
+}
+
+static void counting_free(void *pointer)
+{
+	g_frees++;
+	free(pointer);
+}
+
+static double now_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static char *read_file(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return NULL;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	char *text = size >= 0 ? (char *)malloc((size_t)size + 1) : NULL;
+	if (text != NULL && fread(text, 1, (size_t)size, file) == (size_t)size)
+		text[size] = '\0';
+	else
+	{
+		free(text);
+		text = NULL;
+	}
+	fclose(file);
+	return text;
+}
+
+static RESULT finish(double start, int iterations)
+{
+	RESULT result;
+	result.nanoseconds = (now_ns() - start) / iterations;
+	result.allocations = g_allocations;
+	result.frees = g_frees;
+	return result;
+}
+
+//a lookup like the firmware does with the parsed document, so the parse is not the only work
+static int touch(const cJSON *json)
+{
+	int count = 0;
+	const cJSON *item = NULL;
+	cJSON_ArrayForEach(item, json)
+		count += item->string != NULL;
+	return count;
+}
+
+static RESULT run_heap(const char *text, int iterations)
+{
+	g_allocations = g_frees = 0;
+	double start = now_ns();
+	for (int i = 0; i < iterations; i++)
+	{
+		cJSON *json = cJSON_Parse(text);
+		touch(json);
+		cJSON_Delete(json);
+	}
+	return finish(start, iterations);
+}
+
+static RESULT run_arena(const char *text, int iterations, void *block, size_t size)
+{
+	cJSON_Arena arena;
+	g_allocations = g_frees = 0;
+	cJSON_ArenaInit(&arena, block, size);
+	double start = now_ns();
+	for (int i = 0; i < iterations; i++)
+	{
+		cJSON *json = cJSON_ParseInArena(&arena, text);
+		touch(json);
+		cJSON_ArenaReset(&arena);
+	}
+	cJSON_ArenaFree(&arena);
+	return finish(start, iterations);
+}
+
+static void print_result(const char *mode, RESULT result, int iterations)
+{
+	printf("  %-22s %10lu mallocs %10lu frees %8.2f calls %8.0f ns per document\n", mode, result.allocations, result.frees,
+		(double)(result.allocations + result.frees) / iterations, result.nanoseconds);
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = DEFAULT_ITERATIONS;
+	DOCUMENT documents[16];
+	int count = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			iterations = atoi(argv[++i]);
+		else if (count < (int)(sizeof(documents) / sizeof(documents[0])))
+		{
+			documents[count].name = argv[i];
+			documents[count].text = read_file(argv[i]);
+			if (documents[count].text == NULL)
+			{
+				fprintf(stderr, "Unable to read %s\n", argv[i]);
+				return 1;
+			}
+			count++;
+		}
+	}
+	if (iterations <= 0)
+	{
+		fprintf(stderr, "usage: json_bench [-n iterations] [document.json ...]\n");
+		return 1;
+	}
+	if (count == 0)
+	{
+		documents[0].name = "twin";
+		documents[0].text = (char *)g_twin;
+		documents[1].name = "manifest";
+		documents[1].text = (char *)g_manifest;
+		count = 2;
+	}
+
+	cJSON_Hooks hooks = { counting_malloc, counting_free };
+	cJSON_InitHooks(&hooks);
+	//8 byte alignment for the nodes
+	static double callerBlock[CALLER_BLOCK_SIZE / sizeof(double)];
+	for (int i = 0; i < count; i++)
+	{
+		cJSON *json = cJSON_Parse(documents[i].text);
+		if (json == NULL)
+		{
+			fprintf(stderr, "%s is not valid JSON\n", documents[i].name);
+			return 1;
+		}
+		cJSON_Delete(json);
+
+		printf("%s, %zu bytes, %d iterations\n", documents[i].name, strlen(documents[i].text), iterations);
+		print_result("cJSON_Parse", run_heap(documents[i].text, iterations), iterations);
+		print_result("arena, malloc blocks", run_arena(documents[i].text, iterations, NULL, 0), iterations);
+		print_result("arena, caller block", run_arena(documents[i].text, iterations, callerBlock, sizeof(callerBlock)), iterations);
+	}
+	return 0;
+}
@@ -0,0 +1,188 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <string.h>
+#include "mqtt_packet.h"
+
+#define MQTT_PROTOCOL_LEVEL 4 //3.1.1
+#define MQTT_CLEAN_SESSION 0x02
+#define MQTT_USER_NAME 0x80
+
+int mqtt_packet_parse(const uint8_t *data, size_t size, MQTT_PACKET *packet)
+{
+	//the remaining length is a base 128 varint of up to 4 bytes
+	uint32_t length = 0;
+	size_t offset = 1;
+	for (int shift = 0;; shift += 7)
+	{
+		if (offset >= size)
+			return 0;
+		if (shift > 21)
+			return -1;
+		uint8_t digit = data[offset++];
+		length |= (uint32_t)(digit & 0x7f) << shift;
+		if ((digit & 0x80) == 0)
+			break;
+	}
+	if (length > MQTT_MAX_PACKET_SIZE)
+		return -1;
+	if (size - offset < length)
+		return 0;
+
+	packet->type = data[0] >> 4;
+	packet->flags = data[0] & 0x0f;
+	packet->body = data + offset;
+	packet->length = length;
+	return (int)(offset + length);
+}
+
+bool mqtt_packet_read_string(const MQTT_PACKET *packet, uint32_t *offset, const char **text, uint16_t *length)
+{
+	if (packet->length - *offset < 2)
+		return false;
+	uint16_t stringLength = (uint16_t)(packet->body[*offset] << 8 | packet->body[*offset + 1]);
+	if (packet->length - *offset - 2 < stringLength)
+		return false;
+	*text = (const char *)packet->body + *offset + 2;
+	*length = stringLength;
+	*offset += 2 + stringLength;
+	return true;
+}
+
+bool mqtt_packet_read_publish(const MQTT_PACKET *packet, MQTT_PUBLISH_PACKET *publish)
+{
+	uint32_t offset = 0;
+	if (packet->type != MQTT_PUBLISH || !mqtt_packet_read_string(packet, &offset, &publish->topic, &publish->topicLength))
+		return false;
+	publish->qos = (packet->flags >> 1) & 0x03;
+	publish->isDuplicate = (packet->flags & 0x08) != 0;
+	publish->packetId = 0;
+	if (publish->qos > 1)
+		return false;
+	if (publish->qos == 1)
+	{
+		if (packet->length - offset < 2)
+			return false;
+		publish->packetId = (uint16_t)(packet->body[offset] << 8 | packet->body[offset + 1]);
+		offset += 2;
+	}
+	publish->payload = packet->body + offset;
+	publish->payloadLength = packet->length - offset;
+	return true;
+}
+
+uint16_t mqtt_packet_read_id(const MQTT_PACKET *packet)
+{
+	return packet->length < 2 ? 0 : (uint16_t)(packet->body[0] << 8 | packet->body[1]);
+}
+
+static size_t write_header(uint8_t *out, uint8_t typeAndFlags, size_t remainingLength)
+{
+	size_t offset = 0;
+	out[offset++] = typeAndFlags;
+	do
+	{
+		uint8_t digit = remainingLength & 0x7f;
+		remainingLength >>= 7;
+		out[offset++] = remainingLength > 0 ? digit | 0x80 : digit;
+	} while (remainingLength > 0);
+	return offset;
+}
+
+static size_t write_u16(uint8_t *out, uint16_t value)
+{
+	out[0] = (uint8_t)(value >> 8);
+	out[1] = (uint8_t)value;
+	return 2;
+}
+
+static size_t write_string(uint8_t *out, const char *text, size_t length)
+{
+	write_u16(out, (uint16_t)length);
+	memcpy(out + 2, text, length);
+	return 2 + length;
+}
+
+size_t mqtt_packet_connect(uint8_t *out, size_t size, const char *clientId, const char *userName, uint16_t keepAliveSeconds)
+{
+	size_t clientIdLength = strlen(clientId), userNameLength = userName != NULL ? strlen(userName) : 0;
+	size_t remainingLength = 10 + 2 + clientIdLength + (userName != NULL ? 2 + userNameLength : 0);
+	if (MQTT_MAX_HEADER_SIZE + remainingLength > size || clientIdLength > UINT16_MAX || userNameLength > UINT16_MAX)
+		return 0;
+
+	size_t offset = write_header(out, MQTT_CONNECT << 4, remainingLength);
+	offset += write_string(out + offset, "MQTT", 4);
+	out[offset++] = MQTT_PROTOCOL_LEVEL;
+	out[offset++] = MQTT_CLEAN_SESSION | (userName != NULL ? MQTT_USER_NAME : 0);
+	offset += write_u16(out + offset, keepAliveSeconds);
+	offset += write_string(out + offset, clientId, clientIdLength);
+	if (userName != NULL)
+		offset += write_string(out + offset, userName, userNameLength);
+	return offset;
+}
+
+size_t mqtt_packet_connack(uint8_t *out, size_t size, uint8_t returnCode)
+{
+	if (size < 4)
+		return 0;
+	size_t offset = write_header(out, MQTT_CONNACK << 4, 2);
+	out[offset++] = 0; //no session present, every session is clean
+	out[offset++] = returnCode;
+	return offset;
+}
+
+size_t mqtt_packet_publish(uint8_t *out, size_t size, const char *topic, size_t topicLength, uint16_t packetId, bool isDuplicate, const void *payload, size_t payloadLength)
+{
+	size_t remainingLength = 2 + topicLength + (packetId != 0 ? 2 : 0) + payloadLength;
+	if (MQTT_MAX_HEADER_SIZE + remainingLength > size || topicLength > UINT16_MAX || remainingLength > MQTT_MAX_PACKET_SIZE)
+		return 0;
+
+	uint8_t flags = (packetId != 0 ? 0x02 : 0) | (isDuplicate ? 0x08 : 0);
+	size_t offset = write_header(out, MQTT_PUBLISH << 4 | flags, remainingLength);
+	offset += write_string(out + offset, topic, topicLength);
+	if (packetId != 0)
+		offset += write_u16(out + offset, packetId);
+	memcpy(out + offset, payload, payloadLength);
+	return offset + payloadLength;
+}
+
+size_t mqtt_packet_ack(uint8_t *out, size_t size, uint8_t type, uint16_t packetId)
+{
+	bool hasId = type == MQTT_PUBACK || type == MQTT_UNSUBACK;
+	if (size < 4)
+		return 0;
+	size_t offset = write_header(out, type << 4, hasId ? 2 : 0);
+	if (hasId)
+		offset += write_u16(out + offset, packetId);
+	return offset;
+}
+
+size_t mqtt_packet_subscribe(uint8_t *out, size_t size, uint16_t packetId, const char *const *topics, int count)
+{
+	size_t remainingLength = 2;
+	for (int i = 0; i < count; i++)
+		remainingLength += 2 + strlen(topics[i]) + 1;
+	if (MQTT_MAX_HEADER_SIZE + remainingLength > size)
+		return 0;
+
+	//the reserved flags of SUBSCRIBE are 0010
+	size_t offset = write_header(out, MQTT_SUBSCRIBE << 4 | 0x02, remainingLength);
+	offset += write_u16(out + offset, packetId);
+	for (int i = 0; i < count; i++)
+	{
+		offset += write_string(out + offset, topics[i], strlen(topics[i]));
+		out[offset++] = 1;
+	}
+	return offset;
+}
+
+size_t mqtt_packet_suback(uint8_t *out, size_t size, uint16_t packetId, const uint8_t *returnCodes, int count)
+{
+	size_t remainingLength = 2 + (size_t)count;
+	if (MQTT_MAX_HEADER_SIZE + remainingLength > size)
+		return 0;
+	size_t offset = write_header(out, MQTT_SUBACK << 4, remainingLength);
+	offset += write_u16(out + offset, packetId);
+	memcpy(out + offset, returnCodes, (size_t)count);
+	return offset + (size_t)count;
+}
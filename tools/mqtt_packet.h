@@ -0,0 +1,79 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_PACKET_H
+#define MQTT_PACKET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * The MQTT 3.1.1 packets that IoT Hub uses, for the local broker and the host device.
+	 * QoS 2, retained messages and wills are not used by IoT Hub and not supported.
+	 * The encoders write to out and return the size, or 0 when the packet does not fit in size bytes.
+	 */
+#define MQTT_CONNECT 1
+#define MQTT_CONNACK 2
+#define MQTT_PUBLISH 3
+#define MQTT_PUBACK 4
+#define MQTT_SUBSCRIBE 8
+#define MQTT_SUBACK 9
+#define MQTT_UNSUBSCRIBE 10
+#define MQTT_UNSUBACK 11
+#define MQTT_PINGREQ 12
+#define MQTT_PINGRESP 13
+#define MQTT_DISCONNECT 14
+
+#define MQTT_MAX_HEADER_SIZE 5
+#define MQTT_MAX_PACKET_SIZE (256 * 1024) //the IoT Hub limit of a message
+
+	typedef struct MQTT_PACKET_TAG
+	{
+		uint8_t type;
+		uint8_t flags;
+		const uint8_t *body;
+		uint32_t length;
+	} MQTT_PACKET;
+
+	//a PUBLISH, topic and payload point into the packet
+	typedef struct MQTT_PUBLISH_TAG
+	{
+		const char *topic;
+		uint16_t topicLength;
+		uint8_t qos;
+		bool isDuplicate;
+		uint16_t packetId; //0 with QoS 0
+		const uint8_t *payload;
+		uint32_t payloadLength;
+	} MQTT_PUBLISH_PACKET;
+
+	//the next packet of data, returns its size, 0 while it is incomplete and -1 when it is invalid or too large
+	int mqtt_packet_parse(const uint8_t *data, size_t size, MQTT_PACKET *packet);
+	//a length prefixed string of the packet body at *offset, false when it does not fit
+	bool mqtt_packet_read_string(const MQTT_PACKET *packet, uint32_t *offset, const char **text, uint16_t *length);
+	bool mqtt_packet_read_publish(const MQTT_PACKET *packet, MQTT_PUBLISH_PACKET *publish);
+	//the packet id that follows the fixed header of PUBACK, SUBSCRIBE, SUBACK, UNSUBSCRIBE and UNSUBACK
+	uint16_t mqtt_packet_read_id(const MQTT_PACKET *packet);
+
+	size_t mqtt_packet_connect(uint8_t *out, size_t size, const char *clientId, const char *userName, uint16_t keepAliveSeconds);
+	size_t mqtt_packet_connack(uint8_t *out, size_t size, uint8_t returnCode);
+	//a packetId of 0 publishes with QoS 0, otherwise with QoS 1
+	size_t mqtt_packet_publish(uint8_t *out, size_t size, const char *topic, size_t topicLength, uint16_t packetId, bool isDuplicate, const void *payload, size_t payloadLength);
+	//PUBACK, UNSUBACK and the empty PINGREQ, PINGRESP and DISCONNECT
+	size_t mqtt_packet_ack(uint8_t *out, size_t size, uint8_t type, uint16_t packetId);
+	//all the topics with QoS 1
+	size_t mqtt_packet_subscribe(uint8_t *out, size_t size, uint16_t packetId, const char *const *topics, int count);
+	size_t mqtt_packet_suback(uint8_t *out, size_t size, uint16_t packetId, const uint8_t *returnCodes, int count);
+
+#define MQTT_PUBLISH_SIZE(topicLength, payloadLength) (MQTT_MAX_HEADER_SIZE + 4 + (topicLength) + (payloadLength))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_PACKET_H */
@@ -0,0 +1,139 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/*
+ * Host side compression of firmware images and patches for the device inflater (see ota_inflate.h).
+ *   ota_compress <esp32.bin> <esp32.bin.zlib>
+ * The output is a zlib stream with a 4KB window. The tool decompresses it again the way the device does,
+ * 4KB of output and a download sized piece of input at a time, checks the result and reports the throughput.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+//zlib windowBits of the 4KB device window
+#define WINDOW_BITS 12
+#define WINDOW_SIZE (1 << WINDOW_BITS)
+//a raw download read
+#define INPUT_PIECE_SIZE 4096
+#define BENCHMARK_SECONDS 1.0
+
+static unsigned char *read_file(const char *fileName, size_t *length)
+{
+	FILE *file = fopen(fileName, "rb");
+	if (file == NULL)
+	{
+		perror(fileName);
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	*length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	unsigned char *data = malloc(*length > 0 ? *length : 1);
+	if (data != NULL && fread(data, 1, *length, file) != *length)
+	{
+		free(data);
+		data = NULL;
+	}
+	fclose(file);
+	return data;
+}
+
+//inflate in device sized pieces, check against image when it is not NULL
+static int inflate_like_device(const unsigned char *compressed, size_t compressedLength, const unsigned char *image, size_t imageLength)
+{
+	static unsigned char window[WINDOW_SIZE];
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (inflateInit2(&stream, WINDOW_BITS) != Z_OK)
+		return -1;
+
+	size_t offset = 0, produced = 0;
+	int status = Z_OK;
+	while (status != Z_STREAM_END)
+	{
+		if (stream.avail_in == 0)
+		{
+			if (offset == compressedLength)
+				break;
+			stream.next_in = (unsigned char *)compressed + offset;
+			stream.avail_in = compressedLength - offset < INPUT_PIECE_SIZE ? compressedLength - offset : INPUT_PIECE_SIZE;
+			offset += stream.avail_in;
+		}
+		stream.next_out = window;
+		stream.avail_out = sizeof(window);
+		status = inflate(&stream, Z_NO_FLUSH);
+		if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR)
+			break;
+
+		size_t length = sizeof(window) - stream.avail_out;
+		if (image != NULL && (produced + length > imageLength || memcmp(image + produced, window, length) != 0))
+			break;
+		produced += length;
+	}
+	inflateEnd(&stream);
+	return status == Z_STREAM_END && produced == imageLength ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "usage: %s <esp32.bin> <esp32.bin.zlib>\n", argv[0]);
+		return 1;
+	}
+
+	size_t imageLength;
+	unsigned char *image = read_file(argv[1], &imageLength);
+	if (image == NULL)
+		return 1;
+
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, WINDOW_BITS, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+		return 1;
+	size_t capacity = deflateBound(&stream, imageLength);
+	unsigned char *compressed = malloc(capacity);
+	stream.next_in = image;
+	stream.avail_in = imageLength;
+	stream.next_out = compressed;
+	stream.avail_out = capacity;
+	if (compressed == NULL || deflate(&stream, Z_FINISH) != Z_STREAM_END)
+	{
+		fprintf(stderr, "compression failed\n");
+		return 1;
+	}
+	size_t compressedLength = stream.total_out;
+	deflateEnd(&stream);
+
+	if (inflate_like_device(compressed, compressedLength, image, imageLength) != 0)
+	{
+		fprintf(stderr, "the compressed image does not decompress to %s\n", argv[1]);
+		return 1;
+	}
+
+	FILE *file = fopen(argv[2], "wb");
+	if (file == NULL || fwrite(compressed, 1, compressedLength, file) != compressedLength || fclose(file) != 0)
+	{
+		perror(argv[2]);
+		return 1;
+	}
+
+	int iterations = 0;
+	clock_t begin = clock();
+	double seconds;
+	do
+	{
+		inflate_like_device(compressed, compressedLength, NULL, imageLength);
+		++iterations;
+		seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+	} while (seconds < BENCHMARK_SECONDS);
+
+	printf("%zu -> %zu bytes (%.1f%%), \"compressedSize\":%zu\n", imageLength, compressedLength, compressedLength * 100.0 / (imageLength ? imageLength : 1), compressedLength);
+	printf("inflate with a %d byte window: %.1f MB/s of image on this host\n", WINDOW_SIZE, imageLength * (double)iterations / seconds / 1e6);
+	return 0;
+}
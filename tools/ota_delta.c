@@ -0,0 +1,240 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/*
+ * Host side generator of delta updates (see ota_patch.h).
+ *   ota_delta diff <running.bin> <new.bin> <update.patch>   create a patch and check it with the device applier
+ *   ota_delta apply <running.bin> <update.patch> <new.bin>  apply a patch
+ * The running image is the .bin of the version that the devices run now, upload the patch next to the full image.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../ota_patch.h"
+
+#define MIN_MATCH 16
+#define HASH_BITS 20
+
+typedef struct BUFFER_TAG
+{
+	unsigned char *data;
+	size_t length;
+	size_t capacity;
+} BUFFER;
+
+static int read_file(const char *fileName, BUFFER *buffer)
+{
+	FILE *file = fopen(fileName, "rb");
+	if (file == NULL)
+	{
+		perror(fileName);
+		return -1;
+	}
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	buffer->data = malloc(length > 0 ? length : 1);
+	buffer->length = buffer->capacity = length;
+	int result = buffer->data != NULL && fread(buffer->data, 1, length, file) == (size_t)length ? 0 : -1;
+	fclose(file);
+	if (result != 0)
+		fprintf(stderr, "%s: read failed\n", fileName);
+	return result;
+}
+
+static int write_file(const char *fileName, const BUFFER *buffer)
+{
+	FILE *file = fopen(fileName, "wb");
+	if (file == NULL)
+	{
+		perror(fileName);
+		return -1;
+	}
+	int result = fwrite(buffer->data, 1, buffer->length, file) == buffer->length ? 0 : -1;
+	return fclose(file) == 0 ? result : -1;
+}
+
+static void append(BUFFER *buffer, const void *data, size_t length)
+{
+	if (buffer->length + length > buffer->capacity)
+	{
+		buffer->capacity = (buffer->length + length) * 2;
+		buffer->data = realloc(buffer->data, buffer->capacity);
+		if (buffer->data == NULL)
+		{
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	memcpy(buffer->data + buffer->length, data, length);
+	buffer->length += length;
+}
+
+static void append_u32(BUFFER *buffer, uint32_t value)
+{
+	unsigned char bytes[4] = { (unsigned char)value, (unsigned char)(value >> 8), (unsigned char)(value >> 16), (unsigned char)(value >> 24) };
+	append(buffer, bytes, sizeof(bytes));
+}
+
+static uint32_t hash(const unsigned char *data)
+{
+	uint32_t value = 0;
+	for (int i = 0; i < MIN_MATCH; ++i)
+		value = value * 0x9E3779B1u + data[i];
+	return value >> (32 - HASH_BITS);
+}
+
+static size_t match_length(const BUFFER *source, size_t sourceOffset, const BUFFER *target, size_t targetOffset)
+{
+	size_t length = 0;
+	while (sourceOffset + length < source->length && targetOffset + length < target->length
+		&& source->data[sourceOffset + length] == target->data[targetOffset + length])
+		++length;
+	return length;
+}
+
+static void flush_insert(BUFFER *patch, const BUFFER *target, size_t begin, size_t end, int *operations)
+{
+	if (end == begin)
+		return;
+	append(patch, (unsigned char[]) { OTA_PATCH_OP_INSERT }, 1);
+	append_u32(patch, (uint32_t)(end - begin));
+	append(patch, target->data + begin, end - begin);
+	++*operations;
+}
+
+//greedy matcher, a code change moves the rest of the image so the position after the last copy is tried before the hash index
+static void create_patch(const BUFFER *source, const BUFFER *target, BUFFER *patch)
+{
+	int32_t *index = malloc(sizeof(int32_t) << HASH_BITS);
+	memset(index, 0xff, sizeof(int32_t) << HASH_BITS);
+	for (size_t i = 0; i + MIN_MATCH <= source->length; ++i)
+		index[hash(source->data + i)] = (int32_t)i;
+
+	append(patch, OTA_PATCH_MAGIC, 4);
+	append_u32(patch, (uint32_t)source->length);
+	append_u32(patch, (uint32_t)target->length);
+
+	size_t position = 0, insertBegin = 0, predicted = 0;
+	int copies = 0, inserts = 0;
+	while (position < target->length)
+	{
+		size_t bestOffset = 0, bestLength = 0;
+		if (predicted < source->length)
+		{
+			bestOffset = predicted;
+			bestLength = match_length(source, predicted, target, position);
+		}
+		if (bestLength < MIN_MATCH && position + MIN_MATCH <= target->length)
+		{
+			int32_t candidate = index[hash(target->data + position)];
+			size_t length = candidate < 0 ? 0 : match_length(source, candidate, target, position);
+			if (length > bestLength)
+			{
+				bestOffset = candidate;
+				bestLength = length;
+			}
+		}
+
+		if (bestLength < MIN_MATCH)
+		{
+			++position;
+			++predicted;
+			continue;
+		}
+
+		//take back the bytes before the match that are the same in the source
+		while (position > insertBegin && bestOffset > 0 && source->data[bestOffset - 1] == target->data[position - 1])
+		{
+			--position;
+			--bestOffset;
+			++bestLength;
+		}
+		flush_insert(patch, target, insertBegin, position, &inserts);
+		append(patch, (unsigned char[]) { OTA_PATCH_OP_COPY }, 1);
+		append_u32(patch, (uint32_t)bestOffset);
+		append_u32(patch, (uint32_t)bestLength);
+		++copies;
+
+		position += bestLength;
+		insertBegin = position;
+		predicted = bestOffset + bestLength;
+	}
+	flush_insert(patch, target, insertBegin, position, &inserts);
+	free(index);
+
+	printf("patch: %zu bytes for a %zu bytes image (%.1f%%), %d copy and %d insert operations\n",
+		patch->length, target->length, patch->length * 100.0 / (target->length ? target->length : 1), copies, inserts);
+}
+
+typedef struct APPLY_CONTEXT_TAG
+{
+	const BUFFER *source;
+	BUFFER *target;
+} APPLY_CONTEXT;
+
+static int read_source(void *context, size_t offset, void *buffer, size_t length)
+{
+	const BUFFER *source = ((APPLY_CONTEXT *)context)->source;
+	if (offset + length > source->length)
+		return -1;
+	memcpy(buffer, source->data + offset, length);
+	return 0;
+}
+
+static int write_target(void *context, const void *data, size_t length)
+{
+	append(((APPLY_CONTEXT *)context)->target, data, length);
+	return 0;
+}
+
+//feed the patch in odd sized pieces like the download does
+static int apply_patch(const BUFFER *source, const BUFFER *patch, BUFFER *target)
+{
+	static OTA_PATCH patcher;
+	APPLY_CONTEXT context = { source, target };
+	ota_patch_init(&patcher, read_source, write_target, &context);
+
+	for (size_t offset = 0; offset < patch->length; offset += 1357)
+	{
+		size_t length = patch->length - offset < 1357 ? patch->length - offset : 1357;
+		if (ota_patch_feed(&patcher, patch->data + offset, length) != 0)
+		{
+			fprintf(stderr, "invalid patch at offset %zu\n", offset);
+			return -1;
+		}
+	}
+	if (!ota_patch_is_complete(&patcher))
+	{
+		fprintf(stderr, "truncated patch\n");
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 5 || (strcmp(argv[1], "diff") != 0 && strcmp(argv[1], "apply") != 0))
+	{
+		fprintf(stderr, "usage: %s diff <running.bin> <new.bin> <update.patch>\n       %s apply <running.bin> <update.patch> <new.bin>\n", argv[0], argv[0]);
+		return 1;
+	}
+
+	BUFFER source = { 0 }, input = { 0 }, output = { 0 };
+	if (read_file(argv[2], &source) != 0 || read_file(argv[3], &input) != 0)
+		return 1;
+
+	if (strcmp(argv[1], "apply") == 0)
+		return apply_patch(&source, &input, &output) == 0 && write_file(argv[4], &output) == 0 ? 0 : 1;
+
+	create_patch(&source, &input, &output);
+	BUFFER check = { 0 };
+	if (apply_patch(&source, &output, &check) != 0 || check.length != input.length || memcmp(check.data, input.data, input.length) != 0)
+	{
+		fprintf(stderr, "the patch does not reproduce %s\n", argv[3]);
+		return 1;
+	}
+	return write_file(argv[4], &output) == 0 ? 0 : 1;
+}
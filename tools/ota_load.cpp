@@ -0,0 +1,377 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/*
+ * Load generator for tools/ota_server: simulated devices that check the manifest and download the image at the
+ * same time, the way a fleet does after a release. Every device verifies the Content-MD5 of the chunks and the
+ * sha256 of the manifest over the whole image.
+ *   ota_load <host> <port> [-d devices] [-m raw|chunked] [-s chunk size] [-v device version]
+ * raw streams blobUrl with one Range request like download_raw, chunked requests base64 chunks like download_chunked.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "digest.h"
+
+#define DEFAULT_DEVICES 200
+#define DEFAULT_CHUNK_SIZE 4096
+#define READ_SIZE 4096
+
+typedef std::chrono::steady_clock CLOCK;
+
+struct RESPONSE
+{
+	int status = 0;
+	std::string headers; //lower case names
+	std::string body;
+};
+
+struct DEVICE_RESULT
+{
+	bool isOk = false;
+	double seconds = 0;
+	size_t bytes = 0;
+	std::vector<double> latencies; //ms per request
+};
+
+static std::string g_host;
+static std::string g_port;
+static std::string g_mode = "raw";
+static size_t g_chunkSize = DEFAULT_CHUNK_SIZE;
+static std::string g_version = "0.0.0.0";
+static std::mutex g_logLock;
+
+static void log_failure(int device, const char *what)
+{
+	std::lock_guard<std::mutex> lock(g_logLock);
+	fprintf(stderr, "device %d: %s\n", device, what);
+}
+
+static int connect_server()
+{
+	struct addrinfo hints, *addresses = nullptr;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(g_host.c_str(), g_port.c_str(), &hints, &addresses) != 0)
+		return -1;
+
+	int fd = -1;
+	for (struct addrinfo *address = addresses; address != nullptr && fd < 0; address = address->ai_next)
+	{
+		fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) != 0)
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(addresses);
+	if (fd >= 0)
+	{
+		int noDelay = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+	}
+	return fd;
+}
+
+static std::string header_value(const RESPONSE &response, const char *name)
+{
+	std::string key = std::string("\n") + name + ":";
+	size_t start = response.headers.find(key);
+	if (start == std::string::npos)
+		return "";
+	start = response.headers.find_first_not_of(" ", start + key.size());
+	size_t end = response.headers.find("\r\n", start);
+	return response.headers.substr(start, end - start);
+}
+
+//one keep-alive request, the body is read up to Content-Length. consume gets the body in pieces instead when it is set
+static bool request(int fd, const std::string &target, const std::string &extraHeaders, RESPONSE *response, void (*consume)(void *, const char *, size_t) = nullptr, void *context = nullptr)
+{
+	std::string text = "GET " + target + " HTTP/1.1\r\nHost: " + g_host + ":" + g_port + "\r\n" + extraHeaders + "\r\n";
+	if (send(fd, text.data(), text.size(), MSG_NOSIGNAL) != (ssize_t)text.size())
+		return false;
+
+	std::string input;
+	char buffer[READ_SIZE];
+	size_t headEnd;
+	while ((headEnd = input.find("\r\n\r\n")) == std::string::npos)
+	{
+		ssize_t length = recv(fd, buffer, sizeof(buffer), 0);
+		if (length <= 0)
+			return false;
+		input.append(buffer, (size_t)length);
+	}
+
+	response->headers = "\n" + input.substr(0, headEnd + 2);
+	for (size_t i = 0; i < response->headers.size(); i++)
+	{
+		//names only, the values keep their case
+		size_t colon = response->headers.find(':', i);
+		size_t lineEnd = response->headers.find('\n', i);
+		for (size_t j = i; j < colon && j < lineEnd; j++)
+			response->headers[j] = (char)tolower((unsigned char)response->headers[j]);
+		i = lineEnd == std::string::npos ? response->headers.size() : lineEnd;
+	}
+	response->status = atoi(input.c_str() + 9);
+	size_t contentLength = (size_t)strtoull(header_value(*response, "content-length").c_str(), nullptr, 10);
+
+	std::string rest = input.substr(headEnd + 4);
+	size_t received = std::min(rest.size(), contentLength);
+	if (consume != nullptr)
+		consume(context, rest.data(), received);
+	else
+		response->body = rest.substr(0, received);
+	while (received < contentLength)
+	{
+		ssize_t length = recv(fd, buffer, std::min(sizeof(buffer), contentLength - received), 0);
+		if (length <= 0)
+			return false;
+		if (consume != nullptr)
+			consume(context, buffer, (size_t)length);
+		else
+			response->body.append(buffer, (size_t)length);
+		received += (size_t)length;
+	}
+	return true;
+}
+
+static std::string json_string(const std::string &json, const char *key)
+{
+	std::string pattern = std::string("\"") + key + "\":\"";
+	size_t start = json.find(pattern);
+	if (start == std::string::npos)
+		return "";
+	start += pattern.size();
+	return json.substr(start, json.find('"', start) - start);
+}
+
+static size_t json_number(const std::string &json, const char *key)
+{
+	std::string pattern = std::string("\"") + key + "\":";
+	size_t start = json.find(pattern);
+	return start == std::string::npos ? 0 : (size_t)strtoull(json.c_str() + start + pattern.size(), nullptr, 10);
+}
+
+static int base64_value(char c)
+{
+	return c >= 'A' && c <= 'Z' ? c - 'A' : c >= 'a' && c <= 'z' ? c - 'a' + 26 : c >= '0' && c <= '9' ? c - '0' + 52 : c == '+' ? 62 : c == '/' ? 63 : -1;
+}
+
+static std::string base64_decode(const std::string &text)
+{
+	std::string decoded;
+	uint32_t bits = 0;
+	int count = 0;
+	for (char c : text)
+	{
+		int value = base64_value(c);
+		if (value < 0)
+			continue;
+		bits = (bits << 6) | (uint32_t)value;
+		if (++count == 4)
+		{
+			decoded += (char)(bits >> 16);
+			decoded += (char)(bits >> 8);
+			decoded += (char)bits;
+			bits = 0;
+			count = 0;
+		}
+	}
+	if (count == 3)
+	{
+		decoded += (char)(bits >> 10);
+		decoded += (char)(bits >> 2);
+	}
+	else if (count == 2)
+	{
+		decoded += (char)(bits >> 4);
+	}
+	return decoded;
+}
+
+static void hash_body(void *context, const char *data, size_t length)
+{
+	digest_sha256_update((DIGEST_SHA256 *)context, data, length);
+}
+
+static double elapsed_ms(CLOCK::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(CLOCK::now() - start).count();
+}
+
+static void run_device(int device, DEVICE_RESULT *result)
+{
+	CLOCK::time_point deviceStart = CLOCK::now();
+	int fd = connect_server();
+	if (fd < 0)
+	{
+		log_failure(device, "connect failed");
+		return;
+	}
+
+	RESPONSE manifest;
+	CLOCK::time_point start = CLOCK::now();
+	if (!request(fd, "/api/CheckForNewFirmware?version=" + g_version, "", &manifest) || manifest.status != 200)
+	{
+		log_failure(device, "manifest request failed");
+		close(fd);
+		return;
+	}
+	result->latencies.push_back(elapsed_ms(start));
+
+	std::string blobName = json_string(manifest.body, "blobName");
+	std::string blobUrl = json_string(manifest.body, "blobUrl");
+	std::string sha256 = json_string(manifest.body, "sha256");
+	//a compressed blob has the size of its data in compressedSize
+	size_t blobSize = json_string(manifest.body, "encoding").empty() ? json_number(manifest.body, "blobSize") : json_number(manifest.body, "compressedSize");
+
+	DIGEST_SHA256 hash;
+	digest_sha256_init(&hash);
+	bool isOk = true;
+	if (g_mode == "raw")
+	{
+		size_t path = blobUrl.find("/blobs/");
+		RESPONSE blob;
+		start = CLOCK::now();
+		isOk = path != std::string::npos && request(fd, blobUrl.substr(path), "Range: bytes=0-\r\n", &blob, hash_body, &hash) && blob.status == 206;
+		result->latencies.push_back(elapsed_ms(start));
+		result->bytes = blobSize;
+	}
+	else
+	{
+		char target[512];
+		for (size_t offset = 0; isOk && offset < blobSize; offset += g_chunkSize)
+		{
+			snprintf(target, sizeof(target), "/api/DownloadFirmware?firmwareBlobName=%s&offset=%zu&chunkSize=%zu", blobName.c_str(), offset, g_chunkSize);
+			RESPONSE chunk;
+			start = CLOCK::now();
+			isOk = request(fd, target, "", &chunk) && chunk.status == 200;
+			result->latencies.push_back(elapsed_ms(start));
+			if (!isOk)
+				break;
+
+			std::string data = base64_decode(chunk.body);
+			unsigned char md5[16];
+			char md5Text[DIGEST_BASE64_SIZE(16)];
+			digest_md5(data.data(), data.size(), md5);
+			digest_base64(md5, sizeof(md5), md5Text);
+			isOk = header_value(chunk, "content-md5") == md5Text && data.size() == std::min(g_chunkSize, blobSize - offset);
+			digest_sha256_update(&hash, data.data(), data.size());
+			result->bytes += data.size();
+		}
+	}
+	close(fd);
+
+	unsigned char digest[32];
+	char digestText[65];
+	digest_sha256_finish(&hash, digest);
+	digest_hex(digest, sizeof(digest), digestText);
+	//the manifest sha256 is the one of the decompressed image, a compressed blob is only checked for its chunks
+	if (isOk && json_string(manifest.body, "encoding").empty() && sha256 != digestText)
+	{
+		log_failure(device, "image sha256 differs from the manifest");
+		isOk = false;
+	}
+	else if (!isOk)
+	{
+		log_failure(device, "download failed");
+	}
+	result->isOk = isOk;
+	result->seconds = elapsed_ms(deviceStart) / 1000;
+}
+
+static double percentile(std::vector<double> &values, double fraction)
+{
+	if (values.empty())
+		return 0;
+	size_t index = std::min(values.size() - 1, (size_t)(fraction * values.size()));
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: ota_load <host> <port> [-d devices] [-m raw|chunked] [-s chunk size] [-v device version]\n");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		usage();
+		return 1;
+	}
+	g_host = argv[1];
+	g_port = argv[2];
+	int devices = DEFAULT_DEVICES;
+	for (int i = 3; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+			devices = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+			g_mode = argv[++i];
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			g_chunkSize = (size_t)atoi(argv[++i]);
+		else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc)
+			g_version = argv[++i];
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+	if (devices <= 0 || g_chunkSize == 0 || (g_mode != "raw" && g_mode != "chunked"))
+	{
+		usage();
+		return 1;
+	}
+
+	std::vector<DEVICE_RESULT> results((size_t)devices);
+	std::vector<std::thread> threads;
+	CLOCK::time_point start = CLOCK::now();
+	for (int i = 0; i < devices; i++)
+		threads.emplace_back(run_device, i, &results[(size_t)i]);
+	for (std::thread &thread : threads)
+		thread.join();
+	double seconds = elapsed_ms(start) / 1000;
+
+	std::vector<double> latencies, durations;
+	size_t bytes = 0, failures = 0;
+	for (DEVICE_RESULT &result : results)
+	{
+		latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+		if (!result.isOk)
+		{
+			failures++;
+			continue;
+		}
+		durations.push_back(result.seconds);
+		bytes += result.bytes;
+	}
+
+	printf("%d devices, %s downloads, %zu failed, %.2f s\n", devices, g_mode.c_str(), failures, seconds);
+	printf("%.1f MB/s, %.0f requests/s\n", bytes / seconds / (1024 * 1024), latencies.size() / seconds);
+	printf("request latency ms: p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n", percentile(latencies, 0.5), percentile(latencies, 0.9), percentile(latencies, 0.99), percentile(latencies, 1));
+	printf("device update s:    p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n", percentile(durations, 0.5), percentile(durations, 0.9), percentile(durations, 0.99), percentile(durations, 1));
+
+	int fd = connect_server();
+	RESPONSE stats;
+	if (fd >= 0 && request(fd, "/stats", "", &stats) && stats.status == 200)
+		printf("server: %s\n", stats.body.c_str());
+	if (fd >= 0)
+		close(fd);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,960 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/*
+ * Local firmware server for the CheckForNewFirmware and DownloadFirmware contract of "Azure Functions for OTA.txt",
+ * so OTA can be run and measured without Azure. It serves the blobs of one directory:
+ *   esp32_<latest version>.bin                  the image, the manifest sha256 is computed from it
+ *   esp32_<latest version>.bin.zlib             optional, the compressed image of tools/ota_compress
+ *   esp32_<from>_<latest version>.patch[.zlib]  optional, the patches of tools/ota_delta
+ *
+ *   ota_server <directory> <latest version> [-p port] [-c chunk cache MB] [-v]
+ *
+ *   GET /api/CheckForNewFirmware?version=   the manifest, with ETag, Last-Modified and 304
+ *   GET /api/DownloadFirmware?firmwareBlobName=&offset=&chunkSize=   a base64 chunk with Content-MD5
+ *   GET /blobs/<name>                       the raw blob, the blobUrl of the manifest, with Range, ETag and Content-MD5
+ *   GET /stats                              the server counters
+ *
+ * One epoll thread serves all the connections. Blobs are mapped with mmap, raw responses go from the page cache
+ * to the socket with sendfile, and the encoded base64 chunks are kept in an LRU cache because a fleet asks for the
+ * same offsets. The server speaks plain HTTP, OTA_FUNCTIONS_URL in OTA.c points a device build to it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include "digest.h"
+
+#define DEFAULT_PORT 8080
+#define DEFAULT_CACHE_MB 64
+#define MAX_EVENTS 256
+#define MAX_HEADER_LENGTH 16384
+#define MAX_CHUNK_SIZE (1024 * 1024)
+#define IDLE_TIMEOUT_S 60
+#define READ_BUFFER_SIZE 16384
+
+//a blob of the firmware directory, mapped while a response or the cache still uses it
+struct FIRMWARE_FILE
+{
+	std::string name;
+	int fd = -1;
+	const unsigned char *data = nullptr;
+	size_t size = 0;
+	time_t modified = 0;
+	std::string etag;
+	std::string md5; //base64, computed by the first full read
+	std::string sha256; //hex, computed for the image of the manifest
+
+	~FIRMWARE_FILE()
+	{
+		if (data != nullptr)
+			munmap((void *)data, size);
+		if (fd >= 0)
+			close(fd);
+	}
+};
+
+typedef std::shared_ptr<FIRMWARE_FILE> FILE_PTR;
+
+struct CHUNK
+{
+	std::string body;
+	std::string md5;
+};
+
+typedef std::shared_ptr<const CHUNK> CHUNK_PTR;
+
+struct REQUEST
+{
+	std::string method;
+	std::string path;
+	std::map<std::string, std::string> query;
+	std::map<std::string, std::string> headers; //lower case names
+	bool keepAlive = true;
+};
+
+struct CONNECTION
+{
+	int fd = -1;
+	std::string input;
+	std::string output;
+	size_t outputSent = 0;
+	//the body that follows output, one of a cached chunk or a file range
+	CHUNK_PTR chunk;
+	size_t chunkSent = 0;
+	FILE_PTR file;
+	off_t fileOffset = 0;
+	size_t fileRemaining = 0;
+	bool closeAfterResponse = false;
+	bool isWaitingForOutput = false;
+	time_t lastActivity = 0;
+};
+
+struct STATS
+{
+	uint64_t connections = 0;
+	uint64_t openConnections = 0;
+	uint64_t requests = 0;
+	uint64_t manifests = 0;
+	uint64_t notModified = 0;
+	uint64_t chunks = 0;
+	uint64_t blobs = 0;
+	uint64_t errors = 0;
+	uint64_t bytesSent = 0;
+	uint64_t sendfileBytes = 0;
+	uint64_t cacheHits = 0;
+	uint64_t cacheMisses = 0;
+	uint64_t cacheEvictions = 0;
+	uint64_t cacheBytes = 0;
+};
+
+static std::string g_directory;
+static std::string g_latestVersion;
+static size_t g_cacheBudget = (size_t)DEFAULT_CACHE_MB * 1024 * 1024;
+static bool g_isVerbose = false;
+static int g_epoll = -1;
+static STATS g_stats;
+static std::unordered_map<std::string, FILE_PTR> g_files;
+static std::unordered_map<int, std::unique_ptr<CONNECTION>> g_connections;
+
+//LRU of the encoded chunks, the front is the most recently used
+static std::list<std::pair<std::string, CHUNK_PTR>> g_chunkList;
+static std::unordered_map<std::string, std::list<std::pair<std::string, CHUNK_PTR>>::iterator> g_chunkIndex;
+
+static std::string http_date(time_t time)
+{
+	char text[64];
+	struct tm tm;
+	gmtime_r(&time, &tm);
+	strftime(text, sizeof(text), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	return text;
+}
+
+static time_t parse_http_date(const std::string &text)
+{
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	if (strptime(text.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm) == nullptr)
+		return -1;
+	return timegm(&tm);
+}
+
+static std::string json_escape(const std::string &text)
+{
+	std::string escaped;
+	for (unsigned char c : text)
+	{
+		if (c == '"' || c == '\\')
+		{
+			escaped += '\\';
+			escaped += (char)c;
+		}
+		else if (c < 0x20)
+		{
+			char unicode[8];
+			snprintf(unicode, sizeof(unicode), "\\u%04x", c);
+			escaped += unicode;
+		}
+		else
+		{
+			escaped += (char)c;
+		}
+	}
+	return escaped;
+}
+
+static std::string url_decode(const std::string &text)
+{
+	std::string decoded;
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		if (text[i] == '%' && i + 2 < text.size() && isxdigit((unsigned char)text[i + 1]) && isxdigit((unsigned char)text[i + 2]))
+		{
+			decoded += (char)strtol(text.substr(i + 1, 2).c_str(), nullptr, 16);
+			i += 2;
+		}
+		else
+		{
+			decoded += text[i] == '+' ? ' ' : text[i];
+		}
+	}
+	return decoded;
+}
+
+//blob names come from requests, only plain file names of the directory are served
+static bool is_valid_name(const std::string &name)
+{
+	if (name.empty() || name[0] == '.')
+		return false;
+	for (unsigned char c : name)
+	{
+		if (!isalnum(c) && c != '.' && c != '_' && c != '-')
+			return false;
+	}
+	return true;
+}
+
+//the mapped blob, remapped when the file on disk changed. null when it does not exist
+static FILE_PTR open_file(const std::string &name)
+{
+	if (!is_valid_name(name))
+		return nullptr;
+
+	std::string path = g_directory + "/" + name;
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+	{
+		g_files.erase(name);
+		return nullptr;
+	}
+
+	auto found = g_files.find(name);
+	if (found != g_files.end() && found->second->size == (size_t)info.st_size && found->second->modified == info.st_mtime)
+		return found->second;
+
+	FILE_PTR file = std::make_shared<FIRMWARE_FILE>();
+	file->name = name;
+	file->fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (file->fd < 0)
+		return nullptr;
+	file->size = (size_t)info.st_size;
+	file->modified = info.st_mtime;
+	if (file->size > 0)
+	{
+		void *data = mmap(nullptr, file->size, PROT_READ, MAP_SHARED, file->fd, 0);
+		if (data == MAP_FAILED)
+			return nullptr;
+		file->data = (const unsigned char *)data;
+	}
+	char etag[64];
+	snprintf(etag, sizeof(etag), "\"%zx-%llx\"", file->size, (unsigned long long)file->modified);
+	file->etag = etag;
+	g_files[name] = file;
+	return file;
+}
+
+static const std::string &file_md5(const FILE_PTR &file)
+{
+	if (file->md5.empty())
+	{
+		unsigned char digest[16];
+		char text[DIGEST_BASE64_SIZE(16)];
+		digest_md5(file->data, file->size, digest);
+		digest_base64(digest, sizeof(digest), text);
+		file->md5 = text;
+	}
+	return file->md5;
+}
+
+static const std::string &file_sha256(const FILE_PTR &file)
+{
+	if (file->sha256.empty())
+	{
+		unsigned char digest[32];
+		char text[65];
+		digest_sha256(file->data, file->size, digest);
+		digest_hex(digest, sizeof(digest), text);
+		file->sha256 = text;
+	}
+	return file->sha256;
+}
+
+static CHUNK_PTR get_chunk(const FILE_PTR &file, size_t offset, size_t chunkSize)
+{
+	char key[512];
+	snprintf(key, sizeof(key), "%s:%llx:%zu:%zu", file->name.c_str(), (unsigned long long)file->modified, offset, chunkSize);
+	auto found = g_chunkIndex.find(key);
+	if (found != g_chunkIndex.end())
+	{
+		g_stats.cacheHits++;
+		g_chunkList.splice(g_chunkList.begin(), g_chunkList, found->second);
+		return found->second->second;
+	}
+	g_stats.cacheMisses++;
+
+	//like the function: the bytes from offset, fewer at the end of the blob, as a JSON string
+	size_t length = offset < file->size ? std::min(chunkSize, file->size - offset) : 0;
+	const unsigned char *data = file->data + (length > 0 ? offset : 0);
+	std::shared_ptr<CHUNK> chunk = std::make_shared<CHUNK>();
+	chunk->body.resize(DIGEST_BASE64_SIZE(length) + 2);
+	chunk->body[0] = '"';
+	size_t encoded = digest_base64(data, length, &chunk->body[1]);
+	chunk->body[encoded + 1] = '"';
+	chunk->body.resize(encoded + 2);
+
+	unsigned char digest[16];
+	char md5[DIGEST_BASE64_SIZE(16)];
+	digest_md5(data, length, digest);
+	digest_base64(digest, sizeof(digest), md5);
+	chunk->md5 = md5;
+
+	if (chunk->body.size() <= g_cacheBudget)
+	{
+		g_chunkList.emplace_front(key, chunk);
+		g_chunkIndex[key] = g_chunkList.begin();
+		g_stats.cacheBytes += chunk->body.size();
+		while (g_stats.cacheBytes > g_cacheBudget)
+		{
+			g_stats.cacheBytes -= g_chunkList.back().second->body.size();
+			g_chunkIndex.erase(g_chunkList.back().first);
+			g_chunkList.pop_back();
+			g_stats.cacheEvictions++;
+		}
+	}
+	return chunk;
+}
+
+static void start_response(CONNECTION *connection, const REQUEST &request, int status, const char *reason, const std::string &headers, size_t contentLength)
+{
+	char line[256];
+	snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\nServer: ota_server\r\nDate: %s\r\nContent-Length: %zu\r\n", status, reason, http_date(time(nullptr)).c_str(), contentLength);
+	connection->output += line;
+	connection->output += headers;
+	if (!request.keepAlive)
+	{
+		connection->output += "Connection: close\r\n";
+		connection->closeAfterResponse = true;
+	}
+	connection->output += "\r\n";
+	if (g_isVerbose)
+		printf("%d %s %s\n", connection->fd, request.path.c_str(), line + 9);
+}
+
+static void send_text(CONNECTION *connection, const REQUEST &request, int status, const char *reason, const std::string &contentType, const std::string &body)
+{
+	if (status >= 400)
+		g_stats.errors++;
+	start_response(connection, request, status, reason, "Content-Type: " + contentType + "\r\n", body.size());
+	if (request.method != "HEAD")
+		connection->output += body;
+}
+
+//If-None-Match wins over If-Modified-Since, like the function
+static bool is_not_modified(const REQUEST &request, const std::string &etag, time_t modified)
+{
+	auto noneMatch = request.headers.find("if-none-match");
+	if (noneMatch != request.headers.end())
+		return noneMatch->second == "*" || noneMatch->second.find(etag) != std::string::npos;
+	auto modifiedSince = request.headers.find("if-modified-since");
+	if (modifiedSince == request.headers.end())
+		return false;
+	time_t since = parse_http_date(modifiedSince->second);
+	return since >= 0 && since >= modified;
+}
+
+static std::string blob_url(const REQUEST &request, const std::string &name)
+{
+	auto host = request.headers.find("host");
+	return "http://" + (host != request.headers.end() ? host->second : std::string("localhost")) + "/blobs/" + name;
+}
+
+static void handle_manifest(CONNECTION *connection, const REQUEST &request)
+{
+	g_stats.manifests++;
+	std::string blobName = "esp32_" + g_latestVersion + ".bin";
+	FILE_PTR image = open_file(blobName);
+	if (image == nullptr)
+	{
+		send_text(connection, request, 400, "Bad Request", "text/plain", "Error: " + blobName + " does not exist");
+		return;
+	}
+
+	size_t blobSize = image->size;
+	std::string url = blob_url(request, blobName);
+	std::string sha256 = file_sha256(image);
+	std::string encoding;
+	size_t compressedSize = 0;
+	time_t modified = image->modified;
+
+	FILE_PTR compressed = open_file(blobName + ".zlib");
+	if (compressed != nullptr)
+	{
+		blobName = compressed->name;
+		url = blob_url(request, blobName);
+		encoding = "zlib";
+		compressedSize = compressed->size;
+		modified = std::max(modified, compressed->modified);
+	}
+
+	std::string version;
+	auto versionParameter = request.query.find("version");
+	if (versionParameter != request.query.end())
+		version = versionParameter->second;
+
+	std::string patchBaseVersion, patchBlobName, patchBlobUrl, patchEncoding;
+	size_t patchSize = 0;
+	if (!version.empty() && version != g_latestVersion)
+	{
+		std::string name = "esp32_" + version + "_" + g_latestVersion + ".patch";
+		FILE_PTR patch = open_file(name + ".zlib");
+		if (patch != nullptr)
+			patchEncoding = "zlib";
+		else
+			patch = open_file(name);
+		if (patch != nullptr)
+		{
+			patchBaseVersion = version;
+			patchBlobName = patch->name;
+			patchSize = patch->size;
+			patchBlobUrl = blob_url(request, patch->name);
+			modified = std::max(modified, patch->modified);
+		}
+	}
+
+	//the ETag covers everything but the urls, the same rule as the function
+	char numbers[128];
+	snprintf(numbers, sizeof(numbers), "%zu,%zu,%zu", blobSize, compressedSize, patchSize);
+	std::string identity = g_latestVersion + "|" + blobName + "|" + sha256 + "|" + encoding + "|" + patchBaseVersion + "|" + patchBlobName + "|" + patchEncoding + "|" + numbers;
+	unsigned char digest[32];
+	char hex[65];
+	digest_sha256(identity.data(), identity.size(), digest);
+	digest_hex(digest, sizeof(digest), hex);
+	std::string etag = "\"" + std::string(hex, 32) + "\"";
+
+	if (is_not_modified(request, etag, modified))
+	{
+		g_stats.notModified++;
+		start_response(connection, request, 304, "Not Modified", "ETag: " + etag + "\r\n", 0);
+		return;
+	}
+
+	char sizes[160];
+	std::string json = "{\"latestVersion\":\"" + json_escape(g_latestVersion) + "\",\"blobName\":\"" + json_escape(blobName) + "\"";
+	snprintf(sizes, sizeof(sizes), ",\"blobSize\":%zu", blobSize);
+	json += sizes;
+	json += ",\"blobUrl\":\"" + json_escape(url) + "\",\"sha256\":\"" + sha256 + "\",\"encoding\":\"" + encoding + "\"";
+	snprintf(sizes, sizeof(sizes), ",\"compressedSize\":%zu", compressedSize);
+	json += sizes;
+	json += ",\"patchBaseVersion\":\"" + json_escape(patchBaseVersion) + "\",\"patchBlobName\":\"" + json_escape(patchBlobName) + "\"";
+	snprintf(sizes, sizeof(sizes), ",\"patchSize\":%zu", patchSize);
+	json += sizes;
+	json += ",\"patchBlobUrl\":\"" + json_escape(patchBlobUrl) + "\",\"patchEncoding\":\"" + patchEncoding + "\"}";
+
+	std::string headers = "Content-Type: application/json\r\nETag: " + etag + "\r\nLast-Modified: " + http_date(modified) + "\r\n";
+	start_response(connection, request, 200, "OK", headers, json.size());
+	if (request.method != "HEAD")
+		connection->output += json;
+}
+
+static bool parse_size(const std::map<std::string, std::string> &query, const char *name, size_t *value)
+{
+	auto found = query.find(name);
+	if (found == query.end() || found->second.empty())
+		return false;
+	char *end = nullptr;
+	unsigned long long number = strtoull(found->second.c_str(), &end, 10);
+	if (*end != '\0' || found->second[0] == '-')
+		return false;
+	*value = (size_t)number;
+	return true;
+}
+
+static void handle_chunk(CONNECTION *connection, const REQUEST &request)
+{
+	g_stats.chunks++;
+	auto blobName = request.query.find("firmwareBlobName");
+	size_t offset = 0, chunkSize = 0;
+	if (blobName == request.query.end() || !parse_size(request.query, "offset", &offset) || !parse_size(request.query, "chunkSize", &chunkSize) || chunkSize > MAX_CHUNK_SIZE)
+	{
+		send_text(connection, request, 400, "Bad Request", "text/plain", "Please pass a valid arguments");
+		return;
+	}
+
+	FILE_PTR file = open_file(blobName->second);
+	if (file == nullptr)
+	{
+		send_text(connection, request, 400, "Bad Request", "text/plain", "Error " + blobName->second + " does not exist");
+		return;
+	}
+
+	CHUNK_PTR chunk = get_chunk(file, offset, chunkSize);
+	start_response(connection, request, 200, "OK", "Content-Type: application/json\r\nContent-MD5: " + chunk->md5 + "\r\n", chunk->body.size());
+	if (request.method != "HEAD")
+	{
+		connection->chunk = chunk;
+		connection->chunkSent = 0;
+	}
+}
+
+//a single range of bytes=first-last, bytes=first- or bytes=-suffix. false for other forms, they get the whole blob
+static bool parse_range(const std::string &range, size_t size, size_t *first, size_t *last, bool *isSatisfiable)
+{
+	if (range.compare(0, 6, "bytes=") != 0 || range.find(',') != std::string::npos)
+		return false;
+	std::string spec = range.substr(6);
+	size_t dash = spec.find('-');
+	if (dash == std::string::npos)
+		return false;
+
+	std::string firstText = spec.substr(0, dash), lastText = spec.substr(dash + 1);
+	if (firstText.find_first_not_of("0123456789") != std::string::npos || lastText.find_first_not_of("0123456789") != std::string::npos)
+		return false;
+	if (firstText.empty())
+	{
+		if (lastText.empty())
+			return false;
+		size_t suffix = (size_t)strtoull(lastText.c_str(), nullptr, 10);
+		*isSatisfiable = suffix > 0 && size > 0;
+		*first = suffix >= size ? 0 : size - suffix;
+		*last = size - 1;
+		return true;
+	}
+
+	*first = (size_t)strtoull(firstText.c_str(), nullptr, 10);
+	*last = lastText.empty() ? size - 1 : std::min((size_t)strtoull(lastText.c_str(), nullptr, 10), size - 1);
+	*isSatisfiable = *first < size && *first <= *last;
+	return true;
+}
+
+static void handle_blob(CONNECTION *connection, const REQUEST &request, const std::string &name)
+{
+	g_stats.blobs++;
+	FILE_PTR file = open_file(name);
+	if (file == nullptr)
+	{
+		send_text(connection, request, 404, "Not Found", "text/plain", "The blob does not exist");
+		return;
+	}
+
+	std::string headers = "Content-Type: application/octet-stream\r\nAccept-Ranges: bytes\r\nETag: " + file->etag + "\r\nLast-Modified: " + http_date(file->modified) + "\r\n";
+	if (is_not_modified(request, file->etag, file->modified))
+	{
+		g_stats.notModified++;
+		start_response(connection, request, 304, "Not Modified", "ETag: " + file->etag + "\r\n", 0);
+		return;
+	}
+
+	size_t first = 0, last = file->size - 1;
+	bool isSatisfiable = true;
+	auto range = request.headers.find("range");
+	auto ifRange = request.headers.find("if-range");
+	bool isRange = range != request.headers.end() && (ifRange == request.headers.end() || ifRange->second == file->etag)
+		&& parse_range(range->second, file->size, &first, &last, &isSatisfiable);
+	if (isRange && !isSatisfiable)
+	{
+		char contentRange[64];
+		snprintf(contentRange, sizeof(contentRange), "Content-Range: bytes */%zu\r\n", file->size);
+		g_stats.errors++;
+		start_response(connection, request, 416, "Range Not Satisfiable", contentRange, 0);
+		return;
+	}
+
+	size_t length = file->size == 0 ? 0 : last - first + 1;
+	if (isRange)
+	{
+		char contentRange[96];
+		snprintf(contentRange, sizeof(contentRange), "Content-Range: bytes %zu-%zu/%zu\r\n", first, last, file->size);
+		start_response(connection, request, 206, "Partial Content", headers + contentRange, length);
+	}
+	else
+	{
+		//the digest of the whole blob, a range has none like Azure blob storage without x-ms-range-get-content-md5
+		start_response(connection, request, 200, "OK", headers + "Content-MD5: " + file_md5(file) + "\r\n", length);
+	}
+
+	if (request.method != "HEAD" && length > 0)
+	{
+		connection->file = file;
+		connection->fileOffset = (off_t)first;
+		connection->fileRemaining = length;
+	}
+}
+
+static void handle_stats(CONNECTION *connection, const REQUEST &request)
+{
+	char json[1024];
+	snprintf(json, sizeof(json),
+		"{\"connections\":%llu,\"openConnections\":%llu,\"requests\":%llu,\"manifests\":%llu,\"notModified\":%llu,\"chunks\":%llu,\"blobs\":%llu,\"errors\":%llu,"
+		"\"bytesSent\":%llu,\"sendfileBytes\":%llu,\"cacheHits\":%llu,\"cacheMisses\":%llu,\"cacheEvictions\":%llu,\"cacheBytes\":%llu}",
+		(unsigned long long)g_stats.connections, (unsigned long long)g_stats.openConnections, (unsigned long long)g_stats.requests,
+		(unsigned long long)g_stats.manifests, (unsigned long long)g_stats.notModified, (unsigned long long)g_stats.chunks,
+		(unsigned long long)g_stats.blobs, (unsigned long long)g_stats.errors, (unsigned long long)g_stats.bytesSent,
+		(unsigned long long)g_stats.sendfileBytes, (unsigned long long)g_stats.cacheHits, (unsigned long long)g_stats.cacheMisses,
+		(unsigned long long)g_stats.cacheEvictions, (unsigned long long)g_stats.cacheBytes);
+	send_text(connection, request, 200, "OK", "application/json", json);
+}
+
+static bool parse_request(const std::string &head, REQUEST *request)
+{
+	size_t lineEnd = head.find("\r\n");
+	std::string line = head.substr(0, lineEnd);
+	size_t space1 = line.find(' '), space2 = line.rfind(' ');
+	if (space1 == std::string::npos || space2 == space1)
+		return false;
+	request->method = line.substr(0, space1);
+	std::string target = line.substr(space1 + 1, space2 - space1 - 1);
+	std::string version = line.substr(space2 + 1);
+	request->keepAlive = version == "HTTP/1.1";
+
+	size_t question = target.find('?');
+	request->path = url_decode(target.substr(0, question));
+	if (question != std::string::npos)
+	{
+		std::string query = target.substr(question + 1);
+		size_t start = 0;
+		while (start <= query.size())
+		{
+			size_t end = query.find('&', start);
+			if (end == std::string::npos)
+				end = query.size();
+			std::string pair = query.substr(start, end - start);
+			size_t equals = pair.find('=');
+			if (!pair.empty())
+				request->query[url_decode(pair.substr(0, equals))] = equals == std::string::npos ? "" : url_decode(pair.substr(equals + 1));
+			start = end + 1;
+		}
+	}
+
+	size_t start = lineEnd + 2;
+	while (start < head.size())
+	{
+		size_t end = head.find("\r\n", start);
+		if (end == std::string::npos)
+			end = head.size();
+		std::string header = head.substr(start, end - start);
+		size_t colon = header.find(':');
+		if (colon != std::string::npos)
+		{
+			std::string name = header.substr(0, colon);
+			for (char &c : name)
+				c = (char)tolower((unsigned char)c);
+			size_t valueStart = header.find_first_not_of(" \t", colon + 1);
+			request->headers[name] = valueStart == std::string::npos ? "" : header.substr(valueStart);
+		}
+		start = end + 2;
+	}
+
+	auto connection = request->headers.find("connection");
+	if (connection != request->headers.end())
+	{
+		if (strcasecmp(connection->second.c_str(), "close") == 0)
+			request->keepAlive = false;
+		else if (strcasecmp(connection->second.c_str(), "keep-alive") == 0)
+			request->keepAlive = true;
+	}
+	return true;
+}
+
+static void handle_request(CONNECTION *connection, const REQUEST &request)
+{
+	g_stats.requests++;
+	if (request.method != "GET" && request.method != "HEAD")
+	{
+		REQUEST closing = request;
+		closing.keepAlive = false; //a request body would be read as the next request
+		send_text(connection, closing, 405, "Method Not Allowed", "text/plain", "Only GET and HEAD are supported");
+	}
+	else if (request.path == "/api/CheckForNewFirmware")
+		handle_manifest(connection, request);
+	else if (request.path == "/api/DownloadFirmware")
+		handle_chunk(connection, request);
+	else if (request.path.compare(0, 7, "/blobs/") == 0)
+		handle_blob(connection, request, request.path.substr(7));
+	else if (request.path == "/stats")
+		handle_stats(connection, request);
+	else
+		send_text(connection, request, 404, "Not Found", "text/plain", "Not found");
+}
+
+static bool has_pending_output(const CONNECTION *connection)
+{
+	return connection->outputSent < connection->output.size() || connection->chunk != nullptr || connection->fileRemaining > 0;
+}
+
+static void close_connection(CONNECTION *connection)
+{
+	epoll_ctl(g_epoll, EPOLL_CTL_DEL, connection->fd, nullptr);
+	close(connection->fd);
+	g_stats.openConnections--;
+	g_connections.erase(connection->fd);
+}
+
+//sends what the socket takes, false when the connection failed
+static bool flush_output(CONNECTION *connection)
+{
+	while (connection->outputSent < connection->output.size())
+	{
+		ssize_t sent = send(connection->fd, connection->output.data() + connection->outputSent, connection->output.size() - connection->outputSent, MSG_NOSIGNAL);
+		if (sent < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		connection->outputSent += (size_t)sent;
+		g_stats.bytesSent += (uint64_t)sent;
+	}
+	connection->output.clear();
+	connection->outputSent = 0;
+
+	while (connection->chunk != nullptr)
+	{
+		const std::string &body = connection->chunk->body;
+		ssize_t sent = send(connection->fd, body.data() + connection->chunkSent, body.size() - connection->chunkSent, MSG_NOSIGNAL);
+		if (sent < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		connection->chunkSent += (size_t)sent;
+		g_stats.bytesSent += (uint64_t)sent;
+		if (connection->chunkSent == body.size())
+			connection->chunk = nullptr;
+	}
+
+	//straight from the page cache, the blob never passes through user space
+	while (connection->fileRemaining > 0)
+	{
+		ssize_t sent = sendfile(connection->fd, connection->file->fd, &connection->fileOffset, connection->fileRemaining);
+		if (sent < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		if (sent == 0)
+			return false; //the file was truncated under the response
+		connection->fileRemaining -= (size_t)sent;
+		g_stats.bytesSent += (uint64_t)sent;
+		g_stats.sendfileBytes += (uint64_t)sent;
+	}
+	connection->file = nullptr;
+	return true;
+}
+
+//answers the complete requests of the input, one at a time so pipelined responses stay in order.
+//false when the connection has to be closed
+static bool process_input(CONNECTION *connection)
+{
+	while (!has_pending_output(connection))
+	{
+		size_t headEnd = connection->input.find("\r\n\r\n");
+		if (headEnd == std::string::npos)
+			return connection->input.size() <= MAX_HEADER_LENGTH;
+
+		REQUEST request;
+		bool isValid = parse_request(connection->input.substr(0, headEnd), &request);
+		connection->input.erase(0, headEnd + 4);
+		if (!isValid)
+			return false;
+		handle_request(connection, request);
+		if (!flush_output(connection))
+			return false;
+		if (!has_pending_output(connection) && connection->closeAfterResponse)
+			return false;
+	}
+	return true;
+}
+
+static void update_interest(CONNECTION *connection)
+{
+	bool isWaiting = has_pending_output(connection);
+	if (isWaiting == connection->isWaitingForOutput)
+		return;
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = isWaiting ? EPOLLOUT : EPOLLIN;
+	event.data.fd = connection->fd;
+	epoll_ctl(g_epoll, EPOLL_CTL_MOD, connection->fd, &event);
+	connection->isWaitingForOutput = isWaiting;
+}
+
+static void on_readable(CONNECTION *connection)
+{
+	char buffer[READ_BUFFER_SIZE];
+	while (true)
+	{
+		ssize_t length = recv(connection->fd, buffer, sizeof(buffer), 0);
+		if (length > 0)
+		{
+			connection->input.append(buffer, (size_t)length);
+			continue;
+		}
+		if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		close_connection(connection); //closed by the client or failed
+		return;
+	}
+
+	connection->lastActivity = time(nullptr);
+	if (!process_input(connection))
+	{
+		close_connection(connection);
+		return;
+	}
+	update_interest(connection);
+}
+
+static void on_writable(CONNECTION *connection)
+{
+	connection->lastActivity = time(nullptr);
+	if (!flush_output(connection))
+	{
+		close_connection(connection);
+		return;
+	}
+	if (has_pending_output(connection))
+		return;
+	if (connection->closeAfterResponse || !process_input(connection))
+	{
+		close_connection(connection);
+		return;
+	}
+	update_interest(connection);
+}
+
+static void accept_connections(int listener)
+{
+	while (true)
+	{
+		int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			return;
+
+		int noDelay = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+		std::unique_ptr<CONNECTION> connection(new CONNECTION());
+		connection->fd = fd;
+		connection->lastActivity = time(nullptr);
+
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.fd = fd;
+		if (epoll_ctl(g_epoll, EPOLL_CTL_ADD, fd, &event) != 0)
+		{
+			close(fd);
+			continue;
+		}
+		g_connections[fd] = std::move(connection);
+		g_stats.connections++;
+		g_stats.openConnections++;
+	}
+}
+
+static void close_idle_connections()
+{
+	time_t now = time(nullptr);
+	std::vector<CONNECTION *> idle;
+	for (auto &entry : g_connections)
+	{
+		if (now - entry.second->lastActivity > IDLE_TIMEOUT_S)
+			idle.push_back(entry.second.get());
+	}
+	for (CONNECTION *connection : idle)
+		close_connection(connection);
+}
+
+static int create_listener(int port)
+{
+	int listener = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listener < 0)
+		return -1;
+
+	int option = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
+	option = 0;
+	setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &option, sizeof(option));
+
+	struct sockaddr_in6 address;
+	memset(&address, 0, sizeof(address));
+	address.sin6_family = AF_INET6;
+	address.sin6_addr = in6addr_any;
+	address.sin6_port = htons((uint16_t)port);
+	if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 1024) != 0)
+	{
+		close(listener);
+		return -1;
+	}
+	return listener;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: ota_server <directory> <latest version> [-p port] [-c chunk cache MB] [-v]\n");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		usage();
+		return 1;
+	}
+	g_directory = argv[1];
+	g_latestVersion = argv[2];
+	int port = DEFAULT_PORT;
+	for (int i = 3; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+			port = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			g_cacheBudget = (size_t)atoi(argv[++i]) * 1024 * 1024;
+		else if (strcmp(argv[i], "-v") == 0)
+			g_isVerbose = true;
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	if (open_file("esp32_" + g_latestVersion + ".bin") == nullptr)
+		fprintf(stderr, "Warning: %s/esp32_%s.bin does not exist yet\n", g_directory.c_str(), g_latestVersion.c_str());
+
+	int listener = create_listener(port);
+	g_epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (listener < 0 || g_epoll < 0)
+	{
+		fprintf(stderr, "Listening on port %d failed: %s\n", port, strerror(errno));
+		return 1;
+	}
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = listener;
+	epoll_ctl(g_epoll, EPOLL_CTL_ADD, listener, &event);
+	printf("Serving %s, latest version %s, on port %d\n", g_directory.c_str(), g_latestVersion.c_str(), port);
+	fflush(stdout);
+
+	struct epoll_event events[MAX_EVENTS];
+	time_t lastSweep = time(nullptr);
+	while (true)
+	{
+		int count = epoll_wait(g_epoll, events, MAX_EVENTS, 1000);
+		for (int i = 0; i < count; i++)
+		{
+			int fd = events[i].data.fd;
+			if (fd == listener)
+			{
+				accept_connections(listener);
+				continue;
+			}
+			auto found = g_connections.find(fd);
+			if (found == g_connections.end())
+				continue;
+			CONNECTION *connection = found->second.get();
+			if (events[i].events & (EPOLLERR | EPOLLHUP))
+				close_connection(connection);
+			else if (events[i].events & EPOLLOUT)
+				on_writable(connection);
+			else
+				on_readable(connection);
+		}
+
+		if (time(nullptr) - lastSweep >= 5)
+		{
+			close_idle_connections();
+			lastSweep = time(nullptr);
+		}
+	}
+}
@@ -0,0 +1,670 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/*
+ * Telemetry load generator for tools/iothub_broker, or any MQTT endpoint with the IoT Hub topics: thousands of
+ * virtual water tank devices on one epoll thread. Every device runs the main loop cycle of iothub_client_run with
+ * the code of the firmware, telemetry.c formats the messages and the reported state and send_rate.c batches the
+ * readings while the in-flight window fills, so the fleet backs off like the devices do.
+ *   telemetry_load <host> <port> [-n devices] [-t seconds] [-c cycle ms] [-r ramp up s] [-s sensor trace] [-p device id prefix]
+ * The readings come from a sensor trace, every device starts at its own offset and loops it:
+ *   a DumpTrace dump (tools/watertank_host -d, or the method on a device), its TRACE_ADC_READING records
+ *   a .csv with watertemperature1,watertemperature2,current ADC values per line
+ * Without -s they are synthetic: two water temperatures that drift over an hour and a heater current that is on
+ * for two thirds of it, each device with its own phase.
+ * The report has the message and ack rates and the ack latency percentiles, the time from the PUBLISH to its PUBACK.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "mqtt_packet.h"
+#include "../telemetry.h"
+#include "../trace_events.h"
+
+#define DEFAULT_DEVICES 1000
+#define DEFAULT_DURATION_S 60
+//the period of the device loop: 10 readings 10 ms apart, a second of current samples and 5000 do_work cycles of 1 ms
+#define DEFAULT_CYCLE_MS 6100
+#define DEFAULT_RAMP_S 10
+#define MAX_EVENTS 512
+#define READ_BUFFER_SIZE 16384
+#define REPORT_PERIOD_S 10
+//the same as hal_iothub_posix.c, the keep alive of the SDK and its backoff
+#define MQTT_KEEP_ALIVE_S 240
+#define RECONNECT_MIN_MS 1000
+#define RECONNECT_MAX_MS 60000
+#define TEMPERATURE_PERIOD_S 3600
+//the root mean square of the heater current, like read_ac of the default hal_posix.c sensors
+#define HEATER_CURRENT 424
+
+struct READING
+{
+	uint32_t values[SEND_RATE_CHANNELS];
+};
+
+//a telemetry message waiting for its PUBACK, sent again after a reconnect
+struct IN_FLIGHT
+{
+	int64_t sendTime;
+	bool isSent;
+	std::string packet;
+};
+
+struct DEVICE
+{
+	int index = 0;
+	int fd = -1;
+	std::string id;
+	bool isConnecting = false;
+	bool isConnected = false;
+	std::string input;
+	std::string output;
+	size_t outputSent = 0;
+	bool isWaitingForOutput = false;
+	int64_t lastSendTime = 0;
+	int64_t pingTime = 0;
+	uint32_t backoffMs = RECONNECT_MIN_MS;
+	int64_t nextConnectTime = 0;
+	//the loop state of iothub_client_run
+	SEND_RATE_CONTROLLER sendRate;
+	size_t tracePosition = 0;
+	uint16_t nextPacketId = 1;
+	uint32_t nextRequestId = 1;
+	std::unordered_map<uint16_t, IN_FLIGHT> inFlight;
+	std::unordered_map<uint32_t, int64_t> reports;
+};
+
+struct TOTALS
+{
+	uint64_t cycles = 0;
+	uint64_t sent = 0;
+	uint64_t acked = 0;
+	uint64_t samples = 0;
+	uint64_t reports = 0;
+	uint64_t reportAcks = 0;
+	uint64_t skippedReports = 0;
+	uint64_t bytes = 0;
+	uint64_t connects = 0;
+	uint64_t disconnects = 0;
+	uint64_t failedConnects = 0;
+	uint64_t resent = 0;
+	uint64_t c2d = 0;
+	uint64_t methods = 0;
+};
+
+static std::string g_host;
+static int g_port = 0;
+static int64_t g_cycleUs = (int64_t)DEFAULT_CYCLE_MS * 1000;
+static std::vector<READING> g_trace;
+static std::vector<DEVICE> g_devices;
+static int g_epoll = -1;
+static struct sockaddr_storage g_address;
+static socklen_t g_addressLength = 0;
+static int64_t g_startTime = 0;
+static uint32_t g_randomState = 0x9E3779B9u;
+static TOTALS g_totals;
+static std::vector<float> g_ackLatencies; //ms
+static std::vector<float> g_reportLatencies;
+//the cycle timers of all the devices, the earliest first
+static std::priority_queue<std::pair<int64_t, int>, std::vector<std::pair<int64_t, int>>, std::greater<std::pair<int64_t, int>>> g_timers;
+
+static int64_t now_us()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static uint32_t next_random()
+{
+	uint32_t x = g_randomState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	g_randomState = x;
+	return x;
+}
+
+static bool load_trace(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (file == nullptr)
+		return false;
+	size_t length = strlen(path);
+	if (length > 4 && strcmp(path + length - 4, ".csv") == 0)
+	{
+		char line[256];
+		while (fgets(line, sizeof(line), file) != nullptr)
+		{
+			READING reading;
+			if (sscanf(line, "%u,%u,%u", &reading.values[0], &reading.values[1], &reading.values[2]) == 3)
+				g_trace.push_back(reading);
+		}
+	}
+	else
+	{
+		TRACE_RECORD record;
+		while (fread(&record, sizeof(record), 1, file) == 1)
+		{
+			if (record.id == TRACE_ADC_READING)
+				g_trace.push_back(READING{ { (uint32_t)record.args[0], (uint32_t)record.args[1], (uint32_t)record.args[2] } });
+		}
+	}
+	fclose(file);
+	return !g_trace.empty();
+}
+
+static READING next_reading(DEVICE *device, int64_t now)
+{
+	if (!g_trace.empty())
+		return g_trace[device->tracePosition++ % g_trace.size()];
+
+	double seconds = (now - g_startTime) / 1e6 + device->index * 7919 % TEMPERATURE_PERIOD_S;
+	double phase = 2 * M_PI * seconds / TEMPERATURE_PERIOD_S;
+	READING reading;
+	reading.values[0] = (uint32_t)(1500 + 300 * sin(phase) + (int)(next_random() % 21) - 10);
+	reading.values[1] = (uint32_t)(1700 + 200 * sin(phase + 1) + (int)(next_random() % 21) - 10);
+	reading.values[2] = (fmod(seconds, TEMPERATURE_PERIOD_S) < TEMPERATURE_PERIOD_S * 2 / 3 ? HEATER_CURRENT : 0) + next_random() % 6;
+	return reading;
+}
+
+static void update_interest(DEVICE *device)
+{
+	bool isWaiting = device->isConnecting || device->outputSent < device->output.size();
+	if (isWaiting == device->isWaitingForOutput)
+		return;
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN | (isWaiting ? EPOLLOUT : 0);
+	event.data.u32 = (uint32_t)device->index;
+	epoll_ctl(g_epoll, EPOLL_CTL_MOD, device->fd, &event);
+	device->isWaitingForOutput = isWaiting;
+}
+
+static void disconnect(DEVICE *device)
+{
+	if (device->fd >= 0)
+	{
+		epoll_ctl(g_epoll, EPOLL_CTL_DEL, device->fd, nullptr);
+		close(device->fd);
+	}
+	if (device->isConnected)
+		g_totals.disconnects++;
+	else
+		g_totals.failedConnects++;
+	device->fd = -1;
+	device->isConnecting = device->isConnected = false;
+	device->input.clear();
+	device->output.clear();
+	device->outputSent = 0;
+	device->pingTime = 0;
+	//the twin requests are not repeated, the next cycle reports again
+	device->reports.clear();
+	device->nextConnectTime = now_us() + (int64_t)(device->backoffMs + next_random() % (device->backoffMs / 2 + 1)) * 1000;
+	device->backoffMs = std::min(device->backoffMs * 2, (uint32_t)RECONNECT_MAX_MS);
+}
+
+//sends what the socket takes, false when the connection failed
+static bool flush_output(DEVICE *device)
+{
+	while (device->outputSent < device->output.size())
+	{
+		ssize_t sent = send(device->fd, device->output.data() + device->outputSent, device->output.size() - device->outputSent, MSG_NOSIGNAL);
+		if (sent < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		device->outputSent += (size_t)sent;
+		device->lastSendTime = now_us();
+	}
+	device->output.clear();
+	device->outputSent = 0;
+	return true;
+}
+
+static void flush_or_disconnect(DEVICE *device)
+{
+	if (!flush_output(device))
+		disconnect(device);
+	else
+		update_interest(device);
+}
+
+static void queue_packet(DEVICE *device, const uint8_t *packet, size_t length)
+{
+	device->output.append((const char *)packet, length);
+}
+
+static std::string create_publish(const std::string &topic, uint16_t packetId, const char *payload, size_t size)
+{
+	std::string packet(MQTT_PUBLISH_SIZE(topic.size(), size), '\0');
+	packet.resize(mqtt_packet_publish((uint8_t *)&packet[0], packet.size(), topic.data(), topic.size(), packetId, false, payload, size));
+	return packet;
+}
+
+static void start_connect(DEVICE *device)
+{
+	device->fd = socket(g_address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (device->fd < 0)
+	{
+		disconnect(device);
+		return;
+	}
+	int noDelay = 1;
+	setsockopt(device->fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+	if (connect(device->fd, (struct sockaddr *)&g_address, g_addressLength) != 0 && errno != EINPROGRESS)
+	{
+		close(device->fd);
+		device->fd = -1;
+		disconnect(device);
+		return;
+	}
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN | EPOLLOUT;
+	event.data.u32 = (uint32_t)device->index;
+	epoll_ctl(g_epoll, EPOLL_CTL_ADD, device->fd, &event);
+	device->isConnecting = true;
+	device->isWaitingForOutput = true;
+
+	//the CONNECT waits in the output until the socket is connected
+	std::string userName = g_host + "/" + device->id + "/?api-version=2018-06-30";
+	std::vector<uint8_t> packet(MQTT_MAX_HEADER_SIZE + 16 + device->id.size() + userName.size());
+	queue_packet(device, packet.data(), mqtt_packet_connect(packet.data(), packet.size(), device->id.c_str(), userName.c_str(), MQTT_KEEP_ALIVE_S));
+}
+
+static void on_connack(DEVICE *device, const MQTT_PACKET &packet)
+{
+	if (packet.length < 2 || packet.body[1] != 0)
+	{
+		disconnect(device);
+		return;
+	}
+	device->isConnected = true;
+	device->backoffMs = RECONNECT_MIN_MS;
+	g_totals.connects++;
+
+	std::string c2d = "devices/" + device->id + "/messages/devicebound/#";
+	const char *topics[] = { c2d.c_str(), "$iothub/twin/res/#", "$iothub/methods/POST/#" };
+	uint8_t packetBuffer[MQTT_MAX_HEADER_SIZE + 2 + 3 * 3 + 512];
+	queue_packet(device, packetBuffer, mqtt_packet_subscribe(packetBuffer, sizeof(packetBuffer), device->nextPacketId++, topics, 3));
+	if (device->nextPacketId == 0)
+		device->nextPacketId = 1;
+
+	//the telemetry queued while disconnected, the unacknowledged messages again as duplicates
+	for (auto &entry : device->inFlight)
+	{
+		if (entry.second.isSent)
+		{
+			entry.second.packet[0] |= 0x08;
+			g_totals.resent++;
+		}
+		entry.second.isSent = true;
+		device->output += entry.second.packet;
+	}
+}
+
+static void on_publish(DEVICE *device, const MQTT_PUBLISH_PACKET &publish, int64_t now)
+{
+	std::string topic(publish.topic, publish.topicLength);
+	if (publish.qos == 1)
+	{
+		uint8_t ack[4];
+		queue_packet(device, ack, mqtt_packet_ack(ack, sizeof(ack), MQTT_PUBACK, publish.packetId));
+	}
+	size_t rid = topic.find("$rid=");
+	if (topic.compare(0, 17, "$iothub/twin/res/") == 0 && rid != std::string::npos)
+	{
+		auto report = device->reports.find((uint32_t)strtoul(topic.c_str() + rid + 5, nullptr, 10));
+		if (report != device->reports.end())
+		{
+			g_totals.reportAcks++;
+			g_reportLatencies.push_back((float)((now - report->second) / 1000.0));
+			device->reports.erase(report);
+		}
+	}
+	else if (topic.compare(0, 21, "$iothub/methods/POST/") == 0 && rid != std::string::npos)
+	{
+		//the virtual devices have no methods, the answer of the firmware to an unknown one
+		static const char notFound[] = "{\"error\":\"unknown method\"}";
+		g_totals.methods++;
+		std::string packet = create_publish("$iothub/methods/res/404/?" + topic.substr(rid), 0, notFound, sizeof(notFound) - 1);
+		device->output += packet;
+	}
+	else
+	{
+		g_totals.c2d++;
+	}
+}
+
+static void on_readable(DEVICE *device)
+{
+	char buffer[READ_BUFFER_SIZE];
+	while (true)
+	{
+		ssize_t length = recv(device->fd, buffer, sizeof(buffer), 0);
+		if (length > 0)
+		{
+			device->input.append(buffer, (size_t)length);
+			continue;
+		}
+		if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		disconnect(device);
+		return;
+	}
+
+	int64_t now = now_us();
+	size_t offset = 0;
+	while (device->fd >= 0)
+	{
+		MQTT_PACKET packet;
+		int length = mqtt_packet_parse((const uint8_t *)device->input.data() + offset, device->input.size() - offset, &packet);
+		if (length == 0)
+			break;
+		if (length < 0)
+		{
+			disconnect(device);
+			return;
+		}
+		offset += (size_t)length;
+
+		MQTT_PUBLISH_PACKET publish;
+		if (packet.type == MQTT_CONNACK)
+			on_connack(device, packet);
+		else if (packet.type == MQTT_PUBACK)
+		{
+			auto found = device->inFlight.find(mqtt_packet_read_id(&packet));
+			if (found != device->inFlight.end())
+			{
+				g_totals.acked++;
+				g_ackLatencies.push_back((float)((now - found->second.sendTime) / 1000.0));
+				device->inFlight.erase(found);
+			}
+		}
+		else if (packet.type == MQTT_PINGRESP)
+			device->pingTime = 0;
+		else if (packet.type == MQTT_PUBLISH && mqtt_packet_read_publish(&packet, &publish))
+			on_publish(device, publish, now);
+	}
+	if (device->fd < 0)
+		return;
+	device->input.erase(0, offset);
+	flush_or_disconnect(device);
+}
+
+static void on_writable(DEVICE *device)
+{
+	if (device->isConnecting)
+	{
+		int error = 0;
+		socklen_t length = sizeof(error);
+		if (getsockopt(device->fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0)
+		{
+			disconnect(device);
+			return;
+		}
+		device->isConnecting = false;
+	}
+	flush_or_disconnect(device);
+}
+
+//one pass of the main loop of iothub_client_run, the firmware's own formatting and batching
+static void run_cycle(DEVICE *device, int64_t now)
+{
+	g_totals.cycles++;
+	if (device->fd < 0 && now >= device->nextConnectTime)
+		start_connect(device);
+
+	READING reading = next_reading(device, now);
+	int activeMessages = (int)device->inFlight.size();
+	char text[512];
+	uint32_t averages[SEND_RATE_CHANNELS];
+	int length = telemetry_add_readings(&device->sendRate, reading.values, activeMessages, device->id.c_str(), text, sizeof(text), averages);
+	if (length > 0)
+	{
+		//like the SDK the message waits for the connection
+		uint16_t packetId = device->nextPacketId++;
+		if (device->nextPacketId == 0)
+			device->nextPacketId = 1;
+		IN_FLIGHT &message = device->inFlight[packetId];
+		message.sendTime = now;
+		message.isSent = device->isConnected;
+		message.packet = create_publish("devices/" + device->id + "/messages/events/", packetId, text, (size_t)length);
+		if (device->isConnected)
+			device->output += message.packet;
+		g_totals.sent++;
+		g_totals.bytes += (uint64_t)length;
+	}
+
+	if (telemetry_should_report((int)device->inFlight.size()))
+	{
+		if (device->isConnected)
+		{
+			TELEMETRY_REPORTED_STATE state = { "load", 0, 0, 0, false };
+			telemetry_format_reported_state(text, sizeof(text), &state);
+			uint32_t requestId = device->nextRequestId++;
+			device->output += create_publish("$iothub/twin/PATCH/properties/reported/?$rid=" + std::to_string(requestId), 0, text, strlen(text));
+			device->reports[requestId] = now;
+			g_totals.reports++;
+		}
+		else
+			g_totals.skippedReports++;
+	}
+
+	if (device->isConnected)
+	{
+		if (device->pingTime != 0 && now - device->pingTime > (int64_t)MQTT_KEEP_ALIVE_S * 1000000)
+		{
+			disconnect(device);
+			return;
+		}
+		if (device->pingTime == 0 && now - device->lastSendTime >= (int64_t)MQTT_KEEP_ALIVE_S * 1000000)
+		{
+			uint8_t ping[4];
+			queue_packet(device, ping, mqtt_packet_ack(ping, sizeof(ping), MQTT_PINGREQ, 0));
+			device->pingTime = now;
+		}
+		flush_or_disconnect(device);
+	}
+}
+
+static double percentile(std::vector<float> &values, double fraction)
+{
+	if (values.empty())
+		return 0;
+	size_t index = std::min(values.size() - 1, (size_t)(fraction * values.size()));
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+static void print_latencies(const char *name, std::vector<float> &values)
+{
+	printf("%s ms: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n", name, percentile(values, 0.5), percentile(values, 0.9),
+		percentile(values, 0.99), percentile(values, 0.999), percentile(values, 1));
+}
+
+static bool resolve_host()
+{
+	char port[16];
+	snprintf(port, sizeof(port), "%d", g_port);
+	struct addrinfo hints, *address = nullptr;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(g_host.c_str(), port, &hints, &address) != 0)
+		return false;
+	memcpy(&g_address, address->ai_addr, address->ai_addrlen);
+	g_addressLength = address->ai_addrlen;
+	freeaddrinfo(address);
+	return true;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: telemetry_load <host> <port> [-n devices] [-t seconds] [-c cycle ms] [-r ramp up s] [-s sensor trace] [-p device id prefix]\n");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		usage();
+		return 1;
+	}
+	g_host = argv[1];
+	g_port = atoi(argv[2]);
+	int devices = DEFAULT_DEVICES, durationSeconds = DEFAULT_DURATION_S, rampSeconds = DEFAULT_RAMP_S;
+	const char *tracePath = nullptr;
+	std::string prefix = "load-";
+	for (int i = 3; i < argc; i++)
+	{
+		if (i + 1 == argc)
+		{
+			usage();
+			return 1;
+		}
+		const char *value = argv[++i];
+		if (strcmp(argv[i - 1], "-n") == 0)
+			devices = atoi(value);
+		else if (strcmp(argv[i - 1], "-t") == 0)
+			durationSeconds = atoi(value);
+		else if (strcmp(argv[i - 1], "-c") == 0)
+			g_cycleUs = (int64_t)atoi(value) * 1000;
+		else if (strcmp(argv[i - 1], "-r") == 0)
+			rampSeconds = atoi(value);
+		else if (strcmp(argv[i - 1], "-s") == 0)
+			tracePath = value;
+		else if (strcmp(argv[i - 1], "-p") == 0)
+			prefix = value;
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+	if (devices <= 0 || g_port <= 0 || durationSeconds <= 0 || g_cycleUs <= 0 || rampSeconds < 0)
+	{
+		usage();
+		return 1;
+	}
+	if (tracePath != nullptr && !load_trace(tracePath))
+	{
+		fprintf(stderr, "No readings in %s\n", tracePath);
+		return 1;
+	}
+	if (!resolve_host())
+	{
+		fprintf(stderr, "Unable to resolve %s\n", g_host.c_str());
+		return 1;
+	}
+
+	//a socket per device
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	signal(SIGPIPE, SIG_IGN);
+	g_epoll = epoll_create1(EPOLL_CLOEXEC);
+
+	//the devices start spread over the ramp up, each at its own point of the trace
+	g_startTime = now_us();
+	g_devices.resize((size_t)devices);
+	for (int i = 0; i < devices; i++)
+	{
+		DEVICE &device = g_devices[(size_t)i];
+		device.index = i;
+		device.id = prefix + std::to_string(i);
+		send_rate_init(&device.sendRate);
+		device.tracePosition = g_trace.empty() ? 0 : (size_t)next_random() % g_trace.size();
+		g_timers.emplace(g_startTime + (int64_t)rampSeconds * 1000000 * i / devices, i);
+	}
+	printf("%d devices to %s:%d, a cycle every %.1f s, ramp up %d s, %s readings\n", devices, g_host.c_str(), g_port, g_cycleUs / 1e6,
+		rampSeconds, tracePath != nullptr ? tracePath : "synthetic");
+	fflush(stdout);
+
+	struct epoll_event events[MAX_EVENTS];
+	int64_t endTime = g_startTime + (int64_t)durationSeconds * 1000000;
+	int64_t nextReport = g_startTime + (int64_t)REPORT_PERIOD_S * 1000000;
+	TOTALS previous;
+	for (int64_t now = g_startTime; now < endTime; now = now_us())
+	{
+		int timeoutMs = (int)std::min<int64_t>(1000, std::max<int64_t>(0, (g_timers.top().first - now + 999) / 1000));
+		int count = epoll_wait(g_epoll, events, MAX_EVENTS, timeoutMs);
+		for (int i = 0; i < count; i++)
+		{
+			DEVICE *device = &g_devices[events[i].data.u32];
+			if (device->fd < 0)
+				continue;
+			if (events[i].events & (EPOLLERR | EPOLLHUP))
+				disconnect(device);
+			else if (events[i].events & EPOLLIN)
+				on_readable(device);
+			else if (events[i].events & EPOLLOUT)
+				on_writable(device);
+		}
+
+		now = now_us();
+		while (g_timers.top().first <= now)
+		{
+			std::pair<int64_t, int> timer = g_timers.top();
+			g_timers.pop();
+			run_cycle(&g_devices[(size_t)timer.second], now);
+			g_timers.emplace(timer.first + g_cycleUs, timer.second);
+		}
+
+		if (now >= nextReport)
+		{
+			int connected = 0;
+			size_t inFlight = 0;
+			for (const DEVICE &device : g_devices)
+			{
+				connected += device.isConnected;
+				inFlight += device.inFlight.size();
+			}
+			printf("%4.0f s: %d connected, %.0f msgs/s, %.0f acks/s, %zu in flight, %llu disconnects\n", (now - g_startTime) / 1e6, connected,
+				(g_totals.sent - previous.sent) / (double)REPORT_PERIOD_S, (g_totals.acked - previous.acked) / (double)REPORT_PERIOD_S, inFlight,
+				(unsigned long long)g_totals.disconnects);
+			fflush(stdout);
+			previous = g_totals;
+			nextReport += (int64_t)REPORT_PERIOD_S * 1000000;
+		}
+	}
+
+	double seconds = (now_us() - g_startTime) / 1e6;
+	size_t inFlight = 0;
+	for (const DEVICE &device : g_devices)
+		inFlight += device.inFlight.size();
+	printf("%llu cycles in %.1f s, %llu messages (%.1f KB) sent, %llu acked, %zu in flight at the end\n", (unsigned long long)g_totals.cycles, seconds,
+		(unsigned long long)g_totals.sent, g_totals.bytes / 1024.0, (unsigned long long)g_totals.acked, inFlight);
+	printf("throughput: %.1f msgs/s, %.1f acks/s, %.2f readings per message\n", g_totals.sent / seconds, g_totals.acked / seconds,
+		g_totals.sent > 0 ? (double)g_totals.cycles / g_totals.sent : 0);
+	printf("reported states: %llu sent, %llu acked, %llu skipped while disconnected\n", (unsigned long long)g_totals.reports,
+		(unsigned long long)g_totals.reportAcks, (unsigned long long)g_totals.skippedReports);
+	printf("connections: %llu connects, %llu failed, %llu disconnects, %llu messages sent again, %llu c2d, %llu methods\n",
+		(unsigned long long)g_totals.connects, (unsigned long long)g_totals.failedConnects, (unsigned long long)g_totals.disconnects,
+		(unsigned long long)g_totals.resent, (unsigned long long)g_totals.c2d, (unsigned long long)g_totals.methods);
+	print_latencies("ack latency", g_ackLatencies);
+	print_latencies("twin latency", g_reportLatencies);
+	return 0;
+}
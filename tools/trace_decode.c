@@ -0,0 +1,69 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/*
+ * Host side decoder of the device trace ring buffer (see trace_log.h).
+ * Get the dump with the "DumpTrace" direct method, base64 decode the "records" field and pass the binary file:
+ *   az iot hub invoke-device-method -n <hub> -d <device> --method-name DumpTrace --query payload.records -o tsv | base64 -d > trace.bin
+ *   trace_decode trace.bin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../trace_events.h"
+
+#define TRACE_EVENT_FORMAT(id, format) format,
+static const char *g_formats[TRACE_EVENT_COUNT] = { TRACE_EVENTS(TRACE_EVENT_FORMAT) };
+#undef TRACE_EVENT_FORMAT
+
+#define TRACE_EVENT_NAME(id, format) #id,
+static const char *g_names[TRACE_EVENT_COUNT] = { TRACE_EVENTS(TRACE_EVENT_NAME) };
+#undef TRACE_EVENT_NAME
+
+int main(int argc, char *argv[])
+{
+	if (argc != 2)
+	{
+		fprintf(stderr, "usage: %s <trace.bin>\n", argv[0]);
+		return 1;
+	}
+
+	FILE *file = fopen(argv[1], "rb");
+	if (file == NULL)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+
+	TRACE_RECORD record;
+	int haveLast = 0;
+	uint16_t lastSequence = 0;
+	uint32_t lastTimestamp = 0;
+	uint64_t time = 0; //unwrapped microseconds since the first record
+
+	while (fread(&record, sizeof(record), 1, file) == 1)
+	{
+		if (haveLast)
+		{
+			if ((uint16_t)(lastSequence + 1) != record.sequence)
+				printf("--- %u records lost ---\n", (unsigned)(uint16_t)(record.sequence - lastSequence - 1));
+			time += (uint32_t)(record.timestamp - lastTimestamp);
+		}
+		haveLast = 1;
+		lastSequence = record.sequence;
+		lastTimestamp = record.timestamp;
+
+		printf("[%10.6f] ", time / 1e6);
+		if (record.id >= TRACE_EVENT_COUNT)
+		{
+			printf("unknown event %u: %d %d %d\n", record.id, record.args[0], record.args[1], record.args[2]);
+			continue;
+		}
+		printf("%s: ", g_names[record.id]);
+		printf(g_formats[record.id], record.args[0], record.args[1], record.args[2]);
+		printf("\n");
+	}
+
+	fclose(file);
+	return 0;
+}
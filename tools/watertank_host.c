@@ -0,0 +1,302 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/*
+ * The water tank firmware as a Linux process: iothub_client_run and the OTA task, on hal_posix.c with simulated sensors,
+ * the local hub of hal_iothub_posix.c and the ESP-IDF stand ins of tools/host.
+ *   watertank_host [-t seconds] [-x time scale] [-l ack latency ms] [-j ack jitter ms] [-L loss probability]
+ *     [-m cloud to device message] [-d trace.bin] [-o ota server host] [-p ota server port] [-v firmware version]
+ *     [-T timeline.csv] [-i timeline period s] [-B broker host:port] [-D device id] [-S soak warm up s]
+ * After -t seconds of simulated time the hub sends "Quit" and the device loop ends. -d dumps the trace ring buffer with
+ * the DumpTrace direct method first, for tools/trace_decode. Without -o the update task does not run.
+ * -x 0 runs on the virtual clock of host_clock.h, as fast as the host can: days of the device loop take minutes.
+ * -T writes the in-flight telemetry, the ack latency and the heap every -i seconds as CSV.
+ * -B connects to tools/iothub_broker instead of the local hub, its -a, -j and -d then decide the acks instead of -l, -j and -L.
+ * The broker runs in real time, so its latencies are only the device's at -x 1, and it can not be used with -x 0.
+ * -S is the soak test: the firmware sources must not allocate from -S seconds until the stop, the heap of host_heap.h
+ * counts them, and the exit code is 1 if they did.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_ota_ops.h"
+#include "nvs_flash.h"
+#include "host_clock.h"
+#include "host_heap.h"
+#include "host_network.h"
+#include "host_system.h"
+#include "fake_flash.h"
+#include "hal_posix.h"
+#include "Common.h"
+#include "iothub_watertank_client.h"
+#include "ota_scheduler.h"
+#include "ota_probation.h"
+#include "base64_stream.h"
+#include "cJSON.h"
+
+#define DEFAULT_DURATION_S 600
+#define DEFAULT_TIME_SCALE 20
+#define DEFAULT_ACK_LATENCY_MS 150
+#define DEFAULT_ACK_JITTER_MS 100
+#define PARTITION_SIZE (1536 * 1024)
+#define DEVICE_FREE_HEAP 120000
+#define OTA_RTT_MS 100
+#define OTA_BYTES_PER_SECOND 50000
+#define DEFAULT_TIMELINE_PERIOD_S 60
+#define DEFAULT_DEVICE_ID "watertank"
+
+//the firmware globals that azure_main.c defines
+int CONNECTED_BIT = 1; //BIT0, like azure_main.c
+EventGroupHandle_t wifi_event_group = NULL;
+extern const char *g_currentFirmwareVersion;
+
+static const char *g_traceFile = NULL;
+static FILE *g_timeline = NULL;
+static int g_timelinePeriodSeconds = DEFAULT_TIMELINE_PERIOD_S;
+//the firmware heap and the hub at the end of the soak warm up and at the stop
+static HOST_HEAP_STATS g_soakHeap[2];
+static HAL_POSIX_HUB_STATS g_soakHub[2];
+
+static void device_restart(const esp_partition_t *bootPartition)
+{
+	printf("restart at %.1f s, boot partition %s\n", esp_timer_get_time() / 1000000.0, bootPartition->label);
+	exit(0);
+}
+
+static void write_trace(int status, const unsigned char *response, size_t size, void *context)
+{
+	//the response is not zero terminated
+	char *text = (char *)malloc(size + 1);
+	cJSON *json = NULL;
+	if (text != NULL)
+	{
+		memcpy(text, response, size);
+		text[size] = '\0';
+		json = cJSON_Parse(text);
+		free(text);
+	}
+	cJSON *records = cJSON_GetObjectItem(json, "records");
+	if (status != 200 || !cJSON_IsString(records))
+	{
+		fprintf(stderr, "DumpTrace failed with %d\n", status);
+		cJSON_Delete(json);
+		return;
+	}
+
+	size_t length = strlen(records->valuestring);
+	unsigned char *binary = (unsigned char *)malloc(BASE64_STREAM_DECODED_SIZE(length));
+	BASE64_STREAM stream;
+	base64_stream_init(&stream);
+	int decoded = binary != NULL ? base64_stream_decode(&stream, records->valuestring, length, binary) : -1;
+	FILE *file = decoded >= 0 ? fopen(g_traceFile, "wb") : NULL;
+	if (file == NULL || fwrite(binary, 1, (size_t)decoded, file) != (size_t)decoded)
+		fprintf(stderr, "writing %s failed\n", g_traceFile);
+	if (file != NULL)
+		fclose(file);
+	free(binary);
+	cJSON_Delete(json);
+}
+
+//a task, so it runs on the virtual clock too
+static void timeline_task(void *parameters)
+{
+	HAL_POSIX_HUB_STATS previous;
+	memset(&previous, 0, sizeof(previous));
+	fprintf(g_timeline, "time_s,pending,oldest_pending_s,sent,confirmed,lost,timed_out,ack_ms,heap_in_use,free_heap\n");
+	for (;;)
+	{
+		HAL_POSIX_HUB_STATS stats;
+		hal_posix_hub_get_stats(&stats);
+		int64_t now = esp_timer_get_time();
+		uint32_t confirmed = stats.confirmed - previous.confirmed;
+		struct mallinfo2 heap = mallinfo2();
+		fprintf(g_timeline, "%.0f,%u,%.1f,%u,%u,%u,%u,%.1f,%zu,%u\n", now / 1000000.0, stats.pending,
+			stats.pending > 0 ? (now - stats.oldestPendingTime) / 1000000.0 : 0, stats.events - previous.events, confirmed,
+			stats.lost - previous.lost, stats.timedOut - previous.timedOut, confirmed > 0 ? (stats.confirmationTime - previous.confirmationTime) / 1000.0 / confirmed : 0,
+			heap.uordblks, esp_get_free_heap_size());
+		fflush(g_timeline);
+		previous = stats;
+		vTaskDelay((TickType_t)g_timelinePeriodSeconds * 1000 / portTICK_PERIOD_MS);
+	}
+}
+
+static void soak_snapshot(int index)
+{
+	host_heap_get_stats(&g_soakHeap[index]);
+	hal_posix_hub_get_stats(&g_soakHub[index]);
+}
+
+static void soak_begin(void *arg)
+{
+	soak_snapshot(0);
+}
+
+static void stop(void *arg)
+{
+	//before the DumpTrace response, which allocates
+	soak_snapshot(1);
+	if (g_traceFile != NULL)
+		hal_posix_hub_invoke_method("DumpTrace", write_trace, NULL);
+	hal_posix_hub_send_message("Quit");
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: watertank_host [-t seconds] [-x time scale] [-l ack latency ms] [-j ack jitter ms] [-L loss probability]\n"
+		"  [-m cloud to device message] [-d trace.bin] [-o ota server host] [-p ota server port] [-v firmware version]\n"
+		"  [-T timeline.csv] [-i timeline period s] [-B broker host:port] [-D device id] [-S soak warm up s]\n");
+}
+
+int main(int argc, char **argv)
+{
+	HAL_POSIX_HUB hub = { DEFAULT_ACK_LATENCY_MS, DEFAULT_ACK_JITTER_MS, 0, (uint32_t)time(NULL), NULL, 0, DEFAULT_DEVICE_ID };
+	HOST_NETWORK network;
+	memset(&network, 0, sizeof(network));
+	network.serverPort = 80;
+	network.rttMs = OTA_RTT_MS;
+	network.bytesPerSecond = OTA_BYTES_PER_SECOND;
+	int durationSeconds = DEFAULT_DURATION_S;
+	double timeScale = DEFAULT_TIME_SCALE;
+	const char *message = NULL;
+	const char *timelinePath = NULL;
+	int soakSeconds = -1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 == argc)
+		{
+			usage();
+			return 1;
+		}
+		const char *value = argv[++i];
+		if (strcmp(argv[i - 1], "-t") == 0)
+			durationSeconds = atoi(value);
+		else if (strcmp(argv[i - 1], "-x") == 0)
+			timeScale = atof(value);
+		else if (strcmp(argv[i - 1], "-l") == 0)
+			hub.ackLatencyMs = (uint32_t)atoi(value);
+		else if (strcmp(argv[i - 1], "-j") == 0)
+			hub.ackJitterMs = (uint32_t)atoi(value);
+		else if (strcmp(argv[i - 1], "-L") == 0)
+			hub.lossProbability = atof(value);
+		else if (strcmp(argv[i - 1], "-m") == 0)
+			message = value;
+		else if (strcmp(argv[i - 1], "-d") == 0)
+			g_traceFile = value;
+		else if (strcmp(argv[i - 1], "-o") == 0)
+			network.serverHost = value;
+		else if (strcmp(argv[i - 1], "-p") == 0)
+			network.serverPort = atoi(value);
+		else if (strcmp(argv[i - 1], "-v") == 0)
+			g_currentFirmwareVersion = value;
+		else if (strcmp(argv[i - 1], "-T") == 0)
+			timelinePath = value;
+		else if (strcmp(argv[i - 1], "-i") == 0)
+			g_timelinePeriodSeconds = atoi(value);
+		else if (strcmp(argv[i - 1], "-B") == 0 && strchr(value, ':') != NULL)
+		{
+			*strchr(argv[i], ':') = '\0';
+			hub.brokerHost = argv[i];
+			hub.brokerPort = atoi(argv[i] + strlen(argv[i]) + 1);
+		}
+		else if (strcmp(argv[i - 1], "-D") == 0)
+			hub.deviceId = value;
+		else if (strcmp(argv[i - 1], "-S") == 0)
+			soakSeconds = atoi(value);
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+	if (durationSeconds <= 0 || timeScale < 0 || soakSeconds >= durationSeconds || g_timelinePeriodSeconds <= 0 || (hub.brokerHost != NULL && (timeScale == 0 || hub.brokerPort <= 0)))
+	{
+		usage();
+		return 1;
+	}
+	if (timelinePath != NULL && (g_timeline = fopen(timelinePath, "w")) == NULL)
+	{
+		perror(timelinePath);
+		return 1;
+	}
+
+	if (timeScale == 0)
+		host_clock_set_virtual();
+	else
+		host_clock_set_realtime(timeScale);
+	host_system_init(hub.seed, DEVICE_FREE_HEAP);
+	host_system_set_restart_handler(device_restart);
+	network.seed = hub.seed;
+	host_network_init(&network);
+	hal_posix_hub_init(&hub);
+
+	const esp_partition_t *running = fake_flash_init(PARTITION_SIZE, 0);
+	if (running == NULL || fake_flash_add("ota_1", ESP_PARTITION_SUBTYPE_APP_OTA_1, PARTITION_SIZE, 0) == NULL)
+	{
+		fprintf(stderr, "creating the flash failed\n");
+		return 1;
+	}
+	host_system_set_running_partition(running);
+
+	//app_main of azure_main.c, the access point is there from the start
+	nvs_flash_init();
+	ota_probation_begin();
+	wifi_event_group = xEventGroupCreate();
+	xEventGroupSetBits(wifi_event_group, CONNECTED_BIT);
+	if (network.serverHost != NULL && xTaskCreate(&ota_task, "ota_task", 8192, NULL, OTA_TASK_PRIORITY, NULL) != pdPASS)
+	{
+		fprintf(stderr, "unable to create update task\n");
+		return 1;
+	}
+
+	if (g_timeline != NULL && xTaskCreate(&timeline_task, "timeline", 4096, NULL, 1, NULL) != pdPASS)
+		return 1;
+
+	esp_timer_handle_t stopTimer;
+	esp_timer_create_args_t stopArgs = { stop, NULL, "stop" };
+	if (esp_timer_create(&stopArgs, &stopTimer) != ESP_OK || esp_timer_start_once(stopTimer, (uint64_t)durationSeconds * 1000000) != ESP_OK)
+		return 1;
+	esp_timer_handle_t soakTimer;
+	esp_timer_create_args_t soakArgs = { soak_begin, NULL, "soak" };
+	if (soakSeconds >= 0 && (esp_timer_create(&soakArgs, &soakTimer) != ESP_OK || esp_timer_start_once(soakTimer, (uint64_t)soakSeconds * 1000000) != ESP_OK))
+		return 1;
+	if (message != NULL)
+		hal_posix_hub_send_message(message);
+
+	struct timespec begin, end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	iothub_client_run();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	HAL_POSIX_HUB_STATS stats;
+	hal_posix_hub_get_stats(&stats);
+	double realSeconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+	printf("firmware %s ran %.1f s in %.1f s, %.0fx real time\n", get_firmware_version(), esp_timer_get_time() / 1000000.0, realSeconds,
+		esp_timer_get_time() / 1000000.0 / realSeconds);
+	double seconds = esp_timer_get_time() / 1000000.0;
+	printf("telemetry: %u sent (%llu bytes), %u confirmed, %u lost, %u timed out, %.2f msgs/s, mean ack %.0f ms, max ack %.0f ms\n", stats.events,
+		(unsigned long long)stats.eventBytes, stats.confirmed, stats.lost, stats.timedOut, stats.events / seconds,
+		stats.confirmed > 0 ? stats.confirmationTime / 1000.0 / stats.confirmed : 0, stats.maxConfirmationTime / 1000.0);
+	if (hub.brokerHost != NULL)
+		printf("broker %s:%d as %s: %u connects, %u disconnects, %u messages sent again\n", hub.brokerHost, hub.brokerPort, hub.deviceId, stats.connects, stats.disconnects, stats.resent);
+	printf("reported states: %u, cloud to device messages: %u, direct methods: %u, clients: %u\n", stats.reportedStates, stats.messages, stats.methods, stats.clients);
+	uint32_t leds[] = { OK_STATUS_LED, ERROR_STATUS_LED };
+	for (size_t i = 0; i < sizeof(leds) / sizeof(leds[0]); i++)
+		printf("gpio %u: %u changes\n", leds[i], hal_posix_gpio_changes(leds[i]));
+	if (soakSeconds < 0)
+		return 0;
+
+	uint32_t allocations = g_soakHeap[1].allocations - g_soakHeap[0].allocations;
+	printf("soak: %u firmware allocations, %u frees in %d s after the warm up, %u telemetry messages, %u timed out\n", allocations,
+		g_soakHeap[1].frees - g_soakHeap[0].frees, durationSeconds - soakSeconds, g_soakHub[1].events - g_soakHub[0].events,
+		g_soakHub[1].timedOut - g_soakHub[0].timedOut);
+	return allocations == 0 && g_soakHub[1].events > g_soakHub[0].events ? 0 : 1;
+}
@@ -0,0 +1,42 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef TRACE_EVENTS_H
+#define TRACE_EVENTS_H
+
+#include <stdint.h>
+
+/*
+ * Trace format table, shared by the device (trace_log.c) and the host decoder (tools/trace_decode.c).
+ * The device stores only the event id and the raw arguments, the host expands the format string.
+ * Append new events at the end, the id of an existing event must never change.
+ */
+#define TRACE_EVENTS(X) \
+	X(TRACE_READ_AC,             "read_ac: Result %d,  time:%d us") \
+	X(TRACE_ADC_READING,         "5) %d mV\t6) %d mV\t7) %d mV") \
+	X(TRACE_READY_TO_SEND,       "Ready to Send: watertemperature1=%d watertemperature2=%d current=%d") \
+	X(TRACE_SEND_ACCEPTED,       "IoTHubClient_LL_SendEventAsync accepted message [%d] for transmission to IoT Hub.") \
+	X(TRACE_SEND_CONFIRMATION,   "Confirmation received for message tracking id = %d with result = %d,  current active messages: %d") \
+	X(TRACE_REPORT_CONFIRMATION, "Confirmation received for status %d") \
+	X(TRACE_SEND_EXPIRED,        "No confirmation for message tracking id = %d after %d s, released, current active messages: %d")
+
+#define TRACE_EVENT_ID(id, format) id,
+typedef enum TRACE_EVENT_TAG
+{
+	TRACE_EVENTS(TRACE_EVENT_ID)
+	TRACE_EVENT_COUNT
+} TRACE_EVENT;
+#undef TRACE_EVENT_ID
+
+#define TRACE_MAX_ARGS 3
+
+//one ring buffer entry, this is also the wire format of a trace dump (little endian)
+typedef struct TRACE_RECORD_TAG
+{
+	uint32_t timestamp; //low 32 bits of esp_timer_get_time(), microseconds
+	uint16_t id;
+	uint16_t sequence; //low 16 bits of the write counter, used to detect overwritten records
+	int32_t args[TRACE_MAX_ARGS];
+} TRACE_RECORD;
+
+#endif /* TRACE_EVENTS_H */
@@ -0,0 +1,29 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <string.h>
+#include "trace_log.h"
+
+TRACE_RECORD g_traceRing[TRACE_LOG_CAPACITY];
+uint32_t g_traceHead = 0;
+
+uint32_t trace_log_written()
+{
+	return __atomic_load_n(&g_traceHead, __ATOMIC_RELAXED);
+}
+
+size_t trace_log_snapshot(TRACE_RECORD *records, size_t maxRecords)
+{
+	uint32_t head = trace_log_written();
+	size_t count = head < TRACE_LOG_CAPACITY ? head : TRACE_LOG_CAPACITY;
+	if (count > maxRecords)
+		count = maxRecords;
+
+	//writers are not blocked, a record that is being overwritten while copied is detected by the host decoder using the sequence field
+	for (size_t i = 0; i < count; ++i)
+	{
+		uint32_t index = head - count + i;
+		memcpy(&records[i], &g_traceRing[index & (TRACE_LOG_CAPACITY - 1)], sizeof(TRACE_RECORD));
+	}
+	return count;
+}
@@ -0,0 +1,50 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef TRACE_LOG_H
+#define TRACE_LOG_H
+
+#include <stddef.h>
+#include "esp_timer.h"
+#include "trace_events.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//must be a power of 2
+#define TRACE_LOG_CAPACITY 256
+
+extern TRACE_RECORD g_traceRing[TRACE_LOG_CAPACITY];
+extern uint32_t g_traceHead;
+
+/*
+ * Record an event in the RAM ring buffer. No formatting and no locking takes place,
+ * the slot is reserved with a single atomic increment, so the cost is a few tens of cycles.
+ */
+static inline void trace_log_write(TRACE_EVENT id, int32_t arg0, int32_t arg1, int32_t arg2)
+{
+	uint32_t index = __atomic_fetch_add(&g_traceHead, 1, __ATOMIC_RELAXED);
+	TRACE_RECORD *record = &g_traceRing[index & (TRACE_LOG_CAPACITY - 1)];
+	record->timestamp = (uint32_t)esp_timer_get_time();
+	record->id = (uint16_t)id;
+	record->sequence = (uint16_t)index;
+	record->args[0] = arg0;
+	record->args[1] = arg1;
+	record->args[2] = arg2;
+}
+
+#define TRACE_LOG_ARGS_(a0, a1, a2, ...) (int32_t)(a0), (int32_t)(a1), (int32_t)(a2)
+//TRACE_LOG(TRACE_ADC_READING, v5, v6, v7), takes 1 to TRACE_MAX_ARGS integer arguments
+#define TRACE_LOG(id, ...) trace_log_write((id), TRACE_LOG_ARGS_(__VA_ARGS__, 0, 0, 0))
+
+//copy the buffer content, oldest record first, returns the number of records copied
+size_t trace_log_snapshot(TRACE_RECORD *records, size_t maxRecords);
+//total number of records written since boot, including overwritten ones
+uint32_t trace_log_written();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_LOG_H */